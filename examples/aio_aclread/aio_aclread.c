@@ -167,7 +167,7 @@ static globalArgs_t globals = {
 //To keep track of all packets that are logged and that need not be re-checked again!
 typedef struct flow_logged_data_t {
         uint32_t cur_entries;
-        uint16_t ft_list[MAX_FLOW_TABLE_ENTRIES];
+        uint64_t ft_list[MAX_FLOW_TABLE_ENTRIES];
 }flow_logged_data_t;
 static flow_logged_data_t flow_logged_info;
 
@@ -280,7 +280,7 @@ typedef struct per_flow_ring_buffer {
 //per_flow_ring_buffer_t pre_io_wait_ring[MAX_FLOW_TABLE_ENTRIES];
 typedef struct pre_io_wait_queue {
         uint32_t wait_list_count;
-        per_flow_ring_buffer_t flow_pkts[MAX_FLOW_TABLE_ENTRIES];      //indexed by flow_entry->entry_index
+        per_flow_ring_buffer_t flow_pkts[MAX_FLOW_TABLE_ENTRIES];      //indexed by flow_entry->entry_index (flows past it are not queued)
 }pre_io_wait_queue_t;
 pre_io_wait_queue_t pre_io_wait_ring;
 
@@ -667,7 +667,7 @@ int deinit_pre_io_wait_queue(void) {
         return 0;
 }
 int is_flow_pkt_in_pre_io_wait_queue(__attribute__((unused)) struct rte_mbuf* pkt, struct onvm_flow_entry *flow_entry) {
-        if(!flow_entry) return 0;
+        if(!flow_entry || flow_entry->entry_index >= MAX_FLOW_TABLE_ENTRIES) return 0;
         #ifndef USE_RTE_RING
         if(pre_io_wait_ring.flow_pkts[flow_entry->entry_index].w_h ==  pre_io_wait_ring.flow_pkts[flow_entry->entry_index].r_h) return 0;
         //return pre_io_wait_ring.flow_pkts[flow_entry->entry_index].pkt_count;
@@ -678,7 +678,7 @@ int is_flow_pkt_in_pre_io_wait_queue(__attribute__((unused)) struct rte_mbuf* pk
         #endif
 }
 int add_flow_pkt_to_pre_io_wait_queue(struct rte_mbuf* pkt, struct onvm_flow_entry *flow_entry) {
-        if(!flow_entry) return 1;
+        if(!flow_entry || flow_entry->entry_index >= MAX_FLOW_TABLE_ENTRIES) return 1;
         
         #ifndef USE_RTE_RING       
         if(((pre_io_wait_ring.flow_pkts[flow_entry->entry_index].w_h+1)%pre_io_wait_ring.flow_pkts[flow_entry->entry_index].max_len) == pre_io_wait_ring.flow_pkts[flow_entry->entry_index].r_h) {
@@ -749,7 +749,7 @@ int add_flow_pkt_to_pre_io_wait_queue(struct rte_mbuf* pkt, struct onvm_flow_ent
         return 0;
 }
 struct rte_mbuf* get_next_pkt_for_flow_entry_from_pre_io_wait_queue(struct onvm_flow_entry *flow_entry) {
-        if(!flow_entry) return NULL;
+        if(!flow_entry || flow_entry->entry_index >= MAX_FLOW_TABLE_ENTRIES) return NULL;
         struct rte_mbuf* pkt = NULL;
         
         #ifndef USE_RTE_RING
@@ -104,8 +104,8 @@ static inline int get_index_from_pkt_and_meta(struct rte_mbuf* pkt, struct onvm_
 static inline int get_index_from_pkt_and_meta(struct rte_mbuf* pkt, struct onvm_pkt_meta* meta) {
         if(pkt && meta) {
                 struct onvm_flow_entry *flow_entry = NULL;
-                if((get_flow_entry(pkt, &flow_entry) >=0) && (flow_entry != NULL)) {
-                        return flow_entry->entry_index;
+                if((get_flow_entry(pkt, &flow_entry) >=0) && (flow_entry != NULL) && flow_entry->entry_index < MAX_FLOW_TABLE_ENTRIES) {
+                        return (int)flow_entry->entry_index;
                 }
         }
         return -1;
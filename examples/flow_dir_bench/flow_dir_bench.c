@@ -0,0 +1,202 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2016 George Washington University
+ *            2015-2016 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *  flow_dir_bench.c - lookup/insert throughput of the flow director table
+ *                     (onvm_ft_*) at different flow counts.
+ ********************************************************************/
+
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+
+#include <rte_common.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_cycles.h>
+#include <rte_malloc.h>
+
+#include "onvm_flow_table.h"
+#include "onvm_flow_dir.h"
+
+#define MAX_RUNS 16
+
+/* flow counts to benchmark */
+static uint32_t flow_counts[MAX_RUNS] = {1000, 100000, 10000000};
+static uint32_t num_runs = 3;
+
+/* initial table size when growing online (0 => table sized for the flow count) */
+static uint32_t grow_from = 0;
+
+static void
+usage(const char *progname) {
+        printf("Usage: %s [EAL args] -- [-s NUM_FLOWS[,NUM_FLOWS...]] [-g INITIAL_SIZE]\n\n", progname);
+        printf(" -s NUM_FLOWS: comma separated flow counts to benchmark (default 1000,100000,10000000)\n");
+        printf(" -g INITIAL_SIZE: create the table with INITIAL_SIZE entries and let it grow online to the flow count\n");
+}
+
+static int
+parse_app_args(int argc, char *argv[]) {
+        const char *progname = argv[0];
+        char *tok, *end;
+        int c;
+
+        while ((c = getopt(argc, argv, "s:g:")) != -1) {
+                switch (c) {
+                case 's':
+                        num_runs = 0;
+                        for (tok = strtok(optarg, ","); tok && num_runs < MAX_RUNS; tok = strtok(NULL, ",")) {
+                                flow_counts[num_runs] = strtoul(tok, &end, 10);
+                                if (*end != '\0' || flow_counts[num_runs] == 0) {
+                                        usage(progname);
+                                        return -1;
+                                }
+                                num_runs++;
+                        }
+                        break;
+                case 'g':
+                        grow_from = strtoul(optarg, NULL, 10);
+                        break;
+                default:
+                        usage(progname);
+                        return -1;
+                }
+        }
+        return optind;
+}
+
+static inline void
+fill_key(struct onvm_ft_ipv4_5tuple *key, uint32_t i, uint32_t salt) {
+        key->src_addr = rte_cpu_to_be_32(0x0a000000 | (i & 0xFFFFFF));
+        key->dst_addr = rte_cpu_to_be_32((i * 2654435761u) ^ salt);
+        key->src_port = rte_cpu_to_be_16((uint16_t)(1024 + (i >> 24)));
+        key->dst_port = rte_cpu_to_be_16(80);
+        key->proto = IP_PROTOCOL_TCP;
+}
+
+static struct onvm_service_chain * volatile entry_sink;
+
+static inline double
+mops(uint32_t ops, uint64_t cycles) {
+        return (cycles)? ((double)ops * rte_get_tsc_hz() / cycles / 1e6):(0);
+}
+
+static int
+run_bench(uint32_t flows) {
+        struct onvm_ft_ipv4_5tuple *keys, miss;
+        struct onvm_ft *ft;
+        char *data;
+        uint64_t start, t_insert, t_lookup, t_miss;
+        uint32_t i, failed = 0, found = 0;
+        uint32_t initial = (grow_from && grow_from < flows)? (grow_from):(flows);
+
+        /* the hash table leaves no head room: size it above the flow count as the manager would */
+        ft = onvm_ft_create_resizable(initial, flows + (flows >> 2), sizeof(struct onvm_flow_entry), rte_socket_id());
+        if (ft == NULL) {
+                printf("flows=%u: unable to create the flow table\n", flows);
+                return -1;
+        }
+        keys = malloc((size_t)flows * sizeof(*keys));
+        if (keys == NULL) {
+                onvm_ft_free(ft);
+                return -1;
+        }
+        memset(keys, 0, (size_t)flows * sizeof(*keys));
+        for (i = 0; i < flows; i++) {
+                fill_key(&keys[i], i, 0);
+        }
+
+        start = rte_rdtsc();
+        for (i = 0; i < flows; i++) {
+                if (onvm_ft_add_key(ft, &keys[i], &data) < 0) {
+                        failed++;
+                }
+        }
+        t_insert = rte_rdtsc() - start;
+
+        start = rte_rdtsc();
+        for (i = 0; i < flows; i++) {
+                if (onvm_ft_lookup_key(ft, &keys[i], &data) >= 0) {
+                        /* read the entry as the Rx path does: counts the cache lines of the entry layout */
+                        entry_sink = ((struct onvm_flow_entry *)data)->sc;
+                        found++;
+                }
+        }
+        t_lookup = rte_rdtsc() - start;
+
+        memset(&miss, 0, sizeof(miss));
+        start = rte_rdtsc();
+        for (i = 0; i < flows; i++) {
+                fill_key(&miss, i, 0x5a5a5a5a);
+                onvm_ft_lookup_key(ft, &miss, &data);
+        }
+        t_miss = rte_rdtsc() - start;
+
+        printf("flows=%-10u initial=%-10u tiers=%d insert=%6.2f Mops/s lookup=%6.2f Mops/s miss=%6.2f Mops/s (insert failed=%u, found=%u)\n",
+                flows, initial, ft->tiers, mops(flows, t_insert), mops(flows, t_lookup), mops(flows, t_miss), failed, found);
+
+        free(keys);
+        onvm_ft_free(ft);
+        return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+        uint32_t r;
+        int ret;
+
+        ret = rte_eal_init(argc, argv);
+        if (ret < 0) {
+                rte_exit(EXIT_FAILURE, "Invalid EAL arguments\n");
+        }
+        argc -= ret;
+        argv += ret;
+
+        if (parse_app_args(argc, argv) < 0) {
+                rte_exit(EXIT_FAILURE, "Invalid command-line arguments\n");
+        }
+
+        printf("Flow director table benchmark: entry size %zu B, socket %u, single core\n", sizeof(struct onvm_flow_entry), rte_socket_id());
+        for (r = 0; r < num_runs; r++) {
+                run_bench(flow_counts[r]);
+        }
+        return 0;
+}
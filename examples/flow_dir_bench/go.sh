@@ -0,0 +1,14 @@
+#!/bin/bash
+
+cpu=$1
+shift
+
+if [ -z $cpu ]
+then
+        echo "$0 [cpu] [-s NUM_FLOWS[,NUM_FLOWS...]] [-g INITIAL_SIZE]"
+        echo "$0 3 --> core 3, benchmark 1K, 100K and 10M flows on a table sized for the flows"
+        echo "$0 3 -g 1024 --> core 3, same flow counts on a table created with 1024 entries that grows online"
+        exit 1
+fi
+
+sudo ./build/flow_dir_bench -l $cpu -n 3 --proc-type=primary --file-prefix=ft_bench -- $@
@@ -61,6 +61,7 @@
 #include "onvm_sc_common.h"
 #include "onvm_flow_dir.h"
 #include "onvm_sc_mgr.h"
+#include "onvm_flow_classifier.h"
 
 #define NF_TAG "schain_preload"
 
@@ -73,6 +74,7 @@ struct onvm_nf_info *nf_info;
 /* Service Chain Related entries */
 #define MAX_SERVICE_CHAINS 32
 int services[MAX_SERVICE_CHAINS][ONVM_MAX_CHAIN_LENGTH];
+uint32_t services_latency_us[MAX_SERVICE_CHAINS];      // optional ":<us>" latency target of the chain (0 => default)
 uint32_t max_service_chains=0;
 
 /* Use this to pre-allocate and pre-populate the service chains, rather than allocating per flow_entry */
@@ -95,6 +97,17 @@ struct onvm_ft_ipv4_5tuple ipv4_5tRules[MAX_FLOW_TABLE_ENTRIES];
 uint32_t max_ft_entries=0;
 //static const char *base_ip_addr = "10.0.0.1";
 
+#ifdef ENABLE_FLOW_CLASSIFIER
+/* Wildcard rules (prefix, port range or '*' in the rules file): loaded in the flow classifier, not expanded into flow entries */
+#define MAX_WILDCARD_RULES (1024*64)
+struct wildcard_rule {
+        struct onvm_fc_rule rule;
+        int sc_index;                   // -1 => picked round robin
+};
+static struct wildcard_rule wildcard_rules[MAX_WILDCARD_RULES];
+uint32_t max_wildcard_rules=0;
+#endif //ENABLE_FLOW_CLASSIFIER
+
 /* List of Global Command Line Arguments */
 typedef struct globalArgs {
         uint32_t destination;               /* -d <destination_service ID> */
@@ -104,8 +117,10 @@ typedef struct globalArgs {
         const char* base_ip_addr;           /* -b <IPv45Tuple Base Ip Address> */
         uint32_t max_ip_addrs;              /* -m <Maximum number of IP Addresses> */
         uint32_t max_ft_rules;              /* -M <Maximum number of FT entries> */
+        const char* binrules_file;          /* -B <Binary rules file: bulk loaded and swapped in> */
+        const char* write_binrules_file;    /* -w <Binary rules file written from the -s and -r files> */
 }globalArgs_t;
-static const char *optString = "d:p:s:r:b:m:M";
+static const char *optString = "d:p:s:r:b:m:M:B:w:";
 
 static globalArgs_t globals = {
         .destination = 0,
@@ -115,6 +130,8 @@ static globalArgs_t globals = {
         .base_ip_addr   = "10.0.0.1",
         .max_ip_addrs   = 10,
         .max_ft_rules   = MAX_FLOW_TABLE_ENTRIES,
+        .binrules_file  = NULL,
+        .write_binrules_file = NULL,
 };
 
 /******************************************************************************
@@ -136,6 +153,8 @@ static struct onvm_service_chain* get_sc_and_index_based_on_flow_key(struct onvm
 uint32_t populate_random_flow_rules(uint32_t max_rules);
 static int setup_flow_rule_and_sc_entries(void);
 static int setup_rule_for_packet(struct rte_mbuf *pkt, struct onvm_pkt_meta* meta);
+static int write_binary_rules_file(const char *path);
+static int load_binary_rules_file(const char *path);
 /******************************************************************************
  *                      FUNCTION DECLARATIONS
  ******************************************************************************/
@@ -144,7 +163,7 @@ static void
 usage(const char *progname) {
         printf("Usage: %s [EAL args] -- [NF_LIB args] -- -d <destination> -p <print_delay>"
                 "-s <service_chain_file> -r <IPv4_5tuple Rules file>"
-                "-b <base_ip_address> -m <max_num_ips>        \n\n", progname);
+                "-b <base_ip_address> -m <max_num_ips> [-B <binary_rules_file>] [-w <binary_rules_file>]\n\n", progname);
 }
 
 static int
@@ -174,6 +193,12 @@ parse_app_args(int argc, char *argv[], const char *progname) {
                 case 'M':
                         globals.max_ft_rules = strtoul(optarg, NULL, 10);
                         break;
+                case 'B':
+                        globals.binrules_file = optarg;
+                        break;
+                case 'w':
+                        globals.write_binrules_file = optarg;
+                        break;
                 case '?':
                         usage(progname);
                         if (optopt == 'd')
@@ -213,6 +238,12 @@ parse_services(int services[][ONVM_MAX_CHAIN_LENGTH]) {
                 printf("parsing services in line:%s \n", line);
 
                 int llen = strlen(line);
+                char *lat = strchr(line, ':');
+                if (lat != NULL) {
+                        services_latency_us[max_service_chains] = (uint32_t)strtoul(lat + 1, NULL, 10);
+                        *lat = '\n';
+                        llen = lat - line + 1;
+                }
                 int slen = 0;
                 int svc_index = 0;
                 int added = 0;
@@ -283,6 +314,10 @@ parse_services(int services[][ONVM_MAX_CHAIN_LENGTH]) {
                         printf("PANIC!!! Requested Service chain Index [%d] Got [%d]\n", i, sc_index);
                 }
                 setup_service_chain_for_flow_entry(sc_flip, sc_index, 1, NULL);
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                onvm_sc_set_latency_target(sc, services_latency_us[i]);
+                onvm_sc_set_latency_target(sc_flip, services_latency_us[i]);
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
                 gSClist.ref_count_for_sc[i]         = 0;
                 gSClist.ref_count_for_sc_flip[i]    = 0;
                 gSClist.max_service_chains++;
@@ -326,6 +361,60 @@ static uint32_t get_ipv4_value(const char *ip_addr){
         return rte_be_to_cpu_32(ipv4_val2);
         #endif
 }
+#ifdef ENABLE_FLOW_CLASSIFIER
+/* "a.b.c.d[/len]" or "*" */
+static int parse_ipv4_prefix(const char *str, uint32_t *addr, uint8_t *plen) {
+        char ip[32] = "";
+        const char *slash = strchr(str, '/');
+        size_t len = (slash)? ((size_t)(slash - str)):(strcspn(str, " \r\n"));
+
+        if (str[0] == '*') {
+                *addr = 0; *plen = 0;
+                return 0;
+        }
+        if (len == 0 || len >= sizeof(ip)) return -1;
+        memcpy(ip, str, len);
+        *addr = get_ipv4_value(ip);
+        *plen = (slash)? ((uint8_t)MIN(strtoul(slash+1, NULL, 10), 32)):(32);
+        return 0;
+}
+
+/* "port", "lo-hi" or "*" */
+static void parse_port_range(const char *str, uint16_t *lo, uint16_t *hi) {
+        char *end = NULL;
+        if (str[0] == '*') {
+                *lo = 0; *hi = UINT16_MAX;
+                return;
+        }
+        *lo = (uint16_t)strtoul(str, &end, 10);
+        *hi = (end && *end == '-')? ((uint16_t)strtoul(end+1, NULL, 10)):(*lo);
+}
+
+/* Rule line: src[/len],dst[/len],sport[-hi],dport[-hi],proto[,sc_index[,priority]] with '*' for any field */
+static int parse_wildcard_rule(char *in[], uint32_t num_cols, struct wildcard_rule *wr) {
+        struct onvm_fc_rule *r = &wr->rule;
+
+        memset(wr, 0, sizeof(*wr));
+        if (parse_ipv4_prefix(in[0], &r->src_addr, &r->src_plen) < 0 || parse_ipv4_prefix(in[1], &r->dst_addr, &r->dst_plen) < 0)
+                return -1;
+        parse_port_range(in[2], &r->src_port_lo, &r->src_port_hi);
+        parse_port_range(in[3], &r->dst_port_lo, &r->dst_port_hi);
+        r->proto_any = (in[4][0] == '*');
+        r->proto = (r->proto_any)? (0):((uint8_t)strtoul(in[4], NULL, 10));
+        wr->sc_index = (num_cols > 5)? ((int)strtol(in[5], NULL, 10)):(-1);
+        r->priority = (num_cols > 6)? ((uint16_t)strtoul(in[6], NULL, 10)):(0);
+        return 0;
+}
+
+static int is_wildcard_rule(char *in[]) {
+        uint32_t i;
+        for (i = 0; i < 5; i++) {
+                if (strpbrk(in[i], "/-*")) return 1;
+        }
+        return 0;
+}
+#endif //ENABLE_FLOW_CLASSIFIER
+
 static void
 parse_ipv4_5t_rules(void) {
         FILE *fp = fopen(globals.ipv4rules_file, "rb");
@@ -342,8 +431,12 @@ parse_ipv4_5t_rules(void) {
                         continue;
                 }
                 //printf("parsing ipv4rule in line[%s]", line);
-                char *s = line, *in[6], *sp=NULL;
+                char *s = line, *in[7], *sp=NULL;
+                #ifdef ENABLE_FLOW_CLASSIFIER
+                uint32_t num_cols = 7;
+                #else
                 uint32_t num_cols = 5;
+                #endif //ENABLE_FLOW_CLASSIFIER
                 static const char *dlm = ",";
                 for (i = 0; i != num_cols; i++, s = NULL) {
                         in[i] = strtok_r(s, dlm, &sp);
@@ -351,6 +444,14 @@ parse_ipv4_5t_rules(void) {
                                 break;
                         }
                 }
+                #ifdef ENABLE_FLOW_CLASSIFIER
+                if (i >= 5 && is_wildcard_rule(in)) {
+                        if (max_wildcard_rules < MAX_WILDCARD_RULES && parse_wildcard_rule(in, i, &wildcard_rules[max_wildcard_rules]) == 0) {
+                                max_wildcard_rules++;
+                        }
+                        continue;
+                }
+                #endif //ENABLE_FLOW_CLASSIFIER
                 if (i >=5) {
                         //onvm_ft_ipv4_5tuple read_tuple = {0,0,0,0,0};
                         //read_tuple.src_addr = ;
@@ -385,6 +486,9 @@ parse_ipv4_5t_rules(void) {
 #else
         printf("Total FT Entries = [%d]", max_ft_entries);
 #endif
+#ifdef ENABLE_FLOW_CLASSIFIER
+        printf("Total Wildcard Rules = [%d]", max_wildcard_rules);
+#endif //ENABLE_FLOW_CLASSIFIER
         return;
 }
 
@@ -434,7 +538,7 @@ static struct onvm_service_chain* get_sc_and_index_based_on_flow_key(struct onvm
         if(index >=0 && index < (int)max_service_chains) {
                 if(flip) {
                         gSClist.ref_count_for_sc_flip[index]+=1;
-                        gSClist.sc_flip[index]->ref_cnt+=1;
+                        onvm_sc_ref_get(gSClist.sc_flip[index]);
                         printf("\n Returning Flip chain at index:[%d], len:[%d], ref_cnt:[%d, %d], : ", index, gSClist.sc[index]->chain_length, gSClist.sc[index]->ref_cnt, gSClist.ref_count_for_sc[index]);
                         for(i = 1; i <= gSClist.sc_flip[index]->chain_length; i++) printf(" [%d]", gSClist.sc_flip[index]->sc[i].destination);printf("\n");
                         #ifdef DEBUG_0
@@ -444,7 +548,7 @@ static struct onvm_service_chain* get_sc_and_index_based_on_flow_key(struct onvm
                 }
                 else {
                         gSClist.ref_count_for_sc[index]+=1;
-                        gSClist.sc[index]->ref_cnt+=1;
+                        onvm_sc_ref_get(gSClist.sc[index]);
                         printf("\n Returning chain at index:[%d], len:[%d], ref_cnt:[%d, %d], : ", index, gSClist.sc[index]->chain_length, gSClist.sc[index]->ref_cnt, gSClist.ref_count_for_sc[index]);
                         for(i = 1; i <= gSClist.sc[index]->chain_length; i++) printf(" [%d]", gSClist.sc[index]->sc[i].destination); //printf("\n");
                         #ifdef DEBUG_0
@@ -853,9 +957,133 @@ setup_flow_rule_and_sc_entries(void) {
                 ret = add_flow_key_to_sc_flow_table(&ipv4_5tRules[i]);
         }
         printf("\n\n Populated %d flow table rules with service chains!\n", max_ft_entries);
+
+        #ifdef ENABLE_FLOW_CLASSIFIER
+        /* Wildcard rules go to the classifier: the manager installs the flows matching them on their first pkt */
+        uint32_t loaded = 0, entries = 0;
+        for (i = 0; i < max_wildcard_rules && gSClist.max_service_chains; i++) {
+                struct wildcard_rule *wr = &wildcard_rules[i];
+                int sc_index = (wr->sc_index >= 0 && wr->sc_index < (int)gSClist.max_service_chains)? (wr->sc_index):((int)(i % gSClist.max_service_chains));
+                wr->rule.sc = gSClist.sc[sc_index];
+                ret = onvm_fc_add_rule(onvm_fc, &wr->rule);
+                if (ret < 0) {
+                        printf("Failed to add wildcard rule [%u] to the flow classifier: [%d]\n", i, ret);
+                        continue;
+                }
+                entries += ret;
+                loaded++;
+        }
+        printf("\n Loaded %u wildcard rules (%u classifier entries)!\n", loaded, entries);
+        #endif //ENABLE_FLOW_CLASSIFIER
         return ret;
 }
 
+/* Write the parsed rules and service chains as a binary rules file (onvm_flow_dir_ruleset_load()) */
+static int
+write_binary_rules_file(const char *path) {
+        struct onvm_flow_rules_hdr hdr = {FLOW_RULES_FILE_MAGIC, FLOW_RULES_FILE_VERSION, 0, 0};
+        struct onvm_flow_rules_chain fchain;
+        struct onvm_flow_rules_rule frule;
+        struct onvm_service_chain *sc;
+        uint32_t i, h, nb_sc = gSClist.max_service_chains;
+        int index, ret = 0;
+        FILE *fp;
+
+        if (nb_sc == 0) {
+                return -EINVAL;
+        }
+        fp = fopen(path, "wb");
+        if (fp == NULL) {
+                return -errno;
+        }
+        hdr.nb_chains = 2 * nb_sc;      // the chains, then their flip variants
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        for (i = 0; i < hdr.nb_chains; i++) {
+                sc = (i < nb_sc)? (gSClist.sc[i]):(gSClist.sc_flip[i - nb_sc]);
+                memset(&fchain, 0, sizeof(fchain));
+                fchain.chain_length = MIN(sc->chain_length, ONVM_MAX_CHAIN_LENGTH);
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                fchain.latency_target_us = sc->latency_target_us;
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                for (h = 0; h < fchain.chain_length; h++) {
+                        fchain.hop[h].action = sc->sc[h + 1].action;
+                        fchain.hop[h].destination = sc->sc[h + 1].destination;
+                }
+                fwrite(&fchain, sizeof(fchain), 1, fp);
+        }
+        /* each rule and its flip rule, keys in network order as in add_flow_key_to_sc_flow_table() */
+        for (i = 0; i < max_ft_entries; i++) {
+                memset(&frule, 0, sizeof(frule));
+                frule.key.proto = ipv4_5tRules[i].proto;
+                frule.key.src_addr = rte_cpu_to_be_32(ipv4_5tRules[i].src_addr);
+                frule.key.src_port = rte_cpu_to_be_16(ipv4_5tRules[i].src_port);
+                frule.key.dst_addr = rte_cpu_to_be_32(ipv4_5tRules[i].dst_addr);
+                frule.key.dst_port = rte_cpu_to_be_16(ipv4_5tRules[i].dst_port);
+                index = get_sc_index_based_on_flow_key(&frule.key);
+                if (index < 0) {
+                        continue;
+                }
+                frule.chain = index;
+                fwrite(&frule, sizeof(frule), 1, fp);
+
+                frule.key.src_addr = rte_cpu_to_be_32(ipv4_5tRules[i].dst_addr);
+                frule.key.src_port = rte_cpu_to_be_16(ipv4_5tRules[i].dst_port);
+                frule.key.dst_addr = rte_cpu_to_be_32(ipv4_5tRules[i].src_addr);
+                frule.key.dst_port = rte_cpu_to_be_16(ipv4_5tRules[i].src_port);
+                frule.chain = nb_sc + index;
+                fwrite(&frule, sizeof(frule), 1, fp);
+                hdr.nb_rules += 2;
+        }
+        rewind(fp);
+        fwrite(&hdr, sizeof(hdr), 1, fp);
+        if (ferror(fp)) {
+                ret = -EIO;
+        }
+        if (fclose(fp) != 0 && ret == 0) {
+                ret = -errno;
+        }
+        printf("\n Wrote %u rules, %u chains to %s: [%d]\n", hdr.nb_rules, hdr.nb_chains, path, ret);
+        return ret;
+}
+
+/* Bulk load a binary rules file off to the side and wait for the manager to swap it in */
+static int
+load_binary_rules_file(const char *path) {
+        struct onvm_flow_ruleset *rs;
+        uint64_t start, built, timeout = rte_get_tsc_hz() * 10;
+        int ret;
+
+        start = rte_get_tsc_cycles();
+        rs = onvm_flow_dir_ruleset_load(path, &ret);
+        if (rs == NULL) {
+                printf("Failed to load the rules file %s: [%d]\n", path, ret);
+                return ret;
+        }
+        built = rte_get_tsc_cycles();
+        while ((ret = onvm_flow_dir_ruleset_publish(rs)) == -EBUSY && rte_get_tsc_cycles() - built < timeout) {
+                onvm_flow_dir_quiescent();      //the pending swap may wait for this reader to drop the old table
+                usleep(1000);
+        }
+        if (ret < 0) {
+                printf("Failed to publish the rules of %s: [%d]\n", path, ret);
+                onvm_flow_dir_ruleset_free(rs);
+                return ret;
+        }
+        while (flow_dir_info->pending == rs && rte_get_tsc_cycles() - built < timeout) {
+                onvm_flow_dir_quiescent();
+                usleep(100);
+        }
+        if (flow_dir_info->pending == rs) {
+                /* still published: the manager owns it from now on */
+                printf("Rules of %s not swapped in yet by the manager\n", path);
+                return -ETIMEDOUT;
+        }
+        onvm_flow_dir_quiescent();     //picks up the new table
+        printf("\n Loaded %u rules, %u chains from %s: built in %"PRIu64" us, live in %"PRIu64" us\n", rs->nb_rules, rs->nb_chains, path,
+               (built - start) * 1000000 / rte_get_tsc_hz(), (rte_get_tsc_cycles() - start) * 1000000 / rte_get_tsc_hz());
+        return 0;
+}
+
 static int setup_rule_for_packet(struct rte_mbuf *pkt, struct onvm_pkt_meta* meta) {
         int ret = 0;
         //struct onvm_pkt_meta* meta = (struct onvm_pkt_meta*) &(((struct rte_mbuf*)pkt)->udata64);
@@ -1068,8 +1296,16 @@ int main(int argc, char *argv[]) {
         /* Get Flow rule entries */
         parse_ipv4_5t_rules();
 
+        if (globals.write_binrules_file) {
+                write_binary_rules_file(globals.write_binrules_file);
+        }
+
         /* Setup pre-defined set of FT entries UDP protocol: Extend optargs as necessary */ 
-        setup_flow_rule_and_sc_entries();
+        if (globals.binrules_file) {
+                load_binary_rules_file(globals.binrules_file);
+        } else {
+                setup_flow_rule_and_sc_entries();
+        }
 
         int pid = fork();
         if (pid == 0) {
@@ -101,8 +101,7 @@ cleanup(void) {
         printf("Freeing memory for SDN rings.\n");
         rte_ring_free(ring_to_sdn);
         rte_ring_free(ring_from_sdn);
-        printf("Freeing memory for hash table.\n");
-        rte_hash_free(sdn_ft->hash);
+        /* the flow table belongs to the manager (and may have been swapped): not freed here */
 }
 
 static int
@@ -133,15 +132,13 @@ parse_app_args(int argc, char *argv[]) {
 }
 
 static void
-do_stats_display(struct rte_mbuf* pkt, int32_t tbl_index) {
+do_stats_display(struct rte_mbuf* pkt, int32_t tbl_index, struct onvm_flow_entry *flow_entry) {
         const char clr[] = { 27, '[', '2', 'J', '\0' };
         const char topLeft[] = { 27, '[', '1', ';', '1', 'H', '\0' };
         static int total_pkts = 0;
         /* Fix unused variable warnings: */
         (void)pkt;
 
-
-        struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)onvm_ft_get_data(sdn_ft, tbl_index);
         total_pkts += print_delay;
 
         /* Clear screen and move to top left */
@@ -152,7 +149,11 @@ do_stats_display(struct rte_mbuf* pkt, int32_t tbl_index) {
         printf("Total pkts   : %d\n", total_pkts);
         printf("Total flows  : %d\n", total_flows);
         printf("Flow ID      : %d\n", tbl_index);
-        printf("Flow pkts    : %"PRIu64"\n", flow_entry->packet_count);
+        #ifdef ENABLE_FLOW_COUNTERS
+        onvm_flow_dir_get_counters(flow_entry, NULL, NULL);
+        printf("Flow bytes   : %"PRIu64"\n", flow_entry->stats->byte_count);
+        #endif //ENABLE_FLOW_COUNTERS
+        printf("Flow pkts    : %"PRIu64"\n", flow_entry->stats->packet_count);
        // printf("Flow Action  : %d\n", flow_entry->action);
        // printf("Flow Dest    : %d\n", flow_entry->destination);
         printf("\n\n");
@@ -183,6 +184,15 @@ flow_table_miss(struct rte_mbuf* pkt, struct onvm_pkt_meta* meta) {
         int ret;
 
 
+        #ifdef ENABLE_MBUF_QUOTAS
+        /* Do not hoard mbufs for a chain/NF already at its quota */
+        if (!onvm_nflib_pkt_buffer_ok(pkt)) {
+                meta->action = ONVM_NF_ACTION_DROP;
+                meta->destination = 0;
+                return 0;
+        }
+        #endif //ENABLE_MBUF_QUOTAS
+
         /* Buffer new flows until we get response from SDN controller. */
         ret = rte_ring_enqueue(ring_to_sdn, pkt);
         if(ret != 0) {
@@ -235,7 +245,7 @@ packet_handler(struct rte_mbuf* pkt, struct onvm_pkt_meta* meta) {
 
         if (++counter == print_delay && print_delay != 0) {
 		if (tbl_index >= 0) {
-                	do_stats_display(pkt, tbl_index);
+                	do_stats_display(pkt, tbl_index, flow_entry);
                 	counter = 0;
 		}
         }
@@ -261,6 +271,9 @@ int main(int argc, char *argv[]) {
         printf("Setting up hash table with default destination: %d\n", def_destination);
         total_flows = 0;
 
+	/* Map sdn_ft table: before the SDN thread, which registers as a reader of it */
+	onvm_flow_dir_nf_init();
+
         /* Setup the SDN connection thread */
         printf("Setting up SDN rings and thread.\n");
         setup_rings();
@@ -268,8 +281,6 @@ int main(int argc, char *argv[]) {
         sdn_core = rte_get_next_lcore(sdn_core, 1, 1);
         rte_eal_remote_launch(setup_securechannel, NULL, sdn_core);
 
-	/* Map sdn_ft table */
-	onvm_flow_dir_nf_init();
         printf("Starting packet handler.\n");
         onvm_nflib_run(nf_info, &packet_handler);
         printf("NF exiting...");
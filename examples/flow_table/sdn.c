@@ -59,6 +59,7 @@
 #include <rte_malloc.h>
 #include <rte_common.h>
 #include <rte_memory.h>
+#include <rte_ether.h>
 
 #include "sdn.h"
 #include "sdn_pkt_list.h"
@@ -75,6 +76,49 @@ extern uint16_t def_destination;
 
 struct onvm_ft *pkt_buf_ft;
 
+/* Chains of the installed flows, shared by all the flows with the same actions (rather than one chain per flow): the per chain
+ * state and stats of the manager then stay O(distinct chains). Shared chains are kept as long as the NF runs; past
+ * SDN_MAX_SHARED_CHAINS distinct action lists, a flow gets a chain of its own (retired when the flow is modified). */
+#define SDN_MAX_SHARED_CHAINS   (256)
+static struct onvm_service_chain *sdn_chains[SDN_MAX_SHARED_CHAINS];
+static uint32_t sdn_nb_chains = 0;
+
+static int
+sdn_chain_is_shared(struct onvm_service_chain *chain) {
+        uint32_t i;
+        for (i = 0; i < sdn_nb_chains; i++) {
+                if (sdn_chains[i] == chain) {
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+/* The shared chain with the hops of chain (chain is freed), else chain itself (shared if there is room) */
+static struct onvm_service_chain *
+sdn_chain_intern(struct onvm_service_chain *chain) {
+        uint32_t i;
+        uint8_t h;
+        for (i = 0; i < sdn_nb_chains; i++) {
+                if (sdn_chains[i]->chain_length != chain->chain_length) {
+                        continue;
+                }
+                for (h = 1; h <= chain->chain_length; h++) {
+                        if (sdn_chains[i]->sc[h].action != chain->sc[h].action || sdn_chains[i]->sc[h].destination != chain->sc[h].destination) {
+                                break;
+                        }
+                }
+                if (h > chain->chain_length) {
+                        rte_free(chain);
+                        return sdn_chains[i];
+                }
+        }
+        if (sdn_nb_chains < SDN_MAX_SHARED_CHAINS) {
+                sdn_chains[sdn_nb_chains++] = chain;
+        }
+        return chain;
+}
+
 static struct ofp_switch_config Switch_config = {
     .header = { OFP_VERSION,
 				OFPT_GET_CONFIG_REPLY,
@@ -208,6 +252,13 @@ void datapath_handle_read(struct datapath *dp)
 				count = make_stats_desc_reply(stats_req, buf);
 				msgbuf_push(dp->outbuf, buf, count);
 				debug_msg(dp, "sent description stats_reply");
+				} else if ( ntohs(stats_req->type) == OFPST_FLOW ) {
+				count = send_stats_flow_reply(dp, stats_req);
+				debug_msg(dp, "sent flow stats_reply (%d flows)", count);
+				} else if ( ntohs(stats_req->type) == OFPST_AGGREGATE ) {
+				count = make_stats_aggregate_reply(stats_req, buf);
+				msgbuf_push(dp->outbuf, buf, count);
+				debug_msg(dp, "sent aggregate stats_reply");
 				} else {
 				debug_msg(dp, "Silently ignoring non-desc stats_request msg\n");
 				}
@@ -228,22 +279,29 @@ void datapath_handle_read(struct datapath *dp)
                                 fk = flow_key_extract(&fm->match);
                                 size_t actions_len = ntohs(fm->header.length) - sizeof(*fm);
                                 sc = flow_action_extract(&fm->actions[0], actions_len);
+                                struct onvm_ft_ipv4_5tuple *old_key = NULL;
+                                struct onvm_service_chain *old_sc = NULL;
                                 ret = onvm_flow_dir_get_key(fk, &flow_entry);
                                 if (ret == -ENOENT) {
                                         ret = onvm_flow_dir_add_key(fk, &flow_entry);
                                 }
 				else if (ret >= 0) {
-					rte_free(flow_entry->key);
-					rte_free(flow_entry->sc);
+					old_key = flow_entry->key;
+					old_sc = flow_entry->sc;
 				}
 				else {
 					rte_exit(EXIT_FAILURE, "onvm_flow_dir_get parameters are invalid");
 				}
-                                memset(flow_entry, 0, sizeof(struct onvm_flow_entry));
+                                /* the manager may be using the entry: update it in place, the chain last, and retire the old key and chain */
                                 flow_entry->key = fk;
-                                flow_entry->sc = sc;
                                 flow_entry->idle_timeout = OFP_FLOW_PERMANENT;
                                 flow_entry->hard_timeout = OFP_FLOW_PERMANENT;
+                                rte_wmb();
+                                flow_entry->sc = sc;
+                                onvm_flow_dir_retire(old_key);
+                                if (old_sc && old_sc != sc && !sdn_chain_is_shared(old_sc)) {
+                                        onvm_flow_dir_retire_sc(old_sc);
+                                }
                                 sdn_list = (struct sdn_pkt_list *)onvm_ft_get_data(pkt_buf_ft, buffer_id);
                                 sdn_pkt_list_flush(sdn_list);
                                 break;
@@ -396,6 +454,139 @@ int make_stats_desc_reply(struct ofp_stats_request *req, char *buf)
     return len;
 }
 
+/* Match of a flow/aggregate stats request against an installed flow: only the IPv4 5-tuple fields are checked (in network order, as installed by flow_key_extract()) */
+static int flow_stats_match(struct ofp_stats_request *req, struct onvm_ft_ipv4_5tuple *key)
+{
+    struct ofp_flow_stats_request *fsr = (struct ofp_flow_stats_request *) req->body;
+    uint32_t wc, bits;
+
+    if (ntohs(req->header.length) < sizeof(*req) + sizeof(*fsr))
+		return 1;   // no match body: all flows
+    wc = ntohl(fsr->match.wildcards);
+    if (!(wc & OFPFW_NW_PROTO) && fsr->match.nw_proto != key->proto)
+		return 0;
+    if (!(wc & OFPFW_TP_SRC) && fsr->match.tp_src != key->src_port)
+		return 0;
+    if (!(wc & OFPFW_TP_DST) && fsr->match.tp_dst != key->dst_port)
+		return 0;
+    bits = (wc & OFPFW_NW_SRC_MASK) >> OFPFW_NW_SRC_SHIFT;
+    if (bits < 32 && ((fsr->match.nw_src ^ key->src_addr) & htonl(~0u << bits)))
+		return 0;
+    bits = (wc & OFPFW_NW_DST_MASK) >> OFPFW_NW_DST_SHIFT;
+    if (bits < 32 && ((fsr->match.nw_dst ^ key->dst_addr) & htonl(~0u << bits)))
+		return 0;
+    return 1;
+}
+
+/* Reply to OFPST_FLOW with one ofp_flow_stats per matching flow, split over several replies (OFPSF_REPLY_MORE) if needed */
+int send_stats_flow_reply(struct datapath *dp, struct ofp_stats_request *req)
+{
+    static char buf[BUFLEN];
+    struct ofp_stats_reply *reply = (struct ofp_stats_reply *) buf;
+    struct ofp_flow_stats *fs;
+    struct onvm_flow_entry *flow_entry;
+    struct onvm_ft *ft;
+    int len = sizeof(struct ofp_stats_reply);
+    int flows = 0;
+    const void *key;
+    void *data;
+    int32_t tbl_index;
+    uint32_t next = 0, left;
+
+    memcpy(buf, req, sizeof(*req));
+    reply->header.type = OFPT_STATS_REPLY;
+    onvm_flow_dir_refresh();
+    ft = sdn_ft;        //one table for the whole walk, even if a swap is picked up meanwhile
+    left = (ft) ? onvm_ft_count(ft) : 0;
+    //walk the installed keys, not the table entries (ft->cnt is the table size)
+    while (left && (tbl_index = onvm_ft_iterate(ft, &key, &data, &next)) >= 0) {
+		left--;
+		flow_entry = (struct onvm_flow_entry *) onvm_ft_get_data(ft, tbl_index);
+		if (flow_entry->key == NULL || !flow_stats_match(req, flow_entry->key))
+			continue;
+		if (len + (int)sizeof(*fs) > BUFLEN) {
+			reply->header.length = htons(len);
+			reply->flags = htons(OFPSF_REPLY_MORE);
+			msgbuf_push(dp->outbuf, buf, len);
+			len = sizeof(struct ofp_stats_reply);
+		}
+		#ifdef ENABLE_FLOW_COUNTERS
+		onvm_flow_dir_get_counters(flow_entry, NULL, NULL);
+		#endif //ENABLE_FLOW_COUNTERS
+		fs = (struct ofp_flow_stats *) (buf + len);
+		memset(fs, 0, sizeof(*fs));
+		fs->length = htons(sizeof(*fs));
+		fs->match.wildcards = htonl(OFPFW_ALL & ~(OFPFW_DL_TYPE | OFPFW_NW_PROTO | OFPFW_TP_SRC | OFPFW_TP_DST | OFPFW_NW_SRC_MASK | OFPFW_NW_DST_MASK));
+		fs->match.dl_type = htons(ETHER_TYPE_IPv4);
+		fs->match.nw_proto = flow_entry->key->proto;
+		fs->match.nw_src = flow_entry->key->src_addr;
+		fs->match.nw_dst = flow_entry->key->dst_addr;
+		fs->match.tp_src = flow_entry->key->src_port;
+		fs->match.tp_dst = flow_entry->key->dst_port;
+		if (flow_entry->key->vlan_id) {
+			fs->match.wildcards &= htonl(~OFPFW_DL_VLAN);
+			fs->match.dl_vlan = htons(flow_entry->key->vlan_id);
+		}
+		fs->priority = htons(OFP_DEFAULT_PRIORITY);
+		fs->idle_timeout = htons(flow_entry->idle_timeout);
+		fs->hard_timeout = htons(flow_entry->hard_timeout);
+		fs->packet_count = htonll(flow_entry->stats->packet_count);
+		fs->byte_count = htonll(flow_entry->stats->byte_count);
+		len += sizeof(*fs);
+		flows++;
+    }
+    reply->header.length = htons(len);
+    reply->flags = 0;
+    msgbuf_push(dp->outbuf, buf, len);
+
+    return flows;
+}
+
+/* Reply to OFPST_AGGREGATE with the counters summed over the matching flows */
+int make_stats_aggregate_reply(struct ofp_stats_request *req, char *buf)
+{
+    struct ofp_stats_reply *reply;
+    struct ofp_aggregate_stats_reply *agg;
+    struct onvm_flow_entry *flow_entry;
+    struct onvm_ft *ft;
+    uint64_t pkts = 0, bytes = 0;
+    uint32_t flows = 0;
+    int len = sizeof(struct ofp_stats_reply) + sizeof(struct ofp_aggregate_stats_reply);
+    const void *key;
+    void *data;
+    int32_t tbl_index;
+    uint32_t next = 0, left;
+
+    assert(BUFLEN > len);
+    onvm_flow_dir_refresh();
+    ft = sdn_ft;        //one table for the whole walk, even if a swap is picked up meanwhile
+    left = (ft) ? onvm_ft_count(ft) : 0;
+    while (left && (tbl_index = onvm_ft_iterate(ft, &key, &data, &next)) >= 0) {
+		left--;
+		flow_entry = (struct onvm_flow_entry *) onvm_ft_get_data(ft, tbl_index);
+		if (flow_entry->key == NULL || !flow_stats_match(req, flow_entry->key))
+			continue;
+		#ifdef ENABLE_FLOW_COUNTERS
+		onvm_flow_dir_get_counters(flow_entry, NULL, NULL);
+		#endif //ENABLE_FLOW_COUNTERS
+		pkts += flow_entry->stats->packet_count;
+		bytes += flow_entry->stats->byte_count;
+		flows++;
+    }
+    memcpy(buf, req, sizeof(*req));
+    reply = (struct ofp_stats_reply *) buf;
+    reply->header.type = OFPT_STATS_REPLY;
+    reply->header.length = htons(len);
+    reply->flags = 0;
+    agg = (struct ofp_aggregate_stats_reply *) reply->body;
+    memset(agg, 0, sizeof(*agg));
+    agg->packet_count = htonll(pkts);
+    agg->byte_count = htonll(bytes);
+    agg->flow_count = htonl(flows);
+
+    return len;
+}
+
 int make_vendor_reply(int xid, char *buf, unsigned int buflen)
 {
     struct ofp_error_msg *e;
@@ -471,6 +662,9 @@ struct onvm_ft_ipv4_5tuple* flow_key_extract(struct ofp_match *match)
         fk->proto = match->nw_proto;
 	fk->src_port = match->tp_src;
 	fk->dst_port = match->tp_dst;
+        if (!(ntohl(match->wildcards) & OFPFW_DL_VLAN) && ntohs(match->dl_vlan) != OFP_VLAN_NONE) {
+                fk->vlan_id = ntohs(match->dl_vlan) & 0xFFF;
+        }
 
         return fk;
 }
@@ -507,7 +701,7 @@ flow_action_extract(struct ofp_action_header *oah, size_t actions_len)
         }
     }
 
-    return chain;
+    return sdn_chain_intern(chain);
 }
 
 int setup_securechannel(void *ptr) {
@@ -552,6 +746,11 @@ int setup_securechannel(void *ptr) {
 	sdn_pkt_list_init(sdn_list);
     }
 
+    /* this thread looks up and walks the flow table too */
+    if (onvm_flow_dir_reader_register() < 0) {
+        rte_exit(EXIT_FAILURE, "Unable to register the SDN thread as a flow table reader\n");
+    }
+
     if(debug) fprintf(stderr,"Running secure channel\n");
     run_securechannel(dp);
     return 0;
@@ -568,7 +767,9 @@ void* run_securechannel(void *dp)
     assert(pollfds);
     while(1) {
         datapath_set_pollfd(dp, pollfds);
+        onvm_flow_dir_offline();
         poll(pollfds, n_switches, 1000);
+        onvm_flow_dir_quiescent();
         datapath_handle_io(dp, pollfds);
     }
     free(pollfds);
@@ -175,7 +175,7 @@ packet_handler(struct rte_mbuf* pkt, struct onvm_pkt_meta* meta) {
 	}
 	else {
 		ret = onvm_flow_dir_add_pkt(pkt, &flow_entry);
-		memset(flow_entry, 0, sizeof(struct onvm_flow_entry));
+		onvm_flow_dir_reset_entry(flow_entry);
 		flow_entry->sc = onvm_sc_create();
 		onvm_sc_append_entry(flow_entry->sc, ONVM_NF_ACTION_TONF, destination);
 		//onvm_sc_print(flow_entry->sc);
@@ -74,6 +74,12 @@ static thread_core_map_t thread_core_map;
 #define DISPLAY_STATS_PERIOD_IN_MS      (1000)      // 1000ms or Every second
 #define NF_LOAD_EVAL_PERIOD_IN_MS       (1)         // 1ms
 #define USLEEP_INTERVAL_IN_US           (50)        // 50 micro seconds (even if set to 50, best precision >100micro)
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+//sleep until the shortest periodic master timer is due: nf_load_eval_timer (1ms), or main_arbiter_timer when there is no wakeup thread
+#define MASTER_TIMER_SLEEP_IN_US        ((ONVM_NUM_WAKEUP_THREADS)? ((NF_LOAD_EVAL_PERIOD_IN_MS*1000)/2):(USLEEP_INTERVAL_IN_US))
+#else
+#define MASTER_TIMER_SLEEP_IN_US        (USLEEP_INTERVAL_IN_US)
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
 //#define ARBITER_PERIOD_IN_US            (100)       // 250 micro seconds or 100 micro seconds
 //Note: Running arbiter at 100micro to 250 micro seconds is fine provided we have the buffers available as:
 //RTT (measured with bridge and 1 basic NF) =0.2ms B=10Gbps => B*delay ( 2*RTT*Bw) = 2*200*10^-6 * 10*10^9 = 4Mb = 0.5MB
@@ -84,6 +90,9 @@ struct rte_timer display_stats_timer;   //Timer to periodically Display the stat
 struct rte_timer nf_status_check_timer; //Timer to periodically check new NFs registered or old NFs de-registerd   (0.5 second)
 struct rte_timer nf_load_eval_timer;    //Timer to periodically evaluate the NF Load characteristics    (1ms)
 struct rte_timer main_arbiter_timer;    //Timer to periodically run the Arbiter   (100us to at-most 250 micro seconds)
+#ifdef ENABLE_FLOW_AGING
+struct rte_timer flow_aging_timer;      //Timer to periodically age a slice of the flow table (FLOW_AGING_PERIOD_IN_MS)
+#endif //ENABLE_FLOW_AGING
 
 int initialize_rx_timers(int index, void *data);
 int initialize_tx_timers(int index, void *data);
@@ -97,6 +106,17 @@ static void nf_load_stats_timer_cb(__attribute__((unused)) struct rte_timer *ptr
         __attribute__((unused)) void *ptr_data);
 static void arbiter_timer_cb(__attribute__((unused)) struct rte_timer *ptr_timer,
         __attribute__((unused)) void *ptr_data);
+#ifdef ENABLE_FLOW_AGING
+static void flow_aging_timer_cb(__attribute__((unused)) struct rte_timer *ptr_timer,
+        __attribute__((unused)) void *ptr_data);
+
+static void
+flow_aging_timer_cb(__attribute__((unused)) struct rte_timer *ptr_timer,
+        __attribute__((unused)) void *ptr_data) {
+        onvm_flow_dir_age(FLOW_AGING_SLICE);
+        return;
+}
+#endif //ENABLE_FLOW_AGING
 
 static void
 display_stats_timer_cb(__attribute__((unused)) struct rte_timer *ptr_timer,
@@ -183,6 +203,17 @@ initialize_master_timers(void) {
                 &nf_load_stats_timer_cb, NULL
                 );
 
+        #ifdef ENABLE_FLOW_AGING
+        rte_timer_init(&flow_aging_timer);
+        ticks = ((uint64_t)FLOW_AGING_PERIOD_IN_MS *(rte_get_timer_hz()/1000));
+        rte_timer_reset_sync(&flow_aging_timer,
+                ticks,
+                PERIODICAL,
+                rte_lcore_id(), //timer_core
+                &flow_aging_timer_cb, NULL
+                );
+        #endif //ENABLE_FLOW_AGING
+
         if( 0 == ONVM_NUM_WAKEUP_THREADS) {
                 ticks = ((uint64_t)ARBITER_PERIOD_IN_US *(rte_get_timer_hz()/1000000));
                 rte_timer_reset_sync(&main_arbiter_timer,
@@ -210,11 +241,17 @@ master_thread_main(void) {
 
         /* Longer initial pause so above printf is seen */
         sleep(sleeptime * 3);
+        onvm_flow_dir_reader_register();        //stats and aging walk the flow entries
 
 #ifdef ENABLE_USE_RTE_TIMER_MODE_FOR_MAIN_THREAD
         if(initialize_master_timers() == 0) {
-                while (usleep(USLEEP_INTERVAL_IN_US) == 0) {
+                while (usleep(MASTER_TIMER_SLEEP_IN_US) == 0) {
                         rte_timer_manage();
+                        onvm_flow_dir_swap();
+                        #ifdef ENABLE_CHAIN_STATS
+                        onvm_chain_stats_reclaim();
+                        #endif //ENABLE_CHAIN_STATS
+                        onvm_flow_dir_quiescent();
                         //struct timespec ctime; get_current_time(&ctime);
                         //printf("\n sec:[%ld]: nanosec [%ld]", ctime.tv_sec, ctime.tv_nsec);
                 }
@@ -224,7 +261,15 @@ master_thread_main(void) {
         /* Loop forever: sleep always returns 0 or <= param */
         while (sleep(sleeptime) <= sleeptime) {
                 onvm_nf_check_status();
+                #ifdef ENABLE_FLOW_AGING
+                onvm_flow_dir_age(FLOW_AGING_SLICE * (1000/FLOW_AGING_PERIOD_IN_MS));
+                #endif //ENABLE_FLOW_AGING
                 onvm_stats_display_all(sleeptime);
+                onvm_flow_dir_swap();
+                #ifdef ENABLE_CHAIN_STATS
+                onvm_chain_stats_reclaim();
+                #endif //ENABLE_CHAIN_STATS
+                onvm_flow_dir_quiescent();
         }
 #endif //ENABLE_USE_RTE_TIMER_MODE_FOR_MAIN_THREAD
 }
@@ -245,13 +290,31 @@ rx_thread_main(void *arg) {
                 "Core %d: Running RX thread for RX queue %d\n",
                 rte_lcore_id(),
                 rx->queue_id);
+        onvm_flow_dir_reader_register();
 
         for (;;) {
+                onvm_flow_dir_quiescent();
+                #ifdef ENABLE_LOSSLESS_CREDIT_MODE
+                /* Last resort of the lossless mode: leave pkts in the NIC while an NF's hold queue is filled up */
+                if (unlikely(rte_atomic16_read(&lossless_rx_paused_nfs))) {
+                        onvm_pkt_flush_all_nfs(rx);
+                        rte_pause();
+                        continue;
+                }
+                #endif //ENABLE_LOSSLESS_CREDIT_MODE
+
                 /* Read ports */
                 for (i = 0; i < ports->num_ports; i++) {
                         rx_count = rte_eth_rx_burst(ports->id[i], rx->queue_id, \
                                         pkts, PACKET_READ_SIZE);
                         ports->rx_stats.rx[ports->id[i]] += rx_count;
+                        #ifdef ENABLE_MBUF_QUOTAS
+                        // before any drop path looks at the tags
+                        onvm_mbuf_reset_tags(pkts, rx_count);
+                        #endif //ENABLE_MBUF_QUOTAS
+                        if (unlikely(ports->soft_rss[ports->id[i]]) && rx_count) {
+                                onvm_softrss_burst(pkts, rx_count);
+                        }
 
                         /* Now process the NIC packets read */
                         if (likely(rx_count > 0)) {
@@ -274,12 +337,140 @@ rx_thread_main(void *arg) {
 }
 
 #define PACKET_READ_SIZE_TX ((uint16_t)(PACKET_READ_SIZE*4))
-static int
-tx_thread_main(void *arg) {
+/*
+ * One pass of TX work for the NFs [first_cl, last_cl) of the given TX thread.
+ * Returns the count of packets dequeued from the NFs Tx rings.
+ */
+static inline uint32_t
+tx_thread_drain_nfs(struct thread_info *tx) {
         struct client *cl;
         unsigned i, tx_count;
+        uint32_t drained = 0;
         struct rte_mbuf *pkts[PACKET_READ_SIZE];
+
+        /* Read packets from the client's tx queue and process them as needed */
+        for (i = tx->first_cl; i < tx->last_cl; i++) {
+                tx_count = PACKET_READ_SIZE;
+                cl = &clients[i];
+                if (!onvm_nf_is_valid(cl))
+                        continue;
+                /* try dequeuing max possible packets first, if that fails, get the
+                 * most we can. Loop body should only execute once, maximum
+                while (tx_count > 0 &&
+                        unlikely(rte_ring_dequeue_bulk(cl->tx_q, (void **) pkts, tx_count) != 0)) {
+                        tx_count = (uint16_t)RTE_MIN(rte_ring_count(cl->tx_q),
+                                        PACKET_READ_SIZE);
+                }
+                */
+                tx_count = rte_ring_dequeue_burst(cl->tx_q, (void **) pkts, tx_count);
+
+                /* Now process the Client packets read */
+                if (likely(tx_count > 0)) {
+
+                        #ifdef ENABLE_NF_BACKPRESSURE
+                        #ifdef USE_BKPR_V2_IN_TIMER_MODE
+                        onvm_check_and_reset_back_pressure_v2(pkts, tx_count, cl);
+                        #else
+                        onvm_check_and_reset_back_pressure(pkts, tx_count, cl);
+                        #endif //USE_BKPR_V2_IN_TIMER_MODE
+                        #endif // ENABLE_NF_BACKPRESSURE
+
+                        #if defined(ENABLE_ECN_CE) && !(defined(ENABLE_NF_SOJOURN_AQM) && defined(ENABLE_NF_BACKPRESSURE))
+                        /* Mark the burst when the smoothed (EWMA) Rx ring occupancy of NF is above its ECN mark level: one check per burst */
+                        if (cl->info->ht2_q.ewma_avg >= NF_RX_Q_ECN_WM(cl)) {
+                                onvm_detect_and_set_ecn_ce(pkts, tx_count, cl);
+                        }
+                        #endif //ENABLE_ECN_CE
+
+                        onvm_pkt_process_tx_batch(tx, pkts, tx_count, cl);
+                        drained += tx_count;
+                        //RTE_LOG(INFO,APP,"Core %d: processing %d TX packets for NF: %d \n", rte_lcore_id(),tx_count, i);
+                }
+                else continue;
+        }
+
+        /* Send a burst to every port */
+        onvm_pkt_flush_all_ports(tx);
+
+        /* Send a burst to every NF */
+        onvm_pkt_flush_all_nfs(tx);
+
+        return drained;
+}
+
+#ifdef ENABLE_ELASTIC_MGR_CORES
+elastic_mgr_info_t elastic_mgr;
+
+/* TX thread side: hand the NFs over to the wakeup thread and sleep until resumed (buffers are already flushed by tx_thread_drain_nfs()) */
+static void
+elastic_tx_park(elastic_tx_thread_t *et) {
+        et->park_count++;
+        rte_smp_wmb();
+        et->state = ELASTIC_TX_PARKED;
+        onvm_flow_dir_offline();
+        while (sem_wait(&et->park_sem) != 0 && errno == EINTR);
+        onvm_flow_dir_quiescent();
+        et->state = ELASTIC_TX_ACTIVE;
+}
+
+void
+onvm_mgr_elastic_poll(void) {
+        static uint64_t next_eval = 0;
+        uint64_t now = rte_get_tsc_cycles();
+        uint32_t backlog = 0;
+        unsigned i;
+
+        /* Fold: drain the NFs of every parked TX thread on this core */
+        for (i = 0; i < elastic_mgr.tx_threads; i++) {
+                if (elastic_mgr.tx[i].state == ELASTIC_TX_PARKED)
+                        elastic_mgr.tx[i].folded_pkts += tx_thread_drain_nfs(elastic_mgr.tx[i].tx);
+        }
+
+        if (now < next_eval) return;
+        next_eval = now + (uint64_t)ELASTIC_EVAL_PERIOD_IN_US*(rte_get_tsc_hz()/1000000);
+
+        for (i = 0; i < MAX_CLIENTS; i++) {
+                if (onvm_nf_is_valid(&clients[i]))
+                        backlog += rte_ring_count(clients[i].tx_q);
+        }
+        elastic_mgr.backlog = backlog;
+        elastic_mgr.backlog_ewma = (elastic_mgr.backlog_ewma*3 + backlog)/4;
+
+        if (backlog >= ELASTIC_TX_UNPARK_BACKLOG) {
+                /* Expand: resume the lowest parked TX thread */
+                elastic_mgr.idle_periods = 0;
+                for (i = 0; i < elastic_mgr.tx_threads; i++) {
+                        if (elastic_mgr.tx[i].state == ELASTIC_TX_PARKED) {
+                                elastic_mgr.tx[i].state = ELASTIC_TX_UNPARK_REQ;
+                                rte_smp_mb();
+                                sem_post(&elastic_mgr.tx[i].park_sem);
+                                elastic_mgr.active_tx_threads++;
+                                break;
+                        }
+                }
+        }
+        else if (elastic_mgr.backlog_ewma <= ELASTIC_TX_PARK_BACKLOG) {
+                /* Shrink: park the highest active TX thread after a sustained idle period */
+                if (++elastic_mgr.idle_periods < ELASTIC_TX_PARK_HOLD_PERIODS) return;
+                elastic_mgr.idle_periods = 0;
+                for (i = elastic_mgr.tx_threads; i-- > 0; ) {
+                        if (elastic_mgr.tx[i].state == ELASTIC_TX_ACTIVE) {
+                                elastic_mgr.tx[i].state = ELASTIC_TX_PARK_REQ;
+                                elastic_mgr.active_tx_threads--;
+                                break;
+                        }
+                }
+        }
+        else elastic_mgr.idle_periods = 0;
+}
+#endif //ENABLE_ELASTIC_MGR_CORES
+
+static int
+tx_thread_main(void *arg) {
         struct thread_info* tx = (struct thread_info*)arg;
+        #ifdef ENABLE_ELASTIC_MGR_CORES
+        elastic_tx_thread_t *et = (tx->queue_id < ELASTIC_MAX_TX_THREADS)? (&elastic_mgr.tx[tx->queue_id]):(NULL);
+        #endif //ENABLE_ELASTIC_MGR_CORES
 
         RTE_LOG(INFO,
                APP,
@@ -287,46 +478,17 @@ tx_thread_main(void *arg) {
                rte_lcore_id(),
                tx->first_cl,
                tx->last_cl-1);
+        onvm_flow_dir_reader_register();
 
         for (;;) {
-                /* Read packets from the client's tx queue and process them as needed */
-                for (i = tx->first_cl; i < tx->last_cl; i++) {
-                        tx_count = PACKET_READ_SIZE;
-                        cl = &clients[i];
-                        if (!onvm_nf_is_valid(cl))
-                                continue;
-                        /* try dequeuing max possible packets first, if that fails, get the
-                         * most we can. Loop body should only execute once, maximum
-                        while (tx_count > 0 &&
-                                unlikely(rte_ring_dequeue_bulk(cl->tx_q, (void **) pkts, tx_count) != 0)) {
-                                tx_count = (uint16_t)RTE_MIN(rte_ring_count(cl->tx_q),
-                                                PACKET_READ_SIZE);
-                        }
-                        */
-                        tx_count = rte_ring_dequeue_burst(cl->tx_q, (void **) pkts, tx_count);
-
-                        /* Now process the Client packets read */
-                        if (likely(tx_count > 0)) {
-
-                                #ifdef ENABLE_NF_BACKPRESSURE
-                                #ifdef USE_BKPR_V2_IN_TIMER_MODE
-                                onvm_check_and_reset_back_pressure_v2(pkts, tx_count, cl);
-                                #else
-                                onvm_check_and_reset_back_pressure(pkts, tx_count, cl);
-                                #endif //USE_BKPR_V2_IN_TIMER_MODE
-                                #endif // ENABLE_NF_BACKPRESSURE
-
-                                onvm_pkt_process_tx_batch(tx, pkts, tx_count, cl);
-                                //RTE_LOG(INFO,APP,"Core %d: processing %d TX packets for NF: %d \n", rte_lcore_id(),tx_count, i);
-                        }
-                        else continue;
+                onvm_flow_dir_quiescent();
+                #ifdef ENABLE_ELASTIC_MGR_CORES
+                if (unlikely(et && et->state == ELASTIC_TX_PARK_REQ)) {
+                        elastic_tx_park(et);
+                        continue;
                 }
-
-                /* Send a burst to every port */
-                onvm_pkt_flush_all_ports(tx);
-
-                /* Send a burst to every NF */
-                onvm_pkt_flush_all_nfs(tx);
+                #endif //ENABLE_ELASTIC_MGR_CORES
+                tx_thread_drain_nfs(tx);
         }
 
         return 0;
@@ -350,6 +512,7 @@ main(int argc, char *argv[]) {
         next_instance_id = 1;
         if (init(argc, argv) < 0 )
                 return -1;
+        onvm_pkt_init();
         RTE_LOG(INFO, APP, "Finished Process Init.\n");
 
         /* clear statistics */
@@ -409,6 +572,14 @@ main(int argc, char *argv[]) {
 #endif  //ONVM_MGR_ACT_AS_2PORT_FWD_BRIDGE
                 tx->last_cl = RTE_MIN((i+1) * clients_per_tx, temp_num_clients);
                 //tx->last_cl = RTE_MIN((i+1) * clients_per_tx + 1, temp_num_clients);
+                #ifdef ENABLE_ELASTIC_MGR_CORES
+                if (i < ELASTIC_MAX_TX_THREADS) {
+                        elastic_mgr.tx[i].tx = tx;
+                        elastic_mgr.tx[i].state = ELASTIC_TX_ACTIVE;
+                        sem_init(&elastic_mgr.tx[i].park_sem, 0, 0);
+                        elastic_mgr.tx_threads = elastic_mgr.active_tx_threads = i+1;
+                }
+                #endif //ENABLE_ELASTIC_MGR_CORES
                 cur_lcore = rte_get_next_lcore(cur_lcore, 1, 1);
                 if (rte_eal_remote_launch(tx_thread_main, (void*)tx,  cur_lcore) == -EBUSY) {
                         RTE_LOG(ERR,
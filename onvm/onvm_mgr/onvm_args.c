@@ -89,6 +89,10 @@ parse_default_service(const char *services);
 static int
 parse_num_services(const char *services);
 
+
+static int
+parse_flow_table_size(const char *flows);
+
 #define USE_STATIC_IDS
 #ifdef USE_STATIC_IDS
 
@@ -112,9 +116,9 @@ parse_app_args(uint8_t max_ports, int argc, char *argv[]) {
         is_static_clients = DYNAMIC_CLIENTS;
 
 #ifdef USE_STATIC_IDS
-        while ((opt = getopt_long(argc, argvopt, "n:r:p:d:", lgopts, &option_index)) != EOF) {
+        while ((opt = getopt_long(argc, argvopt, "n:r:p:d:f:", lgopts, &option_index)) != EOF) {
 #else
-        while ((opt = getopt_long(argc, argvopt, "r:p:d:", lgopts, &option_index)) != EOF) {
+        while ((opt = getopt_long(argc, argvopt, "r:p:d:f:", lgopts, &option_index)) != EOF) {
 #endif
                 switch (opt) {
                         case 'p':
@@ -143,6 +147,12 @@ parse_app_args(uint8_t max_ports, int argc, char *argv[]) {
                                         return -1;
                                 }
                                 break;
+                        case 'f':
+                                if (parse_flow_table_size(optarg) != 0) {
+                                        usage();
+                                        return -1;
+                                }
+                                break;
                         default:
                                 printf("ERROR: Unknown option '%c'\n", opt);
                                 usage();
@@ -170,12 +180,13 @@ usage(void) {
 #ifdef USE_STATIC_IDS
             "[-n NUM_CLIENTS] "
 #endif
-            "[-s NUM_SOCKETS] [-r NUM_SERVICES]\n"
+            "[-s NUM_SOCKETS] [-r NUM_SERVICES] [-f NUM_FLOWS[,MAX_FLOWS]]\n"
             " -p PORTMASK: hexadecimal bitmask of ports to use\n"
 #ifdef USE_STATIC_IDS
             " -n NUM_CLIENTS: number of client processes to use (optional)\n"
 #endif
             " -r NUM_SERVICES: number of unique serivces allowed (optional)\n" // -s already used for num sockets
+            " -f NUM_FLOWS[,MAX_FLOWS]: initial size of the flow table, and size up to which it grows online (optional)\n"
             , progname);
 }
 
@@ -243,6 +254,29 @@ parse_num_services(const char *services) {
 }
 
 
+static int
+parse_flow_table_size(const char *flows) {
+        char *end = NULL;
+        unsigned long temp, max;
+
+        temp = strtoul(flows, &end, 10);
+        if (end == NULL || temp == 0 || temp > INT32_MAX)
+                return -1;
+        max = RTE_MAX(temp, (unsigned long)sdn_ft_max_entries);
+        if (*end == ',') {
+                max = strtoul(end + 1, &end, 10);
+                if (max < temp || max > INT32_MAX)
+                        return -1;
+        }
+        if (*end != '\0')
+                return -1;
+
+        sdn_ft_entries = (uint32_t)temp;
+        sdn_ft_max_entries = (uint32_t)max;
+        return 0;
+}
+
+
 #ifdef USE_STATIC_IDS
 static int
 parse_num_clients(const char *clients) {
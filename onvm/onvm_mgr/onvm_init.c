@@ -59,6 +59,9 @@ struct client *clients = NULL;
 struct port_info *ports = NULL;
 
 struct rte_mempool *pktmbuf_pool;
+#ifdef ENABLE_MBUF_QUOTAS
+mbuf_quota_info_t *mbuf_quota;
+#endif //ENABLE_MBUF_QUOTAS
 struct rte_mempool *nf_info_pool;
 struct rte_ring *nf_info_queue;
 uint16_t **services;
@@ -196,12 +199,46 @@ init_mbuf_pools(void) {
          * seems faster to use a cache instead */
         printf("Creating mbuf pool '%s' [%u mbufs] ...\n",
                         PKTMBUF_POOL_NAME, num_mbufs);
+#ifdef ENABLE_MBUF_QUOTAS
+        /* mbufs carry the owner tag (struct onvm_mbuf_tag) in their private area */
+        struct rte_pktmbuf_pool_private mbp_priv;
+        const struct rte_memzone *mz_mq;
+
+        mbp_priv.mbuf_data_room_size = MBUF_SIZE - sizeof(struct rte_mbuf);
+        mbp_priv.mbuf_priv_size = MBUF_PRIV_SIZE;
+        pktmbuf_pool = rte_mempool_create(PKTMBUF_POOL_NAME, num_mbufs,
+                        MBUF_SIZE + MBUF_PRIV_SIZE, MBUF_CACHE_SIZE,
+                        sizeof(struct rte_pktmbuf_pool_private), rte_pktmbuf_pool_init,
+                        &mbp_priv, rte_pktmbuf_init, NULL, rte_socket_id(), NO_FLAGS);
+        if (pktmbuf_pool == NULL)
+                return -1;
+
+        /* set up the mbuf accounting shared with NFs */
+        mz_mq = rte_memzone_reserve(MZ_MBUF_QUOTA_INFO, sizeof(*mbuf_quota),
+                                rte_socket_id(), NO_FLAGS);
+        if (mz_mq == NULL)
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for mbuf quota information\n");
+        mbuf_quota = mz_mq->addr;
+        memset(mbuf_quota, 0, sizeof(*mbuf_quota));
+        mbuf_quota->pool_size = num_mbufs;
+        mbuf_quota->chain_quota = (num_mbufs * MBUF_QUOTA_CHAIN_DEFAULT_PCT)/100;
+        rte_spinlock_init(&mbuf_quota->owner_lock);
+        mbuf_quota->next_owner = 1;
+        {
+                unsigned i;
+                for (i = 0; i < MAX_CLIENTS; i++) {
+                        mbuf_quota->nf[i].quota = MBUF_QUOTA_NF_BUFFER;
+                }
+        }
+        return 0;
+#else
         pktmbuf_pool = rte_mempool_create(PKTMBUF_POOL_NAME, num_mbufs,
                         MBUF_SIZE, MBUF_CACHE_SIZE,
                         sizeof(struct rte_pktmbuf_pool_private), rte_pktmbuf_pool_init,
                         NULL, rte_pktmbuf_init, NULL, rte_socket_id(), NO_FLAGS);
 
         return (pktmbuf_pool == NULL); /* 0  on success */
+#endif //ENABLE_MBUF_QUOTAS
 }
 
 /**
@@ -246,6 +283,7 @@ init_port(uint8_t port_num) {
         const uint16_t rx_ring_size = RTE_MP_RX_DESC_DEFAULT;
         const uint16_t tx_ring_size = RTE_MP_TX_DESC_DEFAULT;
 
+        struct rte_eth_dev_info dev_info;
         uint16_t q;
         int retval;
 
@@ -279,6 +317,14 @@ init_port(uint8_t port_num) {
         retval  = rte_eth_dev_start(port_num);
         if (retval < 0) return retval;
 
+        /* no RSS on the port (net_ring, net_pcap, virtio-user, ...): the flows would all map to the same NF instance */
+        rte_eth_dev_info_get(port_num, &dev_info);
+        ports->soft_rss[port_num] = (dev_info.flow_type_rss_offloads == 0);
+        if (ports->soft_rss[port_num]) {
+                printf("Port %u has no RSS: hashing the flows in software\n", (unsigned)port_num);
+                onvm_softrss_lut_init();
+        }
+
         printf("done: \n");
 
         return 0;
@@ -391,6 +437,37 @@ init_shm_rings(void) {
                 if (clients[i].tx_q == NULL)
                         rte_exit(EXIT_FAILURE, "Cannot create tx ring queue for client %u\n", i);
 
+                #ifdef ENABLE_LOSSLESS_CREDIT_MODE
+                {
+                        char hq_name[sizeof(MP_CLIENT_HOLDQ_NAME) + 2];
+                        snprintf(hq_name, sizeof(hq_name) - 1, MP_CLIENT_HOLDQ_NAME, i);
+                        clients[i].hold_q = rte_ring_create(hq_name,
+                                        LOSSLESS_HOLD_QUEUE_SIZE, socket_id,
+                                        0);                     /* multi prod, multi cons (held and released by either Rx/Tx Threads) */
+                        if (clients[i].hold_q == NULL)
+                                rte_exit(EXIT_FAILURE, "Cannot create hold queue for client %u\n", i);
+                        clients[i].hold_paused = 0;
+                        clients[i].hold_head_cnt = 0;
+                        rte_spinlock_init(&clients[i].hold_lock);
+                }
+                #endif //ENABLE_LOSSLESS_CREDIT_MODE
+
+                #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+                {
+                        unsigned c;
+                        for (c = 0; c < NF_RX_BULK_CLASS; c++) {
+                                clients[i].rx_prio[c].q = rte_ring_create(get_rx_prio_queue_name(i, c),
+                                                NF_RX_PRIO_RING_SIZE, socket_id,
+                                                RING_F_SC_DEQ);         /* multi prod, single cons (same as rx_q) */
+                                if (clients[i].rx_prio[c].q == NULL)
+                                        rte_exit(EXIT_FAILURE, "Cannot create rx priority ring queue %u for client %u\n", c, i);
+                                #ifdef ENABLE_RING_WATERMARK
+                                rte_ring_set_water_mark(clients[i].rx_prio[c].q, NF_RX_PRIO_Q_HIGH_WM);
+                                #endif //ENABLE_RING_WATERMARK
+                        }
+                }
+                #endif //ENABLE_NF_RX_PRIORITY_RINGS
+
                 #ifdef ENABLE_RING_WATERMARK
                 rte_ring_set_water_mark(clients[i].rx_q, CLIENT_QUEUE_RING_WATER_MARK_SIZE);
                 //rte_ring_set_water_mark(clients[i].tx_q, CLIENT_QUEUE_RING_WATER_MARK_SIZE);
@@ -478,9 +555,23 @@ init_shm_rings(void) {
 
                 //#if defined (ENABLE_NF_BACKPRESSURE) && defined (NF_BACKPRESSURE_APPROACH_1)
                 #ifdef ENABLE_NF_BACKPRESSURE
-                memset(&clients[i].bft_list, 0, sizeof(clients[i].bft_list));
-                clients[i].bft_list.max_len=CLIENT_QUEUE_RINGSIZE*2;
+                clients[i].bkpr_gen = 0;
+                clients[i].bkpr_marked = 0;
                 #endif
+
+                #ifdef ENABLE_NF_SOJOURN_AQM
+                memset(&clients[i].aqm, 0, sizeof(clients[i].aqm));
+                #endif //ENABLE_NF_SOJOURN_AQM
+
+                #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+                onvm_nf_reset_watermarks(&clients[i]);
+                #endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
+                #ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                clients[i].deadline.budget_us = UINT32_MAX;
+                clients[i].deadline.slack_us = INT64_MAX;
+                clients[i].deadline.missed = 0;
+                #endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
         }
         return 0;
 }
@@ -115,11 +115,35 @@
 #define CLIENT_QUEUE_RING_THRESHOLD_GAP (20)
 #endif //NF_BACKPRESSURE_APPROACH_1
 
-#define CLIENT_QUEUE_RING_WATER_MARK_SIZE ((uint32_t)((CLIENT_QUEUE_RINGSIZE*CLIENT_QUEUE_RING_THRESHOLD)/100))
-#define CLIENT_QUEUE_RING_LOW_THRESHOLD ((CLIENT_QUEUE_RING_THRESHOLD > CLIENT_QUEUE_RING_THRESHOLD_GAP) ? (CLIENT_QUEUE_RING_THRESHOLD-CLIENT_QUEUE_RING_THRESHOLD_GAP):(CLIENT_QUEUE_RING_THRESHOLD))
-#define CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE ((uint32_t)((CLIENT_QUEUE_RINGSIZE*CLIENT_QUEUE_RING_LOW_THRESHOLD)/100))
+//Note: formulae are in shared/onvm_sched_policy.h (also used by onvm_sim)
+#define CLIENT_QUEUE_RING_WATER_MARK_SIZE ONVM_RING_WATER_MARK_SIZE(CLIENT_QUEUE_RINGSIZE, CLIENT_QUEUE_RING_THRESHOLD)
+#define CLIENT_QUEUE_RING_LOW_THRESHOLD ONVM_RING_LOW_THRESHOLD(CLIENT_QUEUE_RING_THRESHOLD, CLIENT_QUEUE_RING_THRESHOLD_GAP)
+#define CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE ONVM_RING_WATER_MARK_SIZE(CLIENT_QUEUE_RINGSIZE, CLIENT_QUEUE_RING_LOW_THRESHOLD)
 #define ECN_EWMA_ALPHA  (0.25)
-#define CLIENT_QUEUE_RING_ECN_MARK_SIZE ((uint32_t)(((1-ECN_EWMA_ALPHA)*CLIENT_QUEUE_RING_WATER_MARK_SIZE) + ((ECN_EWMA_ALPHA)*CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE)))///2)
+#define CLIENT_QUEUE_RING_ECN_MARK_SIZE ONVM_RING_ECN_MARK_SIZE(CLIENT_QUEUE_RING_WATER_MARK_SIZE, CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE, ECN_EWMA_ALPHA)
+
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+#define MP_CLIENT_HOLDQ_NAME "MProc_Client_%u_HOLD"
+#define LOSSLESS_RX_PAUSE_SIZE  ONVM_RING_WATER_MARK_SIZE(LOSSLESS_HOLD_QUEUE_SIZE, LOSSLESS_RX_PAUSE_THRESHOLD)
+#define LOSSLESS_RX_RESUME_SIZE ONVM_RING_WATER_MARK_SIZE(LOSSLESS_HOLD_QUEUE_SIZE, LOSSLESS_RX_RESUME_THRESHOLD)
+#define LOSSLESS_RELEASE_BURST  (32)    //pkts moved from hold_q to rx_q at a time
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
+
+//Rx ring watermarks in effect for an NF: per NF when tuned online, else the above global values
+#ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+#define NF_RX_Q_HIGH_WM(cl)     ((cl)->wm.high)
+#define NF_RX_Q_LOW_WM(cl)      ((cl)->wm.low)
+#define NF_RX_Q_ECN_WM(cl)      ((cl)->wm.ecn)
+#else
+#define NF_RX_Q_HIGH_WM(cl)     (CLIENT_QUEUE_RING_WATER_MARK_SIZE)
+#define NF_RX_Q_LOW_WM(cl)      (CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE)
+#define NF_RX_Q_ECN_WM(cl)      (CLIENT_QUEUE_RING_ECN_MARK_SIZE)
+#endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+#define NF_RX_PRIO_Q_HIGH_WM    ONVM_RING_WATER_MARK_SIZE(NF_RX_PRIO_RING_SIZE, NF_RX_PRIO_RING_THRESHOLD)
+#define NF_RX_PRIO_Q_LOW_WM     ONVM_RING_WATER_MARK_SIZE(NF_RX_PRIO_RING_SIZE, ONVM_RING_LOW_THRESHOLD(NF_RX_PRIO_RING_THRESHOLD, NF_RX_PRIO_RING_THRESHOLD_GAP))
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
 #define NO_FLAGS 0
 
 #define ONVM_NUM_RX_THREADS 1
@@ -129,22 +153,23 @@
 
 
 /******************************Data structures********************************/
-#ifdef ENABLE_NF_BACKPRESSURE //NF_BACKPRESSURE_APPROACH_1
-//#if defined (ENABLE_NF_BACKPRESSURE) && defined (NF_BACKPRESSURE_APPROACH_1)
-typedef struct bottleneck_ft_data {
-        uint16_t chain_index;           //index of NF (bottleneck) in the chain
-         struct onvm_flow_entry* bft;   //flow_entry field
-}bottleneck_ft_data_t;
-typedef struct bottleneck_ft_info {
-        uint16_t bft_count;         // num of entries in the bft[]
-        uint16_t r_h;               // read_head in the bft[]
-        uint16_t w_h;               // write head in the bft[]
-        uint16_t max_len;           // Max size/count of bft[]
-        //struct onvm_flow_entry* bft[CLIENT_QUEUE_RINGSIZE];
-        bottleneck_ft_data_t bft[CLIENT_QUEUE_RINGSIZE*2+1];
-}bottlenect_ft_info_t;
-
-#endif //ENABLE_NF_BACKPRESSURE
+#ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+typedef struct nf_ring_wm_info {
+        volatile uint32_t high;         //backpressure is signalled at/above this Rx ring occupancy
+        volatile uint32_t low;          //and reset below this
+        volatile uint32_t ecn;          //ECN CE mark level (on EWMA of the occupancy)
+        uint16_t in_bkpr;               //signalled and not yet reset
+        uint16_t calm_epochs;           //consecutive epochs without drops or backpressure
+        uint32_t bkpr_events;           //backpressure on/off cycles in the current epoch
+        uint64_t prev_rx;
+        uint64_t prev_rx_drop;
+        uint64_t prev_tx;
+        uint64_t avg_arrivals;          //EWMA of arrivals per epoch
+        uint64_t avg_dev;               //EWMA of the absolute deviation of arrivals per epoch
+        uint64_t tune_count;
+}nf_ring_wm_info_t;
+#endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
 
 /*
  * Define a client structure with all needed info, including
@@ -153,6 +178,30 @@ typedef struct bottleneck_ft_info {
 struct client {
         struct rte_ring *rx_q;
         struct rte_ring *tx_q;
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+        struct rte_ring *hold_q;        //pkts beyond the credits (free slots) of rx_q, held in order by the manager
+        volatile uint16_t hold_paused;  //hold_q is above the pause threshold: counted in lossless_rx_paused_nfs
+        uint64_t held;                  //pkts that went through hold_q
+        uint64_t hold_pauses;           //times hold_q crossed the pause threshold
+        rte_spinlock_t hold_lock;       //one thread at a time releases the held pkts (keeps them in order)
+        uint16_t hold_head_cnt;         //pkts taken off hold_q but not yet in rx_q: released ahead of hold_q (under hold_lock)
+        struct rte_mbuf *hold_head[LOSSLESS_RELEASE_BURST];
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        /* Rx Rings of the priority classes (0..NF_RX_BULK_CLASS-1): the bulk class is rx_q */
+        struct {
+                struct rte_ring *q;
+                volatile uint16_t in_bkpr;      //ring crossed NF_RX_PRIO_Q_HIGH_WM and is not yet below NF_RX_PRIO_Q_LOW_WM
+                uint64_t rx;
+                uint64_t rx_drop;
+                uint64_t bkpr_events;
+                uint64_t bkpr_drop;             //pkts of the class dropped at the ingress of chains through this NF while in_bkpr
+        } rx_prio[NF_RX_BULK_CLASS];
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+#ifdef ENABLE_ECN_CE
+        uint64_t ecn_ce_marked;         //pkts marked CE at dequeue from tx_q
+        uint64_t ecn_ce_bursts;         //tx_q bursts that went through the marking stage
+#endif //ENABLE_ECN_CE
         struct onvm_nf_info *info;
         uint16_t instance_id;
         /* these stats hold how many packets the client will actually receive,
@@ -193,9 +242,32 @@ struct client {
 #ifdef ENABLE_NF_BACKPRESSURE
 //#if defined (ENABLE_NF_BACKPRESSURE) && defined (NF_BACKPRESSURE_APPROACH_1)
         uint16_t is_bottleneck;         //status: not marked=0/marked for enqueue=1/enqueued as bottleneck=2
-        bottlenect_ft_info_t bft_list;
+        volatile uint32_t bkpr_gen;     //backpressure generation: incremented when NF recovers, invalidates all chain marks set by this NF
+        uint16_t bkpr_marked;           //marks set in the current generation
+#ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+        nf_ring_wm_info_t wm;
+#endif //ENABLE_NF_WATERMARK_AUTOTUNE
+#ifdef ENABLE_NF_SOJOURN_AQM
+        struct {
+                uint64_t first_above_tsc;       //time at which sojourn above target turns into a signal (0 => below target)
+                uint64_t signal_next_tsc;       //time of next signal in the signalling state
+                uint32_t count;                 //signals in the current signalling state
+                uint32_t last_count;            //count at entry to the previous signalling state
+                uint8_t signalling;             //in the signalling (CoDel dropping) state
+                uint64_t sojourn_us;            //minimum sojourn of the last dequeued batch
+                uint64_t signals;
+        } aqm;
+#endif //ENABLE_NF_SOJOURN_AQM
 #endif //defined (ENABLE_NF_BACKPRESSURE) && defined (NF_BACKPRESSURE_APPROACH_1)
 
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+        struct {
+                volatile uint32_t budget_us;    //tightest chain budget left among pkts enqueued to this NF in the current wake epoch (UINT32_MAX => none)
+                int64_t slack_us;               //time to deadline of the head-of-queue pkt (budget_us - age); evaluated every wake epoch
+                uint64_t missed;                //count of epochs in which the head-of-queue pkt had already missed its deadline
+        } deadline;
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+
         /* mutex and semaphore name for NFs to wait on */ 
         #ifdef INTERRUPT_SEM        
         const char *sem_name;
@@ -246,6 +318,39 @@ struct client {
         #endif //INTERRUPT_SEM
 };
 
+#ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+/* Restore the global (initial) watermarks of the NF and restart its measurements */
+static inline void onvm_nf_reset_watermarks(struct client *cl) {
+        memset(&cl->wm, 0, sizeof(cl->wm));
+        cl->wm.high = CLIENT_QUEUE_RING_WATER_MARK_SIZE;
+        cl->wm.low = CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE;
+        cl->wm.ecn = CLIENT_QUEUE_RING_ECN_MARK_SIZE;
+        if(cl->rx_q) rte_ring_set_water_mark(cl->rx_q, cl->wm.high);
+}
+#endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
+/* Pkts waiting for the NF in all its Rx Rings */
+static inline unsigned onvm_nf_rx_pending(struct client *cl) {
+        unsigned count = rte_ring_count(cl->rx_q);
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        unsigned c;
+        for (c = 0; c < NF_RX_BULK_CLASS; c++) {
+                if (cl->rx_prio[c].q) count += rte_ring_count(cl->rx_prio[c].q);
+        }
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+        return count;
+}
+
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+/* Backpressure state of the class c Rx Ring of NF: set on crossing NF_RX_PRIO_Q_HIGH_WM, reset here once below NF_RX_PRIO_Q_LOW_WM */
+static inline unsigned onvm_nf_rx_prio_in_bkpr(struct client *cl, unsigned c) {
+        if (cl->rx_prio[c].in_bkpr && rte_ring_count(cl->rx_prio[c].q) < NF_RX_PRIO_Q_LOW_WM) {
+                cl->rx_prio[c].in_bkpr = 0;
+        }
+        return cl->rx_prio[c].in_bkpr;
+}
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
 #if defined (INTERRUPT_SEM) && defined (USE_SOCKET)
 extern int onvm_socket_id;
 #endif
@@ -281,6 +386,7 @@ struct tx_stats{
 struct port_info {
         uint8_t num_ports;
         uint8_t id[RTE_MAX_ETHPORTS];
+        uint8_t soft_rss[RTE_MAX_ETHPORTS];     // port delivers no RSS hash (virtual ports): the Rx threads compute it
         volatile struct rx_stats rx_stats;
         volatile struct tx_stats tx_stats;
 };
@@ -299,6 +405,9 @@ extern struct rte_mempool *nf_info_pool;
 extern struct port_info *ports;
 
 extern struct rte_mempool *pktmbuf_pool;
+#ifdef ENABLE_MBUF_QUOTAS
+extern mbuf_quota_info_t *mbuf_quota;
+#endif //ENABLE_MBUF_QUOTAS
 extern volatile uint16_t num_clients;
 extern uint16_t num_services;
 extern uint16_t default_service;
@@ -60,6 +60,7 @@
 #include <netinet/ip.h>
 #include <stdbool.h>
 #include <math.h>
+#include <semaphore.h>
 
 
 /********************************DPDK library*********************************/
@@ -138,6 +139,39 @@ struct wakeup_info {
 };
 #endif //INTERRUPT_SEM
 
+#ifdef ENABLE_ELASTIC_MGR_CORES
+/** Elastic manager cores: park/resume state of each TX thread.
+ *  Only the wakeup thread moves a TX thread out of PARKED (and it drains the NFs of PARKED threads itself),
+ *  only the TX thread moves itself out of PARK_REQ/UNPARK_REQ, so the thread_info buffers always have a single user.
+ */
+#define ELASTIC_MAX_TX_THREADS  (8)
+#define ELASTIC_TX_ACTIVE       (0)     //TX thread drains its NFs
+#define ELASTIC_TX_PARK_REQ     (1)     //wakeup thread asked the TX thread to park
+#define ELASTIC_TX_PARKED       (2)     //TX thread sleeps on park_sem; wakeup thread drains its NFs
+#define ELASTIC_TX_UNPARK_REQ   (3)     //park_sem posted, TX thread resuming
+
+typedef struct elastic_tx_thread {
+        struct thread_info *tx;
+        volatile uint8_t state;
+        sem_t park_sem;
+        uint64_t park_count;
+        uint64_t folded_pkts;           //pkts drained by the wakeup thread on behalf of this (parked) TX thread
+}elastic_tx_thread_t;
+
+typedef struct elastic_mgr_info {
+        unsigned tx_threads;            //TX threads launched
+        volatile unsigned active_tx_threads;
+        uint32_t backlog;               //last sampled total pkts pending in NFs Tx rings
+        uint32_t backlog_ewma;
+        uint32_t idle_periods;
+        elastic_tx_thread_t tx[ELASTIC_MAX_TX_THREADS];
+}elastic_mgr_info_t;
+extern elastic_mgr_info_t elastic_mgr;
+
+/* Called from the wakeup thread loop: drains the NFs of parked TX threads and parks/resumes TX threads */
+void onvm_mgr_elastic_poll(void);
+#endif //ENABLE_ELASTIC_MGR_CORES
+
 #ifdef ONVM_MGR_ACT_AS_2PORT_FWD_BRIDGE
 //static int onv_pkt_send_on_alt_port(struct thread_info *rx, struct rte_mbuf *pkts[], uint16_t rx_count);
 //int send_direct_on_alt_port(struct rte_mbuf *pkts[], uint16_t rx_count);
@@ -48,9 +48,13 @@
 ******************************************************************************/
 
 
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
 #include "onvm_mgr.h"
 #include "onvm_nf.h"
 #include "onvm_stats.h"
+#include "onvm_pkt.h"
 
 uint16_t next_instance_id = 0;
 
@@ -58,8 +62,8 @@ uint16_t next_instance_id = 0;
 // Global mode variables (default service chain without flow_Table entry: can support only 1 flow (i.e all flows have same NFs)
 uint8_t  global_bkpr_mode=0;
 uint16_t downstream_nf_overflow = 0;
-uint16_t highest_downstream_nf_service_id=0;
-uint16_t lowest_upstream_to_throttle = 0;
+uint32_t global_bneck_services = 0;
+uint32_t global_upstream_services = 0;
 uint64_t throttle_count = 0;
 #define EWMA_LOAD_ADECAY (0.5)  //(0.1) or or (0.002) or (.004)
 #endif // ENABLE_NF_BACKPRESSURE
@@ -73,19 +77,19 @@ void compute_nf_exec_period_and_cgroup_weight(void);
 void compute_and_assign_nf_cgroup_weight(void);
 void monitor_nf_node_liveliness_via_pid_monitoring(void);
 int nf_sort_func(const void * a, const void *b);
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+static inline void compute_nf_wake_deadline(uint16_t nf_id, uint32_t now);
+int nf_deadline_sort_func(const void * a, const void *b);
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
 inline void extract_nf_load_and_svc_rate_info(__attribute__((unused)) unsigned long interval);
 inline void setup_nfs_priority_per_core_list(__attribute__((unused)) unsigned long interval);
 
-#define DEFAULT_NF_CPU_SHARE    (1024)
-
-//Local Data structure to compute nf_load and comp_cost contention on each core
-typedef struct nf_core_and_cc_info {
-        uint32_t total_comp_cost;       //total computation cost on the core (sum of all NFs computation cost)
-        uint32_t total_nf_count;        //total count of the NFs on the core (sum of all NFs)
-        uint32_t total_pkts_served;     //total pkts processed on the core (sum of all NFs packet processed).
-        uint32_t total_load;            //total pkts (avergae) queued up on the core for processing.
-        uint64_t total_load_cost_fct;   //total product of current load and computation cost on core (aggregate demand in total cycles)
-}nf_core_and_cc_info_t;
+//DEFAULT_NF_CPU_SHARE, nf_core_and_cc_info_t and the share computation live in shared/onvm_sched_policy.h (shared with onvm_sim)
+#ifdef USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE
+#define NF_CPU_SHARE_USE_LOAD_FACTOR    (1)
+#else
+#define NF_CPU_SHARE_USE_LOAD_FACTOR    (0)
+#endif //USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE
 
 /********************************Interfaces***********************************/
 /*
@@ -122,63 +126,22 @@ void compute_nf_exec_period_and_cgroup_weight(void) {
         //First build the total cost and contention info per core
         for (nf_id=0; nf_id < MAX_CLIENTS; nf_id++) {
                 if (onvm_nf_is_valid(&clients[nf_id])){
-                        nfs_on_core[clients[nf_id].info->core_id].total_comp_cost += clients[nf_id].info->comp_cost;
-                        nfs_on_core[clients[nf_id].info->core_id].total_nf_count++;
-                        nfs_on_core[clients[nf_id].info->core_id].total_load += clients[nf_id].info->load;            //clients[nf_id].info->avg_load;
-                        nfs_on_core[clients[nf_id].info->core_id].total_pkts_served += clients[nf_id].info->svc_rate; //clients[nf_id].info->avg_svc;
-                        nfs_on_core[clients[nf_id].info->core_id].total_load_cost_fct += (clients[nf_id].info->comp_cost*clients[nf_id].info->load);
+                        onvm_sched_add_nf_to_core(&nfs_on_core[clients[nf_id].info->core_id], clients[nf_id].info->comp_cost, clients[nf_id].info->load, clients[nf_id].info->svc_rate); //avg_load, avg_svc
                 }
         }
 
         //evaluate and assign the cost of each NF
         for (nf_id=0; nf_id < MAX_CLIENTS; nf_id++) {
                 if ((onvm_nf_is_valid(&clients[nf_id])) && (clients[nf_id].info->comp_cost)) {
-
-                        // share of NF = 1024* NF_comp_cost/Total_comp_cost
-                        //Note: ideal share of NF is 100%(1024) so for N NFs sharing core => N*100 or (N*1024) then divide the cost proportionally
-#ifndef USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE
-                        //Static accounting based on computation_cost_only
-                        if(nfs_on_core[clients[nf_id].info->core_id].total_comp_cost) {
-                                clients[nf_id].info->cpu_share = (uint32_t) ((DEFAULT_NF_CPU_SHARE*nfs_on_core[clients[nf_id].info->core_id].total_nf_count)*(clients[nf_id].info->comp_cost))
-                                                /((nfs_on_core[clients[nf_id].info->core_id].total_comp_cost));
-
-                                clients[nf_id].info->exec_period = ((clients[nf_id].info->comp_cost)*total_cycles_in_epoch)/nfs_on_core[clients[nf_id].info->core_id].total_comp_cost; //(total_cycles_in_epoch)*(total_load_on_core)/(load_of_nf)
-                        }
-                        else {
-                                clients[nf_id].info->cpu_share = (uint32_t)DEFAULT_NF_CPU_SHARE;
-                                clients[nf_id].info->exec_period = 0;
-
-                        }
+                        onvm_sched_compute_nf_share(&nfs_on_core[clients[nf_id].info->core_id], clients[nf_id].info->comp_cost, clients[nf_id].info->load,
+                                                total_cycles_in_epoch, NF_CPU_SHARE_USE_LOAD_FACTOR, &clients[nf_id].info->cpu_share, &clients[nf_id].info->exec_period);
                         #ifdef __DEBUG_LOGS__
-                        printf("\n ***** Client [%d] with cost [%d] on core [%d] with total_demand [%d] shared by [%d] NFs, got cpu share [%d]***** \n ", clients[nf_id].info->instance_id, clients[nf_id].info->comp_cost, clients[nf_id].info->core_id,
+                        printf("\n ***** Client [%d] with cost [%d] and load [%d] on core [%d] with total_demand [%d], total_demand_comp_cost=%"PRIu64", shared by [%d] NFs, got cpu share [%d]***** \n ", clients[nf_id].info->instance_id, clients[nf_id].info->comp_cost, clients[nf_id].info->load, clients[nf_id].info->core_id,
                                                                                                                                                    nfs_on_core[clients[nf_id].info->core_id].total_comp_cost,
-                                                                                                                                                   nfs_on_core[clients[nf_id].info->core_id].total_nf_count,
-                                                                                                                                                   clients[nf_id].info->cpu_share);
-                        #endif //__DEBUG_LOGS__
-
-#else
-                        uint64_t num = 0;
-                        //Dynamic: Based on accounting the product of Load*comp_cost factors. We can define the weights Alpha(\u03b1) and Beta(\u03b2) for apportioning Load and Comp_Costs: (\u03b1*clients[nf_id].info->load)*(\u03b2*clients[nf_id].info->comp_cost) | \u03b2*\u03b1 = 1.
-                        if (nfs_on_core[clients[nf_id].info->core_id].total_load_cost_fct) {
-
-                                num = (uint64_t)(nfs_on_core[clients[nf_id].info->core_id].total_nf_count)*(DEFAULT_NF_CPU_SHARE)*(clients[nf_id].info->comp_cost)*(clients[nf_id].info->load);
-                                clients[nf_id].info->cpu_share = (uint32_t) (num/nfs_on_core[clients[nf_id].info->core_id].total_load_cost_fct);
-                                //clients[nf_id].info->cpu_share = ((uint64_t)(((DEFAULT_NF_CPU_SHARE*nfs_on_core[clients[nf_id].info->core_id].total_nf_count)*(clients[nf_id].info->comp_cost*clients[nf_id].info->load)))
-                                //                /((nfs_on_core[clients[nf_id].info->core_id].total_load_cost_fct)));
-                                clients[nf_id].info->exec_period = ((clients[nf_id].info->comp_cost)*(clients[nf_id].info->load)*total_cycles_in_epoch)/nfs_on_core[clients[nf_id].info->core_id].total_load_cost_fct; //(total_cycles_in_epoch)*(total_load_on_core)/(load_of_nf)
-                        }
-                        else {
-                                clients[nf_id].info->cpu_share = (uint32_t)DEFAULT_NF_CPU_SHARE;
-                                clients[nf_id].info->exec_period = 0;
-                        }
-                        #ifdef __DEBUG_LOGS__
-                        printf("\n ***** Client [%d] with cost [%d] and load [%d] on core [%d] with total_demand_comp_cost=%"PRIu64", shared by [%d] NFs, got num=%"PRIu64", cpu share [%d]***** \n ", clients[nf_id].info->instance_id, clients[nf_id].info->comp_cost, clients[nf_id].info->load, clients[nf_id].info->core_id,
                                                                                                                                                    nfs_on_core[clients[nf_id].info->core_id].total_load_cost_fct,
                                                                                                                                                    nfs_on_core[clients[nf_id].info->core_id].total_nf_count,
-                                                                                                                                                   num, clients[nf_id].info->cpu_share);
+                                                                                                                                                   clients[nf_id].info->cpu_share);
                         #endif //__DEBUG_LOGS__
-#endif //USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE
-
                 }
         }
 #endif // #if defined (USE_CGROUPS_PER_NF_INSTANCE)
@@ -201,63 +164,21 @@ void compute_and_assign_nf_cgroup_weight(void) {
         //First build the total cost and contention info per core
         for (nf_id=0; nf_id < MAX_CLIENTS; nf_id++) {
                 if (onvm_nf_is_valid(&clients[nf_id])){
-                        nf_pool_per_core[clients[nf_id].info->core_id].total_comp_cost += clients[nf_id].info->comp_cost;
-                        nf_pool_per_core[clients[nf_id].info->core_id].total_nf_count++;
-                        nf_pool_per_core[clients[nf_id].info->core_id].total_load += clients[nf_id].info->load;            //clients[nf_id].info->avg_load;
-                        nf_pool_per_core[clients[nf_id].info->core_id].total_pkts_served += clients[nf_id].info->svc_rate; //clients[nf_id].info->avg_svc;
-                        nf_pool_per_core[clients[nf_id].info->core_id].total_load_cost_fct += (clients[nf_id].info->comp_cost*clients[nf_id].info->load);
+                        onvm_sched_add_nf_to_core(&nf_pool_per_core[clients[nf_id].info->core_id], clients[nf_id].info->comp_cost, clients[nf_id].info->load, clients[nf_id].info->svc_rate); //avg_load, avg_svc
                 }
         }
 
         //evaluate and assign the cost of each NF
         for (nf_id=0; nf_id < MAX_CLIENTS; nf_id++) {
                 if ((onvm_nf_is_valid(&clients[nf_id])) && (clients[nf_id].info->comp_cost)) {
-
-                        // share of NF = 1024* NF_comp_cost/Total_comp_cost
-                        //Note: ideal share of NF is 100%(1024) so for N NFs sharing core => N*100 or (N*1024) then divide the cost proportionally
-#ifndef USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE
-                        //Static accounting based on computation_cost_only
-                        if(nf_pool_per_core[clients[nf_id].info->core_id].total_comp_cost) {
-                                clients[nf_id].info->cpu_share = (uint32_t) ((DEFAULT_NF_CPU_SHARE*nf_pool_per_core[clients[nf_id].info->core_id].total_nf_count)*(clients[nf_id].info->comp_cost))
-                                                /((nf_pool_per_core[clients[nf_id].info->core_id].total_comp_cost));
-
-                                clients[nf_id].info->exec_period = ((clients[nf_id].info->comp_cost)*total_cycles_in_epoch)/nf_pool_per_core[clients[nf_id].info->core_id].total_comp_cost; //(total_cycles_in_epoch)*(total_load_on_core)/(load_of_nf)
-                        }
-                        else {
-                                clients[nf_id].info->cpu_share = (uint32_t)DEFAULT_NF_CPU_SHARE;
-                                clients[nf_id].info->exec_period = 0;
-
-                        }
+                        onvm_sched_compute_nf_share(&nf_pool_per_core[clients[nf_id].info->core_id], clients[nf_id].info->comp_cost, clients[nf_id].info->load,
+                                                total_cycles_in_epoch, NF_CPU_SHARE_USE_LOAD_FACTOR, &clients[nf_id].info->cpu_share, &clients[nf_id].info->exec_period);
                         #ifdef __DEBUG_LOGS__
-                        printf("\n ***** Client [%d] with cost [%d] on core [%d] with total_demand [%d] shared by [%d] NFs, got cpu share [%d]***** \n ", clients[nf_id].info->instance_id, clients[nf_id].info->comp_cost, clients[nf_id].info->core_id,
-                                                                                                                                                   nf_pool_per_core[clients[nf_id].info->core_id].total_comp_cost,
+                        printf("\n ***** Client [%d] with cost [%d] and load [%d] on core [%d] shared by [%d] NFs, got cpu share [%d]***** \n ", clients[nf_id].info->instance_id, clients[nf_id].info->comp_cost, clients[nf_id].info->load, clients[nf_id].info->core_id,
                                                                                                                                                    nf_pool_per_core[clients[nf_id].info->core_id].total_nf_count,
                                                                                                                                                    clients[nf_id].info->cpu_share);
                         #endif //__DEBUG_LOGS__
 
-#else
-                        uint64_t num = 0;
-                        //Dynamic: Based on accounting the product of Load*comp_cost factors. We can define the weights Alpha(α) and Beta(β) for apportioning Load and Comp_Costs: (α*clients[nf_id].info->load)*(β*clients[nf_id].info->comp_cost) | β*α = 1.
-                        if (nf_pool_per_core[clients[nf_id].info->core_id].total_load_cost_fct) {
-
-                                num = (uint64_t)(nf_pool_per_core[clients[nf_id].info->core_id].total_nf_count)*(DEFAULT_NF_CPU_SHARE)*(clients[nf_id].info->comp_cost)*(clients[nf_id].info->load);
-                                clients[nf_id].info->cpu_share = (uint32_t) (num/nf_pool_per_core[clients[nf_id].info->core_id].total_load_cost_fct);
-                                //clients[nf_id].info->cpu_share = ((uint64_t)(((DEFAULT_NF_CPU_SHARE*nf_pool_per_core[clients[nf_id].info->core_id].total_nf_count)*(clients[nf_id].info->comp_cost*clients[nf_id].info->load)))
-                                //                /((nf_pool_per_core[clients[nf_id].info->core_id].total_load_cost_fct)));
-                                clients[nf_id].info->exec_period = ((clients[nf_id].info->comp_cost)*(clients[nf_id].info->load)*total_cycles_in_epoch)/nf_pool_per_core[clients[nf_id].info->core_id].total_load_cost_fct; //(total_cycles_in_epoch)*(total_load_on_core)/(load_of_nf)
-                        }
-                        else {
-                                clients[nf_id].info->cpu_share = (uint32_t)DEFAULT_NF_CPU_SHARE;
-                                clients[nf_id].info->exec_period = 0;
-                        }
-                        #ifdef __DEBUG_LOGS__
-                        printf("\n ***** Client [%d] with cost [%d] and load [%d] on core [%d] with total_demand_comp_cost=%"PRIu64", shared by [%d] NFs, got num=%"PRIu64", cpu share [%d]***** \n ", clients[nf_id].info->instance_id, clients[nf_id].info->comp_cost, clients[nf_id].info->load, clients[nf_id].info->core_id,
-                                                                                                                                                   nf_pool_per_core[clients[nf_id].info->core_id].total_load_cost_fct,
-                                                                                                                                                   nf_pool_per_core[clients[nf_id].info->core_id].total_nf_count,
-                                                                                                                                                   num, clients[nf_id].info->cpu_share);
-                        #endif //__DEBUG_LOGS__
-#endif //USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE
-
                         //set_cgroup_nf_cpu_share(clients[nf_id].info->instance_id, clients[nf_id].info->cpu_share);
                         set_cgroup_nf_cpu_share_from_onvm_mgr(clients[nf_id].info->instance_id, clients[nf_id].info->cpu_share);
                 }
@@ -334,20 +255,71 @@ int nf_sort_func(const void * a, const void *b) {
 }
 
 
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+/*
+ * Deadline of NF = budget left for the chain(s) it serves - age of the head-of-queue pkt in its Rx ring.
+ * Head of the Rx ring is peeked (not dequeued); a stale read (NF dequeued it meanwhile) only skews the estimate for this epoch.
+ */
+static inline void compute_nf_wake_deadline(uint16_t nf_id, uint32_t now) {
+        struct client *cl = &clients[nf_id];
+        struct rte_ring *r = cl->rx_q;
+        uint32_t cons_tail = r->cons.tail;
+        uint32_t budget_us = cl->deadline.budget_us;
+
+        //consume the budget of this epoch
+        cl->deadline.budget_us = UINT32_MAX;
+
+        if (cons_tail == r->prod.tail) {
+                cl->deadline.slack_us = INT64_MAX;      //nothing queued; no deadline
+                return;
+        }
+        if (budget_us == UINT32_MAX) {
+                budget_us = DEFAULT_CHAIN_LATENCY_TARGET_IN_US;
+        }
+        cl->deadline.slack_us = (int64_t)budget_us - (int64_t)onvm_get_pkt_sojourn_in_us((struct rte_mbuf*)r->ring[cons_tail & r->cons.mask], now);
+        if (cl->deadline.slack_us < 0) {
+                cl->deadline.missed++;
+        }
+}
+
+/* Earliest deadline (least slack) first; ties are broken by the load as in nf_sort_func() */
+int nf_deadline_sort_func(const void * a, const void *b) {
+        uint32_t nfid1 = *(const uint32_t*)a;
+        uint32_t nfid2 = *(const uint32_t*)b;
+        struct client *cl1 = &clients[nfid1];
+        struct client *cl2 = &clients[nfid2];
+
+        if (cl1->deadline.slack_us < cl2->deadline.slack_us) return (-1);
+        else if (cl1->deadline.slack_us > cl2->deadline.slack_us) return 1;
+
+        return nf_sort_func(a, b);
+}
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+
 void setup_nfs_priority_per_core_list(__attribute__((unused)) unsigned long interval) {
         #ifdef USE_CGROUPS_PER_NF_INSTANCE
         memset(&nf_sched_param, 0, sizeof(nf_sched_param));
         uint16_t nf_id = 0;
+        #ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+        uint32_t now = onvm_get_pkt_ts_now();
+        #endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
         for (nf_id=0; nf_id < MAX_CLIENTS; nf_id++) {
                 if ((onvm_nf_is_valid(&clients[nf_id])) /* && (clients[nf_id].info->comp_cost)*/) {
                         nf_sched_param.nf_list_per_core[clients[nf_id].info->core_id].nf_ids[nf_sched_param.nf_list_per_core[clients[nf_id].info->core_id].count++] = nf_id;
                         nf_sched_param.nf_list_per_core[clients[nf_id].info->core_id].run_time[nf_id] = clients[nf_id].info->exec_period;
+                        #ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                        compute_nf_wake_deadline(nf_id, now);
+                        #endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
                 }
         }
         uint16_t core_id = 0;
         for(core_id=0; core_id < MAX_CORES_ON_NODE; core_id++) {
                 if(!nf_sched_param.nf_list_per_core[core_id].count) continue;
+                #ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                onvm_sort_generic(nf_sched_param.nf_list_per_core[core_id].nf_ids, ONVM_SORT_TYPE_CUSTOM, SORT_ASCENDING, nf_sched_param.nf_list_per_core[core_id].count, sizeof(nf_sched_param.nf_list_per_core[core_id].nf_ids[0]), nf_deadline_sort_func);
+                #else
                 onvm_sort_generic(nf_sched_param.nf_list_per_core[core_id].nf_ids, ONVM_SORT_TYPE_CUSTOM, SORT_DESCENDING, nf_sched_param.nf_list_per_core[core_id].count, sizeof(nf_sched_param.nf_list_per_core[core_id].nf_ids[0]), nf_sort_func);
+                #endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
                 nf_sched_param.nf_list_per_core[core_id].sorted=1;
 #if 0
                 {
@@ -446,6 +418,10 @@ onvm_nf_check_status(void) {
         /* Add PID monitoring to assert active NFs (non crashed) */
         monitor_nf_node_liveliness_via_pid_monitoring();
 
+        #ifdef ENABLE_NF_AUTO_SCALING
+        onvm_nf_check_auto_scale();
+        #endif //ENABLE_NF_AUTO_SCALING
+
         /* Ideal location to re-compute the NF weight
         #if defined (USE_CGROUPS_PER_NF_INSTANCE) && defined(ENABLE_DYNAMIC_CGROUP_WEIGHT_ADJUSTMENT)
         compute_and_assign_nf_cgroup_weight();
@@ -475,8 +451,93 @@ onvm_nf_stats_update(__attribute__((unused)) unsigned long interval) {
                 assign_all_nf_cgroup_weight();
         }
         #endif //USE_CGROUPS_PER_NF_INSTANCE
+
+        #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+        onvm_nf_tune_watermarks(interval);
+        #endif //ENABLE_NF_WATERMARK_AUTOTUNE
 }
 
+#ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+void
+onvm_nf_tune_watermarks(unsigned long interval_us) {
+        const uint32_t min_high = ONVM_RING_WATER_MARK_SIZE(CLIENT_QUEUE_RINGSIZE, NF_WM_MIN_HIGH_THRESHOLD);
+        const uint32_t max_high = ONVM_RING_WATER_MARK_SIZE(CLIENT_QUEUE_RINGSIZE, NF_WM_MAX_HIGH_THRESHOLD);
+        const uint32_t min_gap = ONVM_RING_WATER_MARK_SIZE(CLIENT_QUEUE_RINGSIZE, NF_WM_MIN_GAP_THRESHOLD);
+        uint16_t nf_id;
+
+        if (0 == interval_us)
+                return;
+
+        for (nf_id = 0; nf_id < MAX_CLIENTS; nf_id++) {
+                struct client *cl = &clients[nf_id];
+                nf_ring_wm_info_t *wm = &cl->wm;
+                uint64_t rx, rx_drop, tx, arrivals, drops, served, dev, inflight, drain;
+                uint32_t high, gap, low;
+
+                if (!onvm_nf_is_valid(cl))
+                        continue;
+
+                rx = cl->stats.rx;
+                rx_drop = cl->stats.rx_drop;
+                tx = clients_stats->tx[nf_id];
+                drops = rx_drop - wm->prev_rx_drop;
+                arrivals = (rx - wm->prev_rx) + drops;
+                served = tx - wm->prev_tx;
+                wm->prev_rx = rx;
+                wm->prev_rx_drop = rx_drop;
+                wm->prev_tx = tx;
+
+                /* Burstiness: EWMA (1/8) of arrivals per epoch and of their absolute deviation */
+                dev = (arrivals > wm->avg_arrivals)? (arrivals - wm->avg_arrivals):(wm->avg_arrivals - arrivals);
+                wm->avg_arrivals = ((7*wm->avg_arrivals) + arrivals) >> 3;
+                wm->avg_dev = ((7*wm->avg_dev) + dev) >> 3;
+
+                /* Pkts arriving during the reaction time (inflated by the coefficient of variation of arrivals), and drained by the NF meanwhile */
+                inflight = (arrivals*NF_WM_REACTION_TIME_IN_US)/interval_us;
+                if (wm->avg_arrivals)
+                        inflight += (inflight*wm->avg_dev)/wm->avg_arrivals;
+                drain = (served*NF_WM_REACTION_TIME_IN_US)/interval_us;
+
+                /* High watermark: back off on overflow drops, creep up when calm, but always leave headroom for the in-flight burst */
+                high = wm->high;
+                gap = (wm->high > wm->low)? (wm->high - wm->low):(min_gap);
+                if (drops) {
+                        high -= (high >> 3);
+                        wm->calm_epochs = 0;
+                } else if (0 == wm->bkpr_events) {
+                        if (++wm->calm_epochs >= NF_WM_CALM_EPOCHS) {
+                                high += (CLIENT_QUEUE_RINGSIZE >> 6);
+                                wm->calm_epochs = 0;
+                        }
+                } else {
+                        wm->calm_epochs = 0;
+                }
+                if (inflight < CLIENT_QUEUE_RINGSIZE && high > (CLIENT_QUEUE_RINGSIZE - inflight))
+                        high = CLIENT_QUEUE_RINGSIZE - inflight;
+                if (high < min_high) high = min_high;
+                if (high > max_high) high = max_high;
+
+                /* Low watermark: widen the gap on oscillation, narrow it slowly otherwise; keep the NF busy while backpressure is released */
+                if (wm->bkpr_events > NF_WM_MAX_BKPR_EVENTS_PER_EPOCH)
+                        gap += (gap >> 2) + 1;
+                else if (0 == wm->bkpr_events)
+                        gap -= (gap >> 4);
+                if (gap < min_gap) gap = min_gap;
+                low = (high > gap)? (high - gap):(0);
+                if (low < drain)
+                        low = ((high - min_gap) < drain)? (high - min_gap):(drain);
+                wm->bkpr_events = 0;
+
+                if (high != wm->high)
+                        rte_ring_set_water_mark(cl->rx_q, high);
+                wm->high = high;
+                wm->low = low;
+                wm->ecn = ONVM_RING_ECN_MARK_SIZE(high, low, ECN_EWMA_ALPHA);
+                wm->tune_count++;
+        }
+}
+#endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
 inline uint16_t
 onvm_nf_service_to_nf_map(uint16_t service_id, struct rte_mbuf *pkt) {
         uint16_t num_nfs_available = nf_per_service_count[service_id];
@@ -530,6 +591,11 @@ onvm_nf_start(struct onvm_nf_info *nf_info) {
         clients[nf_id].info = nf_info;
         clients[nf_id].instance_id = nf_id;
 
+        #ifdef ENABLE_NF_AUTO_SCALING
+        // The pending launch (if any) is done: only scale-in moves instances to the standby pool
+        nf_scale_info[nf_info->service_id].launch_pending = 0;
+        #endif //ENABLE_NF_AUTO_SCALING
+
         // Register this NF running within its service
         uint16_t service_count = nf_per_service_count[nf_info->service_id]++;
         services[nf_info->service_id][service_count] = nf_id;
@@ -540,30 +606,12 @@ onvm_nf_start(struct onvm_nf_info *nf_info) {
 }
 
 
-inline int
-onvm_nf_stop(struct onvm_nf_info *nf_info) {
-        uint16_t nf_id;
-        uint16_t service_id;
+/* Remove the NF from the service map.
+ * Need to shift all elements past it in the array left to avoid gaps */
+static void
+onvm_nf_remove_from_service_map(uint16_t service_id, uint16_t nf_id) {
         int mapIndex;
-        struct rte_mempool *nf_info_mp;
 
-        if(nf_info == NULL){
-                printf(" Null Entry for NF! Bad request for Stop!!\n ");
-                return 1;
-        }
-
-
-        nf_id = nf_info->instance_id;
-        service_id = nf_info->service_id;
-
-        /* Clean up dangling pointers to info struct */
-        clients[nf_id].info = NULL;
-
-        /* Reset stats */
-        onvm_stats_clear_client(nf_id);
-
-        /* Remove this NF from the service map.
-         * Need to shift all elements past it in the array left to avoid gaps */
         nf_per_service_count[service_id]--;
         for (mapIndex = 0; mapIndex < MAX_CLIENTS_PER_SERVICE; mapIndex++) {
                 if (services[service_id][mapIndex] == nf_id) {
@@ -583,6 +631,211 @@ onvm_nf_stop(struct onvm_nf_info *nf_info) {
                         services[service_id][mapIndex + 1] = 0;
                 }
         }
+}
+
+#ifdef ENABLE_NF_AUTO_SCALING
+nf_scale_info_t nf_scale_info[MAX_SERVICES];
+
+extern char **environ;
+
+/* Default launcher hook: run NF_SCALE_OUT_LAUNCHER_CMD in a child process, its exit status is checked by onvm_nf_check_auto_scale().
+ * posix_spawn(), not fork(): the manager is multithreaded (and maps the hugepages), the child execs at once without copying it */
+static int
+onvm_nf_default_scale_out_hook(uint16_t service_id, uint16_t bottleneck_nf_id) {
+        char cmd[256];
+        char *argv[] = {(char *)"sh", (char *)"-c", cmd, NULL};
+        pid_t pid;
+        int ret;
+        snprintf(cmd, sizeof(cmd), NF_SCALE_OUT_LAUNCHER_CMD, service_id, bottleneck_nf_id);
+        ret = posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ);
+        if (ret != 0) {
+                RTE_LOG(INFO, APP, "Service %u scale out: launcher not started (%s)\n", service_id, strerror(ret));
+                return -1;
+        }
+        return (int)pid;
+}
+
+/* Give up the pending launch of the service if its launcher failed or no instance registered in time */
+static void
+nf_scale_check_launch(uint16_t sid, uint64_t now) {
+        nf_scale_info_t *si = &nf_scale_info[sid];
+        int status;
+
+        if (si->launch_pid > 0 && waitpid(si->launch_pid, &status, WNOHANG) == si->launch_pid) {
+                si->launch_pid = 0;
+                if (si->launch_pending && !(WIFEXITED(status) && WEXITSTATUS(status) == 0)) {
+                        si->launch_pending = 0;
+                        RTE_LOG(INFO, APP, "Service %u scale out: launcher failed (status %d)\n", sid, status);
+                }
+        }
+        if (si->launch_pending && now >= si->launch_deadline) {
+                si->launch_pending = 0;
+                RTE_LOG(INFO, APP, "Service %u scale out: no instance registered in %u ms, launch given up\n", sid, NF_SCALE_OUT_LAUNCH_TIMEOUT_IN_MS);
+        }
+}
+static onvm_nf_scale_out_hook_t nf_scale_out_hook = onvm_nf_default_scale_out_hook;
+
+void
+onvm_nf_set_scale_out_hook(onvm_nf_scale_out_hook_t hook) {
+        nf_scale_out_hook = hook;
+}
+
+/* returns 0 if the NF was a standby instance of the service (and is removed from the pool) */
+static int
+nf_scale_remove_standby(uint16_t service_id, uint16_t nf_id) {
+        nf_scale_info_t *si = &nf_scale_info[service_id];
+        uint16_t i;
+        for (i = 0; i < si->standby_count; i++) {
+                if (si->standby[i] == nf_id) {
+                        si->standby[i] = si->standby[--si->standby_count];
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+static inline int
+nf_scale_is_bottlenecked(uint16_t nf_id) {
+        #ifdef ENABLE_NF_BACKPRESSURE
+        if (clients[nf_id].is_bottleneck) return 1;
+        #endif //ENABLE_NF_BACKPRESSURE
+        return (rte_ring_count(clients[nf_id].rx_q) >= NF_RX_Q_HIGH_WM(&clients[nf_id]));
+}
+
+void
+onvm_nf_check_auto_scale(void) {
+        static uint64_t prev_arrived[MAX_CLIENTS], prev_served[MAX_CLIENTS], prev_cycles = 0;
+        uint64_t arrival_pps[MAX_CLIENTS] = {0}, served_pps[MAX_CLIENTS] = {0};
+        uint64_t now = rte_get_tsc_cycles(), interval_us;
+        uint16_t sid, i, nf_id;
+
+        interval_us = (prev_cycles)? (get_diff_cpu_cycles_in_us(prev_cycles, now)):(0);
+        prev_cycles = now;
+        for (nf_id = 0; nf_id < MAX_CLIENTS; nf_id++) {
+                uint64_t arrived = clients[nf_id].stats.rx + clients[nf_id].stats.rx_drop;
+                uint64_t served = clients_stats->tx[nf_id];
+                if (interval_us) {
+                        arrival_pps[nf_id] = ((arrived - prev_arrived[nf_id])*SECOND_TO_MICRO_SECOND)/interval_us;
+                        served_pps[nf_id] = ((served - prev_served[nf_id])*SECOND_TO_MICRO_SECOND)/interval_us;
+                }
+                prev_arrived[nf_id] = arrived;
+                prev_served[nf_id] = served;
+        }
+        if (!interval_us) return;
+
+        for (sid = 0; sid < num_services && sid < MAX_SERVICES; sid++) {
+                nf_scale_info_t *si = &nf_scale_info[sid];
+                uint16_t count = nf_per_service_count[sid];
+                uint16_t bneck_nf = MAX_CLIENTS;
+                uint64_t load_pps = 0;
+                int pid;
+
+                nf_scale_check_launch(sid, now);
+                if (count == 0) continue;
+                for (i = 0; i < count; i++) {
+                        nf_id = services[sid][i];
+                        if (!onvm_nf_is_valid(&clients[nf_id])) continue;
+                        load_pps += arrival_pps[nf_id];
+                        if (bneck_nf == MAX_CLIENTS && nf_scale_is_bottlenecked(nf_id)) {
+                                bneck_nf = nf_id;
+                                if (served_pps[nf_id] > si->capacity_pps) si->capacity_pps = served_pps[nf_id];
+                        }
+                }
+
+                /* Scale-out: persistent bottleneck */
+                if (bneck_nf != MAX_CLIENTS) {
+                        si->idle_checks = 0;
+                        if (++si->bneck_checks < NF_SCALE_OUT_PERSIST_CHECKS || si->launch_pending || si->launch_pid || count >= MAX_CLIENTS_PER_SERVICE) continue;
+                        si->bneck_checks = 0;
+                        if (si->standby_count) {
+                                nf_id = si->standby[--si->standby_count];
+                                services[sid][count] = nf_id;
+                                rte_smp_wmb();
+                                nf_per_service_count[sid]++;
+                                si->scale_out_count++;
+                                RTE_LOG(INFO, APP, "Service %u scaled out: standby NF %u activated (bottleneck NF %u)\n", sid, nf_id, bneck_nf);
+                        }
+                        else if (nf_scale_out_hook && (pid = nf_scale_out_hook(sid, bneck_nf)) >= 0) {
+                                si->launch_pending = 1;
+                                si->launch_pid = pid;
+                                si->launch_deadline = now + (rte_get_tsc_hz()/1000)*NF_SCALE_OUT_LAUNCH_TIMEOUT_IN_MS;
+                                si->scale_out_count++;
+                                RTE_LOG(INFO, APP, "Service %u scaling out: launcher hook invoked (bottleneck NF %u)\n", sid, bneck_nf);
+                        }
+                        continue;
+                }
+                si->bneck_checks = 0;
+
+                /* Scale-in: load fits in one instance less (with headroom) */
+                if (count > 1 && si->capacity_pps && (load_pps*100) < ((count - 1)*si->capacity_pps*NF_SCALE_IN_HEADROOM_PCT)) {
+                        if (++si->idle_checks < NF_SCALE_IN_IDLE_CHECKS || si->standby_count >= MAX_CLIENTS_PER_SERVICE) continue;
+                        si->idle_checks = 0;
+                        nf_id = services[sid][count - 1];
+                        onvm_nf_remove_from_service_map(sid, nf_id);
+                        si->standby[si->standby_count++] = nf_id;
+                        si->scale_in_count++;
+                        RTE_LOG(INFO, APP, "Service %u scaled in: NF %u moved to standby\n", sid, nf_id);
+                }
+                else si->idle_checks = 0;
+        }
+}
+#endif //ENABLE_NF_AUTO_SCALING
+
+inline int
+onvm_nf_stop(struct onvm_nf_info *nf_info) {
+        uint16_t nf_id;
+        uint16_t service_id;
+        struct rte_mempool *nf_info_mp;
+
+        if(nf_info == NULL){
+                printf(" Null Entry for NF! Bad request for Stop!!\n ");
+                return 1;
+        }
+
+
+        nf_id = nf_info->instance_id;
+        service_id = nf_info->service_id;
+
+        /* Clean up dangling pointers to info struct */
+        clients[nf_id].info = NULL;
+
+        /* The flow table writers no longer wait for the threads of the NF */
+        onvm_flow_dir_reader_release(nf_info->pid);
+
+        /* Reset stats */
+        onvm_stats_clear_client(nf_id);
+
+        #ifdef ENABLE_LOSSLESS_CREDIT_MODE
+        /* Nobody left to take the pkts held for this NF */
+        onvm_pkt_lossless_release_held(&clients[nf_id]);
+        #endif //ENABLE_LOSSLESS_CREDIT_MODE
+
+        #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        /* Pkts left in the class rings would be delivered to the next NF on this instance id */
+        onvm_pkt_rx_prio_release(&clients[nf_id]);
+        #endif //ENABLE_NF_RX_PRIORITY_RINGS
+
+        #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+        onvm_nf_reset_watermarks(&clients[nf_id]);
+        #endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
+        #ifdef ENABLE_MBUF_QUOTAS
+        /* The pkts this NF kept buffered are not held against the next NF on this instance id */
+        rte_atomic32_set(&mbuf_quota->nf[nf_id].inuse, 0);
+        mbuf_quota->nf[nf_id].quota_drop = 0;
+        #endif //ENABLE_MBUF_QUOTAS
+
+        #ifdef ENABLE_BKPR_GENERATION_MARKS
+        /* Invalidate the chain backpressure marks left by this NF */
+        clients[nf_id].bkpr_marked = 0;
+        clients[nf_id].bkpr_gen++;
+        #endif //ENABLE_BKPR_GENERATION_MARKS
+
+        #ifdef ENABLE_NF_AUTO_SCALING
+        /* A standby NF is not in the service map */
+        if (nf_scale_remove_standby(service_id, nf_id) != 0)
+        #endif //ENABLE_NF_AUTO_SCALING
+        onvm_nf_remove_from_service_map(service_id, nf_id);
 
         /* Free info struct */
         /* Lookup mempool for nf_info struct */
@@ -597,7 +850,66 @@ onvm_nf_stop(struct onvm_nf_info *nf_info) {
 }
 
 
-//Note: This function assumes that the NF mapping is setup in the sc and 2) TODO: Enable for Global (default chain mode).
+#ifdef ENABLE_NF_BACKPRESSURE
+/* Global mode: services feeding the marked entries of the default chain (for the callers without a pkt chain index, e.g. wake-up) */
+static void
+onvm_nf_update_global_upstream_services(void) {
+        uint16_t throttle = onvm_sc_bkpr_throttle_set(default_chain);
+        uint32_t services = 0;
+        while (throttle) {
+                services |= BKPR_SERVICE_BIT(default_chain->sc[__builtin_ctz(throttle) + 1].destination);
+                throttle &= (throttle - 1);
+        }
+        global_upstream_services = services;
+}
+
+/* Global mode: mark every entry of the default chain served by the bottleneck service */
+void
+onvm_nf_set_global_back_pressure(uint16_t service_id) {
+        uint8_t chain_index;
+        if (unlikely(default_chain == NULL || service_id >= MAX_SERVICES)) return;
+        if (global_bneck_services & BKPR_SERVICE_BIT(service_id)) return;
+
+        global_bneck_services |= BKPR_SERVICE_BIT(service_id);
+        for (chain_index = 1; chain_index <= default_chain->chain_length; chain_index++) {
+                if (default_chain->sc[chain_index].action == ONVM_NF_ACTION_TONF && default_chain->sc[chain_index].destination == service_id) {
+                        onvm_bkpr_mark_chain_index(&default_chain->highest_downstream_nf_index_id, chain_index);
+                }
+        }
+        onvm_nf_update_global_upstream_services();
+        downstream_nf_overflow = 1;
+}
+
+void
+onvm_nf_clear_global_back_pressure(uint16_t service_id) {
+        uint8_t chain_index;
+        if (unlikely(default_chain == NULL || service_id >= MAX_SERVICES)) return;
+        if (!(global_bneck_services & BKPR_SERVICE_BIT(service_id))) return;
+
+        global_bneck_services &= ~BKPR_SERVICE_BIT(service_id);
+        for (chain_index = 1; chain_index <= default_chain->chain_length; chain_index++) {
+                if (default_chain->sc[chain_index].action == ONVM_NF_ACTION_TONF && default_chain->sc[chain_index].destination == service_id) {
+                        onvm_bkpr_clear_chain_index(&default_chain->highest_downstream_nf_index_id, chain_index);
+                }
+        }
+        onvm_nf_update_global_upstream_services();
+        if (global_bneck_services == 0) {
+                downstream_nf_overflow = 0;
+        }
+}
+
+#ifdef NF_BACKPRESSURE_APPROACH_2
+void
+onvm_nf_throttle_chain_nfs(struct onvm_service_chain *sc, uint16_t chain_index_set, uint8_t throttle) {
+        while (chain_index_set) {
+                clients[sc->nf_instance_id[__builtin_ctz(chain_index_set) + 1]].throttle_this_upstream_nf = throttle;
+                chain_index_set &= (chain_index_set - 1);
+        }
+}
+#endif //NF_BACKPRESSURE_APPROACH_2
+#endif //ENABLE_NF_BACKPRESSURE
+
+//Note: This function assumes that the NF mapping is setup in the sc.
 #ifdef ENABLE_NF_BACKPRESSURE
 static sc_entries_list sc_list[SDN_FT_ENTRIES];
 #endif //ENABLE_NF_BACKPRESSURE
@@ -608,10 +920,9 @@ onvm_mark_all_entries_for_bottleneck(uint16_t nf_id) {
 
 #ifdef ENABLE_GLOBAL_BACKPRESSURE
         /*** Note: adding this global is expensive (around 1.5Mpps drop) and better to remove the default chain Backpressure feature.. or do int inside default chain usage some way */
-        /** global single chain scenario:: Note: This only works for the default chain case where service ID of chain is always in increasing order **/
+        /** global single chain scenario: mark the default chain entries of this NF's service **/
         if(global_bkpr_mode) {
-                downstream_nf_overflow = 1;
-                SET_BIT(highest_downstream_nf_service_id, clients[nf_id].info->service_id);//highest_downstream_nf_service_id = cl->info->service_id;
+                onvm_nf_set_global_back_pressure(clients[nf_id].info->service_id);
                 return 0;
         }
 #endif //ENABLE_GLOBAL_BACKPRESSURE
@@ -627,22 +938,15 @@ onvm_mark_all_entries_for_bottleneck(uint16_t nf_id) {
                                 for(i=1;i<=sc_list[s_inx].sc->chain_length;++i) {
                                         if(nf_id == sc_list[s_inx].sc->nf_instance_id[i]) {
                                                 //mark this sc with this index;;
-                                                if(!(TEST_BIT(sc_list[s_inx].sc->highest_downstream_nf_index_id, i))) {
-                                                        SET_BIT(sc_list[s_inx].sc->highest_downstream_nf_index_id, i);
+                                                if(onvm_bkpr_mark_chain_index(&sc_list[s_inx].sc->highest_downstream_nf_index_id, i)) {
+                                                        #ifdef NF_BACKPRESSURE_APPROACH_2
+                                                        // throttle the upstream set of this chain index
+                                                        onvm_nf_throttle_chain_nfs(sc_list[s_inx].sc, sc_list[s_inx].sc->bkpr_upstream[i], 1);
+                                                        #endif  //NF_BACKPRESSURE_APPROACH_2
                                                         break;
                                                 }
                                         }
                                 }
-                                #ifdef NF_BACKPRESSURE_APPROACH_2
-                                uint32_t index = (i-1);
-                                //for(; index < meta->chain_index; index++ ) {
-                                for(; index >=1 ; index-- ) {
-                                        clients[sc_list[s_inx].sc->nf_instance_id[index]].throttle_this_upstream_nf=1;
-                                        #ifdef HOP_BY_HOP_BACKPRESSURE
-                                        break;
-                                        #endif //HOP_BY_HOP_BACKPRESSURE
-                                }
-                                #endif  //NF_BACKPRESSURE_APPROACH_2
 
                         }
                         else {
@@ -663,21 +967,10 @@ onvm_clear_all_entries_for_bottleneck(uint16_t nf_id) {
 
 #ifdef ENABLE_GLOBAL_BACKPRESSURE
         /*** Note: adding this global is expensive (around 1.5Mpps drop) and better to remove the default chain Backpressure feature.. or do int inside default chain usage some way */
-        /** global single chain scenario:: Note: This only works for the default chain case where service ID of chain is always in increasing order **/
+        /** global single chain scenario: clear the default chain entries of this NF's service **/
         if(global_bkpr_mode) {
                 if (downstream_nf_overflow) {
-                        struct client *cl = &clients[nf_id];
-                        // If service id is of any downstream that is/are bottlenecked then "move the lowest literally to next higher number" and when it is same as highsest reset bottlenext flag to zero
-                        //  if(rte_ring_count(cl->rx_q) < CLIENT_QUEUE_RING_WATER_MARK_SIZE) {
-                        //if(rte_ring_count(cl->rx_q) < CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE)
-                        {
-                                if (TEST_BIT(highest_downstream_nf_service_id, cl->info->service_id)) { //if (cl->info->service_id == highest_downstream_nf_service_id) {
-                                        CLEAR_BIT(highest_downstream_nf_service_id, cl->info->service_id);
-                                        if (highest_downstream_nf_service_id == 0) {
-                                                downstream_nf_overflow = 0;
-                                        }
-                                }
-                        }
+                        onvm_nf_clear_global_back_pressure(clients[nf_id].info->service_id);
                 }
                 return 0;
         }
@@ -693,21 +986,21 @@ onvm_clear_all_entries_for_bottleneck(uint16_t nf_id) {
                         if(NULL == sc_list[s_inx].sc) break;    //reached end of chains list
                         if(sc_list[s_inx].bneck_flag) {
                                 int i =0;
+                                uint16_t released = 0;
                                 for(i=1;i<=sc_list[s_inx].sc->chain_length;++i) {
                                         if(nf_id == sc_list[s_inx].sc->nf_instance_id[i]) {
                                                 //clear this sc with this index;;
-                                                if((TEST_BIT(sc_list[s_inx].sc->highest_downstream_nf_index_id, i))) {
-                                                        CLEAR_BIT(sc_list[s_inx].sc->highest_downstream_nf_index_id, i);
+                                                if(onvm_bkpr_clear_chain_index(&sc_list[s_inx].sc->highest_downstream_nf_index_id, i)) {
+                                                        released |= sc_list[s_inx].sc->bkpr_upstream[i];
                                                         //break;
                                                 }
                                         }
                                 }
                                 #ifdef NF_BACKPRESSURE_APPROACH_2
-                                // detect the start nf_index based on new val of highest_downstream_nf_index_id
-                                int nf_index=(sc_list[s_inx].sc->highest_downstream_nf_index_id == 0)? (1): (get_index_of_highest_set_bit(sc_list[s_inx].sc->highest_downstream_nf_index_id));
-                                for(; nf_index < i; nf_index++) {
-                                       clients[sc_list[s_inx].sc->nf_instance_id[nf_index]].throttle_this_upstream_nf=0;
-                                }
+                                // release the NFs upstream of this NF that are not upstream of another bottleneck of the chain
+                                onvm_nf_throttle_chain_nfs(sc_list[s_inx].sc, (released & ~onvm_sc_bkpr_throttle_set(sc_list[s_inx].sc)), 0);
+                                #else
+                                (void)released;
                                 #endif  //NF_BACKPRESSURE_APPROACH_2
                         }
                 }
@@ -757,18 +1050,21 @@ int check_and_enqueue_or_dequeue_nfs_from_bottleneck_watch_list(void) {
                 if(BOTTLENECK_NF_STATUS_RESET == bottleneck_nf_list.nf[nf_id].enqueue_status) continue;
                 //is in enqueue list and marked
                 else if (BOTTLENECK_NF_STATUS_DROP_MARKED & bottleneck_nf_list.nf[nf_id].enqueue_status) {
-                        if(rte_ring_count(clients[nf_id].rx_q) < CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE) {
+                        if(rte_ring_count(clients[nf_id].rx_q) < NF_RX_Q_LOW_WM(&clients[nf_id])) {
                                 onvm_clear_all_entries_for_bottleneck(nf_id);
                                 dequeue_nf_from_bottleneck_watch_list(nf_id);
                                 bottleneck_nf_list.nf[nf_id].enqueue_status = BOTTLENECK_NF_STATUS_RESET;
                                 clients[nf_id].is_bottleneck = 0;
+                                #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+                                clients[nf_id].wm.in_bkpr = 0;
+                                #endif //ENABLE_NF_WATERMARK_AUTOTUNE
                         }
                         //else keep as marked.
                 }
                 //is in enqueue list but not marked
                 else if(BOTTLENECK_NF_STATUS_WAIT_ENQUEUED & bottleneck_nf_list.nf[nf_id].enqueue_status) {
                         //ring count is still beyond the water mark threshold
-                        if(rte_ring_count(clients[nf_id].rx_q) >= CLIENT_QUEUE_RING_WATER_MARK_SIZE) {
+                        if(rte_ring_count(clients[nf_id].rx_q) >= NF_RX_Q_HIGH_WM(&clients[nf_id])) {
                                 if((0 == WAIT_TIME_BEFORE_MARKING_OVERFLOW_IN_US)||((WAIT_TIME_BEFORE_MARKING_OVERFLOW_IN_US) <= get_difftime_us(&bottleneck_nf_list.nf[nf_id].s_time, &now))) {
                                         bottleneck_nf_list.nf[nf_id].enqueue_status = BOTTLENECK_NF_STATUS_DROP_MARKED;
                                         onvm_mark_all_entries_for_bottleneck(nf_id);
@@ -780,7 +1076,7 @@ int check_and_enqueue_or_dequeue_nfs_from_bottleneck_watch_list(void) {
                                 //else //time has not expired.. continue to monitor..
                         }
                         //ring count has dropped
-                        else  if(rte_ring_count(clients[nf_id].rx_q) < CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE) {
+                        else  if(rte_ring_count(clients[nf_id].rx_q) < NF_RX_Q_LOW_WM(&clients[nf_id])) {
                                 if((0 == WAIT_TIME_BEFORE_MARKING_OVERFLOW_IN_US)||((WAIT_TIME_BEFORE_MARKING_OVERFLOW_IN_US) <= get_difftime_us(&bottleneck_nf_list.nf[nf_id].s_time, &now))) {
                                         dequeue_nf_from_bottleneck_watch_list(nf_id);
                                         bottleneck_nf_list.nf[nf_id].enqueue_status = BOTTLENECK_NF_STATUS_RESET;
@@ -76,9 +76,19 @@ extern nf_schedule_info_t nf_sched_param;
 // Global mode variables (default service chain without flow_Table entry: can support only 1 flow (i.e all flows have same NFs)
 extern uint8_t  global_bkpr_mode;
 extern uint16_t downstream_nf_overflow;
-extern uint16_t highest_downstream_nf_service_id;
-extern uint16_t lowest_upstream_to_throttle;
+extern uint32_t global_bneck_services;          // bit per service bottlenecked in the default chain
+extern uint32_t global_upstream_services;       // bit per service upstream of a bottleneck in the default chain
 extern uint64_t throttle_count;
+#define BKPR_SERVICE_BIT(service_id) (((uint32_t)1) << (service_id))   //MAX_SERVICES <= 32
+
+/* Global mode: set/clear the backpressure of a service on the default chain, as per the chain topology */
+void onvm_nf_set_global_back_pressure(uint16_t service_id);
+void onvm_nf_clear_global_back_pressure(uint16_t service_id);
+
+#ifdef NF_BACKPRESSURE_APPROACH_2
+/* Set the throttle state of the NFs mapped at the given chain indices (bit i-1 => chain index i) */
+void onvm_nf_throttle_chain_nfs(struct onvm_service_chain *sc, uint16_t chain_index_set, uint8_t throttle);
+#endif //NF_BACKPRESSURE_APPROACH_2
 #endif //ENABLE_NF_BACKPRESSURE
 
 /********************************Interfaces***********************************/
@@ -137,6 +147,36 @@ void compute_and_order_nf_wake_priority(void);
 
 
 
+#ifdef ENABLE_NF_AUTO_SCALING
+/* Per service scale-out/in state */
+typedef struct nf_scale_info {
+        uint16_t standby[MAX_CLIENTS_PER_SERVICE];      //warm standby instances: started, but not in services[] map
+        uint16_t standby_count;
+        uint16_t bneck_checks;          //consecutive checks with an active instance of the service bottlenecked
+        uint16_t idle_checks;           //consecutive checks with the load fitting in one instance less
+        uint16_t launch_pending;        //launcher hook invoked, waiting for an instance of the service to register
+        pid_t launch_pid;               //launcher process to reap (0 => none)
+        uint64_t launch_deadline;       //tsc at which the pending launch is given up
+        uint64_t capacity_pps;          //service rate of one instance measured while bottlenecked
+        uint64_t scale_out_count;
+        uint64_t scale_in_count;
+}nf_scale_info_t;
+extern nf_scale_info_t nf_scale_info[MAX_SERVICES];
+
+/* Launcher hook invoked when a service must scale out and has no warm standby: returns the pid of the launcher process to check for
+ * its exit status (0 => not tracked) if a new instance is being launched, negative on failure */
+typedef int (*onvm_nf_scale_out_hook_t)(uint16_t service_id, uint16_t bottleneck_nf_id);
+void onvm_nf_set_scale_out_hook(onvm_nf_scale_out_hook_t hook);
+
+/* Evaluate the scale-out/in of all services: called with NF status check (onvm_nf_check_status()) */
+void onvm_nf_check_auto_scale(void);
+#endif //ENABLE_NF_AUTO_SCALING
+
+#ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+/* Re-tune the Rx ring watermarks of all NFs from the measurements of the last interval: called with onvm_nf_stats_update() */
+void onvm_nf_tune_watermarks(unsigned long interval_us);
+#endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
 /* Enqueue NF to the bottleneck watch list */
 int enqueu_nf_to_bottleneck_watch_list(uint16_t nf_id);
 int dequeue_nf_from_bottleneck_watch_list(uint16_t nf_id);
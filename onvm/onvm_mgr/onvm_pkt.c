@@ -51,10 +51,40 @@
 #include "onvm_mgr.h"
 #include "onvm_pkt.h"
 #include "onvm_nf.h"
+#include "onvm_wakemgr.h"
+
+#ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+#include <rte_random.h>
+#endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
 
 //pthread_mutex_t mymutex = PTHREAD_MUTEX_INITIALIZER;
 /**********************************Interfaces*********************************/
-//#define USE_KEY_MODE_FOR_FLOW_ENTRY       //Note: Enabling this flag is costing upto 4Mpps (reason: softrss() call)
+#ifdef ENABLE_CHAIN_INGRESS_RATE_LIMIT
+static uint64_t chain_tb_tsc_hz;                //rte_get_tsc_hz(), cached by onvm_pkt_init()
+static uint64_t chain_tb_epoch_cycles;          //CHAIN_TB_EPOCH_IN_US in tsc cycles
+#endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+#ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+static uint64_t afd_epoch_cycles;               //AFD_EPOCH_IN_US in tsc cycles
+/* count-min sketch of the recent pkt count of each flow of the backpressured chains, keyed by (chain, flow key hash) */
+static struct {
+        volatile uint64_t decay_tsc;    // sketch decayed up to this time
+        uint32_t decay_col;             // next sketch column to decay
+        uint16_t sketch[AFD_SKETCH_DEPTH][1 << AFD_SKETCH_WIDTH_BITS];
+} afd_sketch;
+#endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+
+void
+onvm_pkt_init(void) {
+        #ifdef ENABLE_CHAIN_INGRESS_RATE_LIMIT
+        chain_tb_tsc_hz = rte_get_tsc_hz();
+        chain_tb_epoch_cycles = (chain_tb_tsc_hz/SECOND_TO_MICRO_SECOND)*CHAIN_TB_EPOCH_IN_US;
+        #endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+        #ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+        afd_epoch_cycles = (rte_get_tsc_hz()/SECOND_TO_MICRO_SECOND)*AFD_EPOCH_IN_US;
+        #endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+}
+
+//#define USE_KEY_MODE_FOR_FLOW_ENTRY       //Note: Enabling this flag costs a key extraction and software hash (table driven onvm_softrss()) per pkt
 static inline int get_flow_entry( struct rte_mbuf *pkt, struct onvm_flow_entry **flow_entry);
 static inline int get_flow_entry( struct rte_mbuf *pkt, struct onvm_flow_entry **flow_entry) {
         int ret = -1;
@@ -71,6 +101,437 @@ static inline int get_flow_entry( struct rte_mbuf *pkt, struct onvm_flow_entry *
         return ret;
 }
 
+#ifdef ENABLE_BKPR_GENERATION_MARKS
+/* Record the NF and its current generation against the chain mark at chain_index (call before setting the bit) */
+static inline void onvm_bkpr_tag_chain_mark(struct client *cl, struct onvm_service_chain *sc, uint8_t chain_index) {
+        sc->bkpr_mark_nf[chain_index] = cl->instance_id;
+        sc->bkpr_mark_gen[chain_index] = cl->bkpr_gen;
+        cl->bkpr_marked++;
+        rte_wmb();
+}
+/* Clear all the chain marks set by this NF: O(1), existing marks turn stale and are dropped on next packet of the chain */
+static inline void onvm_bkpr_clear_nf_marks(struct client *cl) {
+        if(0 == cl->bkpr_marked) return;
+        cl->bkpr_marked = 0;
+        cl->bkpr_gen++;
+}
+/* Lazily clear the marks of the chain whose marking NF has moved to a new generation */
+static inline void onvm_bkpr_clear_stale_chain_marks(struct onvm_service_chain *sc) {
+        uint16_t marks = sc->highest_downstream_nf_index_id;
+        uint8_t chain_index = 1;
+        for(; marks && chain_index <= ONVM_MAX_CHAIN_LENGTH; chain_index++) {
+                if(!TEST_BIT(marks, chain_index)) continue;
+                CLEAR_BIT(marks, chain_index);
+                if(clients[sc->bkpr_mark_nf[chain_index]].bkpr_gen != sc->bkpr_mark_gen[chain_index]) {
+                        CLEAR_BIT(sc->highest_downstream_nf_index_id, chain_index);
+                }
+        }
+}
+#endif //ENABLE_BKPR_GENERATION_MARKS
+
+#if defined(ENABLE_CHAIN_INGRESS_RATE_LIMIT) || defined(ENABLE_CHAIN_INGRESS_FAIR_DROP)
+/* Instance id of the most upstream bottleneck NF of a chain with non-zero marks */
+static inline uint16_t onvm_chain_bneck_nf(struct onvm_service_chain *sc, uint16_t marks) {
+        uint8_t chain_index = __builtin_ctz(marks) + 1;
+        #ifdef ENABLE_BKPR_GENERATION_MARKS
+        return sc->bkpr_mark_nf[chain_index];
+        #else
+        return sc->nf_instance_id[chain_index];
+        #endif //ENABLE_BKPR_GENERATION_MARKS
+}
+#endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT || ENABLE_CHAIN_INGRESS_FAIR_DROP
+
+#ifdef ENABLE_CHAIN_INGRESS_RATE_LIMIT
+/* Measured Tx rate of each NF: sampled at most once per CHAIN_TB_EPOCH_IN_US by whichever Rx thread asks first */
+typedef struct nf_tx_rate {
+        volatile uint64_t tsc;
+        uint64_t tx;
+        uint64_t rate_pps;
+}nf_tx_rate_t;
+static nf_tx_rate_t nf_tx_rate[MAX_CLIENTS];
+
+static inline uint64_t onvm_nf_tx_rate(uint16_t nf_id, uint64_t now) {
+        nf_tx_rate_t *r = &nf_tx_rate[nf_id];
+        uint64_t last = r->tsc;
+        uint64_t tx;
+        if((now - last) < chain_tb_epoch_cycles) return r->rate_pps;
+        if(!rte_atomic64_cmpset(&r->tsc, last, now)) return r->rate_pps;  //sampled by another thread
+        tx = clients_stats->tx[nf_id];
+        //first sample (or first after a long gap) only seeds the counter
+        r->rate_pps = (last && (now - last) < (chain_tb_epoch_cycles*CHAIN_TB_RELEASE_EPOCHS))? (((tx - r->tx)*chain_tb_tsc_hz)/(now - last)):(0);
+        r->tx = tx;
+        return r->rate_pps;
+}
+
+/* Re-evaluate the admitted rate of the chain (AIMD):
+ * on backpressure, follow the measured service rate of the bottleneck NF (a notch below it, so that its queue drains) and
+ * decrease multiplicatively while no rate is measured;
+ * without backpressure, increase additively and lift the limit once the chain stays calm for CHAIN_TB_RELEASE_EPOCHS.
+ */
+static inline void onvm_chain_tb_update_rate(struct onvm_service_chain *sc, chain_ingress_tb_t *tb, uint64_t now) {
+        uint16_t marks = sc->highest_downstream_nf_index_id;
+        uint64_t svc_rate;
+        uint8_t chain_index;
+
+        //keep the rates of the NFs of the chain measured, so that the first mark starts from the rate of its bottleneck
+        for(chain_index = 1; chain_index <= sc->chain_length; chain_index++) {
+                if(sc->nf_instance_id[chain_index]) (void)onvm_nf_tx_rate(sc->nf_instance_id[chain_index], now);
+        }
+
+        if(marks) {
+                //track the most upstream bottleneck of the chain
+                tb->bneck_nf = onvm_chain_bneck_nf(sc, marks);
+                svc_rate = onvm_nf_tx_rate(tb->bneck_nf, now);
+                tb->calm_epochs = 0;
+                if(0 == tb->rate_pps) {
+                        tb->tokens = ((uint64_t)CHAIN_TB_BURST_PKTS << CHAIN_TB_TOKEN_SHIFT);
+                        tb->refill_rem = 0;
+                        tb->last_tsc = now;
+                }
+                if(svc_rate) {
+                        tb->rate_pps = svc_rate - (svc_rate >> CHAIN_TB_MD_SHIFT);
+                }
+                else if(tb->rate_pps) {
+                        tb->rate_pps -= (tb->rate_pps >> CHAIN_TB_MD_SHIFT);
+                }
+                if(tb->rate_pps < CHAIN_TB_MIN_RATE_PPS) tb->rate_pps = CHAIN_TB_MIN_RATE_PPS;
+        }
+        else if(tb->rate_pps) {
+                tb->calm_epochs = (tb->epoch_drops)? (0):(tb->calm_epochs + 1);
+                if(tb->calm_epochs >= CHAIN_TB_RELEASE_EPOCHS) {
+                        tb->rate_pps = 0;
+                        tb->calm_epochs = 0;
+                }
+                else tb->rate_pps += CHAIN_TB_AI_STEP_PPS;
+        }
+
+        tb->epoch_drops = 0;
+        tb->epoch_tsc = now;
+}
+
+/* Admit a packet at the ingress (chain_index 1) of the chain: returns 1 to admit, 0 to drop */
+static inline int onvm_chain_ingress_admit(struct onvm_service_chain *sc) {
+        chain_ingress_tb_t *tb = &sc->ingress_tb;
+        uint64_t now = rte_rdtsc();
+        uint64_t elapsed;
+
+        if(unlikely((now - tb->epoch_tsc) >= chain_tb_epoch_cycles)) {
+                onvm_chain_tb_update_rate(sc, tb, now);
+        }
+        if(0 == tb->rate_pps) {
+                tb->admitted++;
+                return 1;
+        }
+
+        //refill: cap the elapsed time to one epoch (the bucket is full by then) to keep the fixed point product in range
+        elapsed = now - tb->last_tsc;
+        if(elapsed > chain_tb_epoch_cycles) {
+                elapsed = chain_tb_epoch_cycles;
+        }
+        //keep the remainder of the division, else short gaps between pkts at a low rate never add a token
+        tb->refill_rem += ((elapsed*tb->rate_pps) << CHAIN_TB_TOKEN_SHIFT);
+        tb->tokens += tb->refill_rem/chain_tb_tsc_hz;
+        tb->refill_rem %= chain_tb_tsc_hz;
+        if(tb->tokens > ((uint64_t)CHAIN_TB_BURST_PKTS << CHAIN_TB_TOKEN_SHIFT)) {
+                tb->tokens = ((uint64_t)CHAIN_TB_BURST_PKTS << CHAIN_TB_TOKEN_SHIFT);
+                tb->refill_rem = 0;
+        }
+        tb->last_tsc = now;
+
+        if(tb->tokens >= (1 << CHAIN_TB_TOKEN_SHIFT)) {
+                tb->tokens -= (1 << CHAIN_TB_TOKEN_SHIFT);
+                tb->admitted++;
+                return 1;
+        }
+        tb->epoch_drops++;
+        tb->dropped++;
+        return 0;
+}
+#endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+
+#ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+/* Decay the sketch incrementally: every column is halved once per AFD_EPOCH_IN_US, a slice of columns at a time
+ * (as many as are due since the last call), so no pkt pays for a sweep of the whole sketch.
+ */
+static inline void onvm_afd_sketch_decay(uint64_t now) {
+        uint64_t last = afd_sketch.decay_tsc;
+        uint64_t cols = ((now - last) << AFD_SKETCH_WIDTH_BITS)/afd_epoch_cycles;
+        uint32_t i, d, col;
+        if(likely(0 == cols)) return;
+        if(!rte_atomic64_cmpset(&afd_sketch.decay_tsc, last, now)) return;  //decayed by another thread
+        if(cols > (1 << AFD_SKETCH_WIDTH_BITS)) cols = (1 << AFD_SKETCH_WIDTH_BITS);
+        col = afd_sketch.decay_col;
+        for(i = 0; i < cols; i++) {
+                for(d = 0; d < AFD_SKETCH_DEPTH; d++) {
+                        afd_sketch.sketch[d][col] >>= 1;
+                }
+                col = (col + 1) & ((1 << AFD_SKETCH_WIDTH_BITS) - 1);
+        }
+        afd_sketch.decay_col = col;
+}
+
+/* Hash of the flow key of the entry, seeded with the chain (the NIC rss hash is not keyed on the full tuple on every port) */
+static inline uint32_t onvm_afd_flow_hash(struct onvm_service_chain *sc, struct onvm_flow_entry *flow_entry) {
+        uint32_t seed = (uint32_t)((uintptr_t)sc >> 3);
+        if(likely(flow_entry->key != NULL)) {
+                return DEFAULT_HASH_FUNC(flow_entry->key, sizeof(struct onvm_ft_ipv4_5tuple), seed);
+        }
+        #ifdef ENABLE_FLOW_DIR_IPV6
+        if(flow_entry->key6 != NULL) {
+                return DEFAULT_HASH_FUNC(flow_entry->key6, sizeof(struct onvm_ft_ipv6_5tuple), seed);
+        }
+        #endif //ENABLE_FLOW_DIR_IPV6
+        return DEFAULT_HASH_FUNC(&flow_entry->entry_index, sizeof(flow_entry->entry_index), seed);
+}
+
+/* Add a pkt of the (chain, flow) to the sketch: returns the estimated recent count of the flow (before adding this pkt) */
+static inline uint32_t onvm_afd_sketch_update(uint32_t flow_hash) {
+        uint32_t d, idx, est = UINT16_MAX;
+        uint32_t h = flow_hash;
+        for(d = 0; d < AFD_SKETCH_DEPTH; d++) {
+                idx = h >> (32 - AFD_SKETCH_WIDTH_BITS);
+                if(afd_sketch.sketch[d][idx] < est) est = afd_sketch.sketch[d][idx];
+                if(afd_sketch.sketch[d][idx] < UINT16_MAX) afd_sketch.sketch[d][idx]++;
+                h = (h ^ (h >> 15)) * 0x2c1b3c6d;   //rehash for next row
+                h = (h + 0x9E3779B9) * 0x297a2d39;
+        }
+        return est;
+}
+
+/* Admit a pkt at the ingress (chain_index 1) of a backpressured chain (approximate fair dropping):
+ * fair share = mean recent count per active flow of the chain, scaled by a factor adapted every epoch by the bottleneck NF's Rx queue
+ * (down 1/8 while above its high watermark, up 1/8 otherwise); flows above the fair share are dropped with probability 1 - fair/count.
+ * Returns 1 to admit, 0 to drop.
+ */
+static inline int onvm_chain_fair_admit(struct onvm_service_chain *sc, struct onvm_flow_entry *flow_entry) {
+        chain_fair_drop_t *afd = &sc->fair_drop;
+        uint64_t now = rte_rdtsc();
+        uint64_t epoch_cycles = afd_epoch_cycles;
+        uint32_t count, fair;
+
+        onvm_afd_sketch_decay(now);
+
+        if(unlikely((now - afd->epoch_tsc) >= epoch_cycles)) {
+                if((now - afd->epoch_tsc) >= (epoch_cycles*AFD_EPISODE_GAP_EPOCHS)) {
+                        //new backpressure episode
+                        afd->scale = AFD_SCALE_ONE;
+                        afd->last_arrivals = afd->last_flows = 0;
+                } else {
+                        uint16_t marks = sc->highest_downstream_nf_index_id;
+                        struct client *bneck = (marks)? (&clients[onvm_chain_bneck_nf(sc, marks)]):(NULL);
+                        if(bneck && bneck->rx_q && rte_ring_count(bneck->rx_q) >= NF_RX_Q_HIGH_WM(bneck)) {
+                                afd->scale -= (afd->scale >> 3);
+                                if(afd->scale < AFD_SCALE_MIN) afd->scale = AFD_SCALE_MIN;
+                        } else {
+                                afd->scale += (afd->scale >> 3);
+                                if(afd->scale > AFD_SCALE_MAX) afd->scale = AFD_SCALE_MAX;
+                        }
+                        afd->last_arrivals = afd->arrivals;
+                        afd->last_flows = afd->flows;
+                }
+                afd->arrivals = afd->flows = 0;
+                afd->epoch_tsc = now;
+        }
+
+        count = onvm_afd_sketch_update(onvm_afd_flow_hash(sc, flow_entry));
+        afd->arrivals++;
+        if(0 == count) afd->flows++;
+
+        fair = (uint32_t)((((uint64_t)(afd->arrivals + afd->last_arrivals))*afd->scale)/((uint64_t)AFD_SCALE_ONE*RTE_MAX(1, afd->flows + afd->last_flows)));
+        if(fair < 1) fair = 1;
+        if(count <= fair) return 1;
+        if((uint32_t)(rte_rand() % count) < fair) return 1;
+        afd->dropped++;
+        return 0;
+}
+#endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+
+#if defined(ENABLE_ECN_CE) || defined(ENABLE_NF_RX_PRIORITY_RINGS)
+/* IPv4 header of an untagged or single VLAN tagged pkt, NULL for non IPv4 pkts (checks ether type before touching the L3 header) */
+static inline struct ipv4_hdr*
+onvm_pkt_l3_ipv4_hdr(struct rte_mbuf *pkt) {
+        struct ether_hdr *eth = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+        uint16_t ether_type = eth->ether_type;
+        uint8_t *l3 = (uint8_t*)(eth + 1);
+
+        if (ether_type == rte_cpu_to_be_16(ETHER_TYPE_VLAN)) {
+                ether_type = ((struct vlan_hdr*)l3)->eth_proto;
+                l3 += sizeof(struct vlan_hdr);
+        }
+        if (ether_type != rte_cpu_to_be_16(ETHER_TYPE_IPv4)) return NULL;
+        return (struct ipv4_hdr*)l3;
+}
+#endif //ENABLE_ECN_CE || ENABLE_NF_RX_PRIORITY_RINGS
+
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+/* DSCP code points (RFC 4594) mapped to the priority classes */
+#define DSCP_CS3                (24)
+#define DSCP_CS4                (32)
+#define DSCP_AF41               (34)
+#define DSCP_AF42               (36)
+#define DSCP_AF43               (38)
+#define DSCP_CS5                (40)
+#define DSCP_VOICE_ADMIT        (44)
+#define DSCP_EF                 (46)
+#define DSCP_CS6                (48)
+#define DSCP_CS7                (56)
+
+static inline uint8_t onvm_pkt_dscp_rx_class(uint8_t dscp) {
+        uint8_t rx_class;
+        switch (dscp) {
+        case DSCP_EF: case DSCP_VOICE_ADMIT:                            //voice
+                rx_class = 0; break;
+        case DSCP_CS3: case DSCP_CS5: case DSCP_CS6: case DSCP_CS7:     //signalling and network control
+                rx_class = 1; break;
+        case DSCP_CS4: case DSCP_AF41: case DSCP_AF42: case DSCP_AF43:  //real-time video
+                rx_class = 2; break;
+        default:
+                return NF_RX_BULK_CLASS;
+        }
+        return RTE_MIN(rx_class, NF_RX_BULK_CLASS - 1);
+}
+
+/* Rx class of a pkt: the class of its chain when set, else by DSCP */
+static inline uint8_t onvm_pkt_rx_class(struct rte_mbuf *pkt, struct onvm_service_chain *sc) {
+        struct ipv4_hdr *ip;
+        if (sc && sc->rx_class) {
+                return sc->rx_class - 1;
+        }
+        ip = onvm_pkt_l3_ipv4_hdr(pkt);
+        if (ip == NULL) {
+                return NF_RX_BULK_CLASS;
+        }
+        return onvm_pkt_dscp_rx_class(ip->type_of_service >> 2);
+}
+
+/* Enqueue a priority pkt straight to the class ring of the NF: it does not wait behind the bulk pkts batched in the thread buffer.
+ * Returns 1 when the pkt is taken (enqueued or dropped), 0 when the class ring is full in lossless mode: the caller stages it as bulk.
+ */
+static inline int onvm_pkt_enqueue_nf_prio(struct client *cl, uint8_t rx_class, struct rte_mbuf *pkt, __attribute__((unused)) struct onvm_service_chain *sc) {
+        int enq_status;
+
+        #ifdef ENABLE_PKT_ENQUEUE_TIMESTAMP
+        onvm_set_pkt_enqueue_ts(pkt, onvm_get_pkt_ts_now());
+        #endif //ENABLE_PKT_ENQUEUE_TIMESTAMP
+
+        enq_status = rte_ring_enqueue(cl->rx_prio[rx_class].q, pkt);
+
+        #ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+        if (-ENOBUFS != enq_status) onvm_wake_doorbell_ring();
+        #endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
+        // class ring over its watermark: NF cannot keep up even with the class, throttle the class (only) of the chains feeding it
+        if (0 != enq_status && !cl->rx_prio[rx_class].in_bkpr) {
+                cl->rx_prio[rx_class].in_bkpr = 1;
+                cl->rx_prio[rx_class].bkpr_events++;
+        }
+
+        if (-ENOBUFS == enq_status) {
+                #ifdef ENABLE_LOSSLESS_CREDIT_MODE
+                // held behind the bulk pkts of the NF rather than dropped
+                return 0;
+                #else
+                onvm_pkt_drop(pkt);
+                cl->rx_prio[rx_class].rx_drop++;
+                cl->stats.rx_drop++;
+                #ifdef ENABLE_CHAIN_STATS
+                onvm_chain_stats_drop(sc);
+                #endif //ENABLE_CHAIN_STATS
+                #endif //ENABLE_LOSSLESS_CREDIT_MODE
+        } else {
+                cl->rx_prio[rx_class].rx++;
+                cl->stats.rx++;
+        }
+        return 1;
+}
+
+#ifdef ENABLE_NF_BACKPRESSURE
+/* Admission of a priority pkt: it is not held back by the chain marks and ingress limits (set off by bulk congestion),
+ * only by the backpressure of its own class: dropped at the chain ingress while the class ring of an NF of the chain is over its watermark.
+ * Returns 0 when the pkt is dropped.
+ */
+static inline int onvm_pkt_rx_prio_admit(struct client *cl, uint8_t rx_class, struct rte_mbuf *pkt, struct onvm_flow_entry *flow_entry, struct onvm_pkt_meta *meta) {
+        struct onvm_service_chain *sc;
+        uint8_t chain_index;
+
+        if (flow_entry == NULL || (sc = flow_entry->sc) == NULL) {
+                return 1;
+        }
+        sc->nf_instance_id[meta->chain_index] = (uint8_t)cl->instance_id;
+        if (meta->chain_index != 1) {
+                return 1;
+        }
+        for (chain_index = 1; chain_index <= sc->chain_length; chain_index++) {
+                if (sc->nf_instance_id[chain_index] && onvm_nf_rx_prio_in_bkpr(&clients[sc->nf_instance_id[chain_index]], rx_class)) {
+                        onvm_pkt_drop(pkt);
+                        clients[sc->nf_instance_id[chain_index]].rx_prio[rx_class].bkpr_drop++;
+                        cl->stats.bkpr_drop+=1;
+                        #ifdef ENABLE_CHAIN_STATS
+                        onvm_chain_stats_drop(sc);
+                        #endif //ENABLE_CHAIN_STATS
+                        return 0;
+                }
+        }
+        return 1;
+}
+#endif //ENABLE_NF_BACKPRESSURE
+
+void
+onvm_pkt_rx_prio_release(struct client *cl) {
+        struct rte_mbuf *pkts[PACKET_READ_SIZE];
+        unsigned n, i, c;
+
+        if (cl == NULL)
+                return;
+        for (c = 0; c < NF_RX_BULK_CLASS; c++) {
+                if (cl->rx_prio[c].q == NULL) continue;
+                while ((n = rte_ring_dequeue_burst(cl->rx_prio[c].q, (void **)pkts, PACKET_READ_SIZE)) > 0) {
+                        for (i = 0; i < n; i++) {
+                                onvm_pkt_drop(pkts[i]);
+                        }
+                        cl->rx_prio[c].rx_drop += n;
+                }
+                cl->rx_prio[c].in_bkpr = 0;
+        }
+}
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
+#ifdef ENABLE_MBUF_QUOTAS
+/* Charge a pkt admitted at Rx to its chain: 0 if the chain is at its mbuf quota (pkt must be dropped) */
+static inline int onvm_mbuf_charge_rx(struct onvm_service_chain *sc, struct rte_mbuf *pkt) {
+        struct onvm_mbuf_tag *tag = onvm_get_pkt_mbuf_tag(pkt);
+        mbuf_owner_stats_t *os;
+        uint32_t inuse;
+
+        // tag was cleared when the pkt was read (onvm_mbuf_reset_tags())
+        if (unlikely(0 == sc->mbuf_owner)) {
+                uint16_t owner;
+                if (0 == mbuf_quota->nb_free && mbuf_quota->next_owner >= MBUF_QUOTA_MAX_CHAINS) {
+                        return 1;       //out of owner slots: not accounted
+                }
+                if (0 == (owner = onvm_mbuf_owner_alloc(mbuf_quota))) {
+                        return 1;
+                }
+                //another Rx thread may assign the chain at the same time: the first one wins, the other gives its slot back
+                if (!rte_atomic16_cmpset(&sc->mbuf_owner, 0, owner)) {
+                        onvm_mbuf_owner_free(mbuf_quota, owner);
+                }
+        }
+        os = &mbuf_quota->chain[sc->mbuf_owner];
+        os->quota = (sc->mbuf_quota)? (sc->mbuf_quota):(mbuf_quota->chain_quota);
+        if ((uint32_t)rte_atomic32_read(&os->inuse) >= os->quota) {
+                os->quota_drop++;
+                return 0;
+        }
+        inuse = (uint32_t)rte_atomic32_add_return(&os->inuse, 1);
+        if (inuse > os->peak) {
+                os->peak = inuse;
+        }
+        tag->chain_owner = sc->mbuf_owner;
+        return 1;
+}
+#endif //ENABLE_MBUF_QUOTAS
+
 void
 onvm_pkt_process_rx_batch(struct thread_info *rx, struct rte_mbuf *pkts[], uint16_t rx_count) {
         uint16_t i;
@@ -80,6 +541,16 @@ onvm_pkt_process_rx_batch(struct thread_info *rx, struct rte_mbuf *pkts[], uint1
 
         if (rx == NULL || pkts == NULL)
                 return;
+        #ifdef ENABLE_FLOW_COUNTERS
+        RTE_BUILD_BUG_ON(ONVM_NUM_RX_THREADS > FLOW_COUNTER_SHARDS);
+        #endif //ENABLE_FLOW_COUNTERS
+        #ifdef ENABLE_CHAIN_STATS
+        RTE_BUILD_BUG_ON(ONVM_NUM_RX_THREADS > CHAIN_STATS_SHARDS);
+        uint64_t now = rte_rdtsc();             //backpressure time of the chains, per batch
+        #endif //ENABLE_CHAIN_STATS
+        #ifdef ENABLE_FLOW_CLASSIFIER
+        RTE_BUILD_BUG_ON(ONVM_NUM_RX_THREADS > FLOW_CLASSIFIER_STATS_SHARDS);
+        #endif //ENABLE_FLOW_CLASSIFIER
 
         for (i = 0; i < rx_count; i++) {
                 meta = (struct onvm_pkt_meta*) &(((struct rte_mbuf*)pkts[i])->udata64);
@@ -87,6 +558,13 @@ onvm_pkt_process_rx_batch(struct thread_info *rx, struct rte_mbuf *pkts[], uint1
                 meta->chain_index = 0;
 
                 get_flow_entry(pkts[i], &flow_entry); //ret = get_flow_entry(pkts[i], &flow_entry);
+                #ifdef ENABLE_FLOW_CLASSIFIER
+                // first pkt of a flow: resolve its chain with the wildcard rules and install the flow
+                if (flow_entry == NULL || flow_entry->sc == NULL) {
+                        struct onvm_flow_entry *fc_entry = NULL;
+                        if (onvm_flow_dir_classify_pkt(pkts[i], default_chain, &fc_entry, rx->queue_id) >= 0) flow_entry = fc_entry;
+                }
+                #endif //ENABLE_FLOW_CLASSIFIER
                 /*if((ret >=0 && flow_entry == NULL) || (flow_entry && flow_entry->sc == NULL) ) {
                         printf("\n Aborting due to invalid hit [%d]\n", ret);
                         exit(ret);
@@ -94,6 +572,15 @@ onvm_pkt_process_rx_batch(struct thread_info *rx, struct rte_mbuf *pkts[], uint1
                 */
 
                 if (flow_entry && flow_entry->sc ) {
+                        #ifdef ENABLE_FLOW_AGING
+                        onvm_flow_dir_touch(flow_entry);
+                        #endif //ENABLE_FLOW_AGING
+                        #ifdef ENABLE_FLOW_COUNTERS
+                        onvm_flow_dir_count(flow_entry, rx->queue_id, rte_pktmbuf_pkt_len(pkts[i]));
+                        #endif //ENABLE_FLOW_COUNTERS
+                        #ifdef ENABLE_CHAIN_STATS
+                        onvm_chain_stats_rx(flow_entry, rx->queue_id, now);
+                        #endif //ENABLE_CHAIN_STATS
                         meta->action = onvm_sc_next_action(flow_entry->sc, pkts[i]);
                         meta->destination = onvm_sc_next_destination(flow_entry->sc, pkts[i]);
                         #ifdef ENABLE_NF_BACKPRESSURE
@@ -113,6 +600,17 @@ onvm_pkt_process_rx_batch(struct thread_info *rx, struct rte_mbuf *pkts[], uint1
                  * That may not be possible.
                  */
 
+                #ifdef ENABLE_MBUF_QUOTAS
+                // a chain holding its share of the pool is not admitted more pkts
+                if (!onvm_mbuf_charge_rx(((flow_entry && flow_entry->sc)? (flow_entry->sc):(default_chain)), pkts[i])) {
+                        #ifdef ENABLE_CHAIN_STATS
+                        onvm_chain_stats_drop((flow_entry)? (flow_entry->sc):(NULL));
+                        #endif //ENABLE_CHAIN_STATS
+                        onvm_pkt_drop(pkts[i]);
+                        continue;
+                }
+                #endif //ENABLE_MBUF_QUOTAS
+
                 (meta->chain_index)++;
                 onvm_pkt_enqueue_nf(rx, meta->destination, pkts[i], meta, flow_entry);
         }
@@ -197,8 +695,12 @@ onvm_pkt_drop_batch(struct rte_mbuf **pkts, uint16_t size) {
         if (pkts == NULL)
                 return;
 
-        for (i = 0; i < size; i++)
+        for (i = 0; i < size; i++) {
+                #ifdef ENABLE_MBUF_QUOTAS
+                onvm_mbuf_uncharge(mbuf_quota, pkts[i]);
+                #endif //ENABLE_MBUF_QUOTAS
                 rte_pktmbuf_free(pkts[i]);
+        }
 }
 
 
@@ -233,6 +735,107 @@ onvm_pkt_flush_port_queue(struct thread_info *tx, uint16_t port) {
 }
 
 
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+rte_atomic16_t lossless_rx_paused_nfs;
+
+static inline void onvm_pkt_lossless_update_pause(struct client *cl, unsigned held) {
+        if (held >= LOSSLESS_RX_PAUSE_SIZE) {
+                if (rte_atomic16_cmpset(&cl->hold_paused, 0, 1)) {
+                        rte_atomic16_inc(&lossless_rx_paused_nfs);
+                        cl->hold_pauses++;
+                }
+        } else if (held < LOSSLESS_RX_RESUME_SIZE) {
+                if (rte_atomic16_cmpset(&cl->hold_paused, 1, 0)) {
+                        rte_atomic16_dec(&lossless_rx_paused_nfs);
+                }
+        }
+}
+
+/* Move held pkts (oldest first) to the NFs Rx Ring within its credits: returns 1 if nothing is held afterwards.
+ * Pkts taken off hold_q that do not fit (credits lost to another producer) stay in hold_head, ahead of hold_q.
+ */
+static inline int onvm_pkt_lossless_release(struct client *cl) {
+        struct rte_mbuf **pkts = cl->hold_head;
+        unsigned held, credits, n, enq;
+
+        if (likely(0 == cl->hold_head_cnt && 0 == rte_ring_count(cl->hold_q))) return 1;
+        if (!rte_spinlock_trylock(&cl->hold_lock)) return 0;    //being released by another thread
+
+        credits = rte_ring_free_count(cl->rx_q);
+        while (credits) {
+                if (0 == cl->hold_head_cnt) {
+                        n = rte_ring_dequeue_burst(cl->hold_q, (void **)pkts, RTE_MIN(credits, LOSSLESS_RELEASE_BURST));
+                        if (0 == n) break;
+                        #ifdef ENABLE_PKT_ENQUEUE_TIMESTAMP
+                        {
+                                uint16_t i;
+                                uint32_t now = onvm_get_pkt_ts_now();
+                                for (i = 0; i < n; i++) {
+                                        onvm_set_pkt_enqueue_ts(pkts[i], now);
+                                }
+                        }
+                        #endif //ENABLE_PKT_ENQUEUE_TIMESTAMP
+                        cl->hold_head_cnt = n;
+                }
+                n = RTE_MIN(cl->hold_head_cnt, credits);
+                enq = rte_ring_enqueue_burst(cl->rx_q, (void **)pkts, n);
+                cl->stats.rx += enq;
+                cl->hold_head_cnt -= enq;
+                if (cl->hold_head_cnt) {
+                        memmove(pkts, &pkts[enq], cl->hold_head_cnt * sizeof(pkts[0]));
+                }
+                if (unlikely(enq < n)) break;   //lost the credits to another producer: the remainder stays at the head
+                credits -= enq;
+        }
+        #ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+        onvm_wake_doorbell_ring();
+        #endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
+        held = rte_ring_count(cl->hold_q) + cl->hold_head_cnt;
+        rte_spinlock_unlock(&cl->hold_lock);
+        onvm_pkt_lossless_update_pause(cl, held);
+        return (0 == held);
+}
+
+/* Hold the staged pkts of the NF (no credits, or older pkts are already held) */
+static inline void onvm_pkt_lossless_hold(struct client *cl, struct packet_buf *buf) {
+        unsigned held = rte_ring_enqueue_burst(cl->hold_q, (void **)buf->buffer, buf->count);
+        uint16_t i;
+
+        cl->held += held;
+        //hold queue full: nothing else can be done for these
+        for (i = held; i < buf->count; i++) {
+                onvm_pkt_drop(buf->buffer[i]);
+        }
+        cl->stats.rx_drop += (buf->count - held);
+        buf->count = 0;
+        onvm_pkt_lossless_update_pause(cl, rte_ring_count(cl->hold_q) + cl->hold_head_cnt);
+}
+
+void
+onvm_pkt_lossless_release_held(struct client *cl) {
+        struct rte_mbuf *pkts[PACKET_READ_SIZE];
+        unsigned n, i;
+
+        if (cl == NULL || cl->hold_q == NULL)
+                return;
+        rte_spinlock_lock(&cl->hold_lock);
+        for (i = 0; i < cl->hold_head_cnt; i++) {
+                onvm_pkt_drop(cl->hold_head[i]);
+        }
+        cl->stats.rx_drop += cl->hold_head_cnt;
+        cl->hold_head_cnt = 0;
+        while ((n = rte_ring_dequeue_burst(cl->hold_q, (void **)pkts, PACKET_READ_SIZE)) > 0) {
+                for (i = 0; i < n; i++) {
+                        onvm_pkt_drop(pkts[i]);
+                }
+                cl->stats.rx_drop += n;
+        }
+        rte_spinlock_unlock(&cl->hold_lock);
+        onvm_pkt_lossless_update_pause(cl, 0);
+}
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
+
 void
 onvm_pkt_flush_nf_queue(struct thread_info *thread, uint16_t client) {
         struct client *cl;
@@ -240,21 +843,76 @@ onvm_pkt_flush_nf_queue(struct thread_info *thread, uint16_t client) {
         if (thread == NULL)
                 return;
 
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+        cl = &clients[client];
+        if (thread->nf_rx_buf[client].count == 0 && (NULL == cl->hold_q || (0 == cl->hold_head_cnt && 0 == rte_ring_count(cl->hold_q))))
+                return;
+#else
         if (thread->nf_rx_buf[client].count == 0)
                 return;
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
 
         cl = &clients[client];
 
         // Ensure destination NF is running and ready to receive packets
-        if (!onvm_nf_is_valid(cl))
+        if (!onvm_nf_is_valid(cl)) {
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+                // Nobody to take them: drop the staged and held pkts, so that they neither leak nor keep the NIC Rx paused
+                uint16_t i;
+                for (i = 0; i < thread->nf_rx_buf[client].count; i++) {
+                        onvm_pkt_drop(thread->nf_rx_buf[client].buffer[i]);
+                }
+                cl->stats.rx_drop += thread->nf_rx_buf[client].count;
+                thread->nf_rx_buf[client].count = 0;
+                onvm_pkt_lossless_release_held(cl);
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
                 return;
+        }
+
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+        // Held pkts go first; while any remain, the staged pkts are held behind them (in order)
+        if (!onvm_pkt_lossless_release(cl)) {
+                if (thread->nf_rx_buf[client].count) {
+                        #ifdef ENABLE_NF_BACKPRESSURE
+                        #ifdef USE_BKPR_V2_IN_TIMER_MODE
+                        onvm_detect_and_set_back_pressure_v2(cl);
+                        #else
+                        onvm_detect_and_set_back_pressure(thread->nf_rx_buf[client].buffer, thread->nf_rx_buf[client].count, cl);
+                        #endif //USE_BKPR_V2_IN_TIMER_MODE
+                        #endif //ENABLE_NF_BACKPRESSURE
+                        onvm_pkt_lossless_hold(cl, &thread->nf_rx_buf[client]);
+                }
+                return;
+        }
+        if (thread->nf_rx_buf[client].count == 0)
+                return;
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
+
+#ifdef ENABLE_PKT_ENQUEUE_TIMESTAMP
+        {
+                //one timestamp for the whole batch: pkts of a batch enter the Rx Ring together
+                uint16_t i;
+                uint32_t now = onvm_get_pkt_ts_now();
+                for (i = 0; i < thread->nf_rx_buf[client].count; i++) {
+                        onvm_set_pkt_enqueue_ts(thread->nf_rx_buf[client].buffer[i], now);
+                }
+        }
+#endif //ENABLE_PKT_ENQUEUE_TIMESTAMP
 
         int enq_status = rte_ring_enqueue_bulk(cl->rx_q, (void **)thread->nf_rx_buf[client].buffer,
                                 thread->nf_rx_buf[client].count);
 
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+        if (-ENOBUFS != enq_status) onvm_wake_doorbell_ring();
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
 
 #if defined(ENABLE_NF_BACKPRESSURE) || defined (ENABLE_ECN_CE)
+#ifdef ENABLE_NF_SOJOURN_AQM
+        if ( -ENOBUFS == enq_status) {  //watermark is not a signal: delay is evaluated at dequeue (onvm_nf_aqm_on_dequeue())
+#else
         if ( 0 != enq_status) {
+#endif //ENABLE_NF_SOJOURN_AQM
         //if (-EDQUOT == enq_status) {
 #if 0
 #ifdef ENABLE_ECN_CE    //Better to mark ECN_CE ON DEQUEUE
@@ -275,7 +933,15 @@ onvm_pkt_flush_nf_queue(struct thread_info *thread, uint16_t client) {
 #endif  //defined(ENABLE_NF_BACKPRESSURE) || defined (ENABLE_ECN_CE)
 
 
-#ifdef  DO_NOT_DROP_PKTS_ON_FLUSH_FOR_BOTTLENECK_NF
+#if defined(ENABLE_LOSSLESS_CREDIT_MODE)
+        // Out of credits: hold the pkts (in order) instead of dropping them
+        if ( -ENOBUFS == enq_status) {
+                onvm_pkt_lossless_hold(cl, &thread->nf_rx_buf[client]);
+        } else {
+                cl->stats.rx += thread->nf_rx_buf[client].count;
+                thread->nf_rx_buf[client].count = 0;
+        }
+#elif defined(DO_NOT_DROP_PKTS_ON_FLUSH_FOR_BOTTLENECK_NF)
         // In case of Failure with NoBUFS hold on to the packets in the thread buffer, till they can be flushed, and rather drop new packets that need to be enqueued
         if ( -ENOBUFS == enq_status) {
                 //do nothing..
@@ -309,6 +975,10 @@ onvm_pkt_enqueue_port(struct thread_info *tx, uint16_t port, struct rte_mbuf *bu
                 return;
         if(unlikely(port >= ports->num_ports))
                 return;
+        #ifdef ENABLE_MBUF_QUOTAS
+        // leaves the chain: port Tx buffer and NIC descriptors are not charged to chains
+        onvm_mbuf_uncharge(mbuf_quota, buf);
+        #endif //ENABLE_MBUF_QUOTAS
         tx->port_tx_buf[port].buffer[tx->port_tx_buf[port].count++] = buf;
         if (tx->port_tx_buf[port].count == PACKET_READ_SIZE) {
                 onvm_pkt_flush_port_queue(tx, port);
@@ -321,6 +991,9 @@ inline void
 onvm_pkt_enqueue_nf(struct thread_info *thread, uint16_t dst_service_id, struct rte_mbuf *pkt, struct onvm_pkt_meta *meta, struct onvm_flow_entry *flow_entry) {
         struct client *cl;
         uint16_t dst_instance_id;
+        #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        uint8_t rx_class;
+        #endif //ENABLE_NF_RX_PRIORITY_RINGS
 
 
         if (thread == NULL || pkt == NULL)
@@ -345,25 +1018,74 @@ onvm_pkt_enqueue_nf(struct thread_info *thread, uint16_t dst_service_id, struct
         }
 
 #endif
+        #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        // classify first: priority pkts are not throttled for the bulk congestion of the chain
+        rx_class = onvm_pkt_rx_class(pkt, ((flow_entry)? (flow_entry->sc):(NULL)));
+        #endif //ENABLE_NF_RX_PRIORITY_RINGS
+
         #ifdef ENABLE_NF_BACKPRESSURE
+        #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        if (rx_class != NF_RX_BULK_CLASS) {
+                if (!onvm_pkt_rx_prio_admit(cl, rx_class, pkt, flow_entry, meta)) {
+                        return;
+                }
+        }
+        else
+        #endif //ENABLE_NF_RX_PRIORITY_RINGS
         // First regardless of the approach, fill in the NF MAP of service chain if not already done
         // second: if approach is throttle by buffer drop, check if this chain needs upstreams to drop and if this one such upstream NF, then drop packet and return.
         if (flow_entry && flow_entry->sc) {
 
-                #if defined(NF_BACKPRESSURE_APPROACH_2) || defined(USE_BKPR_V2_IN_TIMER_MODE)
+                #if defined(NF_BACKPRESSURE_APPROACH_2) || defined(USE_BKPR_V2_IN_TIMER_MODE) || defined(ENABLE_CHAIN_INGRESS_RATE_LIMIT) || defined(ENABLE_CHAIN_INGRESS_FAIR_DROP)
                 // this information is needed only for NF based throttling apporach; packet drop approach is more in-line.
                 flow_entry->sc->nf_instance_id[meta->chain_index] = (uint8_t)cl->instance_id;
                 #endif  //NF_BACKPRESSURE_APPROACH_2
 
+                #ifdef ENABLE_BKPR_GENERATION_MARKS
+                if (flow_entry->sc->highest_downstream_nf_index_id) {
+                        onvm_bkpr_clear_stale_chain_marks(flow_entry->sc);
+                }
+                #endif //ENABLE_BKPR_GENERATION_MARKS
+
                 #ifdef NF_BACKPRESSURE_APPROACH_1
+                #if defined(ENABLE_CHAIN_INGRESS_FAIR_DROP) || defined(ENABLE_CHAIN_INGRESS_RATE_LIMIT)
+                if (meta->chain_index == 1) {
+                        #ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+                        // Under backpressure drop mainly from the flows exceeding their fair share of the chain
+                        if ((flow_entry->sc->highest_downstream_nf_index_id) && !onvm_chain_fair_admit(flow_entry->sc, flow_entry)) {
+                                onvm_pkt_drop(pkt);
+                                cl->stats.bkpr_drop+=1;
+                                #ifdef ENABLE_CHAIN_STATS
+                                onvm_chain_stats_drop(flow_entry->sc);
+                                #endif //ENABLE_CHAIN_STATS
+                                return;
+                        }
+                        #endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+                        #ifdef ENABLE_CHAIN_INGRESS_RATE_LIMIT
+                        // Admit the chain at its ingress at the rate the bottleneck NF can sustain, rather than all-or-nothing
+                        if (!onvm_chain_ingress_admit(flow_entry->sc)) {
+                                onvm_pkt_drop(pkt);
+                                cl->stats.bkpr_drop+=1;
+                                #ifdef ENABLE_CHAIN_STATS
+                                onvm_chain_stats_drop(flow_entry->sc);
+                                #endif //ENABLE_CHAIN_STATS
+                                return;
+                        }
+                        #endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+                }
+                else
+                #endif //ENABLE_CHAIN_INGRESS_FAIR_DROP || ENABLE_CHAIN_INGRESS_RATE_LIMIT
                 // We want to throttle the packets at the upstream only iff (a) the packet belongs to the service chain whose Downstream NF indicates overflow, (b) this NF is upstream component for the service chain, and not a downstream NF (c) this NF is marked for throttle
 #ifdef DROP_PKTS_ONLY_AT_BEGGINING
                 if ((flow_entry->sc->highest_downstream_nf_index_id) && (meta->chain_index == 1)) {
 #else
-                if ((flow_entry->sc->highest_downstream_nf_index_id) && (is_upstream_NF(flow_entry->sc->highest_downstream_nf_index_id, meta->chain_index))) {
+                if ((flow_entry->sc->highest_downstream_nf_index_id) && (onvm_sc_is_bkpr_upstream(flow_entry->sc, meta->chain_index))) {
 #endif //DROP_PKTS_ONLY_AT_BEGGINING
                         onvm_pkt_drop(pkt);
                         cl->stats.bkpr_drop+=1;
+                        #ifdef ENABLE_CHAIN_STATS
+                        onvm_chain_stats_drop(flow_entry->sc);
+                        #endif //ENABLE_CHAIN_STATS
                         return;
                 }
                 #endif //NF_BACKPRESSURE_APPROACH_1
@@ -375,7 +1097,7 @@ onvm_pkt_enqueue_nf(struct thread_info *thread, uint16_t dst_service_id, struct
                 #ifdef DROP_PKTS_ONLY_AT_BEGGINING
                 if (cl->info != NULL && (meta->chain_index == 1)) {
                 #else
-                if (cl->info != NULL && is_upstream_NF(highest_downstream_nf_service_id,cl->info->service_id)) {
+                if (onvm_sc_is_bkpr_upstream(default_chain, meta->chain_index)) {
                 #endif //DROP_PKTS_ONLY_AT_BEGGINING
                         onvm_pkt_drop(pkt);
                         cl->stats.bkpr_drop+=1;
@@ -386,6 +1108,23 @@ onvm_pkt_enqueue_nf(struct thread_info *thread, uint16_t dst_service_id, struct
         #endif //NF_BACKPRESSURE_APPROACH_1
         #endif //ENABLE_NF_BACKPRESSURE
 
+        #ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+        // keep the tightest budget among chains feeding this NF; consumed and reset on every wake epoch
+        {
+                uint32_t budget_us = onvm_sc_get_remaining_budget_us(((flow_entry && flow_entry->sc)? (flow_entry->sc):(default_chain)), meta->chain_index);
+                if (budget_us < cl->deadline.budget_us) {
+                        cl->deadline.budget_us = budget_us;
+                }
+        }
+        #endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+
+        #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        // admitted priority pkts skip the batching (they do not wait behind bulk pkts); their class rings have their own watermarks
+        if (rx_class != NF_RX_BULK_CLASS && onvm_pkt_enqueue_nf_prio(cl, rx_class, pkt, ((flow_entry)? (flow_entry->sc):(NULL)))) {
+                return;
+        }
+        #endif //ENABLE_NF_RX_PRIORITY_RINGS
+
 
         /* For Drop: Earlier the better, but this part is not only expensive,
          * but can lead to drop of intermittent packets and not batch of packets, and can still result in Tx drops.
@@ -524,6 +1263,9 @@ onvm_pkt_process_next_action(struct thread_info *tx, struct rte_mbuf *pkt, struc
 
 int
 onvm_pkt_drop(struct rte_mbuf *pkt) {
+        #ifdef ENABLE_MBUF_QUOTAS
+        if (pkt != NULL) onvm_mbuf_uncharge(mbuf_quota, pkt);
+        #endif //ENABLE_MBUF_QUOTAS
         rte_pktmbuf_free(pkt);
         if (pkt != NULL) {
                 return 1;
@@ -532,109 +1274,98 @@ onvm_pkt_drop(struct rte_mbuf *pkt) {
 }
 
 
-void
-onvm_detect_and_set_ecn_ce(struct rte_mbuf *pkts[], uint16_t count, struct client *cl) {
-        uint16_t i;
-#define CE_BITS ((uint8_t)0x03)
+#ifdef ENABLE_ECN_CE
+#define ECN_FIELD_MASK          ((uint8_t)0x03)     //ECN bits of IPv4 TOS: 00=Not-ECT, 01=ECT(1), 10=ECT(0), 11=CE
+#define ECN_CE_BITS             ((uint8_t)0x03)
+#define ECN_PREFETCH_AHEAD      (4)
+#ifdef ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
+#define ECN_CE_BURST_FLOWS_BITS (6)     //flows of a burst remembered as marked, by rss hash (a slot collision only costs a repeated mark)
+/* Flows marked in the current burst of the calling thread: a slot is valid only if stamped with the current burst generation */
+typedef struct ecn_burst_flows {
+        uint32_t gen;
+        uint32_t stamp[1 << ECN_CE_BURST_FLOWS_BITS];
+        uint32_t rss[1 << ECN_CE_BURST_FLOWS_BITS];
+}ecn_burst_flows_t;
+static RTE_DEFINE_PER_LCORE(ecn_burst_flows_t, ecn_burst_flows);
+#endif //ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
+
+/* Set CE and update the header checksum incrementally (RFC 1624: HC' = ~(~HC + ~m + m')) on the 16-bit word holding TOS */
+static inline void
+onvm_ecn_set_ce(struct ipv4_hdr *ip) {
+        uint16_t old_w = (uint16_t)(((uint16_t)ip->version_ihl << 8) | ip->type_of_service);
+        uint16_t new_w = (uint16_t)(old_w | ECN_CE_BITS);
+        uint32_t sum = (uint32_t)(uint16_t)~rte_be_to_cpu_16(ip->hdr_checksum) + (uint16_t)~old_w + new_w;
+
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        sum = (sum & 0xFFFF) + (sum >> 16);
+        ip->type_of_service |= ECN_CE_BITS;
+        ip->hdr_checksum = rte_cpu_to_be_16((uint16_t)~sum);
+}
+#endif //ENABLE_ECN_CE
+
+uint16_t
+onvm_detect_and_set_ecn_ce(__attribute__((unused)) struct rte_mbuf *pkts[], __attribute__((unused)) uint16_t count, __attribute__((unused)) struct client *cl) {
+        uint16_t marked = 0;
+#ifdef ENABLE_ECN_CE
         struct ipv4_hdr* ip = NULL;
-        for(i = 0; i < count; i++) {
-                ip = onvm_pkt_ipv4_hdr(pkts[i]);
-                if (ip != NULL) {
-                        //printf("Before: [%d], After: [%d] After1: [%d]", ip->type_of_service, ip->type_of_service|CE_BITS, ip->type_of_service|(CE_BITS << 6));
-                        ip->type_of_service |= (CE_BITS);   //verified this works
-                        //ip->type_of_service |= (CE_BITS << 6)); //rte_cpu_to_be_8(CE_BITS)
+        uint8_t ecn;
+        uint16_t i;
+        #ifdef ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
+        ecn_burst_flows_t *bf = &RTE_PER_LCORE(ecn_burst_flows);
+        uint32_t rss, slot;
+        if (unlikely(++bf->gen == 0)) {         //new burst: the stamps of the previous ones turn stale
+                memset(bf->stamp, 0, sizeof(bf->stamp));
+                bf->gen = 1;
+        }
+        #endif //ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
+
+        for (i = 0; i < count && i < ECN_PREFETCH_AHEAD; i++) {
+                rte_prefetch0(rte_pktmbuf_mtod(pkts[i], void *));
+        }
+        for (i = 0; i < count; i++) {
+                if (i + ECN_PREFETCH_AHEAD < count) {
+                        rte_prefetch0(rte_pktmbuf_mtod(pkts[i + ECN_PREFETCH_AHEAD], void *));
+                }
+                #ifdef ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
+                //the flow is identified by the rss hash of the pkt (0 => unknown: marked on every pkt), no flow table lookup
+                rss = pkts[i]->hash.rss;
+                slot = rss & ((1 << ECN_CE_BURST_FLOWS_BITS) - 1);
+                if (rss && bf->stamp[slot] == bf->gen && bf->rss[slot] == rss) continue;
+                #endif //ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
+
+                ip = onvm_pkt_l3_ipv4_hdr(pkts[i]);
+                if (ip == NULL) continue;
+                ecn = ip->type_of_service & ECN_FIELD_MASK;
+                if (ecn == 0) continue;                 //Not-ECT: never mark, transport would not react
+                if (ecn != ECN_CE_BITS) {
+                        onvm_ecn_set_ce(ip);
+                        marked++;
                 }
+                #ifdef ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
+                if (rss) {
+                        bf->stamp[slot] = bf->gen;
+                        bf->rss[slot] = rss;
+                }
+                #endif //ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST
         }
-        if(cl) {
-                //set this clients CE FLAG ON;
+        if (cl) {
+                cl->ecn_ce_marked += marked;
+                cl->ecn_ce_bursts++;
         }
+#endif //ENABLE_ECN_CE
+        return marked;
 }
 
 #ifdef ENABLE_NF_BACKPRESSURE
 
-#ifdef ENABLE_SAVE_BACKLOG_FT_PER_NF
-static inline void write_ft_to_cl_bft(struct client *cl, struct onvm_flow_entry *flow_entry, uint16_t chain_index);
-static inline void read_all_ft_frm_cl_bft(struct client *cl);
-static inline void write_ft_to_cl_bft(struct client *cl, struct onvm_flow_entry *flow_entry, uint16_t  chain_index) {
-#if defined(BACKPRESSURE_USE_RING_BUFFER_MODE)
-        //if((cl->bft_list.w_h+1) == cl->bft_list.r_h) {
-        if(((cl->bft_list.w_h+1)%cl->bft_list.max_len) == cl->bft_list.r_h) {
-                printf("\n***** BFT_R TERMINATING DUE TO OVERFLOW OF RING BUFFER BOTTLENECK STORE!!****** \n");
-                return; //exit(1);
-        }
-        cl->bft_list.bft[cl->bft_list.w_h].bft=flow_entry;
-        cl->bft_list.bft[cl->bft_list.w_h].chain_index=chain_index;
-        cl->bft_list.bft_count++; //cl->bft_list.bft[cl->bft_list.bft_count++]=flow_entry;
-        //cl->bft_list.w_h = (((cl->bft_list.w_h) == cl->bft_list.max_len)?(0):(cl->bft_list.w_h+1));
-        if((++(cl->bft_list.w_h)) == cl->bft_list.max_len) cl->bft_list.w_h=0;
-#else
-        uint16_t free_index = 0;
-        while(cl->bft_list.bft[cl->bft_list.bft_count].bft != NULL) {
-                cl->bft_list.bft_count++;
-                free_index++;
-                if(free_index ==  cl->bft_list.max_len) break;
-                if (cl->bft_list.bft_count == cl->bft_list.max_len) cl->bft_list.bft_count=0; 
-        }
-        if(free_index < cl->bft_list.max_len) {
-                if(cl->bft_list.bft[cl->bft_list.bft_count].bft != NULL) { printf("\n ************** OverWriting the Existing entry!!! Dangerous !!! ************** \n "); exit(3);}
-                cl->bft_list.bft[cl->bft_list.bft_count].bft=flow_entry;
-                cl->bft_list.bft[cl->bft_list.bft_count].chain_index=chain_index;
-        }
-        //else {
-        //        printf("\n *****************  FAILED TO STORE THE OVERFLOW ENTRY AT NF: [%d] *****************\n ",cl->instance_id);
-        //        exit(0);
-        //}
-#endif
-        flow_entry->idle_timeout |= (1<< (chain_index-1));     // Note: overloading idle timeout for storing chain_index
-        flow_entry->hard_timeout = cl->instance_id;            // Note: overloading hard_timeout for storing cl_instance id where it is last marked for bottleneck.
-#if 0
-        //if (cl->bft_list.bft_count >= CLIENT_QUEUE_RINGSIZE) {printf("\n***** TERMINATING DUE TO OVERFLOW OF RING BUFFER BOTTLENECK STORE!!****** \n");  } //exit(1); continue;
-                //cl->bft_list.bft[cl->bft_list.bft_count++]=flow_entry;
-#endif
-}
-static inline void read_all_ft_frm_cl_bft(struct client *cl) {
-
-#if defined(BACKPRESSURE_USE_RING_BUFFER_MODE)
-        if( cl->bft_list.w_h == cl->bft_list.r_h) return; //empty
-        struct onvm_flow_entry *flow_entry = NULL;
-        uint16_t chain_index = 0, deleted_nodes=0;
-        uint16_t ttl_nodes = (cl->bft_list.w_h > cl->bft_list.r_h)? (cl->bft_list.w_h):(cl->bft_list.w_h+cl->bft_list.max_len-cl->bft_list.r_h);
-        //uint16_t to_del=ttl_nodes;
-        //printf("\n CQ[S]: W_h:[%u], r_h:[%u], lc:[%u], to_del:[%u], del_nd:[%u], ttl_nd:[%u]",cl->bft_list.w_h,cl->bft_list.r_h,cl->bft_list.bft_count, to_del, deleted_nodes, ttl_nodes);
-        while(ttl_nodes--) {
-                flow_entry  = cl->bft_list.bft[cl->bft_list.r_h].bft;
-                chain_index = cl->bft_list.bft[cl->bft_list.r_h].chain_index; //flow_entry->idle_timeout;
-                if(flow_entry) {
-                        CLEAR_BIT(flow_entry->sc->highest_downstream_nf_index_id, chain_index);
-                        cl->bft_list.bft[cl->bft_list.r_h].bft = NULL;
-                        cl->bft_list.bft[cl->bft_list.r_h].chain_index = 0;
-                        //cl->bft_list.r_h = (((cl->bft_list.r_h+1) == cl->bft_list.max_len)?(0):(cl->bft_list.r_h+1));
-                        if((++(cl->bft_list.r_h)) == cl->bft_list.max_len) cl->bft_list.r_h=0;
-                        cl->bft_list.bft_count--;
-                        deleted_nodes++;
-                }
-        }
-        //printf("\n CQ[E]: W_h:[%u], r_h:[%u], lc:[%u], to_del:[%u], del_nd:[%u], ttl_nd:[%d]",cl->bft_list.w_h,cl->bft_list.r_h,cl->bft_list.bft_count, to_del, deleted_nodes, (int)ttl_nodes);
-#else
-        struct onvm_flow_entry *flow_entry = NULL;
-        unsigned rx_q_count=cl->bft_list.max_len;  //CLIENT_QUEUE_RINGSIZE; //cl->bft_list.bft_count;
-        uint16_t i =0;
-        for(i=0; i<rx_q_count; ++i) {
-                flow_entry = cl->bft_list.bft[i].bft; //cl->bft_list.bft[rx_q_count-1-i];
-                if(NULL == flow_entry) continue;
-
-                //CLEAR_BIT(flow_entry->sc->highest_downstream_nf_index_id, flow_entry->idle_timeout);
-                CLEAR_BIT(flow_entry->sc->highest_downstream_nf_index_id, cl->bft_list.bft[i].chain_index);
-                cl->bft_list.bft[i].bft = NULL;
-                cl->bft_list.bft[i].chain_index = 0;
-                if(cl->bft_list.bft_count) cl->bft_list.bft_count--;
-        }
-#endif
-}
-#endif //ENABLE_SAVE_BACKLOG_FT_PER_NF
-
 void onvm_detect_and_set_back_pressure_v2(struct client *cl) {
         if(!cl || cl->is_bottleneck) return ;
+        #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+        if(!cl->wm.in_bkpr) {
+                cl->wm.in_bkpr = 1;
+                cl->wm.bkpr_events++;
+        }
+        #endif //ENABLE_NF_WATERMARK_AUTOTUNE
         cl->is_bottleneck = 1;
         enqueu_nf_to_bottleneck_watch_list(cl->info->instance_id);
 }
@@ -659,11 +1390,16 @@ onvm_detect_and_set_back_pressure(struct rte_mbuf *pkts[], uint16_t count, struc
 
 
         //Inside this function indicates NFs Rx buffer has exceeded water-mark
+        #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+        if(!cl->wm.in_bkpr) {
+                cl->wm.in_bkpr = 1;
+                cl->wm.bkpr_events++;
+        }
+        #endif //ENABLE_NF_WATERMARK_AUTOTUNE
 
-        /** global single chain scenario:: Note: This only works for the default chain case where service ID of chain is always in increasing order **/
+        /** global single chain scenario: mark the default chain entries of this NF's service **/
         if(global_bkpr_mode) {
-                downstream_nf_overflow = 1;
-                SET_BIT(highest_downstream_nf_service_id, cl->info->service_id);//highest_downstream_nf_service_id = cl->info->service_id;
+                onvm_nf_set_global_back_pressure(cl->info->service_id);
                 return;
         }
 
@@ -679,22 +1415,15 @@ onvm_detect_and_set_back_pressure(struct rte_mbuf *pkts[], uint16_t count, struc
 
                         //Check the Flow Entry mark status and Add mark if not already done!
                         if(!(TEST_BIT(flow_entry->sc->highest_downstream_nf_index_id, meta->chain_index))) {
-                                SET_BIT(flow_entry->sc->highest_downstream_nf_index_id, meta->chain_index);
-
-                                // Add Flow Entry to the List of FTs marked as bottleneck
-                                #ifdef ENABLE_SAVE_BACKLOG_FT_PER_NF
-                                write_ft_to_cl_bft(cl, flow_entry, meta->chain_index);
-                                #endif //ENABLE_SAVE_BACKLOG_FT_PER_NF
+                                // Tag the mark with this NF's generation, so that the NF can later clear it in O(1)
+                                #ifdef ENABLE_BKPR_GENERATION_MARKS
+                                onvm_bkpr_tag_chain_mark(cl, flow_entry->sc, meta->chain_index);
+                                #endif //ENABLE_BKPR_GENERATION_MARKS
+                                onvm_bkpr_mark_chain_index(&flow_entry->sc->highest_downstream_nf_index_id, meta->chain_index);
                         //}
                                 #ifdef NF_BACKPRESSURE_APPROACH_2
-                                uint8_t index = 1;
-                                //for(; index < meta->chain_index; index++ ) {
-                                for(index=(meta->chain_index -1); index >=1 ; index-- ) {
-                                        clients[flow_entry->sc->nf_instance_id[index]].throttle_this_upstream_nf=1;
-                                        #ifdef HOP_BY_HOP_BACKPRESSURE
-                                        break;
-                                        #endif //HOP_BY_HOP_BACKPRESSURE
-                                }
+                                // throttle the upstream set of this chain index
+                                onvm_nf_throttle_chain_nfs(flow_entry->sc, flow_entry->sc->bkpr_upstream[meta->chain_index], 1);
                                 #endif  //NF_BACKPRESSURE_APPROACH_2
                                 //approach: extend the service chain to keep track of client_nf_ids that service the chain, in-order to know which NFs to throttle in the wakeup thread..?
                                 //Test and Set
@@ -712,29 +1441,96 @@ onvm_detect_and_set_back_pressure(struct rte_mbuf *pkts[], uint16_t count, struc
         #endif //ENABLE_NF_BACKPRESSURE
 }
 
+#ifdef ENABLE_NF_SOJOURN_AQM
+#define NF_AQM_CLEAR    (-1)    //sojourn below target: reset backpressure
+#define NF_AQM_HOLD     (0)     //keep the current backpressure state
+#define NF_AQM_SIGNAL   (1)     //mark backpressure/ECN now
+static inline uint32_t nf_aqm_isqrt(uint32_t x) {
+        uint32_t r = x, y = (x + 1)/2;
+        if(x < 2) return x;
+        while(y < r) {
+                r = y;
+                y = (r + x/r)/2;
+        }
+        return r;
+}
+/* CoDel style control law on the sojourn of pkts through the NF (enqueue to Rx ring till dequeue from Tx ring):
+ * signal once the minimum sojourn of the dequeued batches stays above NF_AQM_TARGET_IN_US for NF_AQM_INTERVAL_IN_US,
+ * then every interval/sqrt(count) while it remains above; leave the signalling state as soon as it drops below target.
+ */
+static inline int onvm_nf_aqm_on_dequeue(struct rte_mbuf *pkts[], uint16_t count, struct client *cl) {
+        uint32_t now = onvm_get_pkt_ts_now();
+        uint64_t now_tsc = rte_rdtsc();
+        uint64_t interval = (rte_get_tsc_hz()/SECOND_TO_MICRO_SECOND)*NF_AQM_INTERVAL_IN_US;
+        uint64_t sojourn_us = UINT64_MAX, pkt_sojourn_us;
+        uint16_t i;
+        int above = 0;
+
+        for(i = 0; i < count; i++) {
+                pkt_sojourn_us = onvm_get_pkt_sojourn_in_us(pkts[i], now);
+                if(pkt_sojourn_us < sojourn_us) sojourn_us = pkt_sojourn_us;
+        }
+        cl->aqm.sojourn_us = sojourn_us;
+
+        // below target or (nearly) empty Rx ring: no standing queue
+        if(sojourn_us < NF_AQM_TARGET_IN_US || rte_ring_count(cl->rx_q) <= PACKET_READ_SIZE) {
+                cl->aqm.first_above_tsc = 0;
+        } else if(0 == cl->aqm.first_above_tsc) {
+                cl->aqm.first_above_tsc = now_tsc + interval;
+        } else if(now_tsc >= cl->aqm.first_above_tsc) {
+                above = 1;
+        }
+
+        if(cl->aqm.signalling) {
+                if(!above) {
+                        cl->aqm.signalling = 0;
+                        return (cl->aqm.first_above_tsc)? (NF_AQM_HOLD):(NF_AQM_CLEAR);
+                }
+                if(now_tsc >= cl->aqm.signal_next_tsc) {
+                        cl->aqm.count++;
+                        cl->aqm.signals++;
+                        cl->aqm.signal_next_tsc += interval/nf_aqm_isqrt(cl->aqm.count);
+                        return NF_AQM_SIGNAL;
+                }
+                return NF_AQM_HOLD;
+        }
+        if(above) {
+                // resume near the last signalling rate if we just left the signalling state
+                uint32_t delta = cl->aqm.count - cl->aqm.last_count;
+                cl->aqm.count = (delta > 1 && (now_tsc - cl->aqm.signal_next_tsc) < 16*interval)? (delta):(1);
+                cl->aqm.last_count = cl->aqm.count;
+                cl->aqm.signal_next_tsc = now_tsc + interval/nf_aqm_isqrt(cl->aqm.count);
+                cl->aqm.signalling = 1;
+                cl->aqm.signals++;
+                return NF_AQM_SIGNAL;
+        }
+        return (cl->aqm.first_above_tsc)? (NF_AQM_HOLD):(NF_AQM_CLEAR);
+}
+#endif //ENABLE_NF_SOJOURN_AQM
+
 void
 onvm_check_and_reset_back_pressure_v2(__attribute__((unused)) struct rte_mbuf *pkts[], __attribute__((unused)) uint16_t count, __attribute__((unused)) struct client *cl) {
 
         #ifdef ENABLE_NF_BACKPRESSURE
-        #if defined(RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE) || defined(ENABLE_ECN_CE)
+        #ifdef ENABLE_NF_SOJOURN_AQM
+        if(NF_AQM_SIGNAL == onvm_nf_aqm_on_dequeue(pkts, count, cl)) {
+                onvm_detect_and_set_back_pressure_v2(cl);
+                #ifdef ENABLE_ECN_CE
+                onvm_detect_and_set_ecn_ce(pkts, 1, cl);
+                #endif //ENABLE_ECN_CE
+        }
+        return;
+        #endif //ENABLE_NF_SOJOURN_AQM
+        #ifdef RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
         unsigned rx_q_count = rte_ring_count(cl->rx_q);
         // check if rx_q_size has decreased to acceptable level
-        if (rx_q_count >= CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE) {
-                #ifdef RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
-                if(rx_q_count >=CLIENT_QUEUE_RING_WATER_MARK_SIZE) {
+        if (rx_q_count >= NF_RX_Q_LOW_WM(cl)) {
+                if(rx_q_count >= NF_RX_Q_HIGH_WM(cl)) {
                         onvm_detect_and_set_back_pressure_v2(cl);
                 }
-                #endif //RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
-
-                #ifdef ENABLE_ECN_CE
-                if(cl->info->ht2_q.ewma_avg >= CLIENT_QUEUE_RING_ECN_MARK_SIZE) { //if(cl->info->ht2_q.ewma_avg >= CLIENT_QUEUE_RING_WATER_MARK_SIZE) {
-                        onvm_detect_and_set_ecn_ce(pkts, count, cl);
-                }
-                #endif //ENABLE_ECN_CE
-
                 return;
         }
-        #endif //RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE || ENABLE_ECN_CE
+        #endif //RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
         #endif //ENABLE_NF_BACKPRESSURE
         return;
 }
@@ -747,89 +1543,65 @@ onvm_check_and_reset_back_pressure(struct rte_mbuf *pkts[], uint16_t count, stru
         struct onvm_pkt_meta *meta = NULL;
         struct onvm_flow_entry *flow_entry = NULL;
         uint16_t i;
+
+        #ifdef ENABLE_NF_SOJOURN_AQM
+        // check if the sojourn time has decreased to acceptable level; signal with backpressure (and ECN CE on one pkt) as per the control law
+        int aqm_status = onvm_nf_aqm_on_dequeue(pkts, count, cl);
+        if (NF_AQM_CLEAR != aqm_status) {
+                if (NF_AQM_SIGNAL == aqm_status) {
+                        onvm_detect_and_set_back_pressure(pkts, count, cl);
+                        #ifdef ENABLE_ECN_CE
+                        onvm_detect_and_set_ecn_ce(pkts, 1, cl);
+                        #endif //ENABLE_ECN_CE
+                }
+                return;
+        }
+        #else
         unsigned rx_q_count = rte_ring_count(cl->rx_q);
 
         // check if rx_q_size has decreased to acceptable level
-        if (rx_q_count >= CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE) {
-
-                #if defined(RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE) || defined(ENABLE_ECN_CE)
-                if(rx_q_count >=CLIENT_QUEUE_RING_WATER_MARK_SIZE) {
+        if (rx_q_count >= NF_RX_Q_LOW_WM(cl)) {
 
-                        #ifdef RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
+                #ifdef RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
+                if(rx_q_count >= NF_RX_Q_HIGH_WM(cl)) {
                         onvm_detect_and_set_back_pressure(pkts,count,cl);
-                        #endif //RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
-
-                        #ifdef ENABLE_ECN_CE
-                        onvm_detect_and_set_ecn_ce(pkts, count, cl);
-                        #endif //ENABLE_ECN_CE
                 }
-                #endif //RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE || ENABLE_ECN_CE
+                #endif //RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE
                 return;
         }
-
+        #endif //ENABLE_NF_SOJOURN_AQM
 
         //Inside here indicates NFs Rx buffer has resumed to acceptable level (watermark - hysterisis)
+        #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+        cl->wm.in_bkpr = 0;
+        #endif //ENABLE_NF_WATERMARK_AUTOTUNE
 
-        /** global single chain scenario:: Note: This only works for the default chain case where service ID of chain is always in increasing order **/
+        /** global single chain scenario: clear the default chain entries of this NF's service **/
         if(global_bkpr_mode) {
                 if (downstream_nf_overflow) {
-                        // If service id is of any downstream that is/are bottlenecked then "move the lowest literally to next higher number" and when it is same as highsest reset bottlenext flag to zero
-                        //  if(rte_ring_count(cl->rx_q) < CLIENT_QUEUE_RING_WATER_MARK_SIZE) {
-                        if(rte_ring_count(cl->rx_q) < CLIENT_QUEUE_RING_LOW_WATER_MARK_SIZE) {
-                                if (TEST_BIT(highest_downstream_nf_service_id, cl->info->service_id)) { //if (cl->info->service_id == highest_downstream_nf_service_id) {
-                                        CLEAR_BIT(highest_downstream_nf_service_id, cl->info->service_id);
-                                        if (highest_downstream_nf_service_id == 0) {
-                                                downstream_nf_overflow = 0;
-                                        }
-                                }
+                        if(rte_ring_count(cl->rx_q) < NF_RX_Q_LOW_WM(cl)) {
+                                onvm_nf_clear_global_back_pressure(cl->info->service_id);
                         }
                 }
                 return;
         }
 
-#ifdef ENABLE_SAVE_BACKLOG_FT_PER_NF
-        //  if acceptable range then for all service chains, if marked to be overflow, then reset the overflow status
-        /*
-        rx_q_count=cl->bft_list.max_len;  //CLIENT_QUEUE_RINGSIZE; //cl->bft_list.bft_count;
-        for(i=0; i<rx_q_count; ++i) {
-                flow_entry = cl->bft_list.bft[i].bft; //cl->bft_list.bft[rx_q_count-1-i];
-                if(NULL == flow_entry) continue;
-
-                //CLEAR_BIT(flow_entry->sc->highest_downstream_nf_index_id, flow_entry->idle_timeout);
-                CLEAR_BIT(flow_entry->sc->highest_downstream_nf_index_id, cl->bft_list.bft[i].chain_index);
-                cl->bft_list.bft[i].bft = NULL;
-                cl->bft_list.bft[i].chain_index = 0;
-                if(cl->bft_list.bft_count)
-                        cl->bft_list.bft_count--;
-
-                #ifdef NF_BACKPRESSURE_APPROACH_2
-                // detect the start nf_index based on new val of highest_downstream_nf_index_id
-                unsigned nf_index=(flow_entry->sc->highest_downstream_nf_index_id == 0)? (1): (get_index_of_highest_set_bit(flow_entry->sc->highest_downstream_nf_index_id));
-                for(; nf_index < flow_entry->idle_timeout; nf_index++) {
-                        clients[flow_entry->sc->nf_instance_id[nf_index]].throttle_this_upstream_nf=0;
-                }
-                #endif //NF_BACKPRESSURE_APPROACH_2
-
-        }
-        */
-        read_all_ft_frm_cl_bft(cl);
+#ifdef ENABLE_BKPR_GENERATION_MARKS
+        //  if acceptable range then invalidate all the chain marks set by this NF (cleared lazily at onvm_pkt_enqueue_nf())
+        onvm_bkpr_clear_nf_marks(cl);
         return;
-#endif //ENABLE_SAVE_BACKLOG_FT_PER_NF
+#endif //ENABLE_BKPR_GENERATION_MARKS
 
         for(i = 0; i < count; i++) {
                 int ret = get_flow_entry(pkts[i], &flow_entry);
                 if (ret >= 0 && flow_entry && flow_entry->sc) {
                         if(flow_entry->sc->highest_downstream_nf_index_id ) {
                                 meta = onvm_get_pkt_meta(pkts[i]);
-                                if(TEST_BIT(flow_entry->sc->highest_downstream_nf_index_id, meta->chain_index )) {
-                                        // also reset the chain's downstream NFs cl->downstream_nf_overflow and cl->highest_downstream_nf_index_id=0. But How?? <track the nf_instance_id in the service chain.
-                                        CLEAR_BIT(flow_entry->sc->highest_downstream_nf_index_id, meta->chain_index);
+                                // also reset the chain's downstream NFs cl->downstream_nf_overflow and cl->highest_downstream_nf_index_id=0. But How?? <track the nf_instance_id in the service chain.
+                                if(onvm_bkpr_clear_chain_index(&flow_entry->sc->highest_downstream_nf_index_id, meta->chain_index)) {
                                         #ifdef NF_BACKPRESSURE_APPROACH_2
-                                        // detect the start nf_index based on new val of highest_downstream_nf_index_id
-                                        unsigned nf_index=(flow_entry->sc->highest_downstream_nf_index_id == 0)? (1): (get_index_of_highest_set_bit(flow_entry->sc->highest_downstream_nf_index_id));
-                                        for(; nf_index < meta->chain_index; nf_index++) {
-                                                clients[flow_entry->sc->nf_instance_id[nf_index]].throttle_this_upstream_nf=0;
-                                        }
+                                        // release the upstream set of this chain index, except the NFs still upstream of another bottleneck of the chain
+                                        onvm_nf_throttle_chain_nfs(flow_entry->sc, (flow_entry->sc->bkpr_upstream[meta->chain_index] & ~onvm_sc_bkpr_throttle_set(flow_entry->sc)), 0);
                                         #endif //NF_BACKPRESSURE_APPROACH_2
                                 }
                         }
@@ -57,6 +57,15 @@
 /*********************************Interfaces**********************************/
 
 
+/*
+ * Interface to cache the per-run constants (tsc rate) used on the packet path.
+ * Call once after the EAL is initialized and before the RX threads start.
+ *
+ */
+void
+onvm_pkt_init(void);
+
+
 /*
  * Interface to process packets in a given RX queue.
  *
@@ -114,15 +123,17 @@ onvm_pkt_drop_batch(struct rte_mbuf **pkts, uint16_t size);
 
 
 
-/* Interface to check and set ECN CE FLAG status after enqueue of packets to RX queue.
+/* Interface to set ECN CE FLAG on a burst of packets dequeued from the TX queue of a congested NF.
+ * Only ECN capable (ECT) IPv4 packets are marked and their header checksum is updated incrementally.
  *
  * Inputs :
  *          an array of packets
  *          the size/count of buffers in the array
- *          a pointer to the client possessing the RX queue.
+ *          a pointer to the client possessing the TX queue (for stats, can be NULL).
+ * Output : the number of packets newly marked
  *
  */
-void
+uint16_t
 onvm_detect_and_set_ecn_ce(struct rte_mbuf *pkts[], uint16_t count, struct client *cl);
 
 /* Interface to check and set back-pressure status after enqueue of packets to RX queue.
@@ -171,6 +182,31 @@ onvm_pkt_flush_port_queue(struct thread_info *tx, uint16_t port);
 void
 onvm_pkt_flush_nf_queue(struct thread_info *thread, uint16_t client);
 
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+/* Count of NFs whose hold queue is above the pause threshold: NIC Rx is not read while non-zero */
+extern rte_atomic16_t lossless_rx_paused_nfs;
+
+/*
+ * Function releasing (dropping) all the pkts held for a NF, when it stops.
+ *
+ * Input : a pointer to the NF
+ *
+ */
+void
+onvm_pkt_lossless_release_held(struct client *cl);
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
+
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+/*
+ * Function releasing (dropping) all the pkts left in the priority class rings of a NF, when it stops.
+ *
+ * Input : a pointer to the NF
+ *
+ */
+void
+onvm_pkt_rx_prio_release(struct client *cl);
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
 
 /*
  * Function to enqueue a packet on one port's queue.
@@ -51,6 +51,7 @@
 #include "onvm_mgr.h"
 #include "onvm_stats.h"
 #include "onvm_nf.h"
+#include "onvm_wakemgr.h"
 
 
 /****************************Interfaces***************************************/
@@ -59,7 +60,19 @@ void
 onvm_stats_display_all(unsigned difftime) {
         onvm_stats_clear_terminal();
         onvm_stats_display_ports(difftime);
+        #ifdef ENABLE_ELASTIC_MGR_CORES
+        onvm_stats_display_mgr_cores(difftime);
+        #endif //ENABLE_ELASTIC_MGR_CORES
+        #ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+        onvm_stats_display_wake_thread(difftime);
+        #endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
         onvm_stats_display_clients(difftime);
+        #ifdef ENABLE_NF_AUTO_SCALING
+        onvm_stats_display_nf_scaling();
+        #endif //ENABLE_NF_AUTO_SCALING
+        #ifdef ENABLE_MBUF_QUOTAS
+        onvm_stats_display_mbuf_quotas();
+        #endif //ENABLE_MBUF_QUOTAS
         onvm_stats_display_chains(difftime);
 }
 
@@ -172,6 +185,98 @@ onvm_stats_display_ports(unsigned difftime) {
 }
 
 
+#ifdef ENABLE_ELASTIC_MGR_CORES
+void
+onvm_stats_display_mgr_cores(unsigned difftime) {
+        unsigned i;
+        static uint64_t folded_last[ELASTIC_MAX_TX_THREADS];
+        static const char *state_str[] = {"active", "park_req", "parked", "unpark_req"};
+
+        printf("\nMGR CORES\n");
+        printf("-----\n");
+        printf("TX threads active: %u/%u, tx ring backlog: %u (ewma %u)\n",
+                elastic_mgr.active_tx_threads, elastic_mgr.tx_threads, elastic_mgr.backlog, elastic_mgr.backlog_ewma);
+        for (i = 0; i < elastic_mgr.tx_threads; i++) {
+                printf("TX %u: %-10s parked: %"PRIu64" folded: %9"PRIu64" (%9"PRIu64" pps)\n", i,
+                        state_str[elastic_mgr.tx[i].state & 0x3], elastic_mgr.tx[i].park_count, elastic_mgr.tx[i].folded_pkts,
+                        (elastic_mgr.tx[i].folded_pkts - folded_last[i])/difftime);
+                folded_last[i] = elastic_mgr.tx[i].folded_pkts;
+        }
+        printf("\n");
+}
+#endif //ENABLE_ELASTIC_MGR_CORES
+
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+void
+onvm_stats_display_wake_thread(unsigned difftime) {
+        unsigned i;
+        uint64_t total = 0, delta[WAKE_BACKOFF_STAGES];
+        static uint64_t stage_last[WAKE_BACKOFF_STAGES];
+        static uint64_t rings_last, lat_sum_last;
+        uint64_t rings = wake_backoff.doorbell_rings - rings_last;
+        uint64_t hz_us = rte_get_tsc_hz()/1000000;
+
+        for (i = 0; i < WAKE_BACKOFF_STAGES; i++) {
+                delta[i] = wake_backoff.stage_cycles[i] - stage_last[i];
+                stage_last[i] = wake_backoff.stage_cycles[i];
+                total += delta[i];
+        }
+        if (total == 0) total = 1;
+
+        printf("\nWAKE THREAD\n");
+        printf("-----\n");
+        //poll and pause burn the core, nanosleep and block give it back
+        printf("poll: %5.1f%% pause: %5.1f%% nanosleep: %5.1f%% blocked: %5.1f%% | doorbell wakes: %9"PRIu64" (%"PRIu64" /s) wake latency avg: %"PRIu64" us max: %"PRIu64" us\n\n",
+                (100.0*delta[WAKE_BACKOFF_STAGE_POLL])/total, (100.0*delta[WAKE_BACKOFF_STAGE_PAUSE])/total,
+                (100.0*delta[WAKE_BACKOFF_STAGE_NANOSLEEP])/total, (100.0*delta[WAKE_BACKOFF_STAGE_BLOCK])/total,
+                wake_backoff.doorbell_rings, rings/difftime,
+                (rings)? ((wake_backoff.wake_lat_cycles_sum - lat_sum_last)/rings/hz_us):(0), wake_backoff.wake_lat_cycles_max/hz_us);
+        rings_last = wake_backoff.doorbell_rings;
+        lat_sum_last = wake_backoff.wake_lat_cycles_sum;
+}
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
+#ifdef ENABLE_NF_AUTO_SCALING
+void
+onvm_stats_display_nf_scaling(void) {
+        uint16_t sid;
+
+        printf("\nSERVICES\n");
+        printf("-----\n");
+        for (sid = 0; sid < num_services && sid < MAX_SERVICES; sid++) {
+                if (!nf_per_service_count[sid] && !nf_scale_info[sid].standby_count) continue;
+                printf("Service %2u: active: %u standby: %u capacity: %9"PRIu64" pps scale_out: %"PRIu64" scale_in: %"PRIu64"%s\n",
+                        sid, nf_per_service_count[sid], nf_scale_info[sid].standby_count, nf_scale_info[sid].capacity_pps,
+                        nf_scale_info[sid].scale_out_count, nf_scale_info[sid].scale_in_count,
+                        (nf_scale_info[sid].launch_pending)? (" (launch pending)"):(""));
+        }
+        printf("\n");
+}
+#endif //ENABLE_NF_AUTO_SCALING
+
+#ifdef ENABLE_MBUF_QUOTAS
+void
+onvm_stats_display_mbuf_quotas(void) {
+        uint16_t o;
+        unsigned i;
+
+        printf("\nMBUFS\n");
+        printf("-----\n");
+        printf("Pool: in_use: %u/%u, chain default quota: %u\n", mbuf_quota->pool_size - rte_mempool_count(pktmbuf_pool), mbuf_quota->pool_size, mbuf_quota->chain_quota);
+        for (o = 1; o < mbuf_quota->next_owner && o < MBUF_QUOTA_MAX_CHAINS; o++) {
+                if (!rte_atomic32_read(&mbuf_quota->chain[o].inuse) && !mbuf_quota->chain[o].quota_drop) continue;
+                printf("Chain owner %4u: in_use: %6d peak: %6u quota: %6u quota_drop: %9"PRIu64"\n", o, rte_atomic32_read(&mbuf_quota->chain[o].inuse),
+                        mbuf_quota->chain[o].peak, mbuf_quota->chain[o].quota, mbuf_quota->chain[o].quota_drop);
+        }
+        for (i = 0; i < MAX_CLIENTS; i++) {
+                if (!rte_atomic32_read(&mbuf_quota->nf[i].inuse) && !mbuf_quota->nf[i].quota_drop) continue;
+                printf("Client %2u buffered: %6d quota: %6u refused: %9"PRIu64"\n", i, rte_atomic32_read(&mbuf_quota->nf[i].inuse),
+                        mbuf_quota->nf[i].quota, mbuf_quota->nf[i].quota_drop);
+        }
+        printf("\n");
+}
+#endif //ENABLE_MBUF_QUOTAS
+
 int get_onvm_nf_stats_snapshot_v2(unsigned nf_index, onvm_stats_snapshot_t *snapshot, unsigned difftime) {
 
 #ifdef INTERRUPT_SEM
@@ -353,7 +458,7 @@ onvm_stats_display_clients(unsigned difftime) {
         #endif
 
 #ifdef ENABLE_NF_BACKPRESSURE
-        printf("BkprMode=[%d], OverflowFlag=[%d], Highest_DS_SID=[%d], Lowest_DS_SID=[%d], Num Throttles=[%"PRIu64"] \n", global_bkpr_mode, downstream_nf_overflow, highest_downstream_nf_service_id, lowest_upstream_to_throttle, throttle_count);
+        printf("BkprMode=[%d], OverflowFlag=[%d], Bneck_SIDs=[0x%x], Upstream_SIDs=[0x%x], Num Throttles=[%"PRIu64"] \n", global_bkpr_mode, downstream_nf_overflow, global_bneck_services, global_upstream_services, throttle_count);
 #endif  //ENABLE_NF_BACKPRESSURE
 
         printf("\nCLIENTS\n");
@@ -424,7 +529,7 @@ onvm_stats_display_clients(unsigned difftime) {
                 //printf("rx_overflow=[%d], ThrottleNF_Flag=[%d], Highest_DS_SID=[%d] NF_Throttle_count=[%"PRIu64"], \n", clients[i].rx_buffer_overflow, clients[i].throttle_this_upstream_nf, clients[i].highest_downstream_nf_index_id, clients[i].throttle_count);
                 //#ifdef NF_BACKPRESSURE_APPROACH_1
                 #if defined (NF_BACKPRESSURE_APPROACH_1) && defined (BACKPRESSURE_EXTRA_DEBUG_LOGS)
-                printf(" bottlenec_status=[%d], bottleneck_flows=[%d], bkpr_count [%d], max_rx_q_len=[%d], max_tx_q_len=[%d], bkpr_drop=%"PRIu64", bkpr_drop_rate=%"PRIu64"\n",clients[i].is_bottleneck, clients[i].bft_list.bft_count, clients[i].stats.bkpr_count,clients[i].stats.max_rx_q_len, clients[i].stats.max_tx_q_len, clients[i].stats.bkpr_drop,(clients[i].stats.bkpr_drop - clients[i].stats.prev_bkpr_drop)/ difftime);
+                printf(" bottlenec_status=[%d], bkpr_gen=[%u], bkpr_marked=[%d], bkpr_count [%d], max_rx_q_len=[%d], max_tx_q_len=[%d], bkpr_drop=%"PRIu64", bkpr_drop_rate=%"PRIu64"\n",clients[i].is_bottleneck, clients[i].bkpr_gen, clients[i].bkpr_marked, clients[i].stats.bkpr_count,clients[i].stats.max_rx_q_len, clients[i].stats.max_tx_q_len, clients[i].stats.bkpr_drop,(clients[i].stats.bkpr_drop - clients[i].stats.prev_bkpr_drop)/ difftime);
                 clients[i].stats.prev_bkpr_drop = clients[i].stats.bkpr_drop;
                 clients[i].stats.max_rx_q_len=0;
                 clients[i].stats.max_tx_q_len=0;
@@ -434,8 +539,33 @@ onvm_stats_display_clients(unsigned difftime) {
                 #ifdef NF_BACKPRESSURE_APPROACH_2
                 printf("ThrottleNF_Flag=[%d], NF_Throttle_count=[%"PRIu64"], \n", clients[i].throttle_this_upstream_nf, clients[i].throttle_count);
                 #endif //NF_BACKPRESSURE_APPROACH_2
+
+                #ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+                printf(" rx_q_wm:[high=%u, low=%u, ecn=%u, avg_arrivals=%"PRIu64", avg_dev=%"PRIu64", tuned=%"PRIu64"]\n", clients[i].wm.high, clients[i].wm.low, clients[i].wm.ecn, clients[i].wm.avg_arrivals, clients[i].wm.avg_dev, clients[i].wm.tune_count);
+                #endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
+                #ifdef ENABLE_NF_SOJOURN_AQM
+                printf(" aqm:[sojourn_us=%"PRIu64", signalling=%d, count=%u, signals=%"PRIu64"]\n", clients[i].aqm.sojourn_us, clients[i].aqm.signalling, clients[i].aqm.count, clients[i].aqm.signals);
+                #endif //ENABLE_NF_SOJOURN_AQM
         #endif  //ENABLE_NF_BACKPRESSURE
 
+                #ifdef ENABLE_LOSSLESS_CREDIT_MODE
+                printf(" lossless:[hold_qlen=%u, held=%"PRIu64", rx_paused=%d, pauses=%"PRIu64"]\n", rte_ring_count(clients[i].hold_q) + clients[i].hold_head_cnt, clients[i].held, clients[i].hold_paused, clients[i].hold_pauses);
+                #endif //ENABLE_LOSSLESS_CREDIT_MODE
+
+                #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+                {
+                        unsigned c;
+                        for (c = 0; c < NF_RX_BULK_CLASS; c++) {
+                                printf(" rx_prio[%u]:[qlen=%u, rx=%"PRIu64", rx_drop=%"PRIu64", in_bkpr=%d, bkpr_events=%"PRIu64", bkpr_drop=%"PRIu64"]\n", c, rte_ring_count(clients[i].rx_prio[c].q), clients[i].rx_prio[c].rx, clients[i].rx_prio[c].rx_drop, clients[i].rx_prio[c].in_bkpr, clients[i].rx_prio[c].bkpr_events, clients[i].rx_prio[c].bkpr_drop);
+                        }
+                }
+                #endif //ENABLE_NF_RX_PRIORITY_RINGS
+
+                #ifdef ENABLE_ECN_CE
+                printf(" ecn:[ewma_rx_q=%u, mark_level=%u, ce_marked=%"PRIu64", bursts=%"PRIu64"]\n", clients[i].info->ht2_q.ewma_avg, (unsigned)NF_RX_Q_ECN_WM(&clients[i]), clients[i].ecn_ce_marked, clients[i].ecn_ce_bursts);
+                #endif //ENABLE_ECN_CE
+
         #ifdef USE_CGROUPS_PER_NF_INSTANCE
                 //printf("Pid:[%d], CoreId:[%d], cpu_share:[%d], compcost:[%d], load:[%d,%d], svc_rate:[%d,%d] prio:[%d,%d,%d] \n", clients[i].info->pid, clients[i].info->core_id, clients[i].info->cpu_share, clients[i].info->comp_cost, clients[i].info->load, clients[i].info->avg_load, clients[i].info->svc_rate, clients[i].info->avg_svc, sched_getscheduler(clients[i].info->pid), getpriority(PRIO_PROCESS, clients[i].info->pid), nice(0));
                 //printf("Pid:[%d], CoreId:[%d], cpu_share:[%d], compcost:[%d], load:[%d,%d], svc_rate:[%d,%d] prio:[%d,%d,%d] bkpr:[%d,%d,%d]\n", clients[i].info->pid, clients[i].info->core_id, clients[i].info->cpu_share, clients[i].info->comp_cost, clients[i].info->load, clients[i].info->avg_load, clients[i].info->svc_rate, clients[i].info->avg_svc, sched_getscheduler(clients[i].info->pid), getpriority(PRIO_PROCESS, clients[i].info->pid), nice(0), bottleneck_nf_list.nf[clients[i].instance_id].enqueue_status, bottleneck_nf_list.nf[clients[i].instance_id].enqueued_ctr, bottleneck_nf_list.nf[clients[i].instance_id].marked_ctr);
@@ -444,6 +574,10 @@ onvm_stats_display_clients(unsigned difftime) {
                 printf("bkpr:[%d,%d,%d]", bottleneck_nf_list.nf[clients[i].instance_id].enqueue_status, bottleneck_nf_list.nf[clients[i].instance_id].enqueued_ctr, bottleneck_nf_list.nf[clients[i].instance_id].marked_ctr);
                 #endif
 
+                #ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                printf(" deadline:[slack_us=%"PRId64", missed=%"PRIu64"]", ((clients[i].deadline.slack_us == INT64_MAX)? (0):(clients[i].deadline.slack_us)), clients[i].deadline.missed);
+                #endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+
                 #ifdef STORE_HISTOGRAM_OF_NF_COMPUTATION_COST
                 printf("\n Histogram: TtlCnt[%d], Min:[%d], Max:[%d], RAvg:[%d] Median:[%d] PT25:[%d], PT99:[%d] \n", clients[i].info->ht2.histogram.total_count, clients[i].info->ht2.min_val, clients[i].info->ht2.max_val, clients[i].info->ht2.running_avg, clients[i].info->ht2.median_val, hist_percentile(&clients[i].info->ht2.histogram, VAL_TYPE_25_PERCENTILE),hist_percentile(&clients[i].info->ht2.histogram, VAL_TYPE_99_PERCENTILE) );
                 #endif
@@ -132,6 +132,39 @@ void onvm_stats_display_clients(unsigned difftime);
  * Input : time passed since last display (to compute packet rate)
  */
 void onvm_stats_display_chains(unsigned difftime);
+
+#ifdef ENABLE_ELASTIC_MGR_CORES
+/*
+ * Function displaying the state of the elastic TX threads (active/parked, pkts folded into the wakeup thread)
+ *
+ * Input : time passed since last display (to compute packet rate)
+ */
+void onvm_stats_display_mgr_cores(unsigned difftime);
+#endif //ENABLE_ELASTIC_MGR_CORES
+
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+/*
+ * Function displaying the wakeup thread idle backoff: share of time per stage (cpu burn) and doorbell wake latency
+ *
+ * Input : time passed since last display (to compute rate)
+ */
+void onvm_stats_display_wake_thread(unsigned difftime);
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
+#ifdef ENABLE_NF_AUTO_SCALING
+/*
+ * Function displaying per service active/standby instances and scale-out/in counts
+ */
+void onvm_stats_display_nf_scaling(void);
+#endif //ENABLE_NF_AUTO_SCALING
+
+#ifdef ENABLE_MBUF_QUOTAS
+/*
+ * Function displaying the occupancy of the shared mbuf pool per chain (owner slot) and per NF (buffered pkts)
+ */
+void onvm_stats_display_mbuf_quotas(void);
+#endif //ENABLE_MBUF_QUOTAS
+
 /******************************Helper functions*******************************/
 
 
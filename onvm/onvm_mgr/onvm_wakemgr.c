@@ -54,6 +54,7 @@
 
 #ifdef INTERRUPT_SEM
 #include <signal.h>
+#include <time.h>
 #include <rte_timer.h>
 //#define USE_NF_WAKE_THRESHOLD
 #ifdef USE_NF_WAKE_THRESHOLD
@@ -62,6 +63,13 @@ unsigned nfs_wakethr[MAX_CLIENTS] = {[0 ... MAX_CLIENTS-1] = 1};
 
 struct wakeup_info *wakeup_infos;
 
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+wake_backoff_info_t wake_backoff;
+static uint64_t wake_notify_count = 0;     //NFs notified by this thread (work done by a wake pass)
+static inline int wake_backoff_pending_wakeups(void);
+static inline void wake_backoff_idle(uint32_t notified);
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
 /***********************Internal Functions************************************/
 static inline int
 whether_wakeup_client(int instance_id);
@@ -231,7 +239,7 @@ whether_wakeup_client(int instance_id)
         #ifdef NF_BACKPRESSURE_APPROACH_2
         /* Block the upstream (earlier) NFs from getting scheduled, if there is NF at downstream that is bottlenecked! */
         if (downstream_nf_overflow) {
-                if (clients[instance_id].info != NULL && is_upstream_NF(highest_downstream_nf_service_id,clients[instance_id].info->service_id)) {
+                if (clients[instance_id].info != NULL && (global_upstream_services & BKPR_SERVICE_BIT(clients[instance_id].info->service_id))) {
                         throttle_count++;
                         return -1;
                 }
@@ -251,7 +259,7 @@ whether_wakeup_client(int instance_id)
                 return 1;
         }
 #else
-        if(rte_ring_count(clients[instance_id].rx_q)) return 1;
+        if(onvm_nf_rx_pending(&clients[instance_id])) return 1;
 #endif
         return 0;
 }
@@ -332,6 +340,9 @@ wakeup_client_internal(int instance_id) {
                 if (rte_atomic16_read(clients[instance_id].shm_server) ==1) {
                         rte_atomic16_set(clients[instance_id].shm_server, 0);
                         notify_client(instance_id);
+                        #ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+                        wake_notify_count++;
+                        #endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
                 }
         }
         #ifdef ENABLE_NF_BACKPRESSURE
@@ -388,7 +399,7 @@ static inline void handle_wakeup_old(struct wakeup_info *wakeup_info) {
 static inline void handle_wakeup_ordered(__attribute__((unused))struct wakeup_info *wakeup_info) {
 
         #if defined (USE_CGROUPS_PER_NF_INSTANCE)
-        /* Now wake up the NFs as per sorted priority:
+        /* Now wake up the NFs as per sorted priority (earliest deadline first with ENABLE_DEADLINE_AWARE_WAKE_ORDER):
          * Next step Handle slack period before wake-up and schedule NFs for wake up; otherwise
          * we are at the mercy of OS Scheduler to schedule the NFs in each core */
         unsigned i=0;
@@ -420,14 +431,107 @@ inline void handle_wakeup(__attribute__((unused))struct wakeup_info *wakeup_info
         return;
 }
 
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+/* Any NF blocked (shm_server == 1) with pkts pending in its Rx Ring? Re-checked after announcing sleep to avoid a lost wakeup. */
+static inline int
+wake_backoff_pending_wakeups(void) {
+        unsigned i;
+        for (i = 0; i < MAX_CLIENTS; i++) {
+                if (onvm_nf_is_valid(&clients[i]) && rte_atomic16_read(clients[i].shm_server) == 1 && onvm_nf_rx_pending(&clients[i]))
+                        return 1;
+        }
+        return 0;
+}
+
+/* Back off progressively after consecutive passes without any NF notified: poll -> pause -> nanosleep -> doorbell */
+static inline void
+wake_backoff_idle(uint32_t notified) {
+        static uint64_t last_tsc = 0;
+        uint64_t now = rte_get_tsc_cycles();
+        uint8_t max_stage = WAKE_BACKOFF_STAGE_BLOCK;
+
+        if (last_tsc) wake_backoff.stage_cycles[wake_backoff.stage] += (now - last_tsc);
+        last_tsc = now;
+
+        if (notified) {
+                wake_backoff.idle_passes = 0;
+                wake_backoff.stage = WAKE_BACKOFF_STAGE_POLL;
+                return;
+        }
+
+        #ifdef ENABLE_ELASTIC_MGR_CORES
+        //NFs Tx rings of parked TX threads are drained by this thread and do not ring the doorbell
+        if (elastic_mgr.active_tx_threads < elastic_mgr.tx_threads) max_stage = WAKE_BACKOFF_STAGE_NANOSLEEP;
+        #endif //ENABLE_ELASTIC_MGR_CORES
+
+        wake_backoff.idle_passes++;
+        if (wake_backoff.idle_passes < WAKE_BACKOFF_SPIN_PASSES) wake_backoff.stage = WAKE_BACKOFF_STAGE_POLL;
+        else if (wake_backoff.idle_passes < WAKE_BACKOFF_SPIN_PASSES + WAKE_BACKOFF_PAUSE_PASSES) wake_backoff.stage = WAKE_BACKOFF_STAGE_PAUSE;
+        else if (wake_backoff.idle_passes < WAKE_BACKOFF_SPIN_PASSES + WAKE_BACKOFF_PAUSE_PASSES + WAKE_BACKOFF_NANOSLEEP_PASSES) wake_backoff.stage = WAKE_BACKOFF_STAGE_NANOSLEEP;
+        else wake_backoff.stage = WAKE_BACKOFF_STAGE_BLOCK;
+        if (wake_backoff.stage > max_stage) wake_backoff.stage = max_stage;
+
+        switch (wake_backoff.stage) {
+        case WAKE_BACKOFF_STAGE_PAUSE:
+                {
+                        unsigned i;
+                        for (i = 0; i < WAKE_BACKOFF_PAUSE_COUNT; i++) rte_pause();
+                }
+                break;
+        case WAKE_BACKOFF_STAGE_NANOSLEEP:
+                {
+                        struct timespec ts = {.tv_sec = 0, .tv_nsec = WAKE_BACKOFF_NANOSLEEP_NS};
+                        nanosleep(&ts, NULL);
+                }
+                break;
+        case WAKE_BACKOFF_STAGE_BLOCK:
+                {
+                        struct timespec ts;
+                        wake_backoff.sleeping = 1;
+                        rte_smp_mb();
+                        if (wake_backoff_pending_wakeups()) {
+                                //raced with a flush that saw sleeping == 0: do not block
+                                if (!rte_atomic32_cmpset(&wake_backoff.sleeping, 1, 0)) sem_wait(&wake_backoff.doorbell);
+                                wake_backoff.idle_passes = 0;
+                                break;
+                        }
+                        clock_gettime(CLOCK_REALTIME, &ts);
+                        ts.tv_nsec += (WAKE_BACKOFF_BLOCK_TIMEOUT_US*1000);
+                        if (ts.tv_nsec >= 1000000000) { ts.tv_sec++; ts.tv_nsec -= 1000000000;}
+                        int ret;
+                        do { ret = sem_timedwait(&wake_backoff.doorbell, &ts); } while (ret != 0 && errno == EINTR);
+
+                        if (!rte_atomic32_cmpset(&wake_backoff.sleeping, 1, 0)) {
+                                //doorbell was rung (possibly right at the timeout: consume the post)
+                                uint64_t lat;
+                                if (ret != 0) sem_wait(&wake_backoff.doorbell);
+                                lat = rte_get_tsc_cycles() - wake_backoff.ring_tsc;
+                                wake_backoff.wake_lat_cycles_sum += lat;
+                                if (lat > wake_backoff.wake_lat_cycles_max) wake_backoff.wake_lat_cycles_max = lat;
+                                wake_backoff.idle_passes = 0;
+                        }
+                }
+                break;
+        default:
+                break;
+        }
+}
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
 int
 wakemgr_main(void *arg) {
 
 #ifdef ENABLE_USE_RTE_TIMER_MODE_FOR_WAKE_THREAD
         initialize_wake_timers(arg);
 #endif
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+        uint64_t notified_before = 0;
+        if ((struct wakeup_info *)arg == &wakeup_infos[0]) sem_init(&wake_backoff.doorbell, 0, 0);
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
 
+        onvm_flow_dir_reader_register();        //flushes NF buffers (and folds TX duties) on the flow entries
         while (true) {
+                onvm_flow_dir_quiescent();
                 //do it more periodically: poll mode (better than 100microsec delay)
                 check_and_enqueue_or_dequeue_nfs_from_bottleneck_watch_list();
 
@@ -437,6 +541,18 @@ wakemgr_main(void *arg) {
                 handle_wakeup((struct wakeup_info *)arg); //handle_wakeup_old((struct wakeup_info *)arg);
                 //usleep(USLEEP_INTERVAL);  ////usleep(WAKE_INTERVAL_IN_US);
 
+#ifdef ENABLE_ELASTIC_MGR_CORES
+                //TX duties of parked TX threads are folded into this thread
+                if ((struct wakeup_info *)arg == &wakeup_infos[0]) onvm_mgr_elastic_poll();
+#endif //ENABLE_ELASTIC_MGR_CORES
+
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+                if ((struct wakeup_info *)arg == &wakeup_infos[0]) {
+                        wake_backoff_idle((uint32_t)(wake_notify_count - notified_before));
+                        notified_before = wake_notify_count;
+                }
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
         }
 
         return 0;
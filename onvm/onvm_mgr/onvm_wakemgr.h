@@ -64,5 +64,37 @@ int wakemgr_main(void *arg);
 
 inline void handle_wakeup(struct wakeup_info *wakeup_info);
 
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+#define WAKE_BACKOFF_STAGE_POLL         (0)
+#define WAKE_BACKOFF_STAGE_PAUSE        (1)
+#define WAKE_BACKOFF_STAGE_NANOSLEEP    (2)
+#define WAKE_BACKOFF_STAGE_BLOCK        (3)
+#define WAKE_BACKOFF_STAGES             (4)
+
+/* Idle backoff state of the wakeup thread and the doorbell rung by the pkt flush path */
+typedef struct wake_backoff_info {
+        volatile uint32_t sleeping;     //1: wakeup thread blocked on the doorbell
+        sem_t doorbell;
+        volatile uint64_t ring_tsc;     //tsc at which the doorbell was rung
+        uint32_t idle_passes;           //consecutive passes in which no NF needed a wakeup
+        uint8_t stage;
+        uint64_t stage_cycles[WAKE_BACKOFF_STAGES];     //time spent in each stage (poll = passes that found work or spun)
+        uint64_t doorbell_rings;
+        uint64_t wake_lat_cycles_sum;   //doorbell ring -> wakeup thread running again
+        uint64_t wake_lat_cycles_max;
+}wake_backoff_info_t;
+extern wake_backoff_info_t wake_backoff;
+
+/* Called on the pkt flush path: snap the wakeup thread back to polling if it is blocked on the doorbell */
+static inline void
+onvm_wake_doorbell_ring(void) {
+        if (unlikely(wake_backoff.sleeping) && rte_atomic32_cmpset(&wake_backoff.sleeping, 1, 0)) {
+                wake_backoff.ring_tsc = rte_get_tsc_cycles();
+                wake_backoff.doorbell_rings++;
+                sem_post(&wake_backoff.doorbell);
+        }
+}
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
 #endif //INTERRUPT_SEM
 #endif //_ONVM_WAKEMGR_H_
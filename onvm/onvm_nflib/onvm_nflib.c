@@ -191,6 +191,13 @@ onvm_nflib_init(int argc, char *argv[], const char *nf_tag) {
                 rte_exit(EXIT_FAILURE, "Cannot get tx info structure\n");
         tx_stats = mz->addr;
 
+        #ifdef ENABLE_MBUF_QUOTAS
+        mz = rte_memzone_lookup(MZ_MBUF_QUOTA_INFO);
+        if (mz == NULL)
+                rte_exit(EXIT_FAILURE, "Cannot get mbuf quota info structure\n");
+        mbuf_quota = mz->addr;
+        #endif //ENABLE_MBUF_QUOTAS
+
         mz_scp = rte_memzone_lookup(MZ_SCP_INFO);
         if (mz_scp == NULL)
                 rte_exit(EXIT_FAILURE, "Cannot get service chain info structre\n");
@@ -239,6 +246,17 @@ onvm_nflib_init(int argc, char *argv[], const char *nf_tag) {
         if (tx_ring == NULL)
                 rte_exit(EXIT_FAILURE, "Cannot get TX ring - is server process running?\n");
 
+        #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+        {
+                unsigned c;
+                for (c = 0; c < NF_RX_BULK_CLASS; c++) {
+                        rx_prio_ring[c] = rte_ring_lookup(get_rx_prio_queue_name(nf_info->instance_id, c));
+                        if (rx_prio_ring[c] == NULL)
+                                rte_exit(EXIT_FAILURE, "Cannot get RX priority ring %u - is server process running?\n", c);
+                }
+        }
+        #endif //ENABLE_NF_RX_PRIORITY_RINGS
+
         /* Tell the manager we're ready to recieve packets */
         nf_info->status = NF_RUNNING;
 
@@ -285,6 +303,7 @@ onvm_nflib_init(int argc, char *argv[], const char *nf_tag) {
 #ifdef INTERRUPT_SEM
 void onvm_nf_yeild(struct onvm_nf_info* info);
 void onvm_nf_yeild(struct onvm_nf_info* info) {
+        onvm_flow_dir_offline();        //do not hold back the flow table writers while blocked
         
         #ifdef USE_MQ
         static char msg_t[256] = "\0";
@@ -514,6 +533,9 @@ onvm_nflib_run(
                 uint32_t tx_batch_size = 0;
                 int ret_act;
 
+                /* holds no flow entry between bursts (no-op unless the flow director is mapped) */
+                onvm_flow_dir_quiescent();
+
                 /* check if signalled to block, then block */
                 #if defined(ENABLE_NF_BACKPRESSURE) && (defined(NF_BACKPRESSURE_APPROACH_2) || defined(USE_ARBITER_NF_EXEC_PERIOD))
                 #ifdef INTERRUPT_SEM
@@ -530,7 +552,11 @@ onvm_nflib_run(
                 //    nf_ecb();
                 //}
                 
+                #ifdef ENABLE_NF_RX_PRIORITY_RINGS
+                nb_pkts = onvm_nflib_dequeue_rx_prio(pkts, nb_pkts);
+                #else
                 nb_pkts = (uint16_t)rte_ring_dequeue_burst(rx_ring, pkts, nb_pkts);
+                #endif //ENABLE_NF_RX_PRIORITY_RINGS
 
                 if(nb_pkts == 0) {
                         #ifdef INTERRUPT_SEM
@@ -592,6 +618,13 @@ onvm_nflib_run(
                         }
                         else {
                                 tx_stats->tx_buffer[info->instance_id]++;
+                                #ifdef ENABLE_MBUF_QUOTAS
+                                // NF keeps the pkt: account it to the NF till it is returned or dropped
+                                if (0 == onvm_get_pkt_mbuf_tag((struct rte_mbuf*)pkts[i])->nf_holder) {
+                                        onvm_get_pkt_mbuf_tag((struct rte_mbuf*)pkts[i])->nf_holder = info->instance_id;
+                                        rte_atomic32_inc(&mbuf_quota->nf[info->instance_id].inuse);
+                                }
+                                #endif //ENABLE_MBUF_QUOTAS
                         }
                 }
 
@@ -633,6 +666,9 @@ onvm_nflib_run(
 
                         tx_stats->tx_drop[info->instance_id] += tx_batch_size;
                         for (j = 0; j < tx_batch_size; j++) {
+                                #ifdef ENABLE_MBUF_QUOTAS
+                                onvm_mbuf_uncharge(mbuf_quota, pktsTX[j]);
+                                #endif //ENABLE_MBUF_QUOTAS
                                 rte_pktmbuf_free(pktsTX[j]);
                         }
                 } else {
@@ -657,10 +693,41 @@ onvm_nflib_run(
 }
 
 
+#ifdef ENABLE_MBUF_QUOTAS
+/* Pkt is no longer buffered by the NF */
+static inline void
+onvm_nflib_release_nf_hold(struct rte_mbuf* pkt) {
+        struct onvm_mbuf_tag *tag = onvm_get_pkt_mbuf_tag(pkt);
+        if (tag->nf_holder) {
+                rte_atomic32_dec(&mbuf_quota->nf[tag->nf_holder].inuse);
+                tag->nf_holder = 0;
+        }
+}
+
+int
+onvm_nflib_pkt_buffer_ok(struct rte_mbuf* pkt) {
+        mbuf_owner_stats_t *nf = &mbuf_quota->nf[nf_info->instance_id];
+        uint16_t owner = onvm_get_pkt_mbuf_tag(pkt)->chain_owner;
+
+        if ((uint32_t)rte_atomic32_read(&nf->inuse) >= nf->quota ||
+                (owner && (uint32_t)rte_atomic32_read(&mbuf_quota->chain[owner].inuse) >= mbuf_quota->chain[owner].quota)) {
+                nf->quota_drop++;
+                return 0;
+        }
+        return 1;
+}
+#endif //ENABLE_MBUF_QUOTAS
+
 int
 onvm_nflib_return_pkt(struct rte_mbuf* pkt) {
+        #ifdef ENABLE_MBUF_QUOTAS
+        onvm_nflib_release_nf_hold(pkt);
+        #endif //ENABLE_MBUF_QUOTAS
         /* FIXME: should we get a batch of buffered packets and then enqueue? Can we keep stats? */
         if(unlikely(rte_ring_enqueue(tx_ring, pkt) == -ENOBUFS)) {
+                #ifdef ENABLE_MBUF_QUOTAS
+                onvm_mbuf_uncharge(mbuf_quota, pkt);
+                #endif //ENABLE_MBUF_QUOTAS
                 rte_pktmbuf_free(pkt);
                 tx_stats->tx_drop[nf_info->instance_id]++;
                 return -ENOBUFS;
@@ -677,6 +744,10 @@ onvm_nflib_stop(void) {
 
 int
 onvm_nflib_drop_pkt(struct rte_mbuf* pkt) {
+        #ifdef ENABLE_MBUF_QUOTAS
+        onvm_nflib_release_nf_hold(pkt);
+        onvm_mbuf_uncharge(mbuf_quota, pkt);
+        #endif //ENABLE_MBUF_QUOTAS
         rte_pktmbuf_free(pkt);
         tx_stats->tx_drop[nf_info->instance_id]++;
         return 0;
@@ -835,6 +906,34 @@ onvm_nflib_handle_signal(int sig)
         /* TODO: Main thread for INTERRUPT_SEM case: Must additionally relinquish SEM, SHM */
 }
 
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+#define NF_RX_RING_OF_CLASS(c)  (((c) == NF_RX_BULK_CLASS)? (rx_ring):(rx_prio_ring[(c)]))
+static uint16_t
+onvm_nflib_dequeue_rx_prio(void **pkts, uint16_t max_pkts) {
+        uint16_t nb_pkts = 0;
+        unsigned c;
+
+        #ifdef NF_RX_PRIO_WEIGHTED_DRAIN
+        /* each class first gets its weighted share of the burst, so that bulk is not starved */
+        unsigned weight_sum = 0;
+        for (c = 0; c <= NF_RX_BULK_CLASS; c++) {
+                weight_sum += NF_RX_PRIO_WEIGHT(c);
+        }
+        for (c = 0; c <= NF_RX_BULK_CLASS && nb_pkts < max_pkts; c++) {
+                uint16_t share = (uint16_t)RTE_MAX(1U, (max_pkts*NF_RX_PRIO_WEIGHT(c))/weight_sum);
+                share = RTE_MIN(share, (uint16_t)(max_pkts - nb_pkts));
+                nb_pkts += (uint16_t)rte_ring_dequeue_burst(NF_RX_RING_OF_CLASS(c), pkts + nb_pkts, share);
+        }
+        #endif //NF_RX_PRIO_WEIGHTED_DRAIN
+
+        /* strict priority: fill (the rest of) the burst from the highest class down */
+        for (c = 0; c <= NF_RX_BULK_CLASS && nb_pkts < max_pkts; c++) {
+                nb_pkts += (uint16_t)rte_ring_dequeue_burst(NF_RX_RING_OF_CLASS(c), pkts + nb_pkts, max_pkts - nb_pkts);
+        }
+        return nb_pkts;
+}
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
 
 #ifdef INTERRUPT_SEM
 static void set_cpu_sched_policy_and_mode(void) {
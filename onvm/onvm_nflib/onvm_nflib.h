@@ -113,6 +113,13 @@ onvm_nflib_return_pkt(struct rte_mbuf* pkt);
 int
 onvm_nflib_drop_pkt(struct rte_mbuf* pkt);
 
+#ifdef ENABLE_MBUF_QUOTAS
+/* Check before buffering a packet (returning 1 from the handler): 0 if this NF or the chain of the packet is at its mbuf quota,
+ * then the packet should be dropped or passed on instead of buffered */
+int
+onvm_nflib_pkt_buffer_ok(struct rte_mbuf* pkt);
+#endif //ENABLE_MBUF_QUOTAS
+
 /**
  * Stop this NF
  * Sets the info to be not running and exits this process gracefully
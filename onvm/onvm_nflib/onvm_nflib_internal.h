@@ -95,10 +95,20 @@ static struct rte_ring *nf_info_ring;
 // rings used to pass packets between NFlib and NFmgr
 static struct rte_ring *tx_ring, *rx_ring;
 
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+// rx rings of the priority classes (the bulk class is rx_ring)
+static struct rte_ring *rx_prio_ring[NF_RX_BULK_CLASS];
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
 
 // shared data from server. We update statistics here
 static volatile struct client_tx_stats *tx_stats;
 
+#ifdef ENABLE_MBUF_QUOTAS
+// mbuf accounting shared with the manager
+static mbuf_quota_info_t *mbuf_quota;
+#endif //ENABLE_MBUF_QUOTAS
+
 
 // Shared data for client info
 extern struct onvm_nf_info *nf_info;
@@ -217,6 +227,20 @@ static void
 onvm_nflib_handle_signal(int sig);
 
 
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+/*
+ * Function dequeuing a burst from the priority rx rings and the rx ring of the NF:
+ * in strict priority, after a weighted share per class with NF_RX_PRIO_WEIGHTED_DRAIN.
+ *
+ * Input  : the array to fill and its size
+ * Output : the number of packets dequeued
+ *
+ */
+static uint16_t
+onvm_nflib_dequeue_rx_prio(void **pkts, uint16_t max_pkts);
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
+
 #ifdef INTERRUPT_SEM
 /*
  * Function to initalize the shared cpu support
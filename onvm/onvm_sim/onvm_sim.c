@@ -0,0 +1,640 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2016 George Washington University
+ *            2015-2016 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * onvm_sim.c - offline trace driven simulator of the NFVnice cpu share
+ *              (cgroup weight), ring watermark and back-pressure logic.
+ *
+ *   Replays a recorded arrival trace through the configured service
+ *   chains, with per NF cost histograms, and reports throughput, drops
+ *   and latency. The cpu share, watermark and back-pressure marking use
+ *   shared/onvm_sched_policy.h, i.e. the same code as onvm_mgr.
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+
+#include "onvm_sim.h"
+
+static sim_params_t params = {
+        .ring_size = 4096,
+        .threshold = 80,
+        .threshold_gap = 20,
+        .arbiter_period_us = 100,
+        .wake_interval_us = 100,
+        .sampling_rate = 1000,
+        .update_rate = 10,
+        .duration_us = 1000000,
+        .tick_us = 1,
+        .cpu_hz = 2600000000ULL,
+        .drop_only_at_beginning = 1,
+        .seed = 1,
+        .sched_slice_us = 1000,
+        .bkpr = SIM_BKPR_APPROACH_1,
+        .weight = SIM_WEIGHT_STATIC,
+};
+
+static sim_nf_t nfs[SIM_MAX_NFS];
+static sim_chain_t chains[SIM_MAX_CHAINS];
+static sim_arrival_t *arrivals = NULL;
+static uint32_t arrival_count = 0;
+
+/* per core CFS-like run queue state */
+static int16_t cur_nf_on_core[SIM_MAX_CORES];
+static uint64_t slice_left_on_core[SIM_MAX_CORES];
+
+static uint64_t now_us = 0;
+static uint32_t high_wm, low_wm;
+
+/*******************************Config parsing*******************************/
+
+static int
+sim_set_param(const char *key, const char *val) {
+        if (!strcmp(key, "ring_size"))                  params.ring_size = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "threshold"))             params.threshold = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "threshold_gap"))         params.threshold_gap = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "arbiter_period_us"))     params.arbiter_period_us = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "wake_interval_us"))      params.wake_interval_us = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "sampling_rate"))         params.sampling_rate = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "update_rate"))           params.update_rate = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "duration_us"))           params.duration_us = strtoull(val, NULL, 10);
+        else if (!strcmp(key, "tick_us"))               params.tick_us = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "cpu_hz"))                params.cpu_hz = strtoull(val, NULL, 10);
+        else if (!strcmp(key, "drop_only_at_beginning")) params.drop_only_at_beginning = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "seed"))                  params.seed = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "sched_slice_us"))        params.sched_slice_us = strtoul(val, NULL, 10);
+        else if (!strcmp(key, "bkpr")) {
+                if (!strcmp(val, "none"))               params.bkpr = SIM_BKPR_NONE;
+                else if (!strcmp(val, "approach1"))     params.bkpr = SIM_BKPR_APPROACH_1;
+                else if (!strcmp(val, "approach2"))     params.bkpr = SIM_BKPR_APPROACH_2;
+                else return -EINVAL;
+        }
+        else if (!strcmp(key, "weight")) {
+                if (!strcmp(val, "none"))               params.weight = SIM_WEIGHT_NONE;
+                else if (!strcmp(val, "static"))        params.weight = SIM_WEIGHT_STATIC;
+                else if (!strcmp(val, "dynamic"))       params.weight = SIM_WEIGHT_DYNAMIC;
+                else return -EINVAL;
+        }
+        else return -EINVAL;
+        return 0;
+}
+
+/* cost spec is either a constant cycle count or a file of "<cycles> <count>" lines */
+static int
+sim_load_cost(sim_cost_dist_t *d, const char *spec, const char *cfg_dir) {
+        char path[512], line[256];
+        char *end = NULL;
+        unsigned long c = strtoul(spec, &end, 10);
+        FILE *fp;
+
+        d->nbins = 0;
+        if (end && *end == '\0') {
+                d->cycles[0] = c;
+                d->cdf[0] = 1;
+                d->nbins = 1;
+                return 0;
+        }
+        if (spec[0] == '/')
+                snprintf(path, sizeof(path), "%s", spec);
+        else
+                snprintf(path, sizeof(path), "%s/%s", cfg_dir, spec);
+        if ((fp = fopen(path, "r")) == NULL) {
+                fprintf(stderr, "cannot open cost histogram %s\n", path);
+                return -ENOENT;
+        }
+        while (fgets(line, sizeof(line), fp) && d->nbins < SIM_MAX_COST_BINS) {
+                unsigned long cyc, cnt;
+                if (line[0] == '#' || sscanf(line, "%lu %lu", &cyc, &cnt) != 2 || cnt == 0)
+                        continue;
+                d->cycles[d->nbins] = cyc;
+                d->cdf[d->nbins] = cnt + (d->nbins ? d->cdf[d->nbins - 1] : 0);
+                d->nbins++;
+        }
+        fclose(fp);
+        return (d->nbins) ? 0 : -EINVAL;
+}
+
+static int
+sim_load_config(const char *file) {
+        char line[512], key[64], a[256], cfg_path[512];
+        FILE *fp = fopen(file, "r");
+        char *cfg_dir;
+        int lineno = 0;
+
+        if (fp == NULL) {
+                fprintf(stderr, "cannot open config %s\n", file);
+                return -ENOENT;
+        }
+        snprintf(cfg_path, sizeof(cfg_path), "%s", file);
+        cfg_dir = dirname(cfg_path);
+
+        while (fgets(line, sizeof(line), fp)) {
+                lineno++;
+                if (line[0] == '#' || sscanf(line, "%63s", key) != 1)
+                        continue;
+                if (!strcmp(key, "nf")) {
+                        unsigned id, core;
+                        if (sscanf(line, "nf %u %u %255s", &id, &core, a) != 3 || id >= SIM_MAX_NFS || core >= SIM_MAX_CORES)
+                                goto err;
+                        nfs[id].in_use = 1;
+                        nfs[id].core = core;
+                        if (sim_load_cost(&nfs[id].cost, a, cfg_dir) < 0)
+                                goto err;
+                }
+                else if (!strcmp(key, "chain")) {
+                        unsigned id, nf;
+                        int off = 0, n = 0;
+                        char *p;
+                        if (sscanf(line, "chain %u%n", &id, &off) != 1 || id >= SIM_MAX_CHAINS)
+                                goto err;
+                        for (p = line + off; sscanf(p, "%u%n", &nf, &n) == 1; p += n) {
+                                if (nf >= SIM_MAX_NFS || !nfs[nf].in_use || chains[id].len >= SIM_MAX_CHAIN_LEN)
+                                        goto err;
+                                chains[id].nf[++chains[id].len] = nf;
+                        }
+                        if (chains[id].len == 0)
+                                goto err;
+                        chains[id].in_use = 1;
+                }
+                else {
+                        if (sscanf(line, "%63s %255s", key, a) != 2 || sim_set_param(key, a) < 0)
+                                goto err;
+                }
+        }
+        fclose(fp);
+        return 0;
+err:
+        fprintf(stderr, "%s:%d: invalid line: %s", file, lineno, line);
+        fclose(fp);
+        return -EINVAL;
+}
+
+/* trace lines: "<time_us> <chain_id> <pkts> [<period_us> <end_us>]", sorted by time; the optional pair repeats the burst */
+static int
+sim_load_trace(const char *file) {
+        char line[256];
+        uint32_t cap = 1024;
+        FILE *fp = fopen(file, "r");
+
+        if (fp == NULL) {
+                fprintf(stderr, "cannot open trace %s\n", file);
+                return -ENOENT;
+        }
+        arrivals = malloc(cap * sizeof(*arrivals));
+        while (arrivals && fgets(line, sizeof(line), fp)) {
+                unsigned long long ts, period = 0, end = 0;
+                unsigned chain, pkts;
+                if (line[0] == '#' || sscanf(line, "%llu %u %u %llu %llu", &ts, &chain, &pkts, &period, &end) < 3)
+                        continue;
+                if (chain >= SIM_MAX_CHAINS || !chains[chain].in_use) {
+                        fprintf(stderr, "trace references unknown chain %u\n", chain);
+                        fclose(fp);
+                        return -EINVAL;
+                }
+                do {
+                        if (arrival_count == cap) {
+                                cap *= 2;
+                                arrivals = realloc(arrivals, cap * sizeof(*arrivals));
+                                if (arrivals == NULL)
+                                        break;
+                        }
+                        arrivals[arrival_count].ts_us = ts;
+                        arrivals[arrival_count].chain_id = chain;
+                        arrivals[arrival_count].pkts = pkts;
+                        arrival_count++;
+                        ts += period;
+                } while (period && ts < end);
+        }
+        fclose(fp);
+        return (arrivals) ? 0 : -ENOMEM;
+}
+
+/*******************************Simulation***********************************/
+
+static inline uint32_t
+sim_sample_cost(sim_nf_t *nf) {
+        uint64_t r = ((((uint64_t)rand()) << 31) ^ (uint64_t)rand()) % nf->cost.cdf[nf->cost.nbins - 1];
+        uint32_t i = 0;
+        while (nf->cost.cdf[i] <= r)
+                i++;
+        return nf->cost.cycles[i];
+}
+
+static inline void
+sim_chain_drop(sim_chain_t *sc) {
+        sc->dropped++;
+}
+
+/* mirrors onvm_pkt_enqueue_nf(): back-pressure check, then ring enqueue and watermark marking */
+static void
+sim_enqueue_to_nf(sim_chain_t *sc, uint16_t chain_id, uint16_t chain_index, uint64_t arrival_us) {
+        sim_nf_t *nf = &nfs[sc->nf[chain_index]];
+        sim_pkt_t *p;
+
+        if (params.bkpr == SIM_BKPR_APPROACH_1 && sc->highest_downstream_nf_index_id) {
+                if ((params.drop_only_at_beginning && chain_index == 1) ||
+                    (!params.drop_only_at_beginning && is_upstream_NF(sc->highest_downstream_nf_index_id, chain_index))) {
+                        nf->bkpr_drop++;
+                        sim_chain_drop(sc);
+                        return;
+                }
+        }
+
+        if (nf->count >= params.ring_size) {
+                nf->rx_drop++;
+                sim_chain_drop(sc);
+                if (params.bkpr != SIM_BKPR_NONE)
+                        onvm_bkpr_mark_chain_index(&sc->highest_downstream_nf_index_id, chain_index);
+                return;
+        }
+
+        p = &nf->ring[nf->tail];
+        p->arrival_us = arrival_us;
+        p->chain_id = chain_id;
+        p->chain_index = chain_index;
+        nf->tail = (nf->tail + 1) % params.ring_size;
+        nf->count++;
+        nf->rx++;
+
+        //rte_ring_enqueue_bulk() returns -EDQUOT above the water mark
+        if (params.bkpr != SIM_BKPR_NONE && nf->count > high_wm)
+                onvm_bkpr_mark_chain_index(&sc->highest_downstream_nf_index_id, chain_index);
+}
+
+/* mirrors onvm_check_and_reset_back_pressure(): clear marks once the NF drains below the low water mark */
+static void
+sim_check_and_reset_back_pressure(uint16_t nf_id) {
+        uint16_t c, i;
+        if (nfs[nf_id].count > low_wm)
+                return;
+        for (c = 0; c < SIM_MAX_CHAINS; c++) {
+                if (!chains[c].in_use || !chains[c].highest_downstream_nf_index_id)
+                        continue;
+                for (i = 1; i <= chains[c].len; i++) {
+                        if (chains[c].nf[i] == nf_id)
+                                onvm_bkpr_clear_chain_index(&chains[c].highest_downstream_nf_index_id, i);
+                }
+        }
+}
+
+static void
+sim_complete_pkt(uint16_t nf_id) {
+        sim_nf_t *nf = &nfs[nf_id];
+        sim_pkt_t p = nf->ring[nf->head];
+        sim_chain_t *sc = &chains[p.chain_id];
+
+        nf->head = (nf->head + 1) % params.ring_size;
+        nf->count--;
+        nf->served++;
+        nf->served_in_epoch++;
+        if (++nf->sample_ctr >= params.sampling_rate) {
+                nf->sample_ctr = 0;
+                hist_store_v2(&nf->ht2, (uint32_t)nf->cur_pkt_cost);
+        }
+        nf->cur_pkt_cost = 0;
+        nf->credit = 0;
+
+        if (params.bkpr != SIM_BKPR_NONE)
+                sim_check_and_reset_back_pressure(nf_id);
+
+        if (p.chain_index < sc->len) {
+                sim_enqueue_to_nf(sc, p.chain_id, p.chain_index + 1, p.arrival_us);
+        }
+        else {
+                uint64_t lat = now_us - p.arrival_us;
+                sc->delivered++;
+                sc->lat_sum += lat;
+                if (lat > sc->lat_max)
+                        sc->lat_max = lat;
+                sc->lat[(lat < SIM_LAT_BUCKETS) ? lat : (SIM_LAT_BUCKETS - 1)]++;
+        }
+}
+
+/* run the NF for at most budget cycles; returns cycles consumed */
+static uint64_t
+sim_run_nf(uint16_t nf_id, uint64_t budget) {
+        sim_nf_t *nf = &nfs[nf_id];
+        uint64_t used = 0;
+
+        while (nf->count && used < budget) {
+                uint64_t need;
+                if (nf->cur_pkt_cost == 0)
+                        nf->cur_pkt_cost = sim_sample_cost(nf);
+                need = nf->cur_pkt_cost - nf->credit;
+                if (need <= budget - used) {
+                        used += need;
+                        sim_complete_pkt(nf_id);
+                }
+                else {
+                        nf->credit += budget - used;
+                        used = budget;
+                }
+        }
+        nf->busy_cycles += used;
+        nf->vruntime += (used * DEFAULT_NF_CPU_SHARE) / (nf->cpu_share ? nf->cpu_share : DEFAULT_NF_CPU_SHARE);
+        if (nf->count == 0)
+                nf->blocked = 1;        //NF sleeps on its semaphore until the wake thread posts it
+        return used;
+}
+
+static int16_t
+sim_pick_next_nf(uint16_t core) {
+        int16_t best = -1;
+        uint16_t i;
+        for (i = 0; i < SIM_MAX_NFS; i++) {
+                if (!nfs[i].in_use || nfs[i].core != core || nfs[i].blocked || !nfs[i].count)
+                        continue;
+                if (best < 0 || nfs[i].vruntime < nfs[best].vruntime)
+                        best = i;
+        }
+        return best;
+}
+
+static void
+sim_run_core(uint16_t core) {
+        uint64_t budget = (params.cpu_hz / 1000000) * params.tick_us;
+        const uint64_t slice = (params.cpu_hz / 1000000) * params.sched_slice_us;
+
+        while (budget) {
+                int16_t nf_id = cur_nf_on_core[core];
+                uint64_t used;
+                if (nf_id < 0 || nfs[nf_id].blocked || !nfs[nf_id].count || !slice_left_on_core[core]) {
+                        if ((nf_id = sim_pick_next_nf(core)) < 0) {
+                                cur_nf_on_core[core] = -1;
+                                return;
+                        }
+                        cur_nf_on_core[core] = nf_id;
+                        slice_left_on_core[core] = slice;
+                }
+                used = sim_run_nf(nf_id, (budget < slice_left_on_core[core]) ? budget : slice_left_on_core[core]);
+                if (used == 0)
+                        return;
+                budget -= used;
+                slice_left_on_core[core] -= used;
+        }
+}
+
+/* approach 2: an NF is not woken while it is upstream of an overflowing NF of any of its chains */
+static void
+sim_update_throttle(void) {
+        uint16_t c, i;
+        for (i = 0; i < SIM_MAX_NFS; i++)
+                nfs[i].throttled = 0;
+        for (c = 0; c < SIM_MAX_CHAINS; c++) {
+                if (!chains[c].in_use || !chains[c].highest_downstream_nf_index_id)
+                        continue;
+                for (i = 1; i <= chains[c].len; i++) {
+                        if (is_upstream_NF(chains[c].highest_downstream_nf_index_id, i))
+                                nfs[chains[c].nf[i]].throttled = 1;
+                }
+        }
+}
+
+/* mirrors the wake thread: post the semaphore of every sleeping NF that has pending packets */
+static void
+sim_wake_nfs(void) {
+        uint16_t i;
+        if (params.bkpr == SIM_BKPR_APPROACH_2)
+                sim_update_throttle();
+        for (i = 0; i < SIM_MAX_NFS; i++) {
+                if (nfs[i].in_use && nfs[i].blocked && nfs[i].count && !nfs[i].throttled) {
+                        nfs[i].blocked = 0;
+                        nfs[i].wakeups++;
+                }
+        }
+}
+
+/* mirrors extract_nf_load_and_svc_rate_info() + compute_and_assign_nf_cgroup_weight(); load is filled in by the caller */
+static void
+sim_arbiter_epoch(void) {
+        static nf_core_and_cc_info_t nfs_on_core[SIM_MAX_CORES];
+        static uint32_t update_rate = 0;
+        const uint64_t total_cycles_in_epoch = params.arbiter_period_us * (params.cpu_hz / 1000000);
+        uint16_t i;
+
+        for (i = 0; i < SIM_MAX_NFS; i++) {
+                if (!nfs[i].in_use)
+                        continue;
+                nfs[i].svc_rate = nfs[i].served_in_epoch;
+                nfs[i].served_in_epoch = 0;
+                nfs[i].comp_cost = hist_extract_v2(&nfs[i].ht2, VAL_TYPE_MEDIAN);
+        }
+        if (params.weight == SIM_WEIGHT_NONE || ++update_rate < params.update_rate)
+                return;
+        update_rate = 0;
+
+        memset(nfs_on_core, 0, sizeof(nfs_on_core));
+        for (i = 0; i < SIM_MAX_NFS; i++) {
+                if (nfs[i].in_use)
+                        onvm_sched_add_nf_to_core(&nfs_on_core[nfs[i].core], nfs[i].comp_cost, nfs[i].load, nfs[i].svc_rate);
+        }
+        for (i = 0; i < SIM_MAX_NFS; i++) {
+                if (nfs[i].in_use && nfs[i].comp_cost) {
+                        onvm_sched_compute_nf_share(&nfs_on_core[nfs[i].core], nfs[i].comp_cost, nfs[i].load, total_cycles_in_epoch,
+                                        (params.weight == SIM_WEIGHT_DYNAMIC), &nfs[i].cpu_share, &nfs[i].exec_period);
+                }
+        }
+}
+
+static void
+sim_run(void) {
+        uint32_t next_arrival = 0;
+        uint16_t i;
+        uint64_t *prev_arrived = calloc(SIM_MAX_NFS, sizeof(uint64_t));
+        uint64_t next_wake_us = 0, next_epoch_us = 0;   //a tick may step over a multiple of the period
+
+        for (now_us = 0; now_us < params.duration_us; now_us += params.tick_us) {
+                while (next_arrival < arrival_count && arrivals[next_arrival].ts_us <= now_us) {
+                        uint32_t n;
+                        sim_chain_t *sc = &chains[arrivals[next_arrival].chain_id];
+                        for (n = 0; n < arrivals[next_arrival].pkts; n++) {
+                                sc->offered++;
+                                sim_enqueue_to_nf(sc, arrivals[next_arrival].chain_id, 1, now_us);
+                        }
+                        next_arrival++;
+                }
+                if (params.wake_interval_us && now_us >= next_wake_us) {
+                        sim_wake_nfs();
+                        while (next_wake_us <= now_us)
+                                next_wake_us += params.wake_interval_us;
+                }
+                for (i = 0; i < SIM_MAX_CORES; i++)
+                        sim_run_core(i);
+                if (params.arbiter_period_us && now_us >= next_epoch_us) {
+                        while (next_epoch_us <= now_us)
+                                next_epoch_us += params.arbiter_period_us;
+                        //load is the arrivals (rx + drops) seen by the NF in the last epoch
+                        for (i = 0; i < SIM_MAX_NFS; i++) {
+                                uint64_t arrived = nfs[i].rx + nfs[i].rx_drop + nfs[i].bkpr_drop;
+                                nfs[i].load = (uint32_t)(arrived - prev_arrived[i]);
+                                prev_arrived[i] = arrived;
+                        }
+                        sim_arbiter_epoch();
+                }
+        }
+        free(prev_arrived);
+}
+
+/*******************************Report***************************************/
+
+static uint32_t
+sim_lat_percentile(sim_chain_t *sc, uint32_t pct) {
+        uint64_t target = (sc->delivered * pct + 99) / 100, acc = 0;
+        uint32_t i;
+        for (i = 0; i < SIM_LAT_BUCKETS; i++) {
+                acc += sc->lat[i];
+                if (acc >= target)
+                        return i;
+        }
+        return SIM_LAT_BUCKETS - 1;
+}
+
+static void
+sim_print_report(void) {
+        const double secs = (double)params.duration_us / 1000000;
+        const uint64_t total_cycles = params.duration_us * (params.cpu_hz / 1000000);
+        uint16_t i;
+
+        printf("PARAMS\n");
+        printf("-----\n");
+        printf("ring_size=%u threshold=%u gap=%u (high_wm=%u low_wm=%u) arbiter_period_us=%u wake_interval_us=%u sampling_rate=%u bkpr=%u weight=%u duration_us=%llu\n\n",
+                params.ring_size, params.threshold, params.threshold_gap, high_wm, low_wm, params.arbiter_period_us, params.wake_interval_us,
+                params.sampling_rate, params.bkpr, params.weight, (unsigned long long)params.duration_us);
+
+        printf("NFS\n");
+        printf("-----\n");
+        for (i = 0; i < SIM_MAX_NFS; i++) {
+                if (!nfs[i].in_use)
+                        continue;
+                printf("NF %2u core %2u: rx: %9llu served: %9llu rx_drop: %9llu bkpr_drop: %9llu comp_cost: %5u cpu_share: %5u util: %5.1f%% wakeups: %llu\n",
+                        i, nfs[i].core, (unsigned long long)nfs[i].rx, (unsigned long long)nfs[i].served,
+                        (unsigned long long)nfs[i].rx_drop, (unsigned long long)nfs[i].bkpr_drop,
+                        nfs[i].comp_cost, nfs[i].cpu_share, (100.0 * nfs[i].busy_cycles) / total_cycles,
+                        (unsigned long long)nfs[i].wakeups);
+        }
+
+        printf("\nCHAINS\n");
+        printf("-----\n");
+        for (i = 0; i < SIM_MAX_CHAINS; i++) {
+                sim_chain_t *sc = &chains[i];
+                if (!sc->in_use)
+                        continue;
+                printf("Chain %2u: offered: %9llu delivered: %9llu dropped: %9llu (%.2f%%) thrpt: %.3f Mpps lat_us[mean: %llu p50: %u p99: %u max: %u]\n",
+                        i, (unsigned long long)sc->offered, (unsigned long long)sc->delivered, (unsigned long long)sc->dropped,
+                        (sc->offered) ? (100.0 * sc->dropped) / sc->offered : 0.0, sc->delivered / secs / 1000000,
+                        (unsigned long long)((sc->delivered) ? sc->lat_sum / sc->delivered : 0),
+                        (sc->delivered) ? sim_lat_percentile(sc, 50) : 0, (sc->delivered) ? sim_lat_percentile(sc, 99) : 0, sc->lat_max);
+        }
+}
+
+static void
+usage(const char *prog) {
+        printf("Usage: %s -c <config> -t <trace> [-p key=value]...\n"
+               "  -p overrides any config parameter, e.g. -p threshold=70 -p bkpr=approach2\n", prog);
+}
+
+int
+main(int argc, char *argv[]) {
+        const char *cfg = NULL, *trace = NULL;
+        char *overrides[64];
+        int n_overrides = 0, c, i;
+
+        while ((c = getopt(argc, argv, "c:t:p:h")) != -1) {
+                switch (c) {
+                case 'c': cfg = optarg; break;
+                case 't': trace = optarg; break;
+                case 'p':
+                        if (n_overrides < 64) overrides[n_overrides++] = optarg;
+                        break;
+                default:
+                        usage(argv[0]);
+                        return (c == 'h') ? 0 : 1;
+                }
+        }
+        if (cfg == NULL || trace == NULL) {
+                usage(argv[0]);
+                return 1;
+        }
+        if (sim_load_config(cfg) < 0)
+                return 1;
+        for (i = 0; i < n_overrides; i++) {
+                char *eq = strchr(overrides[i], '=');
+                if (eq == NULL) {
+                        fprintf(stderr, "invalid override %s\n", overrides[i]);
+                        return 1;
+                }
+                *eq = '\0';
+                if (sim_set_param(overrides[i], eq + 1) < 0) {
+                        fprintf(stderr, "invalid override %s=%s\n", overrides[i], eq + 1);
+                        return 1;
+                }
+        }
+        if (params.ring_size == 0 || params.tick_us == 0 || params.sampling_rate == 0) {
+                fprintf(stderr, "ring_size, tick_us and sampling_rate must be non-zero\n");
+                return 1;
+        }
+        if (sim_load_trace(trace) < 0)
+                return 1;
+
+        high_wm = ONVM_RING_WATER_MARK_SIZE(params.ring_size, params.threshold);
+        low_wm = ONVM_RING_WATER_MARK_SIZE(params.ring_size, ONVM_RING_LOW_THRESHOLD(params.threshold, params.threshold_gap));
+        srand(params.seed);
+
+        for (i = 0; i < SIM_MAX_CORES; i++)
+                cur_nf_on_core[i] = -1;
+        for (i = 0; i < SIM_MAX_NFS; i++) {
+                if (!nfs[i].in_use)
+                        continue;
+                nfs[i].ring = calloc(params.ring_size, sizeof(sim_pkt_t));
+                if (nfs[i].ring == NULL)
+                        return 1;
+                nfs[i].blocked = 1;
+                nfs[i].cpu_share = DEFAULT_NF_CPU_SHARE;
+                hist_init_v2(&nfs[i].ht2);
+        }
+
+        sim_run();
+        sim_print_report();
+
+        for (i = 0; i < SIM_MAX_NFS; i++)
+                free(nfs[i].ring);
+        free(arrivals);
+        return 0;
+}
@@ -0,0 +1,157 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2016 George Washington University
+ *            2015-2016 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * onvm_sim.h - offline trace driven simulator of the NFVnice cpu share
+ *              (cgroup weight), ring watermark and back-pressure logic.
+ ********************************************************************/
+
+#ifndef _ONVM_SIM_H_
+#define _ONVM_SIM_H_
+
+#include <stdint.h>
+
+#include "../shared/histogram.h"
+#include "../shared/onvm_sched_policy.h"
+
+#define SIM_MAX_NFS             (64)
+#define SIM_MAX_CHAINS          (16)
+#define SIM_MAX_CHAIN_LEN       (ONVM_MAX_CHAIN_LENGTH)
+#define SIM_MAX_CORES           (64)
+#define SIM_MAX_COST_BINS       (1024)
+#define SIM_LAT_BUCKETS         (100000) //1us buckets, anything above lands in the last one
+
+/* back-pressure variants (see NF_BACKPRESSURE_APPROACH_* in common.h) */
+typedef enum sim_bkpr_mode {
+        SIM_BKPR_NONE = 0,
+        SIM_BKPR_APPROACH_1 = 1,        //drop at enqueue to upstream NFs (DROP_PKTS_ONLY_AT_BEGGINING selectable)
+        SIM_BKPR_APPROACH_2 = 2,        //do not wake upstream NFs
+}sim_bkpr_mode_e;
+
+/* cpu share assignment (see USE_CGROUPS_PER_NF_INSTANCE, USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE) */
+typedef enum sim_weight_mode {
+        SIM_WEIGHT_NONE = 0,            //every NF keeps DEFAULT_NF_CPU_SHARE
+        SIM_WEIGHT_STATIC = 1,          //comp_cost only
+        SIM_WEIGHT_DYNAMIC = 2,         //load*comp_cost
+}sim_weight_mode_e;
+
+typedef struct sim_params {
+        uint32_t ring_size;             //CLIENT_QUEUE_RINGSIZE
+        uint32_t threshold;             //CLIENT_QUEUE_RING_THRESHOLD
+        uint32_t threshold_gap;         //CLIENT_QUEUE_RING_THRESHOLD_GAP
+        uint32_t arbiter_period_us;     //ARBITER_PERIOD_IN_US
+        uint32_t wake_interval_us;      //WAKE_INTERVAL_IN_US
+        uint32_t sampling_rate;         //SAMPLING_RATE (every Nth pkt is costed)
+        uint32_t update_rate;           //epochs between cgroup weight updates (compute_and_assign_nf_cgroup_weight)
+        uint64_t duration_us;
+        uint32_t tick_us;               //simulation time step
+        uint32_t sched_slice_us;        //CFS slice before the core picks the NF with the least vruntime
+        uint64_t cpu_hz;
+        uint32_t drop_only_at_beginning;//DROP_PKTS_ONLY_AT_BEGGINING
+        uint32_t seed;
+        sim_bkpr_mode_e bkpr;
+        sim_weight_mode_e weight;
+}sim_params_t;
+
+typedef struct sim_pkt {
+        uint64_t arrival_us;
+        uint16_t chain_id;
+        uint16_t chain_index;           //1 based, same as meta->chain_index
+}sim_pkt_t;
+
+/* cost distribution read from a "<cycles> <count>" histogram dump */
+typedef struct sim_cost_dist {
+        uint32_t nbins;
+        uint32_t cycles[SIM_MAX_COST_BINS];
+        uint64_t cdf[SIM_MAX_COST_BINS];
+}sim_cost_dist_t;
+
+typedef struct sim_nf {
+        uint16_t in_use;
+        uint16_t core;
+        sim_cost_dist_t cost;
+
+        /* rx ring */
+        sim_pkt_t *ring;
+        uint32_t head, tail, count;
+
+        /* scheduler state */
+        uint8_t  blocked;               //sleeping on its semaphore until the wake thread posts it
+        uint8_t  throttled;             //approach 2: not woken while a downstream NF is overflowing
+        uint64_t vruntime;
+        uint64_t credit;                //cycles already spent on the pkt at the ring head
+        uint64_t cur_pkt_cost;
+        uint32_t cpu_share;
+        uint64_t exec_period;
+
+        /* NF info as exported to the manager */
+        uint32_t comp_cost;
+        uint32_t load;
+        uint32_t svc_rate;
+        uint32_t served_in_epoch;
+        uint64_t sample_ctr;
+        histogram_v2_t ht2;
+
+        /* stats */
+        uint64_t rx;
+        uint64_t served;
+        uint64_t rx_drop;
+        uint64_t bkpr_drop;
+        uint64_t busy_cycles;
+        uint64_t wakeups;
+}sim_nf_t;
+
+typedef struct sim_chain {
+        uint16_t in_use;
+        uint16_t len;
+        uint16_t nf[SIM_MAX_CHAIN_LEN + 1];     //1 based like onvm_service_chain
+        uint16_t highest_downstream_nf_index_id;        //same marks as onvm_service_chain
+
+        uint64_t offered;
+        uint64_t delivered;
+        uint64_t dropped;
+        uint64_t lat_sum;
+        uint32_t lat_max;
+        uint32_t lat[SIM_LAT_BUCKETS];
+}sim_chain_t;
+
+typedef struct sim_arrival {
+        uint64_t ts_us;
+        uint16_t chain_id;
+        uint32_t pkts;
+}sim_arrival_t;
+
+#endif  // _ONVM_SIM_H_
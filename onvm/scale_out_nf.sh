@@ -0,0 +1,41 @@
+#!/bin/bash
+# Launcher hook for NF auto scale-out (ENABLE_NF_AUTO_SCALING, NF_SCALE_OUT_LAUNCHER_CMD).
+# Invoked by onvm_mgr (cwd: onvm/) as: ./scale_out_nf.sh <service_id> <bottlenecked_instance_id>
+# Starts one more instance of the NF configured for the service in scale_out_nf.conf:
+#   <service_id> <example_nf_name> <core> [nf args]
+# e.g. "2 bridge 5"
+# The NF runs with the privileges of onvm_mgr (no sudo here: the manager already runs as root).
+
+script_dir=$(cd "$(dirname "$0")" && pwd)
+service_id=$1
+bneck_nf=$2
+conf="$script_dir/scale_out_nf.conf"
+
+if [ -z "$service_id" ]
+then
+        echo "usage: $0 [service_id] [bottlenecked_instance_id]"
+        exit 1
+fi
+
+line=$(grep -E "^${service_id}[[:space:]]" "$conf" 2>/dev/null | head -1)
+if [ -z "$line" ]
+then
+        echo "no launcher entry for service $service_id in $conf"
+        exit 1
+fi
+
+set -- $line
+nf=$2
+core=$3
+shift 3
+nf_bin="$script_dir/../examples/$nf/build/$nf"
+
+if [ ! -x "$nf_bin" ]
+then
+        echo "$nf_bin not found: build examples/$nf first"
+        exit 1
+fi
+
+echo "scale out service $service_id (bottleneck NF $bneck_nf): examples/$nf on core $core"
+"$nf_bin" -l "$core" -n 3 --proc-type=secondary -- -r "$service_id" "$@" > "$script_dir/scale_out_${service_id}.log" 2>&1 &
+exit 0
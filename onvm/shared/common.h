@@ -42,6 +42,7 @@
 #define _COMMON_H_
 
 #include <rte_mbuf.h>
+#include <rte_spinlock.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -69,7 +70,7 @@
 //#define DELAY_BEFORE_SEND
 //#define DELAY_PER_PKT (5) //20micro seconds
 
-#define ONVM_MAX_CHAIN_LENGTH 12   // the maximum chain length
+//ONVM_MAX_CHAIN_LENGTH (the maximum chain length) is in onvm_sched_policy.h, shared with onvm_sim
 #define MAX_CLIENTS 32            // total number of NFs allowed
 #define MAX_SERVICES 32           // total number of unique services allowed
 #define MAX_CLIENTS_PER_SERVICE 8 // max number of NFs per service.
@@ -125,15 +126,116 @@
                                                         //Repercussions in onvm_pkt.c: onvm_pkt_enqueue_nf() to handle overflow and stop putting packet in full buffer and drop new ones instead.
                                                         //Observation: Good for TCP use cases, but with PktGen,Moongen dents line rate approx 0.3Mpps slow down
 
+/* Lossless credit based mode: pkts are not dropped inside a chain for want of room in the next NFs Rx Ring.
+ * Free slots of the NFs Rx Ring are its credits; pkts beyond the credits are held (in order) in a per NF upstream hold queue in the manager,
+ * and as the last resort reading of NIC Rx queues is paused while any hold queue is filled beyond LOSSLESS_RX_PAUSE_THRESHOLD.
+ * Supersedes DO_NOT_DROP_PKTS_ON_FLUSH_FOR_BOTTLENECK_NF */
+// enable: ENABLE_LOSSLESS_CREDIT_MODE
+//#define ENABLE_LOSSLESS_CREDIT_MODE
+#ifdef ENABLE_LOSSLESS_CREDIT_MODE
+#define LOSSLESS_HOLD_QUEUE_SIZE        (8192)  //per NF hold queue (power of 2)
+#define LOSSLESS_RX_PAUSE_THRESHOLD     (75)    //% of the hold queue at which NIC Rx is paused
+#define LOSSLESS_RX_RESUME_THRESHOLD    (25)    //% of the hold queue below which the pause of the NF is lifted
+#undef DO_NOT_DROP_PKTS_ON_FLUSH_FOR_BOTTLENECK_NF
+#endif //ENABLE_LOSSLESS_CREDIT_MODE
+
+/* Multi-priority Rx Rings per NF: NF_RX_PRIO_CLASSES (2..4) classes, class 0 is the highest and the last class (bulk) is the NFs regular Rx Ring.
+ * Pkts are classified by the chain class (onvm_sc_set_rx_class()) or else by DSCP: EF/VOICE-ADMIT => 0, CS3/CS5/CS6/CS7 signalling and control => 1, CS4/AF4x video => 2 (clamped to the classes in use).
+ * Priority pkts are classified ahead of the chain admission: they bypass the per thread batching and the chain marks and ingress limits set off by bulk congestion.
+ * Each priority ring has its own watermarks: while over them, only that class of the chains through the NF is dropped at the chain ingress.
+ * NFs drain in strict priority, or weighted (NF_RX_PRIO_WEIGHTED_DRAIN) so bulk is not starved. */
+// enable: ENABLE_NF_RX_PRIORITY_RINGS
+//#define ENABLE_NF_RX_PRIORITY_RINGS
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+#define NF_RX_PRIO_CLASSES              (3)     //including the bulk class (2..4)
+#define NF_RX_BULK_CLASS                (NF_RX_PRIO_CLASSES - 1)
+#define NF_RX_PRIO_RING_SIZE            (1024)  //per priority class Rx Ring (power of 2)
+#define NF_RX_PRIO_RING_THRESHOLD       (60)    //% of the priority ring at which backpressure is signalled
+#define NF_RX_PRIO_RING_THRESHOLD_GAP   (30)
+//#define NF_RX_PRIO_WEIGHTED_DRAIN             //per read, class c gets a share of the burst in proportion to NF_RX_PRIO_WEIGHT(c) before strict priority fills the rest
+#define NF_RX_PRIO_WEIGHT(c)            (1 << (NF_RX_BULK_CLASS - (c)))        //4:2:1 for 3 classes
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
+/* Per chain (and per NF) mbuf quotas on the shared pktmbuf pool: a pkt is charged to its chain at Rx admission (owner tagged in the mbuf private area)
+ * and uncharged when it leaves through a port or is dropped by the manager/nflib; Rx admission drops the pkts of a chain that is at its quota.
+ * Pkts kept buffered by an NF (handler returns 1) are accounted to the NF; NFs buffering pkts check onvm_nflib_pkt_buffer_ok() first.
+ * The owner slot of a chain goes back to a free list when the chain is freed (once its last charged mbuf is uncharged).
+ * Note: chains beyond MBUF_QUOTA_MAX_CHAINS live at once are not accounted. Pkts freed directly with rte_pktmbuf_free() leak their charge. */
+// enable: ENABLE_MBUF_QUOTAS
+//#define ENABLE_MBUF_QUOTAS
+#ifdef ENABLE_MBUF_QUOTAS
+#define MBUF_QUOTA_MAX_CHAINS           (1024)  //owner slots (slot 0 => not accounted)
+#define MBUF_QUOTA_CHAIN_DEFAULT_PCT    (25)    //% of the pool a chain may hold unless set with onvm_sc_set_mbuf_quota()
+#define MBUF_QUOTA_NF_BUFFER            (1536)  //pkts an NF may keep buffered (as MBUFS_PER_CLIENT)
+#endif //ENABLE_MBUF_QUOTAS
+
+/* Flow entry aging: the manager Rx path stamps the flow entry with a coarse clock (seconds), and the master thread sweeps
+ * FLOW_AGING_SLICE entries of each flow table (IPv4 and IPv6) every FLOW_AGING_PERIOD_IN_MS, removing the flows past their idle/hard timeout.
+ * The chain reference of an expired flow is released (sc->ref_cnt) and detached from the entry once the readers are past it
+ * (retire epoch), the chain itself stays with the NF that installed it.
+ * Note: entries added without a key (onvm_flow_dir_add_pkt() only) cannot be removed and are skipped. */
+// enable: ENABLE_FLOW_AGING
+//#define ENABLE_FLOW_AGING
+#ifdef ENABLE_FLOW_AGING
+#define FLOW_AGING_PERIOD_IN_MS         (100)
+#define FLOW_AGING_SLICE                (8192)  //flow table entries checked per sweep
+#define FLOW_AGING_DEFAULT_IDLE_TIMEOUT (60)    //seconds, for entries installed without idle timeout (0 => such entries are permanent)
+#endif //ENABLE_FLOW_AGING
+
+/* Per flow packet and byte counters: maintained by the manager Rx threads on a flow table hit. Each Rx thread counts in its own
+ * cache aligned shard of the flow entry (no line bouncing across Rx cores); readers merge the shards (onvm_flow_dir_get_counters()).
+ * Note: adds FLOW_COUNTER_SHARDS cache lines to the flow entry; FLOW_COUNTER_SHARDS must be >= ONVM_NUM_RX_THREADS. */
+// enable: ENABLE_FLOW_COUNTERS
+//#define ENABLE_FLOW_COUNTERS
+#ifdef ENABLE_FLOW_COUNTERS
+#define FLOW_COUNTER_SHARDS             (1)     //one per manager Rx thread
+#endif //ENABLE_FLOW_COUNTERS
+
+/* Per chain statistics: a chain gets a chain id on the first pkt the manager steers on it, and its counters (pkts, drops,
+ * backpressure time, flows) are kept in a shared array indexed by the chain id, updated in the manager data path.
+ * The chain stats display and the bottleneck mark/clear scans (extract_sc_list()) then run in O(chains), not over the flow table.
+ * The ids of chains left without flows are reclaimed by the master thread; while a chain finds no free id, extract_sc_list()
+ * walks the flow table again. The flow_table NF shares one chain among the flows with the same actions, so chains stay far fewer than flows.
+ * Note: the flow count is approximate while flows are updated concurrently; pkts are counted per Rx thread (CHAIN_STATS_SHARDS). */
+// enable: ENABLE_CHAIN_STATS
+#define ENABLE_CHAIN_STATS
+#ifdef ENABLE_CHAIN_STATS
+#define MAX_CHAINS                      (4096)  //chain ids (0 => not registered)
+#define CHAIN_STATS_SHARDS              (1)     //one per manager Rx thread
+#define CHAIN_STATS_PRINT_MAX           (16)    //chains listed in the stats display
+#endif //ENABLE_CHAIN_STATS
+
+/* Wildcard flow classifier: prefix/port range rules (onvm_fc_add_rule()) resolve the service chain of the first pkt of a flow that
+ * misses in the flow director; the manager then installs an exact match flow entry, so the next pkts of the flow take the fast path.
+ * A flow matching no rule is installed with the default chain, so it is classified only once.
+ * The installed entries age out after FLOW_CLASSIFIER_IDLE_TIMEOUT (with ENABLE_FLOW_AGING); rule updates do not flush them. */
+// enable: ENABLE_FLOW_CLASSIFIER
+//#define ENABLE_FLOW_CLASSIFIER
+#ifdef ENABLE_FLOW_CLASSIFIER
+#define FLOW_CLASSIFIER_MAX_SUBTABLES           (64)            //distinct rule masks
+#define FLOW_CLASSIFIER_SUBTABLE_ENTRIES        (1024)          //initial entries of a subtable
+#define FLOW_CLASSIFIER_MAX_RULES               (1024*256)      //entries a subtable may grow to
+#define FLOW_CLASSIFIER_IDLE_TIMEOUT            (30)            //seconds, of the installed flow entries (unless set in the rule)
+#define FLOW_CLASSIFIER_ENTRY_RULES             (4)             //overlapping rules (same mask and key) kept per subtable entry
+#define FLOW_CLASSIFIER_STATS_SHARDS            (1)             //one per manager Rx thread
+#ifndef ENABLE_FLOW_AGING
+#error "ENABLE_FLOW_CLASSIFIER needs ENABLE_FLOW_AGING: the installed flow entries are only removed by aging"
+#endif //ENABLE_FLOW_AGING
+#endif //ENABLE_FLOW_CLASSIFIER
+
 /* Enable watermark level NFs Tx and Rx Rings */
 // enable: ENABLE_RING_WATERMARK
 #define ENABLE_RING_WATERMARK // details on count in the onvm_init.h
 
 /* Enable ECN CE FLAG : Feature Flag to enable marking ECN_CE flag on the flows that pass through the NFs with Rx Ring buffers exceeding the watermark level.
- * Dependency: Must have ENABLE_RING_WATERMARK feature defined. and HIGH and LOW Thresholds to be set. otherwise, marking may not happen at all.. Ideally, marking should be done after dequeue from Tx, to mark if Rx is overbudget..
+ * Dependency: Must have ENABLE_RING_WATERMARK feature defined. and HIGH and LOW Thresholds to be set. otherwise, marking may not happen at all..
+ * Marking is done on the burst dequeued from the Tx Ring when the EWMA of the Rx Ring occupancy (ht2_q) is over the ECN mark level: only ECT pkts are marked, with incremental checksum update.
  * On similar lines, even the back-pressure marking must be done for all flows after dequeue from the Tx Ring.. */
 // enable: ENABLE_ECN_CE
 //#define ENABLE_ECN_CE
+#ifdef ENABLE_ECN_CE
+//#define ECN_CE_MARK_ONCE_PER_FLOW_IN_BURST    //mark only the first ECT pkt of each flow (rss hash, stamped with the burst generation) in a Tx burst: header writes bounded by the flows in the burst, not its size
+#endif //ENABLE_ECN_CE
 
 
 /* Enable back-pressure handling to throttle NFs upstream */
@@ -149,10 +251,33 @@
 // Extensions and sub-options for Back_Pressure handling
 #define DROP_PKTS_ONLY_AT_BEGGINING           // Extension to approach 1 to make packet drops only at the beginning on the chain (i.e only at the time to enqueue to first NF). (Note: can Enable)
 
+//enable: ENABLE_CHAIN_INGRESS_RATE_LIMIT
+//#define ENABLE_CHAIN_INGRESS_RATE_LIMIT       // Extension to approach 1: admit packets of a backpressured chain at its ingress (chain_index 1) through a per chain token bucket, instead of dropping all of them until the mark clears.
+#if defined(ENABLE_CHAIN_INGRESS_RATE_LIMIT) && defined(NF_BACKPRESSURE_APPROACH_1)
+#define CHAIN_TB_EPOCH_IN_US            (1000)  // rate (re)evaluation period of the chain token bucket
+#define CHAIN_TB_BURST_PKTS             (64)    // bucket depth in packets
+#define CHAIN_TB_MD_SHIFT               (3)     // multiplicative decrease by 1/8th of the rate for every epoch the chain stays backpressured
+#define CHAIN_TB_AI_STEP_PPS            (10000) // additive increase of the rate for every epoch without backpressure
+#define CHAIN_TB_MIN_RATE_PPS           (1000)  // floor of the admitted rate
+#define CHAIN_TB_RELEASE_EPOCHS         (8)     // consecutive epochs without backpressure or token drops to lift the rate limit
+#define CHAIN_TB_TOKEN_SHIFT            (10)    // fixed point tokens (1 pkt = 1<<CHAIN_TB_TOKEN_SHIFT)
+#endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+
+//enable: ENABLE_CHAIN_INGRESS_FAIR_DROP
+//#define ENABLE_CHAIN_INGRESS_FAIR_DROP        // Extension to approach 1: approximate fair dropping at the ingress of a backpressured chain (flow count sketch + drop probability per flow), instead of dropping all flows of the chain alike.
+#if defined(ENABLE_CHAIN_INGRESS_FAIR_DROP) && defined(NF_BACKPRESSURE_APPROACH_1)
+#define AFD_EPOCH_IN_US                 (1000)  // sketch decay and fair share adaptation period
+#define AFD_EPISODE_GAP_EPOCHS          (8)     // chain not seen under backpressure for this many epochs => next backpressure starts afresh
+#define AFD_SKETCH_DEPTH                (2)     // count-min sketch rows
+#define AFD_SKETCH_WIDTH_BITS           (14)    // count-min sketch columns (log2); one sketch in the manager keyed by (chain, flow): (AFD_SKETCH_DEPTH*2 << AFD_SKETCH_WIDTH_BITS) bytes
+#define AFD_SCALE_ONE                   (256)   // fixed point 1.0 of the fair share scale
+#define AFD_SCALE_MIN                   (16)
+#define AFD_SCALE_MAX                   (AFD_SCALE_ONE*8)
+#endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+
 //#define USE_BKPR_V2_IN_TIMER_MODE       //Use this flag if the Timer Thread can perform the Backpressure setting
 #if !defined(USE_BKPR_V2_IN_TIMER_MODE) && defined(NF_BACKPRESSURE_APPROACH_1)
-#define ENABLE_SAVE_BACKLOG_FT_PER_NF           // save backlog Flow Entries per NF (Note: Enable)
-#define BACKPRESSURE_USE_RING_BUFFER_MODE       // Use Ring buffer to store and delete backlog Flow Entries per NF  (Note: Enable, sub define  under ENABLE_SAVE_BACKLOG_FT_PER_NF)
+#define ENABLE_BKPR_GENERATION_MARKS            // tag chain backpressure marks with the marking NF's generation: NF clears all its marks in O(1) by bumping the generation; stale marks are cleared lazily on next packet of the chain (Note: Enable)
 #endif //USE_BKPR_V2_IN_TIMER_MODE
 
 //#define RECHECK_BACKPRESSURE_MARK_ON_TX_DEQUEUE //Enable to re-check for back-pressure marking, at the time of packet dequeue from the NFs Tx Ring.
@@ -176,6 +301,89 @@
 #define ENABLE_USE_RTE_TIMER_MODE_FOR_MAIN_THREAD
 #define ENABLE_USE_RTE_TIMER_MODE_FOR_WAKE_THREAD
 
+/* Enable Earliest Deadline First (EDF) order of NF wakeups on each core (instead of ordering only by load).
+ * Each service chain carries a latency target; deadline of NF = (chain budget left at this hop) - (age of the head-of-queue pkt in its Rx ring).
+ * Dependency: USE_CGROUPS_PER_NF_INSTANCE (per core NF list is built and sorted in setup_nfs_priority_per_core_list()) */
+// enable: ENABLE_DEADLINE_AWARE_WAKE_ORDER
+//#define ENABLE_DEADLINE_AWARE_WAKE_ORDER
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+#define DEFAULT_CHAIN_LATENCY_TARGET_IN_US  (1000)      //latency target of chains that do not set one (onvm_sc_set_latency_target())
+#define ENABLE_PKT_ENQUEUE_TIMESTAMP                    //stamp pkts at enqueue to NFs Rx Ring (stored in onvm_pkt_meta)
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+
+/* Enable CoDel style delay based AQM on the NFs: marks backpressure (and ECN CE) on the sojourn time of pkts through the NF
+ * (enqueue to its Rx ring till dequeue from its Tx ring) instead of the Rx ring occupancy (CLIENT_QUEUE_RING_WATER_MARK_SIZE, CLIENT_QUEUE_RING_ECN_MARK_SIZE).
+ * Ring overflow is still treated as a backpressure signal. Dependency: ENABLE_NF_BACKPRESSURE */
+// enable: ENABLE_NF_SOJOURN_AQM
+//#define ENABLE_NF_SOJOURN_AQM
+#if defined(ENABLE_NF_SOJOURN_AQM) && defined(ENABLE_NF_BACKPRESSURE)
+#define NF_AQM_TARGET_IN_US         (500)       //acceptable standing sojourn time of pkts through an NF
+#define NF_AQM_INTERVAL_IN_US       (5000)      //sojourn must stay above target for this long before signalling; signals are then spaced at interval/sqrt(count)
+#ifndef ENABLE_PKT_ENQUEUE_TIMESTAMP
+#define ENABLE_PKT_ENQUEUE_TIMESTAMP
+#endif //ENABLE_PKT_ENQUEUE_TIMESTAMP
+#endif //ENABLE_NF_SOJOURN_AQM
+
+/* Enable online tuning of the Rx ring watermarks of each NF (instead of the global CLIENT_QUEUE_RING_THRESHOLD/_GAP):
+ * high watermark leaves headroom for the arrivals in flight during the backpressure reaction time (scaled by burstiness of arrivals) and is lowered on ring overflow drops;
+ * low watermark stays above what the NF drains in the reaction time, and the gap is widened when backpressure oscillates. Tuned every NF_LOAD_EVAL_PERIOD_IN_MS.
+ * Dependency: ENABLE_NF_BACKPRESSURE */
+// enable: ENABLE_NF_WATERMARK_AUTOTUNE
+//#define ENABLE_NF_WATERMARK_AUTOTUNE
+#ifdef ENABLE_NF_WATERMARK_AUTOTUNE
+#define NF_WM_REACTION_TIME_IN_US           (200)   //time for a backpressure (set/reset) to take effect at the NF
+#define NF_WM_MIN_HIGH_THRESHOLD            (40)    //bounds of the high watermark (% of Rx ring)
+#define NF_WM_MAX_HIGH_THRESHOLD            (95)
+#define NF_WM_MIN_GAP_THRESHOLD             (5)     //minimum gap between high and low watermarks (% of Rx ring)
+#define NF_WM_MAX_BKPR_EVENTS_PER_EPOCH     (4)     //more backpressure on/off cycles per tuning epoch is oscillation: widen the gap
+#define NF_WM_CALM_EPOCHS                   (10)    //tuning epochs without drops or backpressure before raising the high watermark
+#endif //ENABLE_NF_WATERMARK_AUTOTUNE
+
+/* Enable elastic manager core count: when the NFs Tx rings stay (nearly) empty, TX threads are parked (sleep on a semaphore, freeing their core)
+ * and the wakeup thread drains their NFs in its own loop (TX + wakeup folded on one core). Parked TX threads are resumed one at a time once the
+ * Tx ring backlog grows beyond what the folded core can drain.
+ * Dependency: INTERRUPT_SEM with ONVM_NUM_WAKEUP_THREADS >= 1 (without a wakeup thread nothing is ever parked) */
+// enable: ENABLE_ELASTIC_MGR_CORES
+//#define ENABLE_ELASTIC_MGR_CORES
+#ifdef ENABLE_ELASTIC_MGR_CORES
+#define ELASTIC_EVAL_PERIOD_IN_US       (1000)  //period to sample the Tx ring backlog and decide on park/unpark
+#define ELASTIC_TX_PARK_BACKLOG         (32)    //(ewma) total pkts pending in NFs Tx rings below which the manager is considered idle
+#define ELASTIC_TX_PARK_HOLD_PERIODS    (100)   //consecutive idle evaluations before parking one more TX thread (100ms)
+#define ELASTIC_TX_UNPARK_BACKLOG       (1024)  //total pkts pending in NFs Tx rings above which one parked TX thread is resumed
+#endif //ENABLE_ELASTIC_MGR_CORES
+
+/* Enable idle backoff of the wakeup thread: after consecutive passes in which no NF needed a wakeup, the thread backs off progressively
+ * spin -> rte_pause() -> nanosleep() -> block on a doorbell (semaphore) that the next flush of pkts to an NF Rx ring rings.
+ * Master thread sleeps for half of its shortest timer period instead of USLEEP_INTERVAL_IN_US.
+ * Dependency: INTERRUPT_SEM */
+// enable: ENABLE_WAKE_THREAD_IDLE_BACKOFF
+//#define ENABLE_WAKE_THREAD_IDLE_BACKOFF
+#ifdef ENABLE_WAKE_THREAD_IDLE_BACKOFF
+#define WAKE_BACKOFF_SPIN_PASSES        (64)    //idle passes polled at full speed
+#define WAKE_BACKOFF_PAUSE_PASSES       (1024)  //idle passes (after spin) with rte_pause() in between
+#define WAKE_BACKOFF_PAUSE_COUNT        (32)    //rte_pause() per idle pass in the pause stage
+#define WAKE_BACKOFF_NANOSLEEP_PASSES   (2048)  //idle passes (after pause) with a short nanosleep() in between
+#define WAKE_BACKOFF_NANOSLEEP_NS       (10000) //10 micro seconds
+#define WAKE_BACKOFF_BLOCK_TIMEOUT_US   (1000)  //bound on doorbell wait so that wake/arbiter timers keep running
+#endif //ENABLE_WAKE_THREAD_IDLE_BACKOFF
+
+/* Enable automatic NF scale-out/in per service: an instance that stays bottlenecked (in the bottleneck watch list / Rx Ring above the water mark)
+ * for NF_SCALE_OUT_PERSIST_CHECKS status checks gets a sibling of the same service_id: a warm standby instance is moved into the service map,
+ * else the launcher hook is invoked (default: NF_SCALE_OUT_LAUNCHER_CMD, whose exit status is checked). A launch that fails or does not
+ * register an instance within NF_SCALE_OUT_LAUNCH_TIMEOUT_IN_MS is given up, and the service may scale out again. Instances that register
+ * always serve the service. When the service load fits in one instance less for NF_SCALE_IN_IDLE_CHECKS checks, the last added
+ * instance is moved to the standby pool (it drains its Rx Ring and sleeps).
+ * Note: onvm_nf_service_to_nf_map() hashes flows over the active instances, so a scale event re-maps a share of the flows. */
+// enable: ENABLE_NF_AUTO_SCALING
+//#define ENABLE_NF_AUTO_SCALING
+#ifdef ENABLE_NF_AUTO_SCALING
+#define NF_SCALE_OUT_PERSIST_CHECKS     (4)     //consecutive NF status checks (500ms each) with the service bottlenecked
+#define NF_SCALE_IN_IDLE_CHECKS         (20)    //consecutive NF status checks with the load fitting in one instance less
+#define NF_SCALE_IN_HEADROOM_PCT        (70)    //scale in only if load < 70% of the capacity left after removing one instance
+#define NF_SCALE_OUT_LAUNCHER_CMD       "./scale_out_nf.sh %u %u"      //args: service_id, instance_id of the bottlenecked NF (the script starts the NF in background)
+#define NF_SCALE_OUT_LAUNCH_TIMEOUT_IN_MS (10000) //launch given up if no instance of the service registered by then
+#endif //ENABLE_NF_AUTO_SCALING
+
 
 /* ENABLE TIMER BASED WEIGHT COMPUTATION IN NF_LIB */
 //enable: ENABLE_TIMER_BASED_NF_CYCLE_COMPUTATION
@@ -198,60 +406,8 @@ struct onvm_service_chain;
 #endif  //ENABLE_NF_BACKPRESSURE
 
 
-#define SET_BIT(x,bitNum) ((x)|=(1<<(bitNum-1)))
-static inline void set_bit(long *x, unsigned bitNum) {
-    *x |= (1L << (bitNum-1));
-}
-
-#define CLEAR_BIT(x,bitNum) ((x) &= ~(1<<(bitNum-1)))
-static inline void clear_bit(long *x, unsigned bitNum) {
-    *x &= (~(1L << (bitNum-1)));
-}
-
-#define TOGGLE_BIT(x,bitNum) ((x) ^= (1<<(bitNum-1)))
-static inline void toggle_bit(long *x, unsigned bitNum) {
-    *x ^= (1L << (bitNum-1));
-}
-#define TEST_BIT(x,bitNum) ((x) & (1<<(bitNum-1)))
-static inline long test_bit(long x, unsigned bitNum) {
-    return (x & (1L << (bitNum-1)));
-}
-
-static inline long is_upstream_NF(long chain_throttle_value, long chain_index) {
-#ifndef HOP_BY_HOP_BACKPRESSURE
-        long chain_index_value = 0;
-        SET_BIT(chain_index_value, chain_index);
-        CLEAR_BIT(chain_throttle_value, chain_index);
-        return ((chain_throttle_value > chain_index_value)? (1):(0) );
-#else
-        long chain_index_value = 0;
-        SET_BIT(chain_index_value, (chain_index+1));
-        return ((chain_throttle_value & chain_index_value));
-        //return is_immediate_upstream_NF(chain_throttle_value,chain_index);
-#endif //HOP_BY_HOP_BACKPRESSURE
-        //1 => NF component at chain_index is an upstream component w.r.t where the bottleneck is seen in the chain (do not drop/throttle)
-        //0 => NF component at chain_index is an downstream component w.r.t where the bottleneck is seen in the chain (so drop/throttle)
-}
-static inline long is_immediate_upstream_NF(long chain_throttle_value, long chain_index) {
-#ifdef HOP_BY_HOP_BACKPRESSURE
-        long chain_index_value = 0;
-        SET_BIT(chain_index_value, (chain_index+1));
-        return ((chain_throttle_value & chain_index_value));
-#else
-        return is_upstream_NF(chain_throttle_value,chain_index);
-#endif  //HOP_BY_HOP_BACKPRESSURE
-        //1 => NF component at chain_index is an immediate upstream component w.r.t where the bottleneck is seen in the chain (do not drop/throttle)
-        //0 => NF component at chain_index is an downstream component w.r.t where the bottleneck is seen in the chain (so drop/throttle)
-}
-
-static inline long get_index_of_highest_set_bit(long x) {
-        long next_set_index = 0;
-        //SET_BIT(chain_index_value, chain_index);
-        //while ((1<<(next_set_index++)) < x);
-        //for(; (x > (1<<next_set_index));next_set_index++)
-        for(; (x >= (1<<next_set_index));next_set_index++);
-        return next_set_index;
-}
+/* ONVM_MAX_CHAIN_LENGTH, bit helpers and upstream NF checks for back-pressure marking on the service chain */
+#include "onvm_sched_policy.h"
 
 //#ifdef USE_MQ2
 //typedef struct msgbuf { long mtype; char mtext[32];}msgbuf_t;
@@ -264,6 +420,9 @@ struct onvm_pkt_meta {
         uint8_t destination; /* where to go next */
         uint8_t src; /* who processed the packet last */
         uint8_t chain_index; /*index of the current step in the service chain*/
+#ifdef ENABLE_PKT_ENQUEUE_TIMESTAMP
+        uint32_t enq_ts; /* time of enqueue to the NFs Rx Ring (tsc >> PKT_TS_CYCLE_SHIFT) */
+#endif //ENABLE_PKT_ENQUEUE_TIMESTAMP
 };
 static inline struct onvm_pkt_meta* onvm_get_pkt_meta(struct rte_mbuf* pkt) {
         return (struct onvm_pkt_meta*)&pkt->udata64;
@@ -273,6 +432,96 @@ static inline uint8_t onvm_get_pkt_chain_index(struct rte_mbuf* pkt) {
         return ((struct onvm_pkt_meta*)&pkt->udata64)->chain_index;
 }
 
+#ifdef ENABLE_MBUF_QUOTAS
+/* mbuf private area: owners the mbuf is charged to */
+struct onvm_mbuf_tag {
+        uint16_t chain_owner;   /* owner slot of the chain (0 => not charged) */
+        uint16_t nf_holder;     /* instance id of the NF keeping it buffered (0 => none) */
+};
+#define MBUF_PRIV_SIZE  (8)     /* onvm_mbuf_tag padded to the alignment of the mbuf private area */
+
+static inline struct onvm_mbuf_tag* onvm_get_pkt_mbuf_tag(struct rte_mbuf* pkt) {
+        return (struct onvm_mbuf_tag*)(pkt + 1);
+}
+
+typedef struct mbuf_owner_stats {
+        rte_atomic32_t inuse;           //mbufs charged to the owner
+        uint32_t quota;
+        uint32_t peak;
+        volatile uint16_t released;     //chain freed with mbufs still charged: the slot is freed with the last of them
+        uint64_t quota_drop;            //pkts refused for the owner being at its quota
+} mbuf_owner_stats_t;
+
+typedef struct mbuf_quota_info {
+        uint32_t pool_size;
+        uint32_t chain_quota;                           //default quota of a chain
+        rte_spinlock_t owner_lock;                      //chain owner slots: assigned by the Rx threads, released by whoever frees the chain
+        volatile uint16_t next_owner;                   //next never used chain owner slot
+        volatile uint16_t nb_free;                      //released slots in free_owner
+        uint16_t free_owner[MBUF_QUOTA_MAX_CHAINS];
+        mbuf_owner_stats_t chain[MBUF_QUOTA_MAX_CHAINS];
+        mbuf_owner_stats_t nf[MAX_CLIENTS];             //pkts buffered by each NF: updated only by the NF
+} mbuf_quota_info_t;
+
+/* Take a chain owner slot: 0 if there is none left */
+static inline uint16_t onvm_mbuf_owner_alloc(mbuf_quota_info_t *mq) {
+        uint16_t owner = 0;
+        rte_spinlock_lock(&mq->owner_lock);
+        if (mq->nb_free) {
+                owner = mq->free_owner[--mq->nb_free];
+        } else if (mq->next_owner < MBUF_QUOTA_MAX_CHAINS) {
+                owner = mq->next_owner++;
+        }
+        rte_spinlock_unlock(&mq->owner_lock);
+        if (owner) {
+                mq->chain[owner].peak = 0;
+                mq->chain[owner].quota_drop = 0;
+        }
+        return owner;
+}
+
+static inline void onvm_mbuf_owner_free(mbuf_quota_info_t *mq, uint16_t owner) {
+        rte_spinlock_lock(&mq->owner_lock);
+        mq->free_owner[mq->nb_free++] = owner;
+        rte_spinlock_unlock(&mq->owner_lock);
+}
+
+/* Release the owner slot of a freed chain: reused only once no mbuf is charged to it (else the last uncharge frees it) */
+static inline void onvm_mbuf_owner_release(mbuf_quota_info_t *mq, uint16_t owner) {
+        if (owner == 0 || owner >= MBUF_QUOTA_MAX_CHAINS) {
+                return;
+        }
+        mq->chain[owner].released = 1;
+        rte_mb();
+        if (0 == rte_atomic32_read(&mq->chain[owner].inuse) && rte_atomic16_cmpset(&mq->chain[owner].released, 1, 0)) {
+                onvm_mbuf_owner_free(mq, owner);
+        }
+}
+
+/* Release the chain charge of a pkt leaving the system */
+static inline void onvm_mbuf_uncharge(mbuf_quota_info_t *mq, struct rte_mbuf* pkt) {
+        struct onvm_mbuf_tag *tag = onvm_get_pkt_mbuf_tag(pkt);
+        mbuf_owner_stats_t *os;
+        if (tag->chain_owner) {
+                os = &mq->chain[tag->chain_owner];
+                if (rte_atomic32_dec_and_test(&os->inuse) && os->released && rte_atomic16_cmpset(&os->released, 1, 0)) {
+                        onvm_mbuf_owner_free(mq, tag->chain_owner);
+                }
+                tag->chain_owner = 0;
+        }
+}
+
+/* Clear the tags of a burst read from the NIC: the private area of an mbuf still carries the tag of its last use */
+static inline void onvm_mbuf_reset_tags(struct rte_mbuf **pkts, uint16_t count) {
+        uint16_t i;
+        for (i = 0; i < count; i++) {
+                struct onvm_mbuf_tag *tag = onvm_get_pkt_mbuf_tag(pkts[i]);
+                tag->chain_owner = 0;
+                tag->nf_holder = 0;
+        }
+}
+#endif //ENABLE_MBUF_QUOTAS
+
 /*
  * Define a structure with stats from the clients.
  */
@@ -340,6 +589,35 @@ struct onvm_nf_info {
 #endif  //ENABLE_ECN_CE
 };
 
+#ifdef ENABLE_CHAIN_INGRESS_RATE_LIMIT
+/* Ingress token bucket of a service chain: updated only by the thread enqueuing to chain index 1 (Rx thread) */
+typedef struct chain_ingress_tb {
+        uint64_t rate_pps;      // admitted rate (0 => chain not rate limited)
+        uint64_t tokens;        // available tokens in fixed point (CHAIN_TB_TOKEN_SHIFT)
+        uint64_t last_tsc;      // last token refill
+        uint64_t refill_rem;    // remainder of the last refill (fixed point tokens * tsc hz), carried to the next refill
+        uint64_t epoch_tsc;     // start of the current rate evaluation epoch
+        uint64_t epoch_drops;   // token drops in the current epoch
+        uint64_t admitted;
+        uint64_t dropped;
+        uint16_t bneck_nf;      // instance id of the tracked bottleneck NF
+        uint16_t calm_epochs;   // consecutive epochs without backpressure or token drops
+}chain_ingress_tb_t;
+#endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+
+#ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+/* Approximate fair dropping state of a service chain at its ingress */
+typedef struct chain_fair_drop {
+        uint32_t arrivals;      // pkts at ingress under backpressure in the current epoch
+        uint32_t flows;         // flows (new in the sketch) in the current epoch
+        uint32_t last_arrivals;
+        uint32_t last_flows;
+        uint32_t scale;         // fair share scale (AFD_SCALE_ONE => mean per flow count)
+        uint64_t epoch_tsc;
+        uint64_t dropped;
+}chain_fair_drop_t;
+#endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+
 /*
  * Define a structure to describe a service chain entry
  */
@@ -351,24 +629,68 @@ struct onvm_service_chain_entry {
 struct onvm_service_chain {
 	struct onvm_service_chain_entry sc[ONVM_MAX_CHAIN_LENGTH+1];
 	uint8_t chain_length;
-	uint8_t ref_cnt;
+	volatile uint16_t ref_cnt;      // flows installed on the chain (onvm_sc_ref_get()/onvm_sc_ref_put())
 #ifdef ENABLE_NF_BACKPRESSURE
-	volatile uint8_t highest_downstream_nf_index_id;     // bit index of each NF in the chain that is overflowing
+	volatile uint16_t highest_downstream_nf_index_id;    // bit index of each NF in the chain that is overflowing
 //#ifdef NF_BACKPRESSURE_APPROACH_2
 	uint8_t nf_instances_mapped; //set when all nf_instances are populated in the below array
 	uint8_t nf_instance_id[ONVM_MAX_CHAIN_LENGTH+1];
 //#endif //NF_BACKPRESSURE_APPROACH_2
+	uint16_t bkpr_upstream[ONVM_MAX_CHAIN_LENGTH+1];     // bit index of the NFs in the chain upstream of each chain index (set from the chain topology)
+#ifdef ENABLE_BKPR_GENERATION_MARKS
+	uint16_t bkpr_mark_nf[ONVM_MAX_CHAIN_LENGTH+1];      // instance id of the NF that set the mark at each chain index
+	uint32_t bkpr_mark_gen[ONVM_MAX_CHAIN_LENGTH+1];     // generation of that NF when the mark was set; mark is stale once NF generation moves on
+#endif //ENABLE_BKPR_GENERATION_MARKS
+#ifdef ENABLE_CHAIN_INGRESS_RATE_LIMIT
+	chain_ingress_tb_t ingress_tb;
+#endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+#ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+	chain_fair_drop_t fair_drop;
+#endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
 #endif //ENABLE_NF_BACKPRESSURE
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+	uint32_t latency_target_us;     // end-to-end latency target of the chain (0 => DEFAULT_CHAIN_LATENCY_TARGET_IN_US)
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+#ifdef ENABLE_MBUF_QUOTAS
+	volatile uint16_t mbuf_owner;           // owner slot in mbuf_quota_info_t (0 => not yet assigned)
+	uint32_t mbuf_quota;            // mbufs the chain may hold (0 => MBUF_QUOTA_CHAIN_DEFAULT_PCT of the pool)
+#endif //ENABLE_MBUF_QUOTAS
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+	uint8_t rx_class;               // Rx priority class of the chain + 1 (0 => classify the pkts by DSCP)
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+#ifdef ENABLE_CHAIN_STATS
+	volatile uint16_t chain_id;     // index in the chain stats (0 => not registered or id reclaimed, CHAIN_ID_RETIRED => being freed)
+#endif //ENABLE_CHAIN_STATS
 };
 
 /* define common names for structures shared between server and client */
 #define MP_CLIENT_RXQ_NAME "MProc_Client_%u_RX"
 #define MP_CLIENT_TXQ_NAME "MProc_Client_%u_TX"
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+#define MP_CLIENT_RXQ_PRIO_NAME "MProc_Client_%u_RX_P%u"
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+/* IPv6 flows in the flow director: kept in a second flow table of IPv6 keys (sdn_ft6), picked by the ether type of the pkt.
+ * The flow entries of IPv6 flows are not aged out, classified or scanned for backpressure (IPv4 only). */
+// enable: ENABLE_FLOW_DIR_IPV6
+//#define ENABLE_FLOW_DIR_IPV6
+
 #define PKTMBUF_POOL_NAME "MProc_pktmbuf_pool"
 #define MZ_PORT_INFO "MProc_port_info"
 #define MZ_CLIENT_INFO "MProc_client_info"
 #define MZ_SCP_INFO "MProc_scp_info"
 #define MZ_FTP_INFO "MProc_ftp_info"
+#ifdef ENABLE_MBUF_QUOTAS
+#define MZ_MBUF_QUOTA_INFO "MProc_mbuf_quota_info"
+#endif //ENABLE_MBUF_QUOTAS
+#ifdef ENABLE_FLOW_CLASSIFIER
+#define MZ_FC_INFO "MProc_fc_info"
+#endif //ENABLE_FLOW_CLASSIFIER
+#ifdef ENABLE_FLOW_DIR_IPV6
+#define MZ_FTP6_INFO "MProc_ftp6_info"
+#endif //ENABLE_FLOW_DIR_IPV6
+#ifdef ENABLE_CHAIN_STATS
+#define MZ_CHAIN_STATS_INFO "MProc_chain_stats_info"
+#endif //ENABLE_CHAIN_STATS
 
 /* interrupt semaphore specific updates */
 #ifdef INTERRUPT_SEM
@@ -425,6 +747,21 @@ get_rx_queue_name(unsigned id) {
         return buffer;
 }
 
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+/*
+ * Given the priority rx queue name template above, get the queue name of the class
+ */
+static inline const char *
+get_rx_prio_queue_name(unsigned id, unsigned rx_class) {
+        /* buffer for return value. Size calculated by %u being replaced
+         * by maximum 3 digits and the class by 1 digit (plus an extra byte for safety) */
+        static char buffer[sizeof(MP_CLIENT_RXQ_PRIO_NAME) + 2];
+
+        snprintf(buffer, sizeof(buffer) - 1, MP_CLIENT_RXQ_PRIO_NAME, id, rx_class);
+        return buffer;
+}
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
 /*
  * Given the tx queue name template above, get the queue name
  */
@@ -597,6 +934,20 @@ static inline uint64_t get_diff_cpu_cycles_in_us(uint64_t start, uint64_t end) {
         return 0;
 }
 
+#ifdef ENABLE_PKT_ENQUEUE_TIMESTAMP
+#define PKT_TS_CYCLE_SHIFT  (10)    //resolution of enq_ts (~0.4us at 2.5GHz); 32bit stamp wraps in ~30mins, age is computed modulo 2^32
+static inline uint32_t onvm_get_pkt_ts_now(void) {
+        return (uint32_t)(rte_rdtsc() >> PKT_TS_CYCLE_SHIFT);
+}
+static inline void onvm_set_pkt_enqueue_ts(struct rte_mbuf *pkt, uint32_t now) {
+        ((struct onvm_pkt_meta*)&pkt->udata64)->enq_ts = now;
+}
+static inline uint64_t onvm_get_pkt_sojourn_in_us(struct rte_mbuf *pkt, uint32_t now) {
+        uint64_t age_cycles = ((uint64_t)(uint32_t)(now - ((struct onvm_pkt_meta*)&pkt->udata64)->enq_ts)) << PKT_TS_CYCLE_SHIFT;
+        return (uint64_t) ((age_cycles*SECOND_TO_MICRO_SECOND)/rte_get_tsc_hz());
+}
+#endif //ENABLE_PKT_ENQUEUE_TIMESTAMP
+
 #ifdef ENABLE_NF_BACKPRESSURE
 typedef struct sc_entries {
         struct onvm_service_chain *sc;
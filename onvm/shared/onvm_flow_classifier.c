@@ -0,0 +1,391 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2016 George Washington University
+ *            2015-2016 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * onvm_flow_classifier.c - wildcard classifier (tuple space search)
+ ********************************************************************/
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <rte_memory.h>
+#include <rte_memzone.h>
+#include <rte_malloc.h>
+#include <rte_byteorder.h>
+#include "common.h"
+#include "onvm_flow_table.h"
+#include "onvm_flow_classifier.h"
+
+#ifdef ENABLE_FLOW_CLASSIFIER
+#define NO_FLAGS 0
+
+struct onvm_fc *onvm_fc = NULL;
+
+int
+onvm_fc_init(void) {
+        const struct rte_memzone *mz_fc;
+        struct onvm_fc *fc;
+
+        fc = rte_zmalloc_socket("flow_classifier", sizeof(struct onvm_fc), RTE_CACHE_LINE_SIZE, rte_socket_id());
+        if (fc == NULL) {
+                return -ENOMEM;
+        }
+        rte_spinlock_init(&fc->lock);
+        rte_atomic32_init(&fc->rules);
+        fc->socket_id = rte_socket_id();
+
+        mz_fc = rte_memzone_reserve(MZ_FC_INFO, sizeof(struct onvm_fc *), rte_socket_id(), NO_FLAGS);
+        if (mz_fc == NULL) {
+                rte_free(fc);
+                return -ENOMEM;
+        }
+        *(struct onvm_fc **)mz_fc->addr = fc;
+        onvm_fc = fc;
+        return 0;
+}
+
+int
+onvm_fc_nf_init(void) {
+        const struct rte_memzone *mz_fc;
+
+        mz_fc = rte_memzone_lookup(MZ_FC_INFO);
+        if (mz_fc == NULL) {
+                return -ENOENT;
+        }
+        onvm_fc = *(struct onvm_fc **)mz_fc->addr;
+        return 0;
+}
+
+/* Split [lo, hi] in aligned power of 2 blocks: value/mask pairs (host order); returns the count */
+static int
+onvm_fc_port_prefixes(uint16_t lo, uint16_t hi, uint16_t *val, uint16_t *mask) {
+        uint32_t l = lo, h = hi, size;
+        int n = 0;
+
+        if (l > h) {
+                return -EINVAL;
+        }
+        while (l <= h && n < ONVM_FC_MAX_PORT_PREFIXES) {
+                size = 1;
+                while (size < 65536 && (l & ((size << 1) - 1)) == 0 && l + (size << 1) - 1 <= h) {
+                        size <<= 1;
+                }
+                val[n] = (uint16_t)l;
+                mask[n] = (uint16_t)~(size - 1);
+                n++;
+                l += size;
+        }
+        return n;
+}
+
+static inline uint32_t
+onvm_fc_prefix_mask(uint8_t plen) {
+        return (plen)? (rte_cpu_to_be_32(~0u << (32 - RTE_MIN(plen, 32)))):(0);
+}
+
+/* Subtable of the given mask; appended if needed (called with fc->lock held) */
+static struct onvm_fc_subtable*
+onvm_fc_get_subtable(struct onvm_fc *fc, const struct onvm_ft_ipv4_5tuple *mask, int create) {
+        struct onvm_fc_subtable *st;
+        uint32_t i;
+
+        for (i = 0; i < fc->nb_subtables; i++) {
+                if (memcmp(&fc->st[i].mask, mask, sizeof(*mask)) == 0) {
+                        return &fc->st[i];
+                }
+        }
+        if (!create || fc->nb_subtables >= FLOW_CLASSIFIER_MAX_SUBTABLES) {
+                return NULL;
+        }
+        st = &fc->st[fc->nb_subtables];
+        st->ft = onvm_ft_create_resizable(FLOW_CLASSIFIER_SUBTABLE_ENTRIES, FLOW_CLASSIFIER_MAX_RULES, sizeof(struct onvm_fc_entry), fc->socket_id);
+        if (st->ft == NULL) {
+                return NULL;
+        }
+        st->mask = *mask;
+        st->max_priority = 0;
+        rte_atomic32_init(&st->entries);
+        /* publish the subtable only once it is complete: lookups may be running */
+        rte_wmb();
+        fc->nb_subtables++;
+        return st;
+}
+
+/* Masks and keys of the rule for the port prefix pair (i, j) */
+static inline void
+onvm_fc_rule_key(const struct onvm_fc_rule *rule, uint16_t sval, uint16_t smask, uint16_t dval, uint16_t dmask,
+                struct onvm_ft_ipv4_5tuple *mask, struct onvm_ft_ipv4_5tuple *key) {
+        memset(mask, 0, sizeof(*mask));
+        memset(key, 0, sizeof(*key));
+        mask->src_addr = onvm_fc_prefix_mask(rule->src_plen);
+        mask->dst_addr = onvm_fc_prefix_mask(rule->dst_plen);
+        mask->src_port = rte_cpu_to_be_16(smask);
+        mask->dst_port = rte_cpu_to_be_16(dmask);
+        mask->proto = (rule->proto_any)? (0):(0xFF);
+        key->src_addr = rte_cpu_to_be_32(rule->src_addr) & mask->src_addr;
+        key->dst_addr = rte_cpu_to_be_32(rule->dst_addr) & mask->dst_addr;
+        key->src_port = rte_cpu_to_be_16(sval) & mask->src_port;
+        key->dst_port = rte_cpu_to_be_16(dval) & mask->dst_port;
+        key->proto = rule->proto & mask->proto;
+}
+
+/* Expose the highest priority rule of the entry to the lookups (sc last: a lookup checks it first) */
+static inline void
+onvm_fc_entry_expose(struct onvm_fc_entry *e) {
+        e->priority = e->rule[0].priority;
+        e->idle_timeout = e->rule[0].idle_timeout;
+        rte_wmb();
+        e->sc = e->rule[0].sc;
+}
+
+/* Insert the rule in the entry by priority (ahead of the rules of the same priority): -ENOSPC if the entry is full */
+static int
+onvm_fc_entry_insert(struct onvm_fc_entry *e, const struct onvm_fc_rule *rule) {
+        uint16_t k;
+
+        if (e->nb_rules >= FLOW_CLASSIFIER_ENTRY_RULES) {
+                return -ENOSPC;
+        }
+        for (k = e->nb_rules; k > 0 && e->rule[k - 1].priority <= rule->priority; k--) {
+                e->rule[k] = e->rule[k - 1];
+        }
+        e->rule[k].sc = rule->sc;
+        e->rule[k].priority = rule->priority;
+        e->rule[k].idle_timeout = (rule->idle_timeout)? (rule->idle_timeout):(FLOW_CLASSIFIER_IDLE_TIMEOUT);
+        e->nb_rules++;
+        return 0;
+}
+
+/* Remove the rule from the entry: -ENOENT if the entry does not hold it */
+static int
+onvm_fc_entry_remove(struct onvm_fc_entry *e, const struct onvm_fc_rule *rule) {
+        uint16_t k;
+
+        for (k = 0; k < e->nb_rules; k++) {
+                if (e->rule[k].sc == rule->sc && e->rule[k].priority == rule->priority) {
+                        break;
+                }
+        }
+        if (k == e->nb_rules) {
+                return -ENOENT;
+        }
+        for (e->nb_rules--; k < e->nb_rules; k++) {
+                e->rule[k] = e->rule[k + 1];
+        }
+        return 0;
+}
+
+/* Drop the entry of the subtable once its last rule is gone */
+static void
+onvm_fc_entry_free(struct onvm_fc_subtable *st, const struct onvm_ft_ipv4_5tuple *key, struct onvm_fc_entry *e) {
+        onvm_ft_remove_key(st->ft, key);
+        e->sc = NULL;   //a lookup racing with the delete skips the entry
+        rte_atomic32_dec(&st->entries);
+}
+
+/* Subtable entry added or updated by onvm_fc_add_rule(): restored if the rule does not fit */
+struct onvm_fc_undo {
+        struct onvm_fc_subtable *st;
+        struct onvm_ft_ipv4_5tuple key;
+        struct onvm_fc_entry *e;
+};
+
+static void
+onvm_fc_rollback(struct onvm_fc_undo *undo, int cnt, const struct onvm_fc_rule *rule) {
+        struct onvm_fc_undo *u;
+
+        while (cnt-- > 0) {
+                u = &undo[cnt];
+                onvm_fc_entry_remove(u->e, rule);
+                if (u->e->nb_rules == 0) {
+                        onvm_fc_entry_free(u->st, &u->key, u->e);
+                } else {
+                        onvm_fc_entry_expose(u->e);
+                }
+        }
+}
+
+int
+onvm_fc_add_rule(struct onvm_fc *fc, const struct onvm_fc_rule *rule) {
+        uint16_t sval[ONVM_FC_MAX_PORT_PREFIXES], smask[ONVM_FC_MAX_PORT_PREFIXES];
+        uint16_t dval[ONVM_FC_MAX_PORT_PREFIXES], dmask[ONVM_FC_MAX_PORT_PREFIXES];
+        struct onvm_ft_ipv4_5tuple mask, key;
+        struct onvm_fc_subtable *st;
+        struct onvm_fc_entry *e;
+        struct onvm_fc_undo *undo;
+        int ns, nd, i, j, ret = 0;
+
+        if (fc == NULL || rule == NULL || rule->sc == NULL) {
+                return -EINVAL;
+        }
+        ns = onvm_fc_port_prefixes(rule->src_port_lo, rule->src_port_hi, sval, smask);
+        nd = onvm_fc_port_prefixes(rule->dst_port_lo, rule->dst_port_hi, dval, dmask);
+        if (ns < 0 || nd < 0) {
+                return -EINVAL;
+        }
+        undo = rte_malloc("fc_undo", sizeof(struct onvm_fc_undo) * ns * nd, 0);
+        if (undo == NULL) {
+                return -ENOMEM;
+        }
+
+        rte_spinlock_lock(&fc->lock);
+        for (i = 0; i < ns && ret >= 0; i++) {
+                for (j = 0; j < nd; j++) {
+                        onvm_fc_rule_key(rule, sval[i], smask[i], dval[j], dmask[j], &mask, &key);
+                        st = onvm_fc_get_subtable(fc, &mask, 1);
+                        if (st == NULL || onvm_ft_add_key(st->ft, &key, (char **)&e) < 0 || onvm_fc_entry_insert(e, rule) < 0) {
+                                //all or nothing: drop this rule from the entries it was added to so far
+                                onvm_fc_rollback(undo, ret, rule);
+                                ret = -ENOSPC;
+                                break;
+                        }
+                        undo[ret].st = st;
+                        undo[ret].key = key;
+                        undo[ret].e = e;
+                        if (e->nb_rules == 1) {
+                                rte_atomic32_inc(&st->entries);
+                        }
+                        onvm_fc_entry_expose(e);
+                        if (rule->priority > st->max_priority) {
+                                st->max_priority = rule->priority;  //kept on rollback: only an upper bound for the lookup
+                        }
+                        ret++;
+                }
+        }
+        if (ret > 0) {
+                rte_atomic32_inc(&fc->rules);
+        }
+        rte_spinlock_unlock(&fc->lock);
+        rte_free(undo);
+        return ret;
+}
+
+int
+onvm_fc_del_rule(struct onvm_fc *fc, const struct onvm_fc_rule *rule) {
+        uint16_t sval[ONVM_FC_MAX_PORT_PREFIXES], smask[ONVM_FC_MAX_PORT_PREFIXES];
+        uint16_t dval[ONVM_FC_MAX_PORT_PREFIXES], dmask[ONVM_FC_MAX_PORT_PREFIXES];
+        struct onvm_ft_ipv4_5tuple mask, key;
+        struct onvm_fc_subtable *st;
+        struct onvm_fc_entry *e;
+        int ns, nd, i, j, ret = 0;
+
+        if (fc == NULL || rule == NULL) {
+                return -EINVAL;
+        }
+        ns = onvm_fc_port_prefixes(rule->src_port_lo, rule->src_port_hi, sval, smask);
+        nd = onvm_fc_port_prefixes(rule->dst_port_lo, rule->dst_port_hi, dval, dmask);
+        if (ns < 0 || nd < 0) {
+                return -EINVAL;
+        }
+
+        rte_spinlock_lock(&fc->lock);
+        for (i = 0; i < ns; i++) {
+                for (j = 0; j < nd; j++) {
+                        onvm_fc_rule_key(rule, sval[i], smask[i], dval[j], dmask[j], &mask, &key);
+                        st = onvm_fc_get_subtable(fc, &mask, 0);
+                        if (st == NULL || onvm_ft_lookup_key(st->ft, &key, (char **)&e) < 0 || onvm_fc_entry_remove(e, rule) < 0) {
+                                continue;
+                        }
+                        if (e->nb_rules == 0) {
+                                onvm_fc_entry_free(st, &key, e);
+                        } else {
+                                onvm_fc_entry_expose(e);        //the next rule shadowed by the deleted one
+                        }
+                        ret++;
+                }
+        }
+        if (ret > 0) {
+                rte_atomic32_dec(&fc->rules);
+        }
+        rte_spinlock_unlock(&fc->lock);
+        return ret;
+}
+
+struct onvm_fc_entry*
+onvm_fc_lookup(struct onvm_fc *fc, const struct onvm_ft_ipv4_5tuple *key, uint16_t shard) {
+        struct onvm_ft_ipv4_5tuple mkey;
+        struct onvm_fc_subtable *st;
+        struct onvm_fc_entry *e, *best = NULL;
+        onvm_fc_stats_t *stats = &fc->stats[shard];
+        uint32_t i, n;
+
+        n = fc->nb_subtables;
+        rte_smp_rmb();
+        stats->lookups++;
+        memset(&mkey, 0, sizeof(mkey));
+        for (i = 0; i < n; i++) {
+                st = &fc->st[i];
+                if (rte_atomic32_read(&st->entries) == 0 || (best && st->max_priority <= best->priority)) {
+                        continue;
+                }
+                mkey.src_addr = key->src_addr & st->mask.src_addr;
+                mkey.dst_addr = key->dst_addr & st->mask.dst_addr;
+                mkey.src_port = key->src_port & st->mask.src_port;
+                mkey.dst_port = key->dst_port & st->mask.dst_port;
+                mkey.proto = key->proto & st->mask.proto;
+                stats->probes++;
+                if (onvm_ft_lookup_key(st->ft, &mkey, (char **)&e) >= 0 && e->sc && (best == NULL || e->priority > best->priority)) {
+                        best = e;
+                }
+        }
+        if (best) {
+                stats->hits++;
+        }
+        return best;
+}
+
+void
+onvm_fc_print_stats(struct onvm_fc *fc) {
+        onvm_fc_stats_t sum;
+        int s;
+
+        if (fc == NULL) {
+                return;
+        }
+        memset(&sum, 0, sizeof(sum));
+        for (s = 0; s < FLOW_CLASSIFIER_STATS_SHARDS; s++) {
+                sum.lookups += fc->stats[s].lookups;
+                sum.hits += fc->stats[s].hits;
+                sum.probes += fc->stats[s].probes;
+                sum.installs += fc->stats[s].installs;
+                sum.miss_installs += fc->stats[s].miss_installs;
+                sum.install_failures += fc->stats[s].install_failures;
+        }
+        printf("Flow classifier: rules=[%d], subtables=[%u], lookups=[%"PRIu64"], hits=[%"PRIu64"], probes=[%"PRIu64"], installs=[%"PRIu64"], miss installs=[%"PRIu64"], install failures=[%"PRIu64"]\n",
+                rte_atomic32_read(&fc->rules), fc->nb_subtables, sum.lookups, sum.hits, sum.probes,
+                sum.installs, sum.miss_installs, sum.install_failures);
+}
+#endif //ENABLE_FLOW_CLASSIFIER
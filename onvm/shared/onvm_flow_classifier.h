@@ -0,0 +1,131 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2016 George Washington University
+ *            2015-2016 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * onvm_flow_classifier.h - wildcard classifier resolving the service chain of new flows
+ ********************************************************************/
+
+#ifndef _ONVM_FLOW_CLASSIFIER_H_
+#define _ONVM_FLOW_CLASSIFIER_H_
+
+#include <rte_atomic.h>
+#include <rte_spinlock.h>
+#include "common.h"
+#include "onvm_flow_table.h"
+
+#ifdef ENABLE_FLOW_CLASSIFIER
+/* Tuple space search: the rules are grouped in subtables by their mask (prefix lengths, port masks, protocol or any), each
+ * subtable is a flow table (onvm_ft) of the masked rule keys. A lookup masks the flow key with each subtable mask and probes it,
+ * keeping the highest priority match. Port ranges are split into port prefixes, so a rule adds at most a few entries.
+ * The manager classifies the first pkt of a flow that misses in the flow director and installs an exact match entry for it.
+ */
+#define ONVM_FC_MAX_PORT_PREFIXES       (32)    // prefixes covering any port range
+
+/* A wildcard rule: addresses and ports in host byte order */
+struct onvm_fc_rule {
+        uint32_t src_addr;
+        uint32_t dst_addr;
+        uint8_t  src_plen;              // 0 => any source
+        uint8_t  dst_plen;              // 0 => any destination
+        uint8_t  proto;
+        uint8_t  proto_any;
+        uint16_t src_port_lo;           // [lo, hi]: 0-65535 => any port
+        uint16_t src_port_hi;
+        uint16_t dst_port_lo;
+        uint16_t dst_port_hi;
+        uint16_t priority;              // the highest priority matching rule wins
+        uint16_t idle_timeout;          // of the flow entries installed for this rule (0 => FLOW_CLASSIFIER_IDLE_TIMEOUT)
+        struct onvm_service_chain *sc;
+};
+
+/* Value of a subtable entry: the rules of the same mask and key, highest priority first; the first one is exposed to lookups */
+struct onvm_fc_entry {
+        struct onvm_service_chain *sc;
+        uint16_t priority;
+        uint16_t idle_timeout;
+        uint16_t nb_rules;
+        struct {
+                struct onvm_service_chain *sc;
+                uint16_t priority;
+                uint16_t idle_timeout;
+        } rule[FLOW_CLASSIFIER_ENTRY_RULES];
+};
+
+struct onvm_fc_subtable {
+        struct onvm_ft_ipv4_5tuple mask;        // network byte order, as the flow keys
+        volatile uint16_t max_priority;
+        rte_atomic32_t entries;
+        struct onvm_ft *ft;
+};
+
+typedef struct onvm_fc_stats {
+        uint64_t lookups;
+        uint64_t hits;
+        uint64_t probes;                // subtables probed
+        uint64_t installs;              // exact match entries installed by the manager
+        uint64_t miss_installs;         // entries installed with the default chain for flows matching no rule
+        uint64_t install_failures;      // incl. the pkts of new flows while the flow table is full
+} __rte_cache_aligned onvm_fc_stats_t;
+
+struct onvm_fc {
+        rte_spinlock_t lock;            // serializes the rule updates (subtables are only appended)
+        volatile uint32_t nb_subtables;
+        rte_atomic32_t rules;
+        int socket_id;
+        onvm_fc_stats_t stats[FLOW_CLASSIFIER_STATS_SHARDS];    // one per manager Rx thread: no shared counter updates
+        struct onvm_fc_subtable st[FLOW_CLASSIFIER_MAX_SUBTABLES];
+};
+
+/* Classifier shared by the manager and the NFs: created by the manager (onvm_fc_init()), mapped by the NFs (onvm_fc_nf_init()) */
+extern struct onvm_fc *onvm_fc;
+
+int onvm_fc_init(void);
+int onvm_fc_nf_init(void);
+
+/* Add/delete a rule: returns the count of subtable entries (port prefix pairs) added/deleted, or a negative errno.
+ * A rule that does not fit (-ENOSPC) is not added: the subtable entries it added or updated are restored.
+ * Deleting a rule re-exposes the next rule of the same mask and key it shadowed, if any */
+int onvm_fc_add_rule(struct onvm_fc *fc, const struct onvm_fc_rule *rule);
+int onvm_fc_del_rule(struct onvm_fc *fc, const struct onvm_fc_rule *rule);
+
+/* Highest priority rule matching the flow key (network byte order, as filled by onvm_ft_fill_key()): NULL if none.
+ * Accounted in the stats shard of the calling Rx thread */
+struct onvm_fc_entry* onvm_fc_lookup(struct onvm_fc *fc, const struct onvm_ft_ipv4_5tuple *key, uint16_t shard);
+
+void onvm_fc_print_stats(struct onvm_fc *fc);
+#endif //ENABLE_FLOW_CLASSIFIER
+
+#endif  // _ONVM_FLOW_CLASSIFIER_H_
@@ -40,32 +40,103 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <rte_memory.h>
 #include <rte_memzone.h>
 #include <rte_mbuf.h>
 #include <rte_malloc.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <rte_spinlock.h>
+#include <rte_ethdev.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "common.h"
 #include "onvm_flow_table.h"
 #include "onvm_flow_dir.h"
+#include "onvm_sc_common.h"
+#include "onvm_flow_classifier.h"
 
 #define NO_FLAGS 0
 
 
 struct onvm_ft *sdn_ft;
 struct onvm_ft **sdn_ft_p;
+struct onvm_flow_dir_info *flow_dir_info;
+#ifdef ENABLE_CHAIN_STATS
+onvm_chain_stats_info_t *chain_stats;
+#endif //ENABLE_CHAIN_STATS
+uint32_t sdn_ft_entries = SDN_FT_ENTRIES;
+uint32_t sdn_ft_max_entries = SDN_FT_MAX_ENTRIES;
+
+#ifdef ENABLE_FLOW_DIR_IPV6
+struct onvm_ft *sdn_ft6;
+
+/* Flow table of the flow of the pkt */
+static inline struct onvm_ft *
+onvm_flow_dir_pkt_table(struct rte_mbuf *pkt) {
+        uint32_t l3_off;
+        uint16_t vlan_id;
+        return (onvm_ft_pkt_l3(pkt, &l3_off, &vlan_id) == ETHER_TYPE_IPv6)? (sdn_ft6):(sdn_ft);
+}
+#define FLOW_DIR_INDEX_TAG(ft)  (((ft) == sdn_ft6)? (FLOW_DIR_INDEX_IPV6):(0))
+#define FLOW_DIR_NB_TABLES      (2)
+#define FLOW_DIR_TABLE(t)       ((t)? (sdn_ft6):(sdn_ft))
+#else
+#define onvm_flow_dir_pkt_table(pkt) (sdn_ft)
+#define FLOW_DIR_INDEX_TAG(ft)  (0)
+#define FLOW_DIR_NB_TABLES      (1)
+#define FLOW_DIR_TABLE(t)       (sdn_ft)
+#endif //ENABLE_FLOW_DIR_IPV6
+
+RTE_DEFINE_PER_LCORE(int, flow_dir_reader);
+
+/* Objects retired by this process, released in order once their epoch is safe */
+#define FLOW_DIR_RETIRE_MIN     (4096)  //initial size of the retire list: doubled whenever it is full of objects in their grace period
+#define FLOW_DIR_RETIRE_FREE    (0)     //obj is freed
+#define FLOW_DIR_RETIRE_SC_REF  (1)     //obj is a removed flow entry: its chain is detached (unless installed again meanwhile)
+#define FLOW_DIR_RETIRE_SC      (2)     //obj is a service chain: its mbuf owner slot is released, then it is freed
+typedef struct flow_dir_retired {
+        void *obj;
+        uint64_t epoch;
+        uint8_t kind;
+}flow_dir_retired_t;
+static flow_dir_retired_t *retired = NULL;
+static uint32_t retire_size = 0;        //power of 2
+static uint32_t retire_head = 0, retire_tail = 0;
+static rte_spinlock_t retire_lock = RTE_SPINLOCK_INITIALIZER;  //guards the list only: objects are released outside of it
+#define FLOW_DIR_RECLAIM_BURST  (32)
+uint64_t flow_dir_retire_overflows = 0;
+#ifdef ENABLE_MBUF_QUOTAS
+static mbuf_quota_info_t *flow_dir_mbuf_quota;
+#endif //ENABLE_MBUF_QUOTAS
+
+static void
+onvm_flow_dir_set_index_of(struct onvm_ft *ft) {
+        int32_t tbl_index = 0;
+        for (; tbl_index < ft->cnt; tbl_index++)
+        {
+                struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)onvm_ft_get_data(ft, tbl_index);
+                flow_entry->entry_index = tbl_index + FLOW_DIR_INDEX_TAG(ft);
+                flow_entry->stats = (struct onvm_flow_stats *)onvm_ft_get_cold(ft, tbl_index);
+        }
+}
 
 void
 onvm_flow_dir_set_index(void) {
 
         if(sdn_ft) {
-                uint32_t tbl_index = 0;
-                for (; tbl_index < SDN_FT_ENTRIES; tbl_index++)
-                {
-                        struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)&sdn_ft->data[tbl_index*sdn_ft->entry_size];
-                        flow_entry->entry_index = tbl_index;
-                }
+                onvm_flow_dir_set_index_of(sdn_ft);
         }
+        #ifdef ENABLE_FLOW_DIR_IPV6
+        if(sdn_ft6) {
+                onvm_flow_dir_set_index_of(sdn_ft6);
+        }
+        #endif //ENABLE_FLOW_DIR_IPV6
         return ;
 }
 
@@ -73,30 +144,231 @@ int onvm_flow_dir_reset_entry(struct onvm_flow_entry *flow_entry) {
 
         if(flow_entry) {
                 uint64_t ft_index = flow_entry->entry_index;
+                struct onvm_flow_stats *stats = flow_entry->stats;
+                #ifdef ENABLE_CHAIN_STATS
+                onvm_chain_stats_uncount_flow(flow_entry);
+                #endif //ENABLE_CHAIN_STATS
                 memset(flow_entry,0,sizeof(struct onvm_flow_entry));
                 flow_entry->entry_index = ft_index;
+                flow_entry->stats = stats;
                 return (int)ft_index;
         }
         return 0;
 }
 
+int
+onvm_flow_dir_reader_register(void) {
+        int reader;
+        if (sdn_ft == NULL) {
+                return -EINVAL;
+        }
+        if (RTE_PER_LCORE(flow_dir_reader)) {
+                return RTE_PER_LCORE(flow_dir_reader) - 1;      //already registered
+        }
+        reader = onvm_ft_reader_register(sdn_ft);
+        if (reader >= 0) {
+                sdn_ft->qsbr->reader[reader].owner = getpid();
+                RTE_PER_LCORE(flow_dir_reader) = reader + 1;
+        }
+        return reader;
+}
+
+void
+onvm_flow_dir_reader_release(pid_t pid) {
+        struct onvm_ft_qsbr *qsbr;
+        int32_t readers, i;
+
+        if (sdn_ft == NULL || pid <= 0) {
+                return;
+        }
+        qsbr = sdn_ft->qsbr;
+        readers = RTE_MIN(rte_atomic32_read(&qsbr->readers), ONVM_FT_MAX_READERS);
+        for (i = 0; i < readers; i++) {
+                if (qsbr->reader[i].used && qsbr->reader[i].owner == pid) {
+                        onvm_ft_reader_unregister(sdn_ft, i);
+                }
+        }
+}
+
+uint32_t
+onvm_flow_dir_reclaim(void) {
+        void *obj[FLOW_DIR_RECLAIM_BURST];
+        uint8_t kind[FLOW_DIR_RECLAIM_BURST];
+        uint32_t n, i, pending;
+
+        do {
+                //take the objects past their grace period off the list, release them once the lock is dropped
+                rte_spinlock_lock(&retire_lock);
+                for (n = 0; n < FLOW_DIR_RECLAIM_BURST && retire_head != retire_tail &&
+                            onvm_ft_epoch_is_safe(sdn_ft, retired[retire_head & (retire_size - 1)].epoch); n++, retire_head++) {
+                        obj[n] = retired[retire_head & (retire_size - 1)].obj;
+                        kind[n] = retired[retire_head & (retire_size - 1)].kind;
+                }
+                pending = retire_tail - retire_head;
+                rte_spinlock_unlock(&retire_lock);
+
+                for (i = 0; i < n; i++) {
+                        if (kind[i] == FLOW_DIR_RETIRE_SC_REF) {
+                                struct onvm_flow_entry *flow_entry = obj[i];
+                                if (flow_entry->key == NULL) {
+                                        flow_entry->sc = NULL;
+                                }
+                        } else {
+                                #ifdef ENABLE_MBUF_QUOTAS
+                                if (kind[i] == FLOW_DIR_RETIRE_SC && flow_dir_mbuf_quota) {
+                                        onvm_mbuf_owner_release(flow_dir_mbuf_quota, ((struct onvm_service_chain *)obj[i])->mbuf_owner);
+                                }
+                                #endif //ENABLE_MBUF_QUOTAS
+                                rte_free(obj[i]);
+                        }
+                }
+        } while (n == FLOW_DIR_RECLAIM_BURST);
+        return pending;
+}
+
+/* Free slots of the retire list before it grows, after releasing what is past its grace period */
+static inline uint32_t
+onvm_flow_dir_retire_room(void) {
+        uint32_t pending = onvm_flow_dir_reclaim();
+        return RTE_MAX(retire_size, FLOW_DIR_RETIRE_MIN) - pending;
+}
+
+/* Double the retire list, keeping the order of the entries (called with retire_lock held) */
+static int
+onvm_flow_dir_retire_grow(void) {
+        uint32_t size = (retire_size)? (retire_size << 1):(FLOW_DIR_RETIRE_MIN);
+        uint32_t i, n = retire_tail - retire_head;
+        flow_dir_retired_t *list;
+
+        list = rte_malloc("flow_dir_retired", (size_t)size * sizeof(*list), 0);
+        if (list == NULL) {
+                return -ENOMEM;
+        }
+        for (i = 0; i < n; i++) {
+                list[i] = retired[(retire_head + i) & (retire_size - 1)];
+        }
+        rte_free(retired);
+        retired = list;
+        retire_size = size;
+        retire_head = 0;
+        retire_tail = n;
+        return 0;
+}
+
+/* Keys and chains of a bulk loaded rule set are freed with their block, not one by one */
+static inline int
+onvm_flow_dir_in_ruleset(void *obj) {
+        struct onvm_flow_ruleset *rs[2];
+        int i;
+        if (flow_dir_info == NULL) {
+                return 0;
+        }
+        rs[0] = flow_dir_info->current;
+        rs[1] = flow_dir_info->replaced;
+        for (i = 0; i < 2; i++) {
+                if (rs[i] && (((char *)obj >= (char *)rs[i]->keys && (char *)obj < (char *)(rs[i]->keys + rs[i]->nb_rules)) ||
+                              ((char *)obj >= (char *)rs[i]->chains && (char *)obj < (char *)(rs[i]->chains + rs[i]->nb_chains)))) {
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+/* Never waits for the readers (the caller may be one): with the list still full after a reclaim, the list grows.
+ * obj is left alone (leaked) and -ENOMEM returned only if the list cannot grow */
+static int
+onvm_flow_dir_retire_obj(void *obj, uint8_t kind) {
+        uint64_t epoch = onvm_ft_retire_epoch(sdn_ft);
+        rte_spinlock_lock(&retire_lock);
+        if (retire_tail - retire_head == retire_size) {
+                if (retire_size) {
+                        rte_spinlock_unlock(&retire_lock);
+                        onvm_flow_dir_reclaim();
+                        rte_spinlock_lock(&retire_lock);
+                }
+                if (retire_tail - retire_head == retire_size && onvm_flow_dir_retire_grow() < 0) {
+                        flow_dir_retire_overflows++;
+                        rte_spinlock_unlock(&retire_lock);
+                        return -ENOMEM;
+                }
+        }
+        retired[retire_tail & (retire_size - 1)].obj = obj;
+        retired[retire_tail & (retire_size - 1)].epoch = epoch;
+        retired[retire_tail & (retire_size - 1)].kind = kind;
+        retire_tail++;
+        rte_spinlock_unlock(&retire_lock);
+        return 0;
+}
+
+int
+onvm_flow_dir_retire(void *obj) {
+        if (obj == NULL || onvm_flow_dir_in_ruleset(obj)) {
+                return 0;
+        }
+        return onvm_flow_dir_retire_obj(obj, FLOW_DIR_RETIRE_FREE);
+}
+
+int
+onvm_flow_dir_retire_sc(struct onvm_service_chain *sc) {
+        if (sc == NULL || onvm_flow_dir_in_ruleset(sc)) {
+                return 0;
+        }
+        #ifdef ENABLE_CHAIN_STATS
+        onvm_chain_stats_unregister(sc);
+        #endif //ENABLE_CHAIN_STATS
+        return onvm_flow_dir_retire_obj(sc, FLOW_DIR_RETIRE_SC);
+}
+
 int
 onvm_flow_dir_init(void)
 {
 	const struct rte_memzone *mz_ftp;
 
-	    sdn_ft = onvm_ft_create(SDN_FT_ENTRIES, sizeof(struct onvm_flow_entry));
+        RTE_BUILD_BUG_ON(sizeof(struct onvm_flow_entry) != RTE_CACHE_LINE_SIZE);
+        sdn_ft = onvm_ft_create_keyed(sdn_ft_entries, sdn_ft_max_entries, sizeof(struct onvm_flow_entry), sizeof(struct onvm_flow_stats),
+                                      rte_socket_id(), ONVM_FT_KEY_IPV4);
         if(sdn_ft == NULL) {
                 rte_exit(EXIT_FAILURE, "Unable to create flow table\n");
         }
-        mz_ftp = rte_memzone_reserve(MZ_FTP_INFO, sizeof(struct onvm_ft *),
+        mz_ftp = rte_memzone_reserve(MZ_FTP_INFO, sizeof(struct onvm_flow_dir_info),
                                   rte_socket_id(), NO_FLAGS);
         if (mz_ftp == NULL) {
                 rte_exit(EXIT_FAILURE, "Canot reserve memory zone for flow table pointer\n");
         }
-        memset(mz_ftp->addr, 0, sizeof(struct onvm_ft *));
-        sdn_ft_p = mz_ftp->addr;
+        memset(mz_ftp->addr, 0, sizeof(struct onvm_flow_dir_info));
+        flow_dir_info = mz_ftp->addr;
+        onvm_ft_qsbr_init(&flow_dir_info->qsbr);
+        onvm_ft_set_qsbr(sdn_ft, &flow_dir_info->qsbr);
+        sdn_ft_p = &flow_dir_info->ft;
         *sdn_ft_p = sdn_ft;
+        #ifdef ENABLE_FLOW_DIR_IPV6
+        sdn_ft6 = onvm_ft_create_keyed(sdn_ft_entries, sdn_ft_max_entries, sizeof(struct onvm_flow_entry), sizeof(struct onvm_flow_stats),
+                                      rte_socket_id(), ONVM_FT_KEY_IPV6);
+        mz_ftp = rte_memzone_reserve(MZ_FTP6_INFO, sizeof(struct onvm_ft *), rte_socket_id(), NO_FLAGS);
+        if (sdn_ft6 == NULL || mz_ftp == NULL) {
+                rte_exit(EXIT_FAILURE, "Unable to create IPv6 flow table\n");
+        }
+        onvm_ft_set_qsbr(sdn_ft6, &flow_dir_info->qsbr);
+        *(struct onvm_ft **)mz_ftp->addr = sdn_ft6;
+        #endif //ENABLE_FLOW_DIR_IPV6
+        #ifdef ENABLE_FLOW_CLASSIFIER
+        if (onvm_fc_init() < 0) {
+                rte_exit(EXIT_FAILURE, "Unable to create flow classifier\n");
+        }
+        #endif //ENABLE_FLOW_CLASSIFIER
+        #ifdef ENABLE_CHAIN_STATS
+        mz_ftp = rte_memzone_reserve(MZ_CHAIN_STATS_INFO, sizeof(onvm_chain_stats_info_t), rte_socket_id(), NO_FLAGS);
+        if (mz_ftp == NULL) {
+                rte_exit(EXIT_FAILURE, "Cannot reserve memory zone for chain stats\n");
+        }
+        memset(mz_ftp->addr, 0, sizeof(onvm_chain_stats_info_t));
+        chain_stats = mz_ftp->addr;
+        rte_spinlock_init(&chain_stats->lock);
+        #endif //ENABLE_CHAIN_STATS
+        #ifdef ENABLE_MBUF_QUOTAS
+        mz_ftp = rte_memzone_lookup(MZ_MBUF_QUOTA_INFO);
+        flow_dir_mbuf_quota = (mz_ftp)? (mz_ftp->addr):(NULL);
+        #endif //ENABLE_MBUF_QUOTAS
 
     onvm_flow_dir_set_index();
 	return 0;
@@ -106,13 +378,38 @@ int
 onvm_flow_dir_nf_init(void)
 {
 	const struct rte_memzone *mz_ftp;
-        struct onvm_ft **ftp;
 
         mz_ftp = rte_memzone_lookup(MZ_FTP_INFO);
         if (mz_ftp == NULL)
                 rte_exit(EXIT_FAILURE, "Cannot get table pointer\n");
-        ftp = mz_ftp->addr;
-        sdn_ft = *ftp;
+        flow_dir_info = mz_ftp->addr;
+        sdn_ft_p = &flow_dir_info->ft;
+        sdn_ft = *sdn_ft_p;
+        #ifdef ENABLE_FLOW_DIR_IPV6
+        mz_ftp = rte_memzone_lookup(MZ_FTP6_INFO);
+        if (mz_ftp == NULL)
+                rte_exit(EXIT_FAILURE, "Cannot get IPv6 table pointer\n");
+        sdn_ft6 = *(struct onvm_ft **)mz_ftp->addr;
+        #endif //ENABLE_FLOW_DIR_IPV6
+        #ifdef ENABLE_FLOW_CLASSIFIER
+        if (onvm_fc_nf_init() < 0)
+                rte_exit(EXIT_FAILURE, "Cannot get flow classifier pointer\n");
+        #endif //ENABLE_FLOW_CLASSIFIER
+        #ifdef ENABLE_CHAIN_STATS
+        mz_ftp = rte_memzone_lookup(MZ_CHAIN_STATS_INFO);
+        if (mz_ftp == NULL)
+                rte_exit(EXIT_FAILURE, "Cannot get chain stats\n");
+        chain_stats = mz_ftp->addr;
+        #endif //ENABLE_CHAIN_STATS
+        #ifdef ENABLE_MBUF_QUOTAS
+        mz_ftp = rte_memzone_lookup(MZ_MBUF_QUOTA_INFO);
+        if (mz_ftp == NULL)
+                rte_exit(EXIT_FAILURE, "Cannot get mbuf quota info\n");
+        flow_dir_mbuf_quota = mz_ftp->addr;
+        #endif //ENABLE_MBUF_QUOTAS
+        /* the calling thread (the one running the nflib loop) reports its quiescent states from the loop */
+        if (onvm_flow_dir_reader_register() < 0)
+                rte_exit(EXIT_FAILURE, "No reader slot left in the flow table\n");
 
 	return 0;
 }
@@ -120,15 +417,50 @@ onvm_flow_dir_nf_init(void)
 int
 onvm_flow_dir_get_pkt( struct rte_mbuf *pkt, struct onvm_flow_entry **flow_entry){
 	int ret;
+	onvm_flow_dir_refresh();
+	#ifdef ENABLE_FLOW_DIR_IPV6
+	uint32_t l3_off;
+	uint16_t vlan_id;
+	uint16_t ether_type = onvm_ft_pkt_l3(pkt, &l3_off, &vlan_id);
+	//parsed once: the ether type picks the table, the L3 offset is reused for the key
+	ret = onvm_ft_lookup_pkt_l3((ether_type == ETHER_TYPE_IPv6)? (sdn_ft6):(sdn_ft), pkt, ether_type, l3_off, vlan_id, (char **)flow_entry);
+	#else
 	ret = onvm_ft_lookup_pkt(sdn_ft, pkt, (char **)flow_entry);
+	#endif //ENABLE_FLOW_DIR_IPV6
 
 	return ret;
 }
 
+struct onvm_flow_entry *
+onvm_flow_dir_get_index(uint64_t entry_index) {
+        struct onvm_ft *ft = sdn_ft;
+        onvm_flow_dir_refresh();
+        #ifdef ENABLE_FLOW_DIR_IPV6
+        if (FLOW_DIR_INDEX_IS_IPV6(entry_index)) {
+                ft = sdn_ft6;
+        }
+        #else
+        if (FLOW_DIR_INDEX_IS_IPV6(entry_index)) {
+                return NULL;
+        }
+        #endif //ENABLE_FLOW_DIR_IPV6
+        if (ft == NULL || FLOW_DIR_INDEX_SLOT(entry_index) >= (uint32_t)ft->cnt) {
+                return NULL;
+        }
+        return (struct onvm_flow_entry *)onvm_ft_get_data(ft, FLOW_DIR_INDEX_SLOT(entry_index));
+}
+
 int
 onvm_flow_dir_add_pkt(struct rte_mbuf *pkt, struct onvm_flow_entry **flow_entry){
 	int ret;
-       	ret = onvm_ft_add_pkt(sdn_ft, pkt, (char**)flow_entry);
+        struct onvm_ft *ft;
+        onvm_flow_dir_refresh();
+        ft = onvm_flow_dir_pkt_table(pkt);
+       	ret = onvm_ft_add_pkt(ft, pkt, (char**)flow_entry);
+        if (ret >= 0) {
+                (*flow_entry)->entry_index = ret + FLOW_DIR_INDEX_TAG(ft);
+                (*flow_entry)->stats = (struct onvm_flow_stats *)onvm_ft_get_cold(ft, ret);
+        }
 
 	return ret;
 }
@@ -141,7 +473,7 @@ onvm_flow_dir_del_pkt(struct rte_mbuf* pkt){
 
         ret = onvm_flow_dir_get_pkt(pkt, &flow_entry);
 	if (ret >= 0) {
-		ref_cnt = flow_entry->sc->ref_cnt--;
+		ref_cnt = onvm_sc_ref_put(flow_entry->sc);
 		if (ref_cnt <= 0) {
 			ret = onvm_flow_dir_del_and_free_pkt(pkt);
 		}
@@ -154,20 +486,97 @@ int
 onvm_flow_dir_del_and_free_pkt(struct rte_mbuf *pkt){
 	int ret;
 	struct onvm_flow_entry *flow_entry;
+	struct onvm_ft_ipv4_5tuple *key;
+	#ifdef ENABLE_FLOW_DIR_IPV6
+	struct onvm_ft_ipv6_5tuple *key6;
+	#endif //ENABLE_FLOW_DIR_IPV6
 
 	ret = onvm_flow_dir_get_pkt(pkt, &flow_entry);
 	if (ret >= 0) {
 		//rte_free(flow_entry->sc); //modification mode to avoid releasing sc entry as it can be multiplexe  across different flow entries.
-		rte_free(flow_entry->key);
-		ret = onvm_ft_remove_pkt(sdn_ft, pkt);
+		ret = onvm_ft_remove_pkt(onvm_flow_dir_pkt_table(pkt), pkt);
+		#ifdef ENABLE_FLOW_COUNTERS
+		onvm_flow_dir_clear_counters(flow_entry);
+		#endif //ENABLE_FLOW_COUNTERS
+		#ifdef ENABLE_CHAIN_STATS
+		onvm_chain_stats_uncount_flow(flow_entry);
+		#endif //ENABLE_CHAIN_STATS
+		key = flow_entry->key;
+		flow_entry->key = NULL;
+		onvm_flow_dir_retire(key);
+		#ifdef ENABLE_FLOW_DIR_IPV6
+		key6 = flow_entry->key6;
+		flow_entry->key6 = NULL;
+		onvm_flow_dir_retire(key6);
+		#endif //ENABLE_FLOW_DIR_IPV6
 	}
 
 	return ret;
 }
 
+#ifdef ENABLE_FLOW_CLASSIFIER
+int
+onvm_flow_dir_classify_pkt(struct rte_mbuf *pkt, struct onvm_service_chain *miss_sc, struct onvm_flow_entry **flow_entry, uint16_t shard) {
+        struct onvm_ft_ipv4_5tuple key, *fk, *old_key;
+        struct onvm_flow_entry *fe;
+        struct onvm_fc_entry *rule;
+        struct onvm_service_chain *sc;
+        onvm_fc_stats_t *stats;
+        uint16_t idle_timeout;
+        int ret;
+
+        if (onvm_fc == NULL || onvm_fc->nb_subtables == 0) {
+                return -ENOENT;
+        }
+        stats = &onvm_fc->stats[shard];
+        //no room to install the flow: skip the subtable probes and the key allocation
+        if (onvm_ft_count(sdn_ft) >= (uint32_t)sdn_ft->max_cnt) {
+                stats->install_failures++;
+                return -ENOSPC;
+        }
+        if ((ret = onvm_ft_fill_key(&key, pkt)) < 0) {
+                return ret;
+        }
+        rule = onvm_fc_lookup(onvm_fc, &key, shard);
+        if (rule != NULL) {
+                sc = rule->sc;
+                idle_timeout = rule->idle_timeout;
+        } else if (miss_sc != NULL) {
+                sc = miss_sc;           //cache the miss, so the next pkts of the flow do not probe the subtables again
+                idle_timeout = FLOW_CLASSIFIER_IDLE_TIMEOUT;
+        } else {
+                return -ENOENT;
+        }
+        fk = rte_malloc("flow_key", sizeof(struct onvm_ft_ipv4_5tuple), 0);
+        //install by key: aging removes the entry by key, so both must use the same (softrss) signature
+        if (fk == NULL || (ret = onvm_flow_dir_add_key(&key, &fe)) < 0) {
+                stats->install_failures++;
+                rte_free(fk);
+                return (fk)? (ret):(-ENOMEM);
+        }
+        *fk = key;
+        old_key = fe->key;              //set only if another thread installed the flow meanwhile
+        fe->key = fk;
+        fe->idle_timeout = idle_timeout;
+        fe->hard_timeout = 0;
+        onvm_sc_ref_get(sc);
+        rte_wmb();
+        fe->sc = sc;
+        onvm_flow_dir_retire(old_key);
+        if (rule != NULL) {
+                stats->installs++;
+        } else {
+                stats->miss_installs++;
+        }
+        *flow_entry = fe;
+        return ret;
+}
+#endif //ENABLE_FLOW_CLASSIFIER
+
 int
 onvm_flow_dir_get_key(struct onvm_ft_ipv4_5tuple *key, struct onvm_flow_entry **flow_entry){
 	int ret;
+        onvm_flow_dir_refresh();
         ret = onvm_ft_lookup_key(sdn_ft, key, (char **)flow_entry);
 
         return ret;
@@ -176,7 +585,12 @@ onvm_flow_dir_get_key(struct onvm_ft_ipv4_5tuple *key, struct onvm_flow_entry **
 int
 onvm_flow_dir_add_key(struct onvm_ft_ipv4_5tuple *key, struct onvm_flow_entry **flow_entry){
         int ret;
+        onvm_flow_dir_refresh();
         ret = onvm_ft_add_key(sdn_ft, key, (char**)flow_entry);
+        if (ret >= 0) {
+                (*flow_entry)->entry_index = ret;
+                (*flow_entry)->stats = (struct onvm_flow_stats *)onvm_ft_get_cold(sdn_ft, ret);
+        }
 
         return ret;
 }
@@ -189,7 +603,7 @@ onvm_flow_dir_del_key(struct onvm_ft_ipv4_5tuple *key){
 
         ret = onvm_flow_dir_get_key(key, &flow_entry);
         if (ret >= 0) {
-                ref_cnt = flow_entry->sc->ref_cnt--;
+                ref_cnt = onvm_sc_ref_put(flow_entry->sc);
                 if (ref_cnt <= 0) {
                         ret = onvm_flow_dir_del_and_free_key(key);
                 }
@@ -202,30 +616,609 @@ int
 onvm_flow_dir_del_and_free_key(struct onvm_ft_ipv4_5tuple *key){
         int ret;
         struct onvm_flow_entry *flow_entry;
+        struct onvm_ft_ipv4_5tuple *old_key;
 
         ret = onvm_flow_dir_get_key(key, &flow_entry);
         if (ret >= 0) {
-                //ret = onvm_ft_remove_key(sdn_ft, key); // This function keeps crashing
+                ret = onvm_ft_remove_key(sdn_ft, key);
                 //rte_free(flow_entry->sc); //Modification to avoid releasing the service chain which can be multiplexed acrossdfferent flow entries
                 //flow_entry->sc=NULL;      // Need separate call to release the service chain as the api onvm_fc_create() have onvm_fc_release()
-                rte_free(flow_entry->key);
+                old_key = flow_entry->key;             //may be the key passed in
                 flow_entry->key=NULL;
+                onvm_flow_dir_retire(old_key);
+                #ifdef ENABLE_FLOW_COUNTERS
+                onvm_flow_dir_clear_counters(flow_entry);
+                #endif //ENABLE_FLOW_COUNTERS
+                #ifdef ENABLE_CHAIN_STATS
+                onvm_chain_stats_uncount_flow(flow_entry);
+                #endif //ENABLE_CHAIN_STATS
+        }
+
+        return ret;
+}
+
+#ifdef ENABLE_FLOW_DIR_IPV6
+int
+onvm_flow_dir_get_key6(struct onvm_ft_ipv6_5tuple *key, struct onvm_flow_entry **flow_entry){
+        return onvm_ft_lookup_key6(sdn_ft6, key, (char **)flow_entry);
+}
+
+int
+onvm_flow_dir_add_key6(struct onvm_ft_ipv6_5tuple *key, struct onvm_flow_entry **flow_entry){
+        int ret;
+        ret = onvm_ft_add_key6(sdn_ft6, key, (char**)flow_entry);
+        if (ret >= 0) {
+                (*flow_entry)->entry_index = ret + FLOW_DIR_INDEX_IPV6;
+                (*flow_entry)->stats = (struct onvm_flow_stats *)onvm_ft_get_cold(sdn_ft6, ret);
         }
+        return ret;
+}
 
+int
+onvm_flow_dir_del_key6(struct onvm_ft_ipv6_5tuple *key){
+        int ret;
+        struct onvm_flow_entry *flow_entry;
+
+        ret = onvm_flow_dir_get_key6(key, &flow_entry);
+        if (ret >= 0 && onvm_sc_ref_put(flow_entry->sc) <= 0) {
+                ret = onvm_flow_dir_del_and_free_key6(key);
+        }
         return ret;
 }
+
+int
+onvm_flow_dir_del_and_free_key6(struct onvm_ft_ipv6_5tuple *key){
+        int ret;
+        struct onvm_flow_entry *flow_entry;
+        struct onvm_ft_ipv6_5tuple *old_key;
+
+        ret = onvm_flow_dir_get_key6(key, &flow_entry);
+        if (ret >= 0) {
+                ret = onvm_ft_remove_key6(sdn_ft6, key);
+                old_key = flow_entry->key6;             //may be the key passed in
+                flow_entry->key6 = NULL;
+                onvm_flow_dir_retire(old_key);
+                #ifdef ENABLE_FLOW_COUNTERS
+                onvm_flow_dir_clear_counters(flow_entry);
+                #endif //ENABLE_FLOW_COUNTERS
+                #ifdef ENABLE_CHAIN_STATS
+                onvm_chain_stats_uncount_flow(flow_entry);
+                #endif //ENABLE_CHAIN_STATS
+        }
+        return ret;
+}
+#endif //ENABLE_FLOW_DIR_IPV6
+
+#ifdef ENABLE_FLOW_AGING
+volatile uint32_t flow_dir_clock = 0;
+flow_aging_stats_t flow_aging_stats;
+
+static uint32_t aging_cursor[FLOW_DIR_NB_TABLES];
+
+/* 1 => idle timeout expired, 2 => hard timeout expired */
+static inline int
+onvm_flow_dir_expired(struct onvm_flow_entry *flow_entry, uint32_t now) {
+        uint16_t idle_timeout = (flow_entry->idle_timeout)? (flow_entry->idle_timeout):(FLOW_AGING_DEFAULT_IDLE_TIMEOUT);
+        if (flow_entry->hard_timeout && (now - flow_entry->install_time) >= flow_entry->hard_timeout) {
+                return 2;
+        }
+        if (idle_timeout && (now - flow_entry->last_seen) >= idle_timeout) {
+                return 1;
+        }
+        return 0;
+}
+
+/* Remove the flow of the entry from table t by its key; the key is detached from the entry and returned (NULL if not removed) */
+static inline void *
+onvm_flow_dir_remove_flow(int t, struct onvm_flow_entry *flow_entry) {
+        void *key = flow_entry->key;
+        #ifdef ENABLE_FLOW_DIR_IPV6
+        if (t) {
+                key = flow_entry->key6;
+                if (onvm_ft_remove_key6(sdn_ft6, flow_entry->key6) < 0) {
+                        return NULL;
+                }
+                flow_entry->key6 = NULL;
+                return key;
+        }
+        #endif //ENABLE_FLOW_DIR_IPV6
+        if (onvm_ft_remove_key(FLOW_DIR_TABLE(t), flow_entry->key) < 0) {
+                return NULL;
+        }
+        flow_entry->key = NULL;
+        return key;
+}
+
+/* Age a slice of budget entries of table t: *room is the retire list room left */
+static uint32_t
+onvm_flow_dir_age_table(int t, uint32_t budget, uint32_t now, uint32_t *room) {
+        struct onvm_ft *ft = FLOW_DIR_TABLE(t);
+        struct onvm_flow_entry *flow_entry;
+        void *key;
+        uint32_t removed = 0, i;
+        int expired;
+
+        if (ft == NULL) {
+                return 0;
+        }
+        //a removed flow retires its key and its entry: stop the slice when the retire list is full (go on next time)
+        for (i = 0; i < budget && *room >= 2; i++) {
+                if (aging_cursor[t] >= (uint32_t)ft->cnt) {
+                        aging_cursor[t] = 0;
+                        if (0 == t) flow_aging_stats.sweeps++;
+                }
+                flow_entry = (struct onvm_flow_entry *)onvm_ft_get_data(ft, aging_cursor[t]++);
+                #ifdef ENABLE_FLOW_DIR_IPV6
+                key = (t)? ((void *)flow_entry->key6):((void *)flow_entry->key);
+                #else
+                key = flow_entry->key;
+                #endif //ENABLE_FLOW_DIR_IPV6
+                if (key == NULL) {
+                        if (flow_entry->sc && 0 == flow_entry->install_time) {
+                                flow_aging_stats.skipped_nokey++;
+                                flow_entry->install_time = now;         //count it once
+                        }
+                        continue;
+                }
+                if (0 == flow_entry->install_time) {
+                        flow_entry->install_time = now;
+                        if (0 == flow_entry->last_seen) flow_entry->last_seen = now;
+                        continue;
+                }
+                expired = onvm_flow_dir_expired(flow_entry, now);
+                if (!expired || (key = onvm_flow_dir_remove_flow(t, flow_entry)) == NULL) {
+                        continue;
+                }
+                onvm_flow_dir_retire(key);
+                flow_entry->install_time = 0;
+                flow_entry->last_seen = 0;
+                #ifdef ENABLE_FLOW_COUNTERS
+                onvm_flow_dir_clear_counters(flow_entry);
+                #endif //ENABLE_FLOW_COUNTERS
+                #ifdef ENABLE_CHAIN_STATS
+                onvm_chain_stats_uncount_flow(flow_entry);
+                #endif //ENABLE_CHAIN_STATS
+                if (flow_entry->sc) {
+                        onvm_sc_ref_put(flow_entry->sc);
+                }
+                //the Rx threads may still hold the entry: its chain is detached once they are past this epoch
+                onvm_flow_dir_retire_obj(flow_entry, FLOW_DIR_RETIRE_SC_REF);
+                *room -= 2;
+                if (expired == 2) flow_aging_stats.expired_hard++;
+                else flow_aging_stats.expired_idle++;
+                removed++;
+        }
+        return removed;
+}
+
+uint32_t
+onvm_flow_dir_age(uint32_t budget) {
+        uint32_t now, removed = 0, room;
+        int t;
+
+        if (sdn_ft == NULL) {
+                return 0;
+        }
+        now = (uint32_t)(rte_get_tsc_cycles() / rte_get_tsc_hz());
+        flow_dir_clock = now;
+
+        room = onvm_flow_dir_retire_room();
+        for (t = 0; t < FLOW_DIR_NB_TABLES; t++) {
+                removed += onvm_flow_dir_age_table(t, budget, now, &room);
+        }
+        return removed;
+}
+#endif //ENABLE_FLOW_AGING
+
+#ifdef ENABLE_CHAIN_STATS
+uint16_t
+onvm_chain_stats_register(struct onvm_service_chain *sc) {
+        uint16_t id;
+
+        if (chain_stats == NULL || sc->chain_id == CHAIN_ID_RETIRED) {
+                return 0;
+        }
+        if (chain_stats->nb_chains >= MAX_CHAINS - 1) {
+                if (!chain_stats->full) chain_stats->full = 1;  //the chain is not counted: extract_sc_list() walks the flow table
+                return 0;
+        }
+        rte_spinlock_lock(&chain_stats->lock);
+        if (sc->chain_id == 0) {        //not registered by another thread meanwhile
+                for (id = 1; id < MAX_CHAINS && chain_stats->chain[id].sc; id++);
+                if (id < MAX_CHAINS) {
+                        memset(&chain_stats->chain[id], 0, sizeof(chain_stats->chain[id]));
+                        chain_stats->chain[id].sc = sc;
+                        chain_stats->nb_chains++;
+                        if (id > chain_stats->max_id) {
+                                chain_stats->max_id = id;
+                        }
+                        rte_wmb();
+                        sc->chain_id = id;
+                } else {
+                        chain_stats->full = 1;
+                }
+        }
+        id = sc->chain_id;
+        rte_spinlock_unlock(&chain_stats->lock);
+        return (id == CHAIN_ID_RETIRED)? (0):(id);
+}
+
+void
+onvm_chain_stats_unregister(struct onvm_service_chain *sc) {
+        uint16_t id;
+
+        if (chain_stats == NULL || sc == NULL) {
+                return;
+        }
+        rte_spinlock_lock(&chain_stats->lock);
+        for (id = 1; id <= chain_stats->max_id; id++) {
+                if (chain_stats->chain[id].sc == sc) {  //its current id, and any id being reclaimed
+                        chain_stats->chain[id].sc = NULL;
+                        chain_stats->nb_chains--;
+                }
+        }
+        sc->chain_id = CHAIN_ID_RETIRED;
+        rte_spinlock_unlock(&chain_stats->lock);
+}
+
+uint16_t
+onvm_chain_stats_count_flow(struct onvm_flow_entry *flow_entry) {
+        uint16_t id = flow_entry->sc->chain_id;
+
+        if (id == 0) {
+                id = onvm_chain_stats_register(flow_entry->sc);
+        }
+        onvm_chain_stats_uncount_flow(flow_entry);
+        if (id == 0 || id >= MAX_CHAINS) {
+                return 0;
+        }
+        rte_atomic32_inc(&chain_stats->chain[id].flows);
+        flow_entry->chain_id = id;
+        return id;
+}
+
+/* Chain ids being reclaimed: detached from chain sc at epoch, freed once no Rx thread may still count on them. Master thread only */
+static struct {
+        struct onvm_service_chain *sc;
+        uint64_t epoch;
+} chain_reclaim[MAX_CHAINS];
+
+uint32_t
+onvm_chain_stats_reclaim(void) {
+        struct onvm_service_chain *sc;
+        uint32_t freed = 0;
+        uint16_t id;
+
+        if (chain_stats == NULL || sdn_ft == NULL) {
+                return 0;
+        }
+        for (id = 1; id <= chain_stats->max_id; id++) {
+                sc = chain_stats->chain[id].sc;
+                if (sc == NULL) {
+                        continue;
+                }
+                if (chain_reclaim[id].sc != sc || sc->chain_id == id) {
+                        /* no flow installed nor counted: detach the id, the next pkt of the chain registers it again */
+                        if (sc->chain_id != id || sc->ref_cnt || rte_atomic32_read(&chain_stats->chain[id].flows) > 0) {
+                                continue;
+                        }
+                        rte_spinlock_lock(&chain_stats->lock);
+                        if (chain_stats->chain[id].sc == sc && sc->chain_id == id) {
+                                sc->chain_id = 0;
+                                chain_reclaim[id].sc = sc;
+                                chain_reclaim[id].epoch = onvm_ft_retire_epoch(sdn_ft);
+                        }
+                        rte_spinlock_unlock(&chain_stats->lock);
+                        continue;
+                }
+                /* free the id once no Rx thread may still count on it, and no flow entry is counted to it */
+                if (!onvm_ft_epoch_is_safe(sdn_ft, chain_reclaim[id].epoch) || rte_atomic32_read(&chain_stats->chain[id].flows) > 0) {
+                        continue;
+                }
+                rte_spinlock_lock(&chain_stats->lock);
+                if (chain_stats->chain[id].sc == sc) {
+                        chain_stats->chain[id].sc = NULL;
+                        chain_stats->nb_chains--;
+                        freed++;
+                }
+                rte_spinlock_unlock(&chain_stats->lock);
+                chain_reclaim[id].sc = NULL;
+        }
+        if (freed && chain_stats->full) {
+                chain_stats->full = 0;          //set again by the chains still finding no free id
+        }
+        return freed;
+}
+
+void
+onvm_chain_stats_clear_flows(void) {
+        uint16_t id;
+        for (id = 1; id <= chain_stats->max_id; id++) {
+                rte_atomic32_set(&chain_stats->chain[id].flows, 0);
+        }
+}
+#endif //ENABLE_CHAIN_STATS
+
+/* Table replaced by the last swap: freed by the master thread once no reader holds it */
+static struct onvm_ft *swap_old_ft = NULL;
+static uint64_t swap_epoch = 0;
+
+void
+onvm_flow_dir_ruleset_free(struct onvm_flow_ruleset *rs) {
+        if (rs == NULL) {
+                return;
+        }
+        if (rs->ft) {
+                onvm_ft_free(rs->ft);
+        }
+        #if defined(ENABLE_CHAIN_STATS) || defined(ENABLE_MBUF_QUOTAS)
+        if (rs->chains) {
+                uint32_t i;
+                for (i = 0; i < rs->nb_chains; i++) {
+                        #ifdef ENABLE_CHAIN_STATS
+                        onvm_chain_stats_unregister(&rs->chains[i]);
+                        #endif //ENABLE_CHAIN_STATS
+                        #ifdef ENABLE_MBUF_QUOTAS
+                        if (flow_dir_mbuf_quota) onvm_mbuf_owner_release(flow_dir_mbuf_quota, rs->chains[i].mbuf_owner);
+                        #endif //ENABLE_MBUF_QUOTAS
+                }
+        }
+        #endif //ENABLE_CHAIN_STATS || ENABLE_MBUF_QUOTAS
+        rte_free(rs->keys);
+        rte_free(rs->chains);
+        rte_free(rs);
+}
+
+/* A chain hop of a rule file: a pkt action with a destination the manager can reach */
+static inline int
+onvm_flow_rules_hop_ok(uint8_t action, uint16_t destination, uint16_t nb_ports) {
+        switch (action) {
+        case ONVM_NF_ACTION_DROP:
+                return 1;
+        case ONVM_NF_ACTION_TONF:
+                return destination < MAX_SERVICES;
+        case ONVM_NF_ACTION_OUT:
+                return destination < nb_ports;
+        default:
+                return 0;       //ONVM_NF_ACTION_NEXT would look the flow up again
+        }
+}
+
+struct onvm_flow_ruleset *
+onvm_flow_dir_ruleset_load(const char *path, int *err) {
+        const struct onvm_flow_rules_hdr *hdr;
+        const struct onvm_flow_rules_chain *fchain;
+        const struct onvm_flow_rules_rule *frule;
+        struct onvm_flow_ruleset *rs = NULL;
+        struct onvm_flow_entry *flow_entry;
+        struct stat st;
+        void *map = MAP_FAILED;
+        size_t need;
+        uint32_t i, h, cnt;
+        uint16_t nb_ports = rte_eth_dev_count();
+        int fd, ret;
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) < 0) {
+                ret = -errno;
+                goto out;
+        }
+        if ((size_t)st.st_size < sizeof(*hdr)) {
+                ret = -EINVAL;
+                goto out;
+        }
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (map == MAP_FAILED) {
+                ret = -errno;
+                goto out;
+        }
+        hdr = map;
+        need = sizeof(*hdr) + (size_t)hdr->nb_chains * sizeof(*fchain) + (size_t)hdr->nb_rules * sizeof(*frule);
+        if (hdr->magic != FLOW_RULES_FILE_MAGIC || hdr->version != FLOW_RULES_FILE_VERSION || hdr->nb_rules == 0 ||
+            (size_t)st.st_size < need) {
+                ret = -EINVAL;
+                goto out;
+        }
+        fchain = (const struct onvm_flow_rules_chain *)(hdr + 1);
+        frule = (const struct onvm_flow_rules_rule *)(fchain + hdr->nb_chains);
+
+        rs = rte_zmalloc("flow_ruleset", sizeof(*rs), 0);
+        if (rs == NULL) {
+                ret = -ENOMEM;
+                goto out;
+        }
+        rs->nb_rules = hdr->nb_rules;
+        rs->nb_chains = hdr->nb_chains;
+        rs->keys = rte_malloc("flow_ruleset_keys", (size_t)rs->nb_rules * sizeof(struct onvm_ft_ipv4_5tuple), RTE_CACHE_LINE_SIZE);
+        rs->chains = rte_zmalloc("flow_ruleset_chains", (size_t)RTE_MAX(rs->nb_chains, 1) * sizeof(struct onvm_service_chain), RTE_CACHE_LINE_SIZE);
+        if (rs->keys == NULL || rs->chains == NULL) {
+                ret = -ENOMEM;
+                goto out;
+        }
+        for (i = 0; i < rs->nb_chains; i++) {
+                if (fchain[i].chain_length > ONVM_MAX_CHAIN_LENGTH) {
+                        ret = -EINVAL;
+                        goto out;
+                }
+                for (h = 0; h < fchain[i].chain_length; h++) {
+                        if (!onvm_flow_rules_hop_ok(fchain[i].hop[h].action, fchain[i].hop[h].destination, nb_ports)) {
+                                ret = -EINVAL;
+                                goto out;
+                        }
+                        onvm_sc_append_entry(&rs->chains[i], fchain[i].hop[h].action, fchain[i].hop[h].destination);
+                }
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+                onvm_sc_set_latency_target(&rs->chains[i], fchain[i].latency_target_us);
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+        }
+
+        /* sized upfront with head room for the cuckoo hash: no tier is added while loading */
+        cnt = RTE_MAX(rs->nb_rules + (rs->nb_rules >> 2), sdn_ft_entries);
+        rs->ft = onvm_ft_create_keyed(cnt, RTE_MAX(cnt, sdn_ft_max_entries), sizeof(struct onvm_flow_entry), sizeof(struct onvm_flow_stats),
+                                      rte_socket_id(), ONVM_FT_KEY_IPV4);
+        if (rs->ft == NULL) {
+                ret = -ENOMEM;
+                goto out;
+        }
+        onvm_ft_set_qsbr(rs->ft, &flow_dir_info->qsbr);
+        onvm_flow_dir_set_index_of(rs->ft);
+        for (i = 0; i < rs->nb_rules; i++) {
+                if (frule[i].chain >= rs->nb_chains) {
+                        ret = -EINVAL;
+                        goto out;
+                }
+                rs->keys[i] = frule[i].key;
+                ret = onvm_ft_add_key(rs->ft, &rs->keys[i], (char **)&flow_entry);
+                if (ret < 0) {
+                        goto out;
+                }
+                flow_entry->entry_index = ret;
+                flow_entry->stats = (struct onvm_flow_stats *)onvm_ft_get_cold(rs->ft, ret);
+                flow_entry->key = &rs->keys[i];         //a duplicate key: the last rule wins
+                flow_entry->sc = &rs->chains[frule[i].chain];
+                flow_entry->idle_timeout = frule[i].idle_timeout;
+                flow_entry->hard_timeout = frule[i].hard_timeout;
+        }
+        ret = 0;
+out:
+        if (map != MAP_FAILED) {
+                munmap(map, st.st_size);
+        }
+        if (fd >= 0) {
+                close(fd);
+        }
+        if (ret < 0) {
+                onvm_flow_dir_ruleset_free(rs);
+                rs = NULL;
+        }
+        if (err) {
+                *err = ret;
+        }
+        return rs;
+}
+
+int
+onvm_flow_dir_ruleset_publish(struct onvm_flow_ruleset *rs) {
+        if (rs == NULL || flow_dir_info == NULL) {
+                return -EINVAL;
+        }
+        rte_wmb();      //the rule set is complete before it can be seen
+        if (!rte_atomic64_cmpset((volatile uint64_t *)&flow_dir_info->pending, 0, (uint64_t)(uintptr_t)rs)) {
+                return -EBUSY;
+        }
+        return 0;
+}
+
+/* Next installed flow of the table after *next (0 to start), NULL past the last one: walks the keys of the table, not its entries */
+static inline struct onvm_flow_entry *
+onvm_flow_dir_next_flow(struct onvm_ft *ft, uint32_t *next) {
+        const void *key;
+        void *data;
+        int32_t tbl_index = onvm_ft_iterate(ft, &key, &data, next);
+        if (tbl_index < 0) {
+                return NULL;
+        }
+        return (struct onvm_flow_entry *)onvm_ft_get_data(ft, tbl_index);
+}
+
+/* Walk of the installed flows of all the flow tables (FLOW_DIR_TABLE(), IPv4 then IPv6): zeroed to start */
+typedef struct flow_dir_walk {
+        int t;
+        uint32_t next;
+        uint32_t left;          // flows left in table t
+} flow_dir_walk_t;
+
+/* Next installed flow of the walk, NULL past the last one */
+static inline struct onvm_flow_entry *
+onvm_flow_dir_walk_next(flow_dir_walk_t *w) {
+        struct onvm_flow_entry *flow_entry;
+        struct onvm_ft *ft;
+        for (; w->t < FLOW_DIR_NB_TABLES; w->t++, w->next = 0) {
+                ft = FLOW_DIR_TABLE(w->t);
+                if (ft == NULL) {
+                        continue;
+                }
+                if (0 == w->next) {
+                        w->left = onvm_ft_count(ft);
+                }
+                //installed flows only (the table capacity may be millions of entries)
+                if (w->left && (flow_entry = onvm_flow_dir_next_flow(ft, &w->next)) != NULL) {
+                        w->left--;
+                        return flow_entry;
+                }
+        }
+        return NULL;
+}
+
+/* Free the keys of a table built rule by rule: their chains may be shared by other flows, they stay allocated */
+static void
+onvm_flow_dir_free_table(struct onvm_ft *ft) {
+        struct onvm_flow_entry *flow_entry;
+        uint32_t next = 0, left = onvm_ft_count(ft);
+        while (left && (flow_entry = onvm_flow_dir_next_flow(ft, &next)) != NULL) {
+                left--;
+                rte_free(flow_entry->key);
+        }
+        onvm_ft_free(ft);
+}
+
+void
+onvm_flow_dir_swap(void) {
+        struct onvm_flow_ruleset *rs;
+
+        if (flow_dir_info == NULL) {
+                return;
+        }
+        if (swap_old_ft) {
+                if (!onvm_ft_epoch_is_safe(sdn_ft, swap_epoch)) {
+                        return;         //one swap at a time: a reader (manager or NF thread) may still hold the old table
+                }
+                onvm_flow_dir_reclaim();        //entries of the old table retired before the swap: their epochs are safe now
+                if (flow_dir_info->replaced) {
+                        onvm_flow_dir_ruleset_free(flow_dir_info->replaced);
+                        flow_dir_info->replaced = NULL;
+                } else {
+                        onvm_flow_dir_free_table(swap_old_ft);
+                }
+                swap_old_ft = NULL;
+        }
+        rs = flow_dir_info->pending;
+        if (rs == NULL) {
+                return;
+        }
+        rte_rmb();
+        #ifdef ENABLE_FLOW_AGING
+        aging_cursor = 0;
+        #endif //ENABLE_FLOW_AGING
+        #ifdef ENABLE_CHAIN_STATS
+        onvm_chain_stats_clear_flows();         //flows of the new table are counted on their next pkt
+        #endif //ENABLE_CHAIN_STATS
+        swap_old_ft = sdn_ft;
+        flow_dir_info->replaced = flow_dir_info->current;
+        flow_dir_info->current = rs;
+        sdn_ft = rs->ft;
+        flow_dir_info->ft = rs->ft;
+        /* a reader reporting this epoch looks up the new table only */
+        swap_epoch = onvm_ft_retire_epoch(sdn_ft);
+        flow_dir_info->version++;
+        rte_wmb();
+        flow_dir_info->pending = NULL;
+        printf("Flow table swapped: version [%u], [%u] rules, [%u] chains\n", flow_dir_info->version, rs->nb_rules, rs->nb_chains);
+}
+
 void onvm_flow_dir_print_stats__old(void);
 void
 onvm_flow_dir_print_stats__old(void) {
 
         if(sdn_ft) {
-                int32_t tbl_index = 0;
+                uint32_t next = 0, left = onvm_ft_count(sdn_ft);
+                struct onvm_flow_entry *flow_entry;
                 uint32_t active_chains = 0;
                 uint32_t mapped_chains = 0;
                 uint32_t bottlnecked_chains=0;
-                for (; tbl_index < SDN_FT_ENTRIES; tbl_index++)
+                while (left && (flow_entry = onvm_flow_dir_next_flow(sdn_ft, &next)) != NULL)
                 {
-                        struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)&sdn_ft->data[tbl_index*sdn_ft->entry_size];
+                        left--;
                         if (flow_entry && flow_entry->sc && flow_entry->sc->chain_length) {
                                 active_chains+=1;
 #ifdef ENABLE_NF_BACKPRESSURE
@@ -240,7 +1233,7 @@ onvm_flow_dir_print_stats__old(void) {
 #ifdef ENABLE_NF_BACKPRESSURE
                         if (flow_entry->sc->highest_downstream_nf_index_id) {
                                 int i =0;
-                                printf ("OverflowStatus [(binx=%d, %d),(nfid=%d),(scl=%d)::", flow_entry->sc->highest_downstream_nf_index_id, flow_entry->idle_timeout, flow_entry->sc->ref_cnt, flow_entry->sc->chain_length );
+                                printf ("OverflowStatus [(binx=%u, %d),(nfid=%d),(scl=%d)::", flow_entry->sc->highest_downstream_nf_index_id, flow_entry->idle_timeout, flow_entry->sc->ref_cnt, flow_entry->sc->chain_length );
                                 for(i=1;i<=flow_entry->sc->chain_length;++i)printf("[%d], ",flow_entry->sc->sc[i].destination);
                                 if(flow_entry->key)
                                         printf ("Tuple:[SRC(%d:%d),DST(%d:%d), PROTO(%d)], \t", flow_entry->key->src_addr, rte_be_to_cpu_16(flow_entry->key->src_port), flow_entry->key->dst_addr, rte_be_to_cpu_16(flow_entry->key->dst_port), flow_entry->key->proto);
@@ -278,19 +1271,22 @@ static inline uint32_t get_index_of_sc(struct onvm_service_chain *sc, sc_entries
         return free_index;
 }
 
-uint32_t
-extract_sc_list(uint32_t *bft_count, sc_entries_list *c_list) {
+/* The chains of the installed flows, by a walk of the flow table */
+static uint32_t
+extract_sc_list_scan(uint32_t *bft_count, sc_entries_list *c_list) {
         uint32_t active_fts = 0, bneck_fts=0;
         if(!c_list) return -1;
+        onvm_flow_dir_refresh();
         if(sdn_ft) {
-                int32_t tbl_index = 0;
+                flow_dir_walk_t walk = {0, 0, 0};
+                struct onvm_flow_entry *flow_entry;
                 uint32_t s_inx = SDN_FT_ENTRIES;
 
-                memset(c_list,0,sizeof(*c_list));
+                memset(c_list,0,sizeof(*c_list)*SDN_FT_ENTRIES);      //the whole list: it may hold a registry list (chain stats fallback)
 
-                for (; tbl_index < SDN_FT_ENTRIES; tbl_index++) {
+                // IPv4 and IPv6 flows
+                while ((flow_entry = onvm_flow_dir_walk_next(&walk)) != NULL) {
                         s_inx = SDN_FT_ENTRIES;
-                        struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)&sdn_ft->data[tbl_index*sdn_ft->entry_size];
                         if (flow_entry && flow_entry->sc && flow_entry->sc->chain_length) {
                                 active_fts+=1;
                                 s_inx = get_index_of_sc(flow_entry->sc, c_list);
@@ -310,7 +1306,7 @@ extract_sc_list(uint32_t *bft_count, sc_entries_list *c_list) {
                                 //#define LIST_FLOW_ENTRIES
                                 #ifdef LIST_FLOW_ENTRIES
                                 int i =0;
-                                printf ("OverflowStatus [(binx=%d, %d),(nfid=%d),(scl=%d)::", flow_entry->sc->highest_downstream_nf_index_id, flow_entry->idle_timeout, flow_entry->sc->ref_cnt, flow_entry->sc->chain_length );
+                                printf ("OverflowStatus [(binx=%u, %d),(nfid=%d),(scl=%d)::", flow_entry->sc->highest_downstream_nf_index_id, flow_entry->idle_timeout, flow_entry->sc->ref_cnt, flow_entry->sc->chain_length );
                                 for(i=1;i<=flow_entry->sc->chain_length;++i)printf("[%d], ",flow_entry->sc->sc[i].destination);
                                 if(flow_entry->key)
                                         printf ("Tuple:[SRC(%d:%d),DST(%d:%d), PROTO(%d)], \t", flow_entry->key->src_addr, rte_be_to_cpu_16(flow_entry->key->src_port), flow_entry->key->dst_addr, rte_be_to_cpu_16(flow_entry->key->dst_port), flow_entry->key->proto);
@@ -324,10 +1320,178 @@ extract_sc_list(uint32_t *bft_count, sc_entries_list *c_list) {
          return active_fts;
 
 }
+
+#ifdef ENABLE_CHAIN_STATS
+/* The chains with flows in the chain stats, in O(chains): sc_count is the flow count of the chain, bneck_flag the same count
+ * if the chain is bottlenecked. Falls back to the flow table walk while a chain found no free chain id.
+ * Returns the flow count, *bft_count that of the bottlenecked chains */
+uint32_t
+extract_sc_list(uint32_t *bft_count, sc_entries_list *c_list) {
+        uint32_t active_fts = 0, bneck_fts = 0, s_inx = 0;
+        struct onvm_service_chain *sc;
+        int32_t flows;
+        uint16_t id;
+
+        if(!c_list) return -1;
+        if (chain_stats->full) {
+                return extract_sc_list_scan(bft_count, c_list);
+        }
+        for (id = 1; id <= chain_stats->max_id && s_inx < SDN_FT_ENTRIES; id++) {
+                sc = chain_stats->chain[id].sc;
+                flows = rte_atomic32_read(&chain_stats->chain[id].flows);
+                if (sc == NULL || sc->chain_length == 0 || sc->chain_id != id || flows <= 0) {
+                        continue;       //free, being reclaimed or without flows
+                }
+                c_list[s_inx].sc = sc;
+                c_list[s_inx].sc_count = (uint16_t)RTE_MIN((uint32_t)flows, UINT16_MAX);
+                c_list[s_inx].bneck_flag = 0;
+                active_fts += flows;
+                if (sc->highest_downstream_nf_index_id) {
+                        c_list[s_inx].bneck_flag = c_list[s_inx].sc_count;
+                        bneck_fts += flows;
+                }
+                s_inx++;
+        }
+        if (s_inx < SDN_FT_ENTRIES) {
+                c_list[s_inx].sc = NULL;        //end of the list
+        }
+        if(bft_count)*bft_count = bneck_fts;
+        return active_fts;
+}
+#else
+uint32_t
+extract_sc_list(uint32_t *bft_count, sc_entries_list *c_list) {
+        return extract_sc_list_scan(bft_count, c_list);
+}
+#endif //ENABLE_CHAIN_STATS
 #endif //ENABLE_NF_BACKPRESSURE
+#ifdef ENABLE_FLOW_COUNTERS
+#define FLOW_COUNTERS_TOP_N     (4)
+/* Totals over the installed flows and the flows with the most bytes */
+static void
+onvm_flow_dir_print_heavy_hitters(void) {
+        struct onvm_flow_entry *top[FLOW_COUNTERS_TOP_N] = {NULL};
+        struct onvm_flow_entry *flow_entry;
+        uint64_t total_pkts = 0, total_bytes = 0, bytes;
+        uint32_t next = 0, left = onvm_ft_count(sdn_ft);
+        int i, j;
+
+        while (left && (flow_entry = onvm_flow_dir_next_flow(sdn_ft, &next)) != NULL) {
+                left--;
+                if (flow_entry->key == NULL) continue;
+                onvm_flow_dir_get_counters(flow_entry, NULL, &bytes);
+                total_pkts += flow_entry->stats->packet_count;
+                total_bytes += bytes;
+                for (i = 0; i < FLOW_COUNTERS_TOP_N; i++) {
+                        if (top[i] == NULL || bytes > top[i]->stats->byte_count) break;
+                }
+                if (i == FLOW_COUNTERS_TOP_N) continue;
+                for (j = FLOW_COUNTERS_TOP_N - 1; j > i; j--) top[j] = top[j-1];
+                top[i] = flow_entry;
+        }
+        printf("Flow counters: pkts=[%"PRIu64"], bytes=[%"PRIu64"]\n", total_pkts, total_bytes);
+        for (i = 0; i < FLOW_COUNTERS_TOP_N && top[i]; i++) {
+                printf("  top%d (ft_index=%"PRIu64"): Tuple:[SRC(%d:%d),DST(%d:%d), PROTO(%d)], pkts=[%"PRIu64"], bytes=[%"PRIu64"]\n", i+1, top[i]->entry_index,
+                        top[i]->key->src_addr, rte_be_to_cpu_16(top[i]->key->src_port), top[i]->key->dst_addr, rte_be_to_cpu_16(top[i]->key->dst_port), top[i]->key->proto,
+                        top[i]->stats->packet_count, top[i]->stats->byte_count);
+        }
+}
+#endif //ENABLE_FLOW_COUNTERS
+
+#ifdef ENABLE_CHAIN_STATS
+/* One line per chain (the first CHAIN_STATS_PRINT_MAX), then the totals: O(chains) */
+static void
+onvm_chain_stats_print(void) {
+        onvm_chain_stats_t *cs;
+        struct onvm_service_chain *sc;
+        uint64_t pkts, drops, bkpr, b, t_pkts = 0, t_drops = 0, now = rte_get_tsc_cycles();
+        uint32_t nb_chains = 0, bneck_chains = 0;
+        int32_t flows, t_flows = 0;
+        uint16_t id, s;
+        int i;
+
+        for (id = 1; id <= chain_stats->max_id; id++) {
+                cs = &chain_stats->chain[id];
+                sc = cs->sc;
+                if (sc == NULL) {
+                        continue;
+                }
+                pkts = 0;
+                bkpr = 0;
+                for (s = 0; s < CHAIN_STATS_SHARDS; s++) {
+                        pkts += cs->rx[s].pkts;
+                        b = cs->rx[s].bkpr_cycles + ((cs->rx[s].bkpr_since)? (now - cs->rx[s].bkpr_since):(0));
+                        bkpr = RTE_MAX(bkpr, b);        //each Rx thread sees the same backpressure
+                }
+                flows = rte_atomic32_read(&cs->flows);
+                drops = (uint64_t)rte_atomic64_read(&cs->drops);
+                t_pkts += pkts;
+                t_drops += drops;
+                t_flows += RTE_MAX(flows, 0);
+                #ifdef ENABLE_NF_BACKPRESSURE
+                if (sc->highest_downstream_nf_index_id) bneck_chains++;
+                #endif //ENABLE_NF_BACKPRESSURE
+                if (nb_chains++ >= CHAIN_STATS_PRINT_MAX) continue;
+
+                printf("Chain [%u] (scl=%d)::", id, sc->chain_length);
+                for(i=1;i<=sc->chain_length;++i)printf(" [%d]",sc->sc[i].destination);
+                printf(", flows=[%d], pkts=[%"PRIu64"], drops=[%"PRIu64"], bkpr_ms=[%"PRIu64"]", flows, pkts, drops, bkpr * 1000 / rte_get_tsc_hz());
+                #ifdef ENABLE_NF_BACKPRESSURE
+                if (sc->highest_downstream_nf_index_id) printf(", overflowStatus (binx=%u)", sc->highest_downstream_nf_index_id);
+                #endif //ENABLE_NF_BACKPRESSURE
+                printf("\n");
+                #if defined(ENABLE_NF_BACKPRESSURE) && defined(ENABLE_CHAIN_INGRESS_RATE_LIMIT)
+                if(sc->ingress_tb.rate_pps || sc->ingress_tb.dropped) {
+                        printf("  ingress_tb: rate_pps=%"PRIu64", admitted=%"PRIu64", dropped=%"PRIu64", bneck_nf=%d\n",
+                                sc->ingress_tb.rate_pps, sc->ingress_tb.admitted, sc->ingress_tb.dropped, sc->ingress_tb.bneck_nf);
+                }
+                #endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+                #if defined(ENABLE_NF_BACKPRESSURE) && defined(ENABLE_CHAIN_INGRESS_FAIR_DROP)
+                if(sc->fair_drop.dropped) {
+                        printf("  fair_drop: dropped=%"PRIu64", scale=%u, flows=%u\n", sc->fair_drop.dropped, sc->fair_drop.scale, sc->fair_drop.last_flows);
+                }
+                #endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+                #ifdef ENABLE_MBUF_QUOTAS
+                if(sc->mbuf_owner) {
+                        printf("  mbuf_owner=%u (see MBUFS), mbuf_quota=%u\n", sc->mbuf_owner, sc->mbuf_quota);
+                }
+                #endif //ENABLE_MBUF_QUOTAS
+        }
+        if (nb_chains > CHAIN_STATS_PRINT_MAX) {
+                printf("... [%u] more chains\n", nb_chains - CHAIN_STATS_PRINT_MAX);
+        }
+        printf("Total chains: [%u], Bottleneck'd chains: [%u], flows: [%d], pkts: [%"PRIu64"], drops: [%"PRIu64"]\n",
+                nb_chains, bneck_chains, t_flows, t_pkts, t_drops);
+}
+#endif //ENABLE_CHAIN_STATS
+
 void
 onvm_flow_dir_print_stats(void) {
-#ifdef ENABLE_NF_BACKPRESSURE
+        onvm_flow_dir_refresh();
+        if(sdn_ft) {
+                printf("Flow table: flows=[%u], capacity=[%d], max=[%d], tiers=[%d]\n", onvm_ft_count(sdn_ft), sdn_ft->cnt, sdn_ft->max_cnt, sdn_ft->tiers);
+                #ifdef ENABLE_FLOW_DIR_IPV6
+                printf("Flow table (IPv6): flows=[%u], capacity=[%d], max=[%d], tiers=[%d]\n", onvm_ft_count(sdn_ft6), sdn_ft6->cnt, sdn_ft6->max_cnt, sdn_ft6->tiers);
+                #endif //ENABLE_FLOW_DIR_IPV6
+                #ifdef ENABLE_FLOW_AGING
+                printf("Flow aging: sweeps=[%"PRIu64"], expired idle=[%"PRIu64"], hard=[%"PRIu64"], not removable (no key)=[%"PRIu64"]\n",
+                        flow_aging_stats.sweeps, flow_aging_stats.expired_idle, flow_aging_stats.expired_hard, flow_aging_stats.skipped_nokey);
+                #endif //ENABLE_FLOW_AGING
+                if (flow_dir_retire_overflows) {
+                        printf("Flow retire list overflows (no memory to grow it, objects not freed): [%"PRIu64"]\n", flow_dir_retire_overflows);
+                }
+                #ifdef ENABLE_FLOW_COUNTERS
+                onvm_flow_dir_print_heavy_hitters();
+                #endif //ENABLE_FLOW_COUNTERS
+                #ifdef ENABLE_FLOW_CLASSIFIER
+                onvm_fc_print_stats(onvm_fc);
+                #endif //ENABLE_FLOW_CLASSIFIER
+        }
+#ifdef ENABLE_CHAIN_STATS
+        if(chain_stats) {
+                onvm_chain_stats_print();
+        }
+#elif defined(ENABLE_NF_BACKPRESSURE)
         if(sdn_ft) {
                 static sc_entries_list sc_l[SDN_FT_ENTRIES];
                 uint32_t active_chains = 0, bneck_chains=0;
@@ -343,31 +1507,55 @@ onvm_flow_dir_print_stats(void) {
                                         bneck_chains+=1;
 #ifdef ENABLE_NF_BACKPRESSURE
                                         int i =0;
-                                        printf ("(ft_count=%d),, overflowStatus (binx=%d),(nfid=%d), (scl=%d)::", sc_l[s_inx].bneck_flag, sc_l[s_inx].sc->highest_downstream_nf_index_id, sc_l[s_inx].sc->ref_cnt, sc_l[s_inx].sc->chain_length);
+                                        printf ("(ft_count=%d),, overflowStatus (binx=%u),(nfid=%d), (scl=%d)::", sc_l[s_inx].bneck_flag, sc_l[s_inx].sc->highest_downstream_nf_index_id, sc_l[s_inx].sc->ref_cnt, sc_l[s_inx].sc->chain_length);
                                         for(i=1;i<=sc_l[s_inx].sc->chain_length;++i)printf("[%d], ",sc_l[s_inx].sc->sc[i].destination);
                                         printf("\n");
 #endif
                                 }
+                                #ifdef ENABLE_CHAIN_INGRESS_RATE_LIMIT
+                                if(sc_l[s_inx].sc->ingress_tb.rate_pps || sc_l[s_inx].sc->ingress_tb.dropped) {
+                                        printf("(scl=%d) ingress_tb: rate_pps=%"PRIu64", admitted=%"PRIu64", dropped=%"PRIu64", bneck_nf=%d\n", sc_l[s_inx].sc->chain_length,
+                                                sc_l[s_inx].sc->ingress_tb.rate_pps, sc_l[s_inx].sc->ingress_tb.admitted, sc_l[s_inx].sc->ingress_tb.dropped, sc_l[s_inx].sc->ingress_tb.bneck_nf);
+                                }
+                                #endif //ENABLE_CHAIN_INGRESS_RATE_LIMIT
+                                #ifdef ENABLE_CHAIN_INGRESS_FAIR_DROP
+                                if(sc_l[s_inx].sc->fair_drop.dropped) {
+                                        printf("(scl=%d) fair_drop: dropped=%"PRIu64", scale=%u, flows=%u\n", sc_l[s_inx].sc->chain_length,
+                                                sc_l[s_inx].sc->fair_drop.dropped, sc_l[s_inx].sc->fair_drop.scale, sc_l[s_inx].sc->fair_drop.last_flows);
+                                }
+                                #endif //ENABLE_CHAIN_INGRESS_FAIR_DROP
+                                #ifdef ENABLE_MBUF_QUOTAS
+                                if(sc_l[s_inx].sc->mbuf_owner) {
+                                        printf("(scl=%d) mbuf_owner=%u (see MBUFS), mbuf_quota=%u\n", sc_l[s_inx].sc->chain_length, sc_l[s_inx].sc->mbuf_owner, sc_l[s_inx].sc->mbuf_quota);
+                                }
+                                #endif //ENABLE_MBUF_QUOTAS
                         }
                 }
                 printf("Total Flow entries and chains: [%d, %d], Bottleneck'd Flow entries and Chains: [%d, %d], \n", active_fts, active_chains, bneck_fts, bneck_chains);
         }
-#endif //ENABLE_NF_BACKPRESSURE
+#endif //ENABLE_CHAIN_STATS
         return ;
 }
 
 int
 onvm_flow_dir_clear_all_entries(void) {
+        onvm_flow_dir_refresh();
         if(sdn_ft) {
-                int32_t tbl_index = 0;
+                flow_dir_walk_t walk = {0, 0, 0};
+                struct onvm_flow_entry *flow_entry;
                 uint32_t active_chains = 0;
                 uint32_t cleared_chains = 0;
-                for (; tbl_index < SDN_FT_ENTRIES; tbl_index++) {
-                        struct onvm_flow_entry *flow_entry = (struct onvm_flow_entry *)&sdn_ft->data[tbl_index*sdn_ft->entry_size];
+                while ((flow_entry = onvm_flow_dir_walk_next(&walk)) != NULL) {
                         if (flow_entry && flow_entry->key) { //flow_entry->sc && flow_entry->sc->chain_length) {
                                 active_chains+=1;
                                 if (onvm_flow_dir_del_key(flow_entry->key) >=0) cleared_chains++;
                         }
+                        #ifdef ENABLE_FLOW_DIR_IPV6
+                        else if (flow_entry && flow_entry->key6) {
+                                active_chains+=1;
+                                if (onvm_flow_dir_del_key6(flow_entry->key6) >=0) cleared_chains++;
+                        }
+                        #endif //ENABLE_FLOW_DIR_IPV6
                         //else continue;
                 }
                 printf("Total chains: [%d], cleared chains: [%d]  \n", active_chains, cleared_chains);
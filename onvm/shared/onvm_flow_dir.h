@@ -41,24 +41,316 @@
 #ifndef _ONVM_FLOW_DIR_H_
 #define _ONVM_FLOW_DIR_H_
 
+#include <rte_eal.h>
 #include "common.h"
 #include "onvm_flow_table.h"
 
-#define SDN_FT_ENTRIES  (1024) //(1024*10*10) //(1024*4)
+#define SDN_FT_ENTRIES  (1024) //(1024*10*10) //(1024*4)   default initial size of the flow table (also max distinct chains listed)
+#define SDN_FT_MAX_ENTRIES  (1024*1024*16)      //default size up to which the flow table grows online
+
+/* flow table sizes: set by the manager (-f NUM_FLOWS[,MAX_FLOWS]) before onvm_flow_dir_init() */
+extern uint32_t sdn_ft_entries;
+extern uint32_t sdn_ft_max_entries;
 
 extern struct onvm_ft *sdn_ft;
 extern struct onvm_ft **sdn_ft_p;
 
-struct onvm_flow_entry {
-        struct onvm_ft_ipv4_5tuple *key;
-        struct onvm_service_chain *sc;
+/* Rule set built off to the side of the live flow table (onvm_flow_dir_ruleset_load()): its table, keys and chains */
+struct onvm_flow_ruleset {
+        struct onvm_ft *ft;
+        struct onvm_ft_ipv4_5tuple *keys;       // one block for all the rules
+        struct onvm_service_chain *chains;      // one block for all the chains
+        uint32_t nb_rules;
+        uint32_t nb_chains;
+};
+
+/* Flow director state shared by the manager and the NFs (MZ_FTP_INFO) */
+struct onvm_flow_dir_info {
+        struct onvm_ft *ft;                             // live flow table: sdn_ft_p points here
+        struct onvm_flow_ruleset * volatile pending;    // published, not yet swapped in by the manager
+        struct onvm_flow_ruleset *current;              // rule set of the live table (NULL => built rule by rule)
+        struct onvm_flow_ruleset *replaced;             // rule set swapped out, not yet freed
+        volatile uint32_t version;                      // bumped by the manager on each swap
+        struct onvm_ft_qsbr qsbr;                       // readers of the flow tables: survives the swaps
+};
+extern struct onvm_flow_dir_info *flow_dir_info;
+#ifdef ENABLE_FLOW_DIR_IPV6
+extern struct onvm_ft *sdn_ft6;         // IPv6 flows: their entry_index is tagged with FLOW_DIR_INDEX_IPV6
+#endif //ENABLE_FLOW_DIR_IPV6
+
+/* entry_index of a flow entry: its index in its flow table, tagged with the table (FLOW_DIR_INDEX_IPV6 for sdn_ft6).
+ * Stable across the table swaps; not bounded by SDN_FT_ENTRIES (the tables grow): check it before indexing an array with it */
+#define FLOW_DIR_INDEX_IPV6             (1ULL << 32)
+#define FLOW_DIR_INDEX_IS_IPV6(index)   (((index) & FLOW_DIR_INDEX_IPV6) != 0)
+#define FLOW_DIR_INDEX_SLOT(index)      ((uint32_t)(index))
+
+#ifdef ENABLE_FLOW_COUNTERS
+typedef struct flow_counter_shard {
+        uint64_t packets;
+        uint64_t bytes;
+} __rte_cache_aligned flow_counter_shard_t;
+#endif //ENABLE_FLOW_COUNTERS
+
+/* Cold part of a flow entry: kept in a separate array of the flow table, as steering a pkt does not need it */
+struct onvm_flow_stats {
         uint64_t ref_cnt;
-        uint16_t idle_timeout;
-        uint16_t hard_timeout;
         uint64_t packet_count;
         uint64_t byte_count;
+#ifdef ENABLE_FLOW_COUNTERS
+        flow_counter_shard_t counters[FLOW_COUNTER_SHARDS];     // written by the Rx threads only; packet_count/byte_count hold the merged value of the last read
+#endif //ENABLE_FLOW_COUNTERS
+};
+
+/* Hot part of a flow entry: one cache line, the only line of the entry array touched per pkt */
+struct onvm_flow_entry {
+        struct onvm_service_chain *sc;
+        struct onvm_ft_ipv4_5tuple *key;
+        struct onvm_flow_stats *stats;          // fixed per slot of the table: set when the entry is added
         uint64_t entry_index;
+        uint16_t idle_timeout;
+        uint16_t hard_timeout;
+#ifdef ENABLE_CHAIN_STATS
+        uint16_t chain_id;              // chain the flow is counted to in the chain stats (0 => not counted)
+#endif //ENABLE_CHAIN_STATS
+#ifdef ENABLE_FLOW_AGING
+        uint32_t last_seen;             // flow clock (seconds) of the last pkt of the flow seen by the manager
+        uint32_t install_time;          // flow clock when the entry was first seen by the aging sweep (0 => not yet)
+#endif //ENABLE_FLOW_AGING
+#ifdef ENABLE_FLOW_DIR_IPV6
+        struct onvm_ft_ipv6_5tuple *key6;       // key of an IPv6 flow (key is NULL)
+#endif //ENABLE_FLOW_DIR_IPV6
+} __rte_cache_aligned;
+
+#ifdef ENABLE_FLOW_AGING
+/* coarse clock (seconds) of the flow table, advanced by onvm_flow_dir_age() */
+extern volatile uint32_t flow_dir_clock;
+
+typedef struct flow_aging_stats {
+        uint64_t sweeps;
+        uint64_t expired_idle;
+        uint64_t expired_hard;
+        uint64_t skipped_nokey;
+}flow_aging_stats_t;
+extern flow_aging_stats_t flow_aging_stats;
+
+/* Stamp the flow entry as seen: written only when the clock has moved on, to keep the entry cache line clean */
+static inline void
+onvm_flow_dir_touch(struct onvm_flow_entry *flow_entry) {
+        if (flow_entry->last_seen != flow_dir_clock) {
+                flow_entry->last_seen = flow_dir_clock;
+        }
+}
+
+/* Check up to budget entries of each flow table (IPv4, then IPv6; from where the last call stopped) and remove the expired flows; returns the number removed */
+uint32_t onvm_flow_dir_age(uint32_t budget);
+#endif //ENABLE_FLOW_AGING
+
+#ifdef ENABLE_FLOW_COUNTERS
+/* Account the pkt to the flow in the shard of the calling Rx thread */
+static inline void
+onvm_flow_dir_count(struct onvm_flow_entry *flow_entry, uint16_t shard, uint32_t bytes) {
+        flow_counter_shard_t *c = &flow_entry->stats->counters[shard];
+        c->packets++;
+        c->bytes += bytes;
+}
+
+/* Merge the shards into packet_count/byte_count of the entry (and *pkts/*bytes if not NULL) */
+static inline void
+onvm_flow_dir_get_counters(struct onvm_flow_entry *flow_entry, uint64_t *pkts, uint64_t *bytes) {
+        uint64_t p = 0, b = 0;
+        uint16_t i;
+        for (i = 0; i < FLOW_COUNTER_SHARDS; i++) {
+                p += flow_entry->stats->counters[i].packets;
+                b += flow_entry->stats->counters[i].bytes;
+        }
+        flow_entry->stats->packet_count = p;
+        flow_entry->stats->byte_count = b;
+        if (pkts) *pkts = p;
+        if (bytes) *bytes = b;
+}
+
+/* Zero the counters of the entry: when the flow is removed, before the slot is reused by another flow */
+static inline void
+onvm_flow_dir_clear_counters(struct onvm_flow_entry *flow_entry) {
+        memset(flow_entry->stats->counters, 0, sizeof(flow_entry->stats->counters));
+        flow_entry->stats->packet_count = 0;
+        flow_entry->stats->byte_count = 0;
+}
+#endif //ENABLE_FLOW_COUNTERS
+
+#ifdef ENABLE_CHAIN_STATS
+#define CHAIN_ID_RETIRED        (0xFFFF)        // chain unregistered, to be freed: not registered again
+
+typedef struct chain_stats_shard {
+        uint64_t pkts;                  // pkts steered on the chain by the Rx thread
+        uint64_t bkpr_since;            // tsc the Rx thread first saw the chain backpressured (0 => not backpressured)
+        uint64_t bkpr_cycles;           // time the chain was seen backpressured, up to bkpr_since
+} __rte_cache_aligned chain_stats_shard_t;
+
+/* Counters of a chain, indexed by its chain id */
+typedef struct onvm_chain_stats {
+        struct onvm_service_chain *sc;  // NULL => free chain id
+        rte_atomic32_t flows;           // flow entries counted to the chain
+        rte_atomic64_t drops;           // pkts of the chain dropped by the manager (backpressure, mbuf quota)
+        chain_stats_shard_t rx[CHAIN_STATS_SHARDS];     // written by the Rx threads only
+} __rte_cache_aligned onvm_chain_stats_t;
+
+typedef struct onvm_chain_stats_info {
+        rte_spinlock_t lock;            // chain id allocation
+        volatile uint16_t nb_chains;
+        volatile uint16_t max_id;       // highest chain id ever given: scans stop here
+        volatile uint8_t full;          // a chain found no free chain id: extract_sc_list() walks the flow table instead
+        onvm_chain_stats_t chain[MAX_CHAINS];
+} onvm_chain_stats_info_t;
+extern onvm_chain_stats_info_t *chain_stats;
+
+/* Give the chain a chain id (MZ_CHAIN_STATS_INFO): returns it, or 0 if none is left or the chain is retired */
+uint16_t onvm_chain_stats_register(struct onvm_service_chain *sc);
+/* Release the chain id before the chain is freed */
+void onvm_chain_stats_unregister(struct onvm_service_chain *sc);
+/* Count the flow to its current chain (registered if needed): returns the chain id, or 0 if not counted */
+uint16_t onvm_chain_stats_count_flow(struct onvm_flow_entry *flow_entry);
+/* Stop counting the flow to its chain: when the flow is removed */
+static inline void
+onvm_chain_stats_uncount_flow(struct onvm_flow_entry *flow_entry) {
+        if (flow_entry->chain_id && flow_entry->chain_id < MAX_CHAINS) {
+                rte_atomic32_dec(&chain_stats->chain[flow_entry->chain_id].flows);
+        }
+        flow_entry->chain_id = 0;
+}
+/* Manager master thread: give back the chain ids of the chains without installed (ref_cnt) nor counted flows, once no Rx
+ * thread may still count on them. Returns the ids freed */
+uint32_t onvm_chain_stats_reclaim(void);
+/* Zero the flow count of all chains: the flows of a replaced flow table are gone */
+void onvm_chain_stats_clear_flows(void);
+
+/* Manager Rx path: account the pkt to the chain of its flow in the shard of the calling Rx thread */
+static inline void
+onvm_chain_stats_rx(struct onvm_flow_entry *flow_entry, uint16_t shard, uint64_t now) {
+        struct onvm_service_chain *sc = flow_entry->sc;
+        chain_stats_shard_t *s;
+        uint16_t id = flow_entry->chain_id;
+
+        if (unlikely(id == 0 || id != sc->chain_id)) {
+                id = onvm_chain_stats_count_flow(flow_entry);
+                if (id == 0) {
+                        return;
+                }
+        }
+        s = &chain_stats->chain[id].rx[shard];
+        s->pkts++;
+        #ifdef ENABLE_NF_BACKPRESSURE
+        if (unlikely((sc->highest_downstream_nf_index_id != 0) != (s->bkpr_since != 0))) {
+                if (s->bkpr_since) {
+                        s->bkpr_cycles += now - s->bkpr_since;
+                        s->bkpr_since = 0;
+                } else {
+                        s->bkpr_since = now;
+                }
+        }
+        #else
+        (void)now;
+        #endif //ENABLE_NF_BACKPRESSURE
+}
+
+/* Account a pkt of the chain dropped by the manager */
+static inline void
+onvm_chain_stats_drop(struct onvm_service_chain *sc) {
+        if (sc && sc->chain_id && sc->chain_id < MAX_CHAINS) {
+                rte_atomic64_inc(&chain_stats->chain[sc->chain_id].drops);
+        }
+}
+#endif //ENABLE_CHAIN_STATS
+
+/* Concurrent updates (see onvm_flow_table.h): NFs and the manager change the flow table while the manager and NF threads look it up.
+ * The threads looking up flows register as readers and report a quiescent state (no flow entry held) once per loop: the manager
+ * threads, the NF thread mapping the flow director (onvm_flow_dir_nf_init()) from the nflib loop, and any other NF thread touching
+ * the flow tables. Keys, service chains and swapped out tables are freed only once no reader can still hold them. */
+RTE_DECLARE_PER_LCORE(int, flow_dir_reader);    // reader slot + 1 of the calling thread (0 => not a reader)
+
+/* Register the calling thread as a reader of the flow table (tagged with the pid of its process): returns its reader slot */
+int onvm_flow_dir_reader_register(void);
+/* Manager: give back the reader slots of a process (a stopped NF), so the writers no longer wait for them */
+void onvm_flow_dir_reader_release(pid_t pid);
+
+/* NFs: switch to the table swapped in by the manager (the manager threads switch in onvm_flow_dir_swap() only) */
+static inline void
+onvm_flow_dir_refresh(void) {
+        if (unlikely(flow_dir_info && flow_dir_info->ft != sdn_ft) && rte_eal_process_type() == RTE_PROC_SECONDARY) {
+                sdn_ft = flow_dir_info->ft;
+        }
+}
+
+static inline void
+onvm_flow_dir_quiescent(void) {
+        int reader = RTE_PER_LCORE(flow_dir_reader);
+        uint64_t epoch;
+        if (reader) {
+                /* an NF reporting the epoch of a swap must hold the new table only: read the epoch, then the table */
+                epoch = (uint64_t)rte_atomic64_read(&sdn_ft->qsbr->epoch);
+                rte_smp_rmb();
+                onvm_flow_dir_refresh();
+                sdn_ft->qsbr->reader[reader - 1].epoch = epoch;
+                rte_smp_mb();
+        }
+}
+
+/* The calling reader thread is about to block: do not hold back the writers meanwhile (next onvm_flow_dir_quiescent() resumes) */
+static inline void
+onvm_flow_dir_offline(void) {
+        int reader = RTE_PER_LCORE(flow_dir_reader);
+        if (reader) onvm_ft_reader_offline(sdn_ft, reader - 1);
+}
+
+/* Free obj (rte_malloc'd key or service chain, already unlinked from the flow table) once no reader may hold it.
+ * Does not block: the retire list grows while it is full of objects still in their grace period (-ENOMEM, obj never freed, if it cannot) */
+int onvm_flow_dir_retire(void *obj);
+extern uint64_t flow_dir_retire_overflows;     // objects leaked for the retire list failing to grow
+/* Free a service chain no flow entry points to any more: as onvm_flow_dir_retire(), and releases its chain stats id and mbuf owner slot */
+int onvm_flow_dir_retire_sc(struct onvm_service_chain *sc);
+/* Free the retired objects past their grace period; returns the count still pending */
+uint32_t onvm_flow_dir_reclaim(void);
+
+/* Bulk rule loading: a whole rule set is built off to the side from a binary rule file and published in one step.
+ * The manager swaps it in from its master thread (onvm_flow_dir_swap()): a lookup sees either the old or the new rules, never a mix.
+ * The replaced table is freed once every reader (manager and NF threads) reported a quiescent state past the swap: the NFs pick
+ * up the new table then at the latest. Entries added or removed meanwhile on the old table are lost with it.
+ * The rules are checked on load: chain hops must be valid actions (ONVM_NF_ACTION_*) with a destination in range. */
+
+/* Binary rule file: header, nb_chains chains, then nb_rules rules (host byte order; keys in network order as in the flow table) */
+#define FLOW_RULES_FILE_MAGIC   (0x4c55524f)    // "ORUL"
+#define FLOW_RULES_FILE_VERSION (2)
+struct onvm_flow_rules_hdr {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t nb_chains;
+        uint32_t nb_rules;
 };
+struct onvm_flow_rules_chain {
+        uint8_t chain_length;
+        uint8_t pad[3];
+        uint32_t latency_target_us;     // end-to-end latency target of the chain (0 => DEFAULT_CHAIN_LATENCY_TARGET_IN_US)
+        struct {
+                uint8_t action;
+                uint8_t pad;
+                uint16_t destination;
+        } hop[ONVM_MAX_CHAIN_LENGTH];
+};
+struct onvm_flow_rules_rule {
+        struct onvm_ft_ipv4_5tuple key;
+        uint32_t chain;                 // index of the chain in the file
+        uint16_t idle_timeout;
+        uint16_t hard_timeout;
+};
+
+/* Build the rule set of a binary rule file (mmap'd): NULL on error, with the negative errno in *err */
+struct onvm_flow_ruleset *onvm_flow_dir_ruleset_load(const char *path, int *err);
+/* Publish a rule set: 0, or -EBUSY while another one is pending. It is live once flow_dir_info->pending no longer holds it */
+int onvm_flow_dir_ruleset_publish(struct onvm_flow_ruleset *rs);
+/* Free a rule set that was not published */
+void onvm_flow_dir_ruleset_free(struct onvm_flow_ruleset *rs);
+/* Manager master thread: swap in the published rule set and free the replaced table once unused */
+void onvm_flow_dir_swap(void);
 
 /* Get a pointer to the flow entry entry for this packet.
  * Returns:
@@ -68,15 +360,30 @@ struct onvm_flow_entry {
 int onvm_flow_dir_init(void);
 int onvm_flow_dir_nf_init(void);
 int onvm_flow_dir_get_pkt(struct rte_mbuf* pkt, struct onvm_flow_entry **flow_entry);
+/* Flow entry of an entry_index (NULL if out of the table) */
+struct onvm_flow_entry* onvm_flow_dir_get_index(uint64_t entry_index);
 int onvm_flow_dir_add_pkt(struct rte_mbuf* pkt, struct onvm_flow_entry **flow_entry);
 /* delete the flow dir entry, but do not free the service chain (useful if a service chain is pointed to by several different flows */
 int onvm_flow_dir_del_pkt(struct rte_mbuf* pkt);
 /* Delete the flow dir entry and free the service chain */
 int onvm_flow_dir_del_and_free_pkt(struct rte_mbuf* pkt);
+#ifdef ENABLE_FLOW_CLASSIFIER
+/* Resolve the chain of a pkt missing in the flow table with the wildcard classifier and install an exact match entry for its flow.
+ * A flow matching no rule is installed with miss_sc (if not NULL), so its next pkts do not probe the subtables again.
+ * Returns the index of the new entry (*flow_entry set), -ENOENT if no rule matches (and no miss_sc), -ENOSPC if the flow table is full
+ * (checked before the classification), or another negative errno if not installed. shard: the calling manager Rx thread */
+int onvm_flow_dir_classify_pkt(struct rte_mbuf* pkt, struct onvm_service_chain *miss_sc, struct onvm_flow_entry **flow_entry, uint16_t shard);
+#endif //ENABLE_FLOW_CLASSIFIER
 int onvm_flow_dir_get_key(struct onvm_ft_ipv4_5tuple* key, struct onvm_flow_entry **flow_entry);
 int onvm_flow_dir_add_key(struct onvm_ft_ipv4_5tuple* key, struct onvm_flow_entry **flow_entry);
 int onvm_flow_dir_del_key(struct onvm_ft_ipv4_5tuple* key);
 int onvm_flow_dir_del_and_free_key(struct onvm_ft_ipv4_5tuple* key);
+#ifdef ENABLE_FLOW_DIR_IPV6
+int onvm_flow_dir_get_key6(struct onvm_ft_ipv6_5tuple* key, struct onvm_flow_entry **flow_entry);
+int onvm_flow_dir_add_key6(struct onvm_ft_ipv6_5tuple* key, struct onvm_flow_entry **flow_entry);
+int onvm_flow_dir_del_key6(struct onvm_ft_ipv6_5tuple* key);
+int onvm_flow_dir_del_and_free_key6(struct onvm_ft_ipv6_5tuple* key);
+#endif //ENABLE_FLOW_DIR_IPV6
 void onvm_flow_dir_print_stats(void);
 int onvm_flow_dir_clear_all_entries(void);
 int onvm_flow_dir_reset_entry(struct onvm_flow_entry *flow_entry);
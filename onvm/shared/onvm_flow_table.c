@@ -43,6 +43,7 @@
 #include <rte_lcore.h>
 #include <rte_cycles.h>
 #include <rte_malloc.h>
+#include <rte_prefetch.h>
 
 #include "onvm_flow_table.h"
 
@@ -57,67 +58,353 @@ uint8_t rss_symmetric_key[40] = { 0x6d, 0x5a, 0x6d, 0x5a,
                                      0x6d, 0x5a, 0x6d, 0x5a,
                                      0x6d, 0x5a, 0x6d, 0x5a,};
 
-/* Create a new flow table made of an rte_hash table and a fixed size
- * data array for storing values. Only supports IPv4 5-tuple lookups. */
-struct onvm_ft*
-onvm_ft_create(int cnt, int entry_size) {
+uint32_t onvm_softrss_lut[ONVM_SOFTRSS_LUT_BYTES][256];
+volatile int onvm_softrss_lut_ready = 0;
+
+void
+onvm_softrss_lut_init(void) {
+        const uint8_t *key = rss_symmetric_key;
+        uint32_t window[8], v;
+        int i, b, k;
+
+        /* window[k]: the 32 bits of the key starting at bit k of byte i, xor'ed in when that input bit is set */
+        for (i = 0; i < ONVM_SOFTRSS_LUT_BYTES; i++) {
+                v = ((uint32_t)key[i] << 24) | ((uint32_t)key[i+1] << 16) | ((uint32_t)key[i+2] << 8) | key[i+3];
+                window[0] = v;
+                for (k = 1; k < 8; k++) {
+                        window[k] = (v << k) | (key[i+4] >> (8 - k));
+                }
+                for (b = 0; b < 256; b++) {
+                        v = 0;
+                        for (k = 0; k < 8; k++) {
+                                if (b & (0x80 >> k)) v ^= window[k];
+                        }
+                        onvm_softrss_lut[i][b] = v;
+                }
+        }
+        rte_wmb();
+        onvm_softrss_lut_ready = 1;
+}
+
+/* L3 (addresses) and L4 (ports) hash as the NIC does: fragments and protocols other than TCP/UDP hash on the addresses only */
+static inline uint32_t
+onvm_softrss_pkt(struct rte_mbuf *pkt) {
+        struct ipv4_hdr *ipv4_hdr;
+        struct ipv6_hdr *ipv6_hdr;
+        uint8_t *l3;
+        uint32_t off, hash;
+        uint16_t vlan_id, type;
+
+        type = onvm_ft_pkt_l3(pkt, &off, &vlan_id);
+        l3 = rte_pktmbuf_mtod(pkt, uint8_t *) + off;
+        if (type == ETHER_TYPE_IPv4) {
+                ipv4_hdr = (struct ipv4_hdr *)l3;
+                hash = onvm_softrss_lut_hash((const uint8_t *)&ipv4_hdr->src_addr, 0, 8, 0);
+                if ((ipv4_hdr->next_proto_id == IP_PROTOCOL_TCP || ipv4_hdr->next_proto_id == IP_PROTOCOL_UDP) &&
+                    !(ipv4_hdr->fragment_offset & rte_cpu_to_be_16(IPV4_HDR_OFFSET_MASK | IPV4_HDR_MF_FLAG))) {
+                        hash = onvm_softrss_lut_hash(l3 + (ipv4_hdr->version_ihl & 0x0F) * 4, 8, 4, hash);
+                }
+        } else if (type == ETHER_TYPE_IPv6) {
+                ipv6_hdr = (struct ipv6_hdr *)l3;
+                hash = onvm_softrss_lut_hash(ipv6_hdr->src_addr, 0, 32, 0);
+                if (ipv6_hdr->proto == IP_PROTOCOL_TCP || ipv6_hdr->proto == IP_PROTOCOL_UDP) {
+                        hash = onvm_softrss_lut_hash(l3 + sizeof(struct ipv6_hdr), 32, 4, hash);
+                }
+        } else {
+                hash = 0;
+        }
+        return hash;
+}
+
+void
+onvm_softrss_burst(struct rte_mbuf **pkts, uint16_t count) {
+        uint16_t i;
+
+        if (unlikely(!onvm_softrss_lut_ready)) {
+                onvm_softrss_lut_init();
+        }
+        for (i = 0; i < count; i++) {
+                if (i + 1 < count) {
+                        rte_prefetch0(rte_pktmbuf_mtod(pkts[i + 1], void *));
+                }
+                pkts[i]->hash.rss = onvm_softrss_pkt(pkts[i]);
+                pkts[i]->ol_flags |= PKT_RX_RSS_HASH;
+        }
+}
+
+/* Create one tier: an rte_hash table and a fixed size data array for storing values */
+static int
+onvm_ft_add_tier(struct onvm_ft *ft, int cnt) {
+        struct onvm_ft_tier *tier;
         struct rte_hash* hash;
-        struct onvm_ft* ft;
+        int t = ft->tiers;
         struct rte_hash_parameters ipv4_hash_params = {
             .name = NULL,
             .entries = cnt,
-            .key_len = sizeof(struct onvm_ft_ipv4_5tuple),
+            .key_len = ft->key_len,
             .hash_func = NULL,
             .hash_func_init_val = 0,
         };
 
         char s[64];
+        if (t >= ONVM_FT_MAX_TIERS || cnt <= 0 || cnt > (1 << ONVM_FT_TIER_BITS)) {
+                return -ENOSPC;
+        }
         /* create ipv4 hash table. use core number and cycle counter to get a unique name. */
         ipv4_hash_params.name = s;
-        ipv4_hash_params.socket_id = rte_socket_id();
-        snprintf(s, sizeof(s), "onvm_ft_%d-%"PRIu64, rte_lcore_id(), rte_get_tsc_cycles());
+        ipv4_hash_params.socket_id = ft->socket_id;
+        snprintf(s, sizeof(s), "onvm_ft_%d-%"PRIu64"-%d", rte_lcore_id(), rte_get_tsc_cycles(), t);
         hash = rte_hash_create(&ipv4_hash_params);
         if (hash == NULL) {
+                return -ENOMEM;
+        }
+        tier = &ft->tier[t];
+        /* Create data array for storing values */
+        tier->data = rte_zmalloc_socket("entry", (size_t)cnt * ft->entry_size, RTE_CACHE_LINE_SIZE, ft->socket_id);
+        if (tier->data == NULL) {
+                rte_hash_free(hash);
+                return -ENOMEM;
+        }
+        tier->cold = NULL;
+        if (ft->cold_size) {
+                tier->cold = rte_zmalloc_socket("entry_cold", (size_t)cnt * ft->cold_size, RTE_CACHE_LINE_SIZE, ft->socket_id);
+                if (tier->cold == NULL) {
+                        rte_free(tier->data);
+                        rte_hash_free(hash);
+                        return -ENOMEM;
+                }
+        }
+        tier->hash = hash;
+        tier->cnt = cnt;
+        tier->base = (t)? (ft->tier[t-1].base + ft->tier[t-1].cnt):(0);
+        rte_atomic32_init(&tier->used);
+        if (t == 0) {
+                ft->hash = hash;
+                ft->data = tier->data;
+        }
+        ft->cnt = tier->base + cnt;
+
+        /* publish the tier only once it is complete: lookups may be running on the other tiers */
+        rte_wmb();
+        ft->tiers = t + 1;
+        return 0;
+}
+
+/* Add the next tier if the last one is (about to be) full and the table may still grow: called with the write lock held */
+static int
+onvm_ft_grow(struct onvm_ft *ft, int on_full) {
+        struct onvm_ft_tier *last;
+        int ret = -ENOSPC;
+        int cnt;
+
+        last = &ft->tier[ft->tiers - 1];
+        if (on_full || rte_atomic32_read(&last->used) >= (int32_t)(((int64_t)last->cnt * ONVM_FT_GROW_PCT)/100)) {
+                cnt = RTE_MIN((int64_t)last->cnt * ONVM_FT_GROW_FACTOR, (int64_t)(ft->max_cnt - ft->cnt));
+                cnt = RTE_MIN(cnt, (1 << ONVM_FT_TIER_BITS));
+                if (cnt > 0) {
+                        ret = onvm_ft_add_tier(ft, cnt);
+                }
+        } else {
+                ret = 0;        //grown meanwhile by another writer
+        }
+        return ret;
+}
+
+struct onvm_ft*
+onvm_ft_create_keyed(int cnt, int max_cnt, int entry_size, int cold_size, int socket_id, uint16_t key_type) {
+        struct onvm_ft* ft;
+
+        if (key_type != ONVM_FT_KEY_IPV4 && key_type != ONVM_FT_KEY_IPV6) {
                 return NULL;
         }
-        ft = (struct onvm_ft*)rte_calloc("table", 1, sizeof(struct onvm_ft), 0);
+        ft = (struct onvm_ft*)rte_zmalloc_socket("table", sizeof(struct onvm_ft), RTE_CACHE_LINE_SIZE, socket_id);
         if (ft == NULL) {
-                rte_hash_free(hash);
                 return NULL;
         }
-        ft->hash = hash;
-        ft->cnt = cnt;
         ft->entry_size = entry_size;
-        /* Create data array for storing values */
-        ft->data = rte_calloc("entry", cnt, entry_size, 0);
-        if (ft->data == NULL) {
-                rte_hash_free(hash);
+        ft->cold_size = cold_size;
+        ft->max_cnt = RTE_MAX(cnt, max_cnt);
+        ft->socket_id = socket_id;
+        ft->key_type = key_type;
+        ft->key_len = (key_type == ONVM_FT_KEY_IPV6)? sizeof(struct onvm_ft_ipv6_5tuple):sizeof(struct onvm_ft_ipv4_5tuple);
+        rte_spinlock_init(&ft->write_lock);
+        onvm_ft_qsbr_init(&ft->own_qsbr);
+        ft->qsbr = &ft->own_qsbr;
+        if (onvm_ft_add_tier(ft, cnt) < 0) {
                 rte_free(ft);
                 return NULL;
         }
         return ft;
 }
 
+struct onvm_ft*
+onvm_ft_create_resizable(int cnt, int max_cnt, int entry_size, int socket_id) {
+        return onvm_ft_create_keyed(cnt, max_cnt, entry_size, 0, socket_id, ONVM_FT_KEY_IPV4);
+}
+
+/* Create a new flow table made of an rte_hash table and a fixed size
+ * data array for storing values. Supports IPv4 5-tuple lookups. */
+struct onvm_ft*
+onvm_ft_create(int cnt, int entry_size) {
+        return onvm_ft_create_resizable(cnt, cnt, entry_size, rte_socket_id());
+}
+
+uint32_t
+onvm_ft_count(struct onvm_ft *table) {
+        uint32_t count = 0;
+        int t;
+        for (t = 0; t < table->tiers; t++) {
+                count += rte_atomic32_read(&table->tier[t].used);
+        }
+        return count;
+}
+
+/* Lookup the key in all the tiers, newest first. Returns the index in the table or -ENOENT */
+static inline int32_t
+onvm_ft_lookup_tiers(struct onvm_ft* table, const void *key, uint32_t sig, int *tier) {
+        int32_t pos = -ENOENT;
+        int t;
+        for (t = table->tiers - 1; t >= 0; t--) {
+                pos = rte_hash_lookup_with_hash(table->tier[t].hash, key, sig);
+                if (pos >= 0) {
+                        if (tier) *tier = t;
+                        return table->tier[t].base + pos;
+                }
+        }
+        return pos;
+}
+
+/* Lock-free lookup: a miss is only trusted if no writer changed the buckets meanwhile, retried up to ONVM_FT_LOOKUP_RETRIES times */
+static inline int32_t
+onvm_ft_lookup_with_hash(struct onvm_ft* table, const void *key, uint32_t sig, int *tier) {
+        uint32_t cnt, tries = 0;
+        int32_t pos;
+        do {
+                cnt = table->change_cnt;
+                rte_smp_rmb();
+                pos = onvm_ft_lookup_tiers(table, key, sig, tier);
+                if (pos >= 0) {
+                        return pos;
+                }
+                rte_smp_rmb();
+        } while (unlikely((cnt & 1) || cnt != table->change_cnt) && ++tries < ONVM_FT_LOOKUP_RETRIES);
+        return -ENOENT;
+}
+
+static inline void
+onvm_ft_write_begin(struct onvm_ft* table) {
+        rte_spinlock_lock(&table->write_lock);
+        table->change_cnt++;
+        rte_smp_wmb();
+}
+
+static inline void
+onvm_ft_write_end(struct onvm_ft* table) {
+        rte_smp_wmb();
+        table->change_cnt++;
+        rte_spinlock_unlock(&table->write_lock);
+}
+
+/* Add the key to the newest tier unless it is present already; grows the table if needed */
+static inline int32_t
+onvm_ft_add_with_hash(struct onvm_ft* table, const void *key, uint32_t sig) {
+        struct onvm_ft_tier *last;
+        int32_t pos;
+        int t;
+
+        onvm_ft_write_begin(table);
+        pos = onvm_ft_lookup_tiers(table, key, sig, NULL);
+        if (pos >= 0) {
+                onvm_ft_write_end(table);
+                return pos;
+        }
+        last = &table->tier[table->tiers - 1];
+        if (unlikely(table->cnt < table->max_cnt && rte_atomic32_read(&last->used) >= (int32_t)(((int64_t)last->cnt * ONVM_FT_GROW_PCT)/100))) {
+                onvm_ft_grow(table, 0);
+        }
+        t = table->tiers - 1;
+        pos = rte_hash_add_key_with_hash(table->tier[t].hash, key, sig);
+        if (unlikely(pos == -ENOSPC) && onvm_ft_grow(table, 1) == 0) {
+                t = table->tiers - 1;
+                pos = rte_hash_add_key_with_hash(table->tier[t].hash, key, sig);
+        }
+        if (pos >= 0) {
+                rte_atomic32_inc(&table->tier[t].used);
+                pos += table->tier[t].base;
+        }
+        onvm_ft_write_end(table);
+        return pos;
+}
+
+/* Remove the key from the tier holding it. Returns its index in the table or -ENOENT */
+static inline int32_t
+onvm_ft_remove_with_hash(struct onvm_ft* table, const void *key, uint32_t sig) {
+        int32_t pos = -ENOENT;
+        int t;
+        onvm_ft_write_begin(table);
+        for (t = table->tiers - 1; t >= 0; t--) {
+                pos = rte_hash_del_key_with_hash(table->tier[t].hash, key, sig);
+                if (pos >= 0) {
+                        rte_atomic32_dec(&table->tier[t].used);
+                        pos += table->tier[t].base;
+                        break;
+                }
+        }
+        onvm_ft_write_end(table);
+        return pos;
+}
+
+/* Key of the parsed pkt for the key type of the table, and its hash signature */
+static inline int
+onvm_ft_pkt_key_l3(struct onvm_ft* table, struct rte_mbuf *pkt, uint16_t ether_type, uint32_t l3_off, uint16_t vlan_id,
+                   union onvm_ft_key *key, uint32_t *sig) {
+        int ret;
+        if (table->key_type == ONVM_FT_KEY_IPV6) {
+                if (unlikely(ether_type != ETHER_TYPE_IPv6)) {
+                        return -EPROTONOSUPPORT;
+                }
+                ret = onvm_ft_fill_key6_l3(&key->v6, pkt, l3_off, vlan_id);
+                *sig = onvm_ft_ipv6_hash(&key->v6);
+        } else {
+                if (unlikely(ether_type != ETHER_TYPE_IPv4)) {
+                        return -EPROTONOSUPPORT;
+                }
+                ret = onvm_ft_fill_key_l3(&key->v4, pkt, l3_off, vlan_id);
+                *sig = pkt->hash.rss;
+        }
+        return ret;
+}
+
+/* Key of the pkt for the key type of the table, and its hash signature */
+static inline int
+onvm_ft_pkt_key(struct onvm_ft* table, struct rte_mbuf *pkt, union onvm_ft_key *key, uint32_t *sig) {
+        uint32_t l3_off;
+        uint16_t vlan_id;
+        uint16_t ether_type = onvm_ft_pkt_l3(pkt, &l3_off, &vlan_id);
+        return onvm_ft_pkt_key_l3(table, pkt, ether_type, l3_off, vlan_id, key, sig);
+}
+
 /* Add an entry in flow table and set data to point to the new value.
 Returns:
  index in the array on success
- -EPROTONOSUPPORT if packet is not ipv4.
+ -EPROTONOSUPPORT if packet is not of the key type of the table.
  -EINVAL if the parameters are invalid.
  -ENOSPC if there is no space in the hash for this key.
 */
 int
 onvm_ft_add_pkt(struct onvm_ft* table, struct rte_mbuf *pkt, char** data) {
         int32_t tbl_index;
-        struct onvm_ft_ipv4_5tuple key;
+        union onvm_ft_key key;
+        uint32_t sig;
         int err;
 
-        err = onvm_ft_fill_key(&key, pkt);
+        err = onvm_ft_pkt_key(table, pkt, &key, &sig);
         if (err < 0) {
                 return err;
         }
-        tbl_index = rte_hash_add_key_with_hash(table->hash, (const void *)&key, pkt->hash.rss);
+        tbl_index = onvm_ft_add_with_hash(table, &key, sig);
         if (tbl_index >= 0) {
-        	*data = &table->data[tbl_index*table->entry_size];
+        	*data = onvm_ft_get_data(table, tbl_index);
         }
         return tbl_index;
 }
@@ -130,17 +417,27 @@ onvm_ft_add_pkt(struct onvm_ft* table, struct rte_mbuf *pkt, char** data) {
 */
 int
 onvm_ft_lookup_pkt(struct onvm_ft* table, struct rte_mbuf *pkt, char** data) {
+        uint32_t l3_off;
+        uint16_t vlan_id;
+        uint16_t ether_type = onvm_ft_pkt_l3(pkt, &l3_off, &vlan_id);
+        return onvm_ft_lookup_pkt_l3(table, pkt, ether_type, l3_off, vlan_id, data);
+}
+
+int
+onvm_ft_lookup_pkt_l3(struct onvm_ft* table, struct rte_mbuf *pkt, uint16_t ether_type, uint32_t l3_off, uint16_t vlan_id, char** data) {
         int32_t tbl_index;
-        struct onvm_ft_ipv4_5tuple key;
+        union onvm_ft_key key;
+        uint32_t sig;
         int ret;
+        int t = 0;
 
-        ret = onvm_ft_fill_key(&key, pkt);
+        ret = onvm_ft_pkt_key_l3(table, pkt, ether_type, l3_off, vlan_id, &key, &sig);
         if (ret < 0) {
                 return ret;
         }
-        tbl_index = rte_hash_lookup_with_hash(table->hash, (const void *)&key, pkt->hash.rss);
+        tbl_index = onvm_ft_lookup_with_hash(table, &key, sig, &t);
         if (tbl_index >= 0) {
-                *data = onvm_ft_get_data(table, tbl_index);
+                *data = &table->tier[t].data[(size_t)(tbl_index - table->tier[t].base)*table->entry_size];
         }
         return tbl_index;
 }
@@ -154,14 +451,15 @@ onvm_ft_lookup_pkt(struct onvm_ft* table, struct rte_mbuf *pkt, char** data) {
 int32_t
 onvm_ft_remove_pkt(struct onvm_ft *table, struct rte_mbuf *pkt)
 {
-        struct onvm_ft_ipv4_5tuple key;
+        union onvm_ft_key key;
+        uint32_t sig;
         int ret;
 
-        ret = onvm_ft_fill_key(&key, pkt);
+        ret = onvm_ft_pkt_key(table, pkt, &key, &sig);
         if (ret < 0) {
                 return ret;
         }
-        return rte_hash_del_key_with_hash(table->hash, (const void *)&key, pkt->hash.rss);
+        return onvm_ft_remove_with_hash(table, &key, sig);
 }
 
 int
@@ -171,7 +469,7 @@ onvm_ft_add_key(struct onvm_ft* table, struct onvm_ft_ipv4_5tuple *key, char** d
 
         softrss = onvm_softrss(key);
 
-        tbl_index = rte_hash_add_key_with_hash(table->hash, (const void *)key, softrss);
+        tbl_index = onvm_ft_add_with_hash(table, key, softrss);
         if (tbl_index >= 0) {
                 *data = onvm_ft_get_data(table, tbl_index);
         }
@@ -183,12 +481,13 @@ int
 onvm_ft_lookup_key(struct onvm_ft* table, struct onvm_ft_ipv4_5tuple *key, char** data) {
         int32_t tbl_index;
 	uint32_t softrss;
+        int t = 0;
 
 	softrss = onvm_softrss(key);
 
-        tbl_index = rte_hash_lookup_with_hash(table->hash, (const void *)key, softrss);
+        tbl_index = onvm_ft_lookup_with_hash(table, key, softrss, &t);
 	if (tbl_index >= 0) {
-                *data = onvm_ft_get_data(table, tbl_index);
+                *data = &table->tier[t].data[(size_t)(tbl_index - table->tier[t].base)*table->entry_size];
         }
 
 	return tbl_index;
@@ -197,7 +496,36 @@ onvm_ft_lookup_key(struct onvm_ft* table, struct onvm_ft_ipv4_5tuple *key, char*
 int32_t
 onvm_ft_remove_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key)
 {
-        return rte_hash_del_key(table->hash, (const void *)key);
+        return onvm_ft_remove_with_hash(table, key, onvm_softrss(key));
+}
+
+int
+onvm_ft_add_key6(struct onvm_ft* table, struct onvm_ft_ipv6_5tuple *key, char** data) {
+        int32_t tbl_index;
+
+        tbl_index = onvm_ft_add_with_hash(table, key, onvm_ft_ipv6_hash(key));
+        if (tbl_index >= 0) {
+                *data = onvm_ft_get_data(table, tbl_index);
+        }
+        return tbl_index;
+}
+
+int
+onvm_ft_lookup_key6(struct onvm_ft* table, struct onvm_ft_ipv6_5tuple *key, char** data) {
+        int32_t tbl_index;
+        int t = 0;
+
+        tbl_index = onvm_ft_lookup_with_hash(table, key, onvm_ft_ipv6_hash(key), &t);
+        if (tbl_index >= 0) {
+                *data = &table->tier[t].data[(size_t)(tbl_index - table->tier[t].base)*table->entry_size];
+        }
+        return tbl_index;
+}
+
+int32_t
+onvm_ft_remove_key6(struct onvm_ft *table, struct onvm_ft_ipv6_5tuple *key)
+{
+        return onvm_ft_remove_with_hash(table, key, onvm_ft_ipv6_hash(key));
 }
 
 /* Iterate through the hash table, returning key-value pairs.
@@ -205,6 +533,7 @@ onvm_ft_remove_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key)
      key: Output containing the key where current iterator was pointing at
      data: Output containing the data associated with key. Returns NULL if data was not stored.
      next: Pointer to iterator. Should be 0 to start iterating the hash table. Iterator is incremented after each call of this function.
+           (the tier being iterated is kept in the bits above ONVM_FT_TIER_BITS)
    Returns:
      Position where key was stored, if successful.
     -EINVAL if the parameters are invalid.
@@ -213,13 +542,106 @@ onvm_ft_remove_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key)
 int32_t
 onvm_ft_iterate(struct onvm_ft *table, const void **key, void **data, uint32_t *next)
 {
-        return rte_hash_iterate(table->hash, key, data, next);
+        uint32_t t = (*next) >> ONVM_FT_TIER_BITS;
+        uint32_t pos = (*next) & ((1 << ONVM_FT_TIER_BITS) - 1);
+        int32_t ret = -ENOENT;
+
+        for (; t < (uint32_t)table->tiers; t++, pos = 0) {
+                ret = rte_hash_iterate(table->tier[t].hash, key, data, &pos);
+                if (ret >= 0) {
+                        *next = (t << ONVM_FT_TIER_BITS) | pos;
+                        return table->tier[t].base + ret;
+                }
+        }
+        *next = (t << ONVM_FT_TIER_BITS);
+        return ret;
+}
+
+void
+onvm_ft_qsbr_init(struct onvm_ft_qsbr *qsbr) {
+        int i;
+        rte_atomic64_init(&qsbr->epoch);
+        rte_atomic32_init(&qsbr->readers);
+        for (i = 0; i < ONVM_FT_MAX_READERS; i++) {
+                qsbr->reader[i].epoch = ONVM_FT_READER_OFFLINE;
+                qsbr->reader[i].used = 0;
+                qsbr->reader[i].owner = 0;
+        }
+}
+
+void
+onvm_ft_set_qsbr(struct onvm_ft *table, struct onvm_ft_qsbr *qsbr) {
+        table->qsbr = qsbr;
+}
+
+int
+onvm_ft_reader_register(struct onvm_ft *table) {
+        struct onvm_ft_qsbr *qsbr = table->qsbr;
+        int32_t readers;
+        int reader;
+
+        for (;;) {
+                /* reuse a slot given back, else take a new one */
+                readers = RTE_MIN(rte_atomic32_read(&qsbr->readers), ONVM_FT_MAX_READERS);
+                for (reader = 0; reader < readers; reader++) {
+                        if (!qsbr->reader[reader].used && rte_atomic32_cmpset(&qsbr->reader[reader].used, 0, 1)) {
+                                goto out;
+                        }
+                }
+                reader = rte_atomic32_add_return(&qsbr->readers, 1) - 1;
+                if (reader >= ONVM_FT_MAX_READERS) {
+                        rte_atomic32_dec(&qsbr->readers);
+                        return -ENOSPC;
+                }
+                if (rte_atomic32_cmpset(&qsbr->reader[reader].used, 0, 1)) {
+                        break;
+                }
+                //taken meanwhile by a register reusing slots: look again
+        }
+out:
+        onvm_ft_reader_quiescent(table, reader);
+        return reader;
+}
+
+void
+onvm_ft_reader_unregister(struct onvm_ft *table, int reader) {
+        if (reader < 0 || reader >= ONVM_FT_MAX_READERS) {
+                return;
+        }
+        onvm_ft_reader_offline(table, reader);
+        table->qsbr->reader[reader].owner = 0;
+        rte_wmb();
+        table->qsbr->reader[reader].used = 0;
+}
+
+uint64_t
+onvm_ft_retire_epoch(struct onvm_ft *table) {
+        rte_smp_mb();   //the unlink is visible before the epoch moves on
+        return (uint64_t)rte_atomic64_add_return(&table->qsbr->epoch, 1);
+}
+
+int
+onvm_ft_epoch_is_safe(struct onvm_ft *table, uint64_t epoch) {
+        int32_t readers = RTE_MIN(rte_atomic32_read(&table->qsbr->readers), ONVM_FT_MAX_READERS);
+        int32_t i;
+        for (i = 0; i < readers; i++) {
+                if (table->qsbr->reader[i].epoch < epoch) {
+                        return 0;
+                }
+        }
+        return 1;
 }
 
 /* Clears a flow table and frees associated memory */
 void
 onvm_ft_free(struct onvm_ft *table)
 {
-        rte_hash_reset(table->hash);
-        rte_hash_free(table->hash);
+        int t;
+        for (t = 0; t < table->tiers; t++) {
+                rte_hash_reset(table->tier[t].hash);
+                rte_hash_free(table->tier[t].hash);
+                rte_free(table->tier[t].data);
+                rte_free(table->tier[t].cold);
+        }
+        rte_free(table);
 }
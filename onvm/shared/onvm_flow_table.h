@@ -45,9 +45,12 @@
 #include <rte_mbuf.h>
 #include <rte_common.h>
 #include <rte_ip.h>
+#include <rte_ether.h>
+#include <rte_memcpy.h>
 #include <rte_tcp.h>
 #include <rte_udp.h>
-#include <rte_thash.h>
+#include <rte_atomic.h>
+#include <rte_spinlock.h>
 #include "onvm_pkt_helper.h"
 #include "common.h"
 
@@ -61,11 +64,69 @@ extern uint8_t rss_symmetric_key[40];
 #define DEFAULT_HASH_FUNC       rte_jhash
 #endif
 
-struct onvm_ft {
+/* A table grows online by adding tiers: a new tier of ONVM_FT_GROW_FACTOR x the last one is created once the last tier fills up.
+ * Entries never move across tiers, so the data pointers and indices handed out stay valid while the table grows;
+ * lookups probe the tiers from the newest (largest) one.
+ */
+#define ONVM_FT_MAX_TIERS       (8)
+#define ONVM_FT_GROW_FACTOR     (4)
+#define ONVM_FT_GROW_PCT        (80)    // grow once the last tier is this full (the cuckoo hash may fail inserts before it is full)
+#define ONVM_FT_TIER_BITS       (26)    // bits of a position within a tier: max entries per tier and iterator encoding
+
+#define ONVM_FT_LOOKUP_RETRIES  (64)    // lookups of a missing key retried while writers change the buckets
+
+struct onvm_ft_tier {
         struct rte_hash* hash;
         char* data;
+        char* cold;                     // cold_size bytes per entry, apart from data (NULL if cold_size is 0)
         int cnt;
+        int base;                       // index of the first entry of the tier in the table
+        rte_atomic32_t used;
+};
+
+/* Concurrency: the table lives in shared memory and is changed by several writers (NFs installing rules, the manager aging flows)
+ * while the manager threads look it up.
+ * - Writers are serialized by write_lock (a spinlock in the table, so it works across processes).
+ * - Lookups take no lock. A writer bumps change_cnt around every change of the buckets (odd while changing); a lookup that
+ *   missed while change_cnt moved is retried, as the cuckoo displacement of an add can hide a present key for a moment.
+ *   Retries are bounded (ONVM_FT_LOOKUP_RETRIES): a lookup racing a long change (e.g. a tier being added) reports a miss.
+ * - Memory reachable from the entries (keys, service chains) is not freed while a reader may still hold it: readers register
+ *   and report a quiescent state (holding no entry) once per loop; a writer tags what it unlinked with a new epoch
+ *   (onvm_ft_retire_epoch()) and frees it once every online reader has reported that epoch (onvm_ft_epoch_is_safe()).
+ *   The readers and epochs form a domain (onvm_ft_qsbr) of the table, which tables swapped for one another may share
+ *   (onvm_ft_set_qsbr()): a table replaced as a whole is then freed the same way.
+ */
+#define ONVM_FT_MAX_READERS     (64)    // manager threads and NF threads
+#define ONVM_FT_READER_OFFLINE  (UINT64_MAX)
+
+struct onvm_ft_reader {
+        volatile uint64_t epoch;        // last epoch seen in a quiescent state, or ONVM_FT_READER_OFFLINE
+        volatile uint32_t used;         // slot handed out, 0 once unregistered (reused by the next register)
+        volatile int32_t owner;         // tag of the registering party (e.g. its pid): lets another process unregister it
+} __rte_cache_aligned;
+
+struct onvm_ft_qsbr {
+        rte_atomic64_t epoch;
+        rte_atomic32_t readers;         // reader slots ever handed out (high mark of the slots in use)
+        struct onvm_ft_reader reader[ONVM_FT_MAX_READERS];
+} __rte_cache_aligned;
+
+struct onvm_ft {
+        struct rte_hash* hash;          // first tier, kept for the users of a fixed size table
+        char* data;
+        int cnt;                        // current capacity of all the tiers
         int entry_size;
+        int cold_size;                  // per entry data kept in a separate array (onvm_ft_get_cold()), off the lookup path
+        int max_cnt;                    // capacity up to which the table may grow
+        int socket_id;
+        uint16_t key_type;              // ONVM_FT_KEY_IPV4 or ONVM_FT_KEY_IPV6: one key type per table
+        uint16_t key_len;
+        volatile int tiers;
+        rte_spinlock_t write_lock;      // serializes add/remove/grow
+        volatile uint32_t change_cnt;   // odd while a writer changes the buckets
+        struct onvm_ft_tier tier[ONVM_FT_MAX_TIERS];
+        struct onvm_ft_qsbr *qsbr;      // reader domain: own_qsbr unless shared (onvm_ft_set_qsbr())
+        struct onvm_ft_qsbr own_qsbr;
 };
 
 struct onvm_ft_ipv4_5tuple {
@@ -74,6 +135,28 @@ struct onvm_ft_ipv4_5tuple {
         uint16_t src_port;
         uint16_t dst_port;
         uint8_t  proto;
+        uint8_t  pad;
+        uint16_t vlan_id;               // VLAN ID of the outer tag, 0 if untagged (kept in what was padding: still 16 bytes)
+};
+
+/* IPv6 5-tuple: padded to 48 bytes, as rte_hash compares keys of 16/32/48/64 bytes with SSE */
+struct onvm_ft_ipv6_5tuple {
+        uint8_t  src_addr[16];
+        uint8_t  dst_addr[16];
+        uint16_t src_port;
+        uint16_t dst_port;
+        uint8_t  proto;
+        uint8_t  pad;
+        uint16_t vlan_id;
+        uint8_t  pad2[8];
+};
+
+#define ONVM_FT_KEY_IPV4        (0)
+#define ONVM_FT_KEY_IPV6        (1)
+
+union onvm_ft_key {
+        struct onvm_ft_ipv4_5tuple v4;
+        struct onvm_ft_ipv6_5tuple v6;
 };
 
 /* from l2_forward example, but modified to include port. This should
@@ -95,12 +178,29 @@ union ipv4_5tuple_host {
 struct onvm_ft*
 onvm_ft_create(int cnt, int entry_size);
 
+/* Create a flow table of cnt entries on the given socket (hugepage memory), that grows online up to max_cnt entries */
+struct onvm_ft*
+onvm_ft_create_resizable(int cnt, int max_cnt, int entry_size, int socket_id);
+
+/* As onvm_ft_create_resizable(), for keys of the given type (ONVM_FT_KEY_IPV4/ONVM_FT_KEY_IPV6),
+ * with cold_size bytes per entry in a separate array (0 for none) */
+struct onvm_ft*
+onvm_ft_create_keyed(int cnt, int max_cnt, int entry_size, int cold_size, int socket_id, uint16_t key_type);
+
+/* Number of keys in the table */
+uint32_t
+onvm_ft_count(struct onvm_ft *table);
+
 int
 onvm_ft_add_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data);
 
 int
 onvm_ft_lookup_pkt(struct onvm_ft *table, struct rte_mbuf *pkt, char **data);
 
+/* Lookup of a pkt already parsed by onvm_ft_pkt_l3() (ether type, L3 offset and VLAN ID), not parsed again */
+int
+onvm_ft_lookup_pkt_l3(struct onvm_ft *table, struct rte_mbuf *pkt, uint16_t ether_type, uint32_t l3_off, uint16_t vlan_id, char **data);
+
 int32_t
 onvm_ft_remove_pkt(struct onvm_ft *table, struct rte_mbuf *pkt);
 
@@ -113,9 +213,42 @@ onvm_ft_lookup_key(struct onvm_ft* table, struct onvm_ft_ipv4_5tuple *key, char*
 int32_t
 onvm_ft_remove_key(struct onvm_ft *table, struct onvm_ft_ipv4_5tuple *key);
 
+int
+onvm_ft_add_key6(struct onvm_ft* table, struct onvm_ft_ipv6_5tuple *key, char** data);
+
+int
+onvm_ft_lookup_key6(struct onvm_ft* table, struct onvm_ft_ipv6_5tuple *key, char** data);
+
+int32_t
+onvm_ft_remove_key6(struct onvm_ft *table, struct onvm_ft_ipv6_5tuple *key);
+
 int32_t
 onvm_ft_iterate(struct onvm_ft *table, const void **key, void **data, uint32_t *next);
 
+/* Init a reader domain, with no reader registered */
+void
+onvm_ft_qsbr_init(struct onvm_ft_qsbr *qsbr);
+
+/* Use the reader domain qsbr (e.g. shared by the tables swapped for one another) instead of the own one of the table */
+void
+onvm_ft_set_qsbr(struct onvm_ft *table, struct onvm_ft_qsbr *qsbr);
+
+/* Register the calling thread as a reader of the table: returns its reader slot, or -ENOSPC */
+int
+onvm_ft_reader_register(struct onvm_ft *table);
+
+/* Give back a reader slot: the writers no longer wait for it */
+void
+onvm_ft_reader_unregister(struct onvm_ft *table, int reader);
+
+/* Start a new epoch for memory just unlinked from the table: it may be freed once onvm_ft_epoch_is_safe() */
+uint64_t
+onvm_ft_retire_epoch(struct onvm_ft *table);
+
+/* 1 if every online reader passed a quiescent state since the epoch started */
+int
+onvm_ft_epoch_is_safe(struct onvm_ft *table, uint64_t epoch);
+
 void
 onvm_ft_free(struct onvm_ft *table);
 
@@ -132,43 +265,152 @@ _onvm_ft_print_key(struct onvm_ft_ipv4_5tuple *key) {
         printf("-%" PRIu8 ".%" PRIu8 ".%" PRIu8 ".%" PRIu8 " ",
                 key->dst_addr & 0xFF, (key->dst_addr >> 8) & 0xFF,
                 (key->dst_addr >> 16) & 0xFF, (key->dst_addr >> 24) & 0xFF);
-        printf("Port: %d %d Proto: %d\n", key->src_port, key->dst_port, key->proto);
+        printf("Port: %d %d Proto: %d VLAN: %d\n", key->src_port, key->dst_port, key->proto, key->vlan_id);
+}
+
+/* Reader holds no pointer to entries/keys/chains of the table: called by the reader threads once per loop */
+static inline void
+onvm_ft_reader_quiescent(struct onvm_ft *table, int reader) {
+        table->qsbr->reader[reader].epoch = (uint64_t)rte_atomic64_read(&table->qsbr->epoch);
+        rte_smp_mb();
+}
+
+/* Reader stops looking up the table (e.g. parked thread): the writers do not wait for it until its next quiescent state */
+static inline void
+onvm_ft_reader_offline(struct onvm_ft *table, int reader) {
+        rte_smp_mb();
+        table->qsbr->reader[reader].epoch = ONVM_FT_READER_OFFLINE;
 }
 
 static inline char*
 onvm_ft_get_data(struct onvm_ft* table, int32_t index) {
-        return &table->data[index*table->entry_size];
+        int t = table->tiers - 1;
+        while (t > 0 && index < table->tier[t].base) {
+                t--;
+        }
+        return &table->tier[t].data[(size_t)(index - table->tier[t].base)*table->entry_size];
+}
+
+#ifndef ETHER_TYPE_QINQ
+#define ETHER_TYPE_QINQ         (0x88A8)
+#endif
+
+/* Ether type of the L3 header of the pkt and its offset, past up to 2 VLAN tags (802.1Q/802.1ad).
+ * vlan_id is the ID of the outer tag (or of the tag stripped by the NIC), 0 if untagged. */
+static inline uint16_t
+onvm_ft_pkt_l3(struct rte_mbuf *pkt, uint32_t *l3_off, uint16_t *vlan_id) {
+        struct ether_hdr *eth_hdr = rte_pktmbuf_mtod(pkt, struct ether_hdr *);
+        struct vlan_hdr *vlan_hdr;
+        uint16_t type = rte_be_to_cpu_16(eth_hdr->ether_type);
+        uint32_t off = sizeof(struct ether_hdr);
+        int tags;
+
+        *vlan_id = (pkt->ol_flags & PKT_RX_VLAN_PKT)? (pkt->vlan_tci & 0xFFF):(0);
+        for (tags = 0; tags < 2 && (type == ETHER_TYPE_VLAN || type == ETHER_TYPE_QINQ); tags++) {
+                vlan_hdr = (struct vlan_hdr *)(rte_pktmbuf_mtod(pkt, uint8_t *) + off);
+                if (*vlan_id == 0) {
+                        *vlan_id = rte_be_to_cpu_16(vlan_hdr->vlan_tci) & 0xFFF;
+                }
+                type = rte_be_to_cpu_16(vlan_hdr->eth_proto);
+                off += sizeof(struct vlan_hdr);
+        }
+        *l3_off = off;
+        return type;
+}
+
+/* Cold data of the entry at index (see onvm_ft_create_keyed()) */
+static inline char*
+onvm_ft_get_cold(struct onvm_ft* table, int32_t index) {
+        int t = table->tiers - 1;
+        while (t > 0 && index < table->tier[t].base) {
+                t--;
+        }
+        return &table->tier[t].cold[(size_t)(index - table->tier[t].base)*table->cold_size];
 }
 
+/* IPv4 key of the pkt whose L3 header is at off (as parsed by onvm_ft_pkt_l3()) */
 static inline int
-onvm_ft_fill_key(struct onvm_ft_ipv4_5tuple *key, struct rte_mbuf *pkt) {
+onvm_ft_fill_key_l3(struct onvm_ft_ipv4_5tuple *key, struct rte_mbuf *pkt, uint32_t off, uint16_t vlan_id) {
         struct ipv4_hdr *ipv4_hdr;
         struct tcp_hdr *tcp_hdr;
         struct udp_hdr *udp_hdr;
 
-        if (unlikely(!onvm_pkt_is_ipv4(pkt))) {
+        ipv4_hdr = (struct ipv4_hdr *)(rte_pktmbuf_mtod(pkt, uint8_t *) + off);
+        if (unlikely((ipv4_hdr->version_ihl >> 4) != 4)) {
                 return -EPROTONOSUPPORT;
         }
-        ipv4_hdr = onvm_pkt_ipv4_hdr(pkt);
         memset(key, 0, sizeof(struct onvm_ft_ipv4_5tuple));
         key->proto  = ipv4_hdr->next_proto_id;
         key->src_addr = ipv4_hdr->src_addr;
         key->dst_addr = ipv4_hdr->dst_addr;
+        key->vlan_id = vlan_id;
+        off += (ipv4_hdr->version_ihl & 0x0F) * 4;
+        if (key->proto == IP_PROTOCOL_TCP) {
+                tcp_hdr = (struct tcp_hdr *)(rte_pktmbuf_mtod(pkt, uint8_t *) + off);
+                key->src_port = tcp_hdr->src_port;
+                key->dst_port = tcp_hdr->dst_port;
+        } else if (key->proto == IP_PROTOCOL_UDP) {
+                udp_hdr = (struct udp_hdr *)(rte_pktmbuf_mtod(pkt, uint8_t *) + off);
+                key->src_port = udp_hdr->src_port;
+                key->dst_port = udp_hdr->dst_port;
+        }
+        return 0;
+}
+
+static inline int
+onvm_ft_fill_key(struct onvm_ft_ipv4_5tuple *key, struct rte_mbuf *pkt) {
+        uint32_t off;
+        uint16_t vlan_id;
+
+        if (unlikely(onvm_ft_pkt_l3(pkt, &off, &vlan_id) != ETHER_TYPE_IPv4)) {
+                return -EPROTONOSUPPORT;
+        }
+        return onvm_ft_fill_key_l3(key, pkt, off, vlan_id);
+}
+
+/* IPv6 key of the pkt whose L3 header is at off. Extension headers are not walked: such flows are keyed on the addresses and the first next header. */
+static inline int
+onvm_ft_fill_key6_l3(struct onvm_ft_ipv6_5tuple *key, struct rte_mbuf *pkt, uint32_t off, uint16_t vlan_id) {
+        struct ipv6_hdr *ipv6_hdr;
+        struct tcp_hdr *tcp_hdr;
+        struct udp_hdr *udp_hdr;
+
+        ipv6_hdr = (struct ipv6_hdr *)(rte_pktmbuf_mtod(pkt, uint8_t *) + off);
+        memset(key, 0, sizeof(struct onvm_ft_ipv6_5tuple));
+        rte_memcpy(key->src_addr, ipv6_hdr->src_addr, sizeof(key->src_addr));
+        rte_memcpy(key->dst_addr, ipv6_hdr->dst_addr, sizeof(key->dst_addr));
+        key->proto = ipv6_hdr->proto;
+        key->vlan_id = vlan_id;
+        off += sizeof(struct ipv6_hdr);
         if (key->proto == IP_PROTOCOL_TCP) {
-                tcp_hdr = onvm_pkt_tcp_hdr(pkt);
+                tcp_hdr = (struct tcp_hdr *)(rte_pktmbuf_mtod(pkt, uint8_t *) + off);
                 key->src_port = tcp_hdr->src_port;
                 key->dst_port = tcp_hdr->dst_port;
         } else if (key->proto == IP_PROTOCOL_UDP) {
-                udp_hdr = onvm_pkt_udp_hdr(pkt);
+                udp_hdr = (struct udp_hdr *)(rte_pktmbuf_mtod(pkt, uint8_t *) + off);
                 key->src_port = udp_hdr->src_port;
                 key->dst_port = udp_hdr->dst_port;
-	} else {
-                key->src_port = 0;
-                key->dst_port = 0;
         }
         return 0;
 }
 
+static inline int
+onvm_ft_fill_key6(struct onvm_ft_ipv6_5tuple *key, struct rte_mbuf *pkt) {
+        uint32_t off;
+        uint16_t vlan_id;
+
+        if (unlikely(onvm_ft_pkt_l3(pkt, &off, &vlan_id) != ETHER_TYPE_IPv6)) {
+                return -EPROTONOSUPPORT;
+        }
+        return onvm_ft_fill_key6_l3(key, pkt, off, vlan_id);
+}
+
+/* Hash signature of an IPv6 key (no RSS of the NIC is relied upon for IPv6) */
+static inline uint32_t
+onvm_ft_ipv6_hash(const struct onvm_ft_ipv6_5tuple *key) {
+        return DEFAULT_HASH_FUNC(key, sizeof(struct onvm_ft_ipv6_5tuple), 0);
+}
+
 /* Hash a flow key to get an int. From L3 fwd example */
 static inline uint32_t
 onvm_ft_ipv4_hash_crc(const void *data, __rte_unused uint32_t data_len,
@@ -196,25 +438,38 @@ onvm_ft_ipv4_hash_crc(const void *data, __rte_unused uint32_t data_len,
         return (init_val);
 }
 
-/*software caculate RSS*/
-static inline uint32_t
-onvm_softrss(struct onvm_ft_ipv4_5tuple *key)
-{
-	union rte_thash_tuple tuple;
-	uint8_t rss_key_be[RTE_DIM(rss_symmetric_key)];
-	uint32_t rss_l3l4;
+/* Software RSS: the Toeplitz hash of rss_symmetric_key (same value as the NIC), table driven.
+ * onvm_softrss_lut[i][b] is the hash contribution of byte value b at byte i of the input (network order tuple), so a hash is
+ * one lookup and xor per input byte. The table is built per process on first use (or by onvm_softrss_lut_init()). */
+#define ONVM_SOFTRSS_LUT_BYTES  (36)    // IPv6 addresses + ports: the longest input a 40 byte key hashes
+extern uint32_t onvm_softrss_lut[ONVM_SOFTRSS_LUT_BYTES][256];
+extern volatile int onvm_softrss_lut_ready;
 
-	rte_convert_rss_key((uint32_t *)rss_symmetric_key, (uint32_t *)rss_key_be,
-				RTE_DIM(rss_symmetric_key));
+void
+onvm_softrss_lut_init(void);
 
-	tuple.v4.src_addr = rte_be_to_cpu_32(key->src_addr);
-	tuple.v4.dst_addr = rte_be_to_cpu_32(key->dst_addr);
-	tuple.v4.sport = rte_be_to_cpu_16(key->src_port);
-	tuple.v4.dport = rte_be_to_cpu_16(key->dst_port);
+/* Fill hash.rss of the pkts of a burst in software (IPv4/IPv6, VLAN tagged or not): for ports that deliver no RSS hash */
+void
+onvm_softrss_burst(struct rte_mbuf **pkts, uint16_t count);
 
-	rss_l3l4 = rte_softrss_be((uint32_t *)&tuple, RTE_THASH_V4_L4_LEN, rss_key_be);
+static inline uint32_t
+onvm_softrss_lut_hash(const uint8_t *in, uint32_t pos, uint32_t len, uint32_t hash) {
+        uint32_t i;
+        for (i = 0; i < len; i++) {
+                hash ^= onvm_softrss_lut[pos + i][in[i]];
+        }
+        return hash;
+}
 
-	return rss_l3l4;
+/*software caculate RSS*/
+static inline uint32_t
+onvm_softrss(struct onvm_ft_ipv4_5tuple *key)
+{
+        if (unlikely(!onvm_softrss_lut_ready)) {
+                onvm_softrss_lut_init();
+        }
+        /* src_addr, dst_addr, src_port, dst_port: the 12 bytes of the IPv4 L4 tuple, in network order */
+        return onvm_softrss_lut_hash((const uint8_t *)key, 0, 12, 0);
 }
 
 #endif  // _ONVM_FLOW_TABLE_H_
@@ -43,6 +43,26 @@
 #include "common.h"
 #include "onvm_sc_common.h"
 
+#ifdef ENABLE_NF_BACKPRESSURE
+/* rebuild the upstream set of each chain index from the chain topology; only NF entries can be throttled */
+static void
+onvm_sc_update_bkpr_upstream(struct onvm_service_chain *chain) {
+	uint16_t upstream = 0;
+	uint8_t i;
+
+	chain->bkpr_upstream[0] = 0;
+	for (i = 1; i <= chain->chain_length; i++) {
+		chain->bkpr_upstream[i] = upstream;
+#ifdef HOP_BY_HOP_BACKPRESSURE
+		upstream = 0;   // only the immediate upstream NF; it propagates further once that NF overflows
+#endif //HOP_BY_HOP_BACKPRESSURE
+		if (chain->sc[i].action == ONVM_NF_ACTION_TONF) {
+			upstream |= (uint16_t)(1 << (i-1));
+		}
+	}
+}
+#endif //ENABLE_NF_BACKPRESSURE
+
 int
 onvm_sc_append_entry(struct onvm_service_chain *chain, uint8_t action, uint16_t destination) {
 #if 0
@@ -57,6 +77,9 @@ onvm_sc_append_entry(struct onvm_service_chain *chain, uint8_t action, uint16_t
 	(chain->chain_length)++;
 	chain->sc[chain_length].action = action;
 	chain->sc[chain_length].destination = destination;
+#ifdef ENABLE_NF_BACKPRESSURE
+	onvm_sc_update_bkpr_upstream(chain);
+#endif //ENABLE_NF_BACKPRESSURE
 	//onvm_sc_print(chain);
 #endif
 	return 0;
@@ -70,6 +93,9 @@ onvm_sc_set_entry(struct onvm_service_chain *chain, int entry, uint8_t action, u
 
 	chain->sc[entry].action = action;
 	chain->sc[entry].destination = destination;
+#ifdef ENABLE_NF_BACKPRESSURE
+	onvm_sc_update_bkpr_upstream(chain);
+#endif //ENABLE_NF_BACKPRESSURE
 
 	//onvm_sc_print(chain);
 	return 0;
@@ -85,3 +111,36 @@ onvm_sc_print(struct onvm_service_chain *chain) {
 	//printf("refcnt:%"PRIu8", downstream:%"PRIu16"\n",chain->ref_cnt, chain->highest_downstream_nf_index_id);
 	printf("\n");
 }
+
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+int
+onvm_sc_set_latency_target(struct onvm_service_chain *chain, uint32_t latency_target_us) {
+	if (unlikely(chain == NULL)) {
+		return -1;
+	}
+	chain->latency_target_us = latency_target_us;
+	return 0;
+}
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+int
+onvm_sc_set_rx_class(struct onvm_service_chain *chain, int rx_class) {
+	if (unlikely(chain == NULL || rx_class >= NF_RX_PRIO_CLASSES)) {
+		return -1;
+	}
+	chain->rx_class = (rx_class < 0)? (0):((uint8_t)(rx_class + 1));
+	return 0;
+}
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
+#ifdef ENABLE_MBUF_QUOTAS
+int
+onvm_sc_set_mbuf_quota(struct onvm_service_chain *chain, uint32_t mbuf_quota) {
+	if (unlikely(chain == NULL)) {
+		return -1;
+	}
+	chain->mbuf_quota = mbuf_quota;
+	return 0;
+}
+#endif //ENABLE_MBUF_QUOTAS
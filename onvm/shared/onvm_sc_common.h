@@ -51,4 +51,74 @@ int onvm_sc_append_entry(struct onvm_service_chain *chain, uint8_t action, uint1
 int onvm_sc_set_entry(struct onvm_service_chain *chain, int entry, uint8_t action, uint16_t destination);
 
 void onvm_sc_print(struct onvm_service_chain *chain);
+
+/* take a reference on the chain for a flow installed on it (the manager and the NFs install flows concurrently) */
+static inline void
+onvm_sc_ref_get(struct onvm_service_chain *chain) {
+        uint16_t cnt;
+        do {
+                cnt = chain->ref_cnt;
+        } while (!rte_atomic16_cmpset(&chain->ref_cnt, cnt, (uint16_t)(cnt + 1)));
+}
+
+/* release a reference on the chain: returns the count before the release (0 => no reference was left) */
+static inline uint16_t
+onvm_sc_ref_put(struct onvm_service_chain *chain) {
+        uint16_t cnt;
+        do {
+                cnt = chain->ref_cnt;
+                if (cnt == 0) {
+                        return 0;
+                }
+        } while (!rte_atomic16_cmpset(&chain->ref_cnt, cnt, (uint16_t)(cnt - 1)));
+        return cnt;
+}
+
+#ifdef ENABLE_NF_BACKPRESSURE
+/* chain indices to throttle: union of the upstream sets of all the bottleneck marks of the chain */
+static inline uint16_t
+onvm_sc_bkpr_throttle_set(struct onvm_service_chain *chain) {
+        uint16_t marks = chain->highest_downstream_nf_index_id;
+        uint16_t throttle = 0;
+        while (marks) {
+                throttle |= chain->bkpr_upstream[__builtin_ctz(marks) + 1];
+                marks &= (marks - 1);
+        }
+        return throttle;
+}
+
+/* non-zero if the NF at chain_index is upstream of a bottleneck NF of the chain */
+static inline uint16_t
+onvm_sc_is_bkpr_upstream(struct onvm_service_chain *chain, uint8_t chain_index) {
+        if (unlikely(chain_index == 0 || chain_index > ONVM_MAX_CHAIN_LENGTH)) {
+                return 0;
+        }
+        return (onvm_sc_bkpr_throttle_set(chain) & (uint16_t)(1 << (chain_index-1)));
+}
+#endif //ENABLE_NF_BACKPRESSURE
+
+#ifdef ENABLE_DEADLINE_AWARE_WAKE_ORDER
+/* set the end-to-end latency target of the service chain (0 resets to DEFAULT_CHAIN_LATENCY_TARGET_IN_US) */
+int onvm_sc_set_latency_target(struct onvm_service_chain *chain, uint32_t latency_target_us);
+
+/* latency budget left for a packet entering the NF at chain_index: target is apportioned equally across the hops of the chain */
+static inline uint32_t
+onvm_sc_get_remaining_budget_us(struct onvm_service_chain *chain, uint8_t chain_index) {
+        uint32_t target = (chain->latency_target_us)? (chain->latency_target_us):(DEFAULT_CHAIN_LATENCY_TARGET_IN_US);
+        if (unlikely(chain_index == 0 || chain_index > chain->chain_length)) {
+                return target;
+        }
+        return (uint32_t)(((uint64_t)target*(chain->chain_length - chain_index + 1))/chain->chain_length);
+}
+#endif //ENABLE_DEADLINE_AWARE_WAKE_ORDER
+
+#ifdef ENABLE_NF_RX_PRIORITY_RINGS
+/* set the Rx priority class of all packets of the service chain (0 = highest); a negative class restores classification by DSCP */
+int onvm_sc_set_rx_class(struct onvm_service_chain *chain, int rx_class);
+#endif //ENABLE_NF_RX_PRIORITY_RINGS
+
+#ifdef ENABLE_MBUF_QUOTAS
+/* set the mbufs the service chain may hold (0 resets to MBUF_QUOTA_CHAIN_DEFAULT_PCT of the pool) */
+int onvm_sc_set_mbuf_quota(struct onvm_service_chain *chain, uint32_t mbuf_quota);
+#endif //ENABLE_MBUF_QUOTAS
 #endif //_SC_COMMON_H_
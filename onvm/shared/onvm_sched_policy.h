@@ -0,0 +1,177 @@
+/*********************************************************************
+ *                     openNetVM
+ *              https://sdnfv.github.io
+ *
+ *   BSD LICENSE
+ *
+ *   Copyright(c)
+ *            2015-2016 George Washington University
+ *            2015-2016 University of California Riverside
+ *   All rights reserved.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following conditions
+ *   are met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *     * Neither the name of Intel Corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived
+ *       from this software without specific prior written permission.
+ *
+ *   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *   "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *   LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *   A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *   OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *   SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ *   LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ *   DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ *   THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *   (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ *   OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * onvm_sched_policy.h - NF cpu share, ring watermark and back-pressure
+ *                       policy helpers. Kept free of DPDK dependencies so
+ *                       that the manager and the offline simulator
+ *                       (onvm_sim) evaluate exactly the same logic.
+ ********************************************************************/
+
+#ifndef _ONVM_SCHED_POLICY_H_
+#define _ONVM_SCHED_POLICY_H_
+
+#include <stdint.h>
+
+#define ONVM_MAX_CHAIN_LENGTH 12   // the maximum chain length
+
+/*********************************CPU Share***********************************/
+
+#define DEFAULT_NF_CPU_SHARE    (1024)
+
+//Data structure to compute nf_load and comp_cost contention on each core
+typedef struct nf_core_and_cc_info {
+        uint32_t total_comp_cost;       //total computation cost on the core (sum of all NFs computation cost)
+        uint32_t total_nf_count;        //total count of the NFs on the core (sum of all NFs)
+        uint32_t total_pkts_served;     //total pkts processed on the core (sum of all NFs packet processed).
+        uint32_t total_load;            //total pkts (avergae) queued up on the core for processing.
+        uint64_t total_load_cost_fct;   //total product of current load and computation cost on core (aggregate demand in total cycles)
+}nf_core_and_cc_info_t;
+
+/* account the NF in the contention info of its core */
+static inline void
+onvm_sched_add_nf_to_core(nf_core_and_cc_info_t *core, uint32_t comp_cost, uint32_t load, uint32_t svc_rate) {
+        core->total_comp_cost += comp_cost;
+        core->total_nf_count++;
+        core->total_load += load;
+        core->total_pkts_served += svc_rate;
+        core->total_load_cost_fct += ((uint64_t)comp_cost*load);
+}
+
+/*
+ * share of NF = 1024* NF_comp_cost/Total_comp_cost
+ * Note: ideal share of NF is 100%(1024) so for N NFs sharing core => N*100 or (N*1024) then divide the cost proportionally
+ * use_load_factor = 0: static accounting based on computation cost only
+ * use_load_factor = 1: dynamic accounting based on the product of load*comp_cost (USE_DYNAMIC_LOAD_FACTOR_FOR_CPU_SHARE)
+ */
+static inline void
+onvm_sched_compute_nf_share(const nf_core_and_cc_info_t *core, uint32_t comp_cost, uint32_t load,
+                uint64_t total_cycles_in_epoch, int use_load_factor, uint32_t *cpu_share, uint64_t *exec_period) {
+        if (!use_load_factor) {
+                if (core->total_comp_cost) {
+                        *cpu_share = (uint32_t) (((uint64_t)DEFAULT_NF_CPU_SHARE*core->total_nf_count*comp_cost)/core->total_comp_cost);
+                        *exec_period = (comp_cost*total_cycles_in_epoch)/core->total_comp_cost; //(total_cycles_in_epoch)*(total_load_on_core)/(load_of_nf)
+                        return;
+                }
+        }
+        else if (core->total_load_cost_fct) {
+                //We can define the weights Alpha and Beta for apportioning Load and Comp_Costs: (Alpha*load)*(Beta*comp_cost) | Alpha*Beta = 1.
+                uint64_t num = (uint64_t)(core->total_nf_count)*(DEFAULT_NF_CPU_SHARE)*(comp_cost)*(load);
+                *cpu_share = (uint32_t) (num/core->total_load_cost_fct);
+                *exec_period = ((uint64_t)comp_cost*load*total_cycles_in_epoch)/core->total_load_cost_fct;
+                return;
+        }
+        *cpu_share = (uint32_t)DEFAULT_NF_CPU_SHARE;
+        *exec_period = 0;
+}
+
+/******************************Ring Watermarks*******************************/
+
+#define ONVM_RING_WATER_MARK_SIZE(ring_size, threshold)         ((uint32_t)(((ring_size)*(threshold))/100))
+#define ONVM_RING_LOW_THRESHOLD(threshold, gap)                 (((threshold) > (gap)) ? ((threshold)-(gap)):(threshold))
+#define ONVM_RING_ECN_MARK_SIZE(high_wm, low_wm, ewma_alpha)    ((uint32_t)(((1-(ewma_alpha))*(high_wm)) + ((ewma_alpha)*(low_wm))))
+
+/******************************Back-Pressure**********************************/
+
+#define SET_BIT(x,bitNum) ((x)|=(1<<(bitNum-1)))
+static inline void set_bit(long *x, unsigned bitNum) {
+    *x |= (1L << (bitNum-1));
+}
+
+#define CLEAR_BIT(x,bitNum) ((x) &= ~(1<<(bitNum-1)))
+static inline void clear_bit(long *x, unsigned bitNum) {
+    *x &= (~(1L << (bitNum-1)));
+}
+
+#define TOGGLE_BIT(x,bitNum) ((x) ^= (1<<(bitNum-1)))
+static inline void toggle_bit(long *x, unsigned bitNum) {
+    *x ^= (1L << (bitNum-1));
+}
+#define TEST_BIT(x,bitNum) ((x) & (1<<(bitNum-1)))
+static inline long test_bit(long x, unsigned bitNum) {
+    return (x & (1L << (bitNum-1)));
+}
+
+static inline long is_upstream_NF(long chain_throttle_value, long chain_index) {
+#ifndef HOP_BY_HOP_BACKPRESSURE
+        long chain_index_value = 0;
+        SET_BIT(chain_index_value, chain_index);
+        CLEAR_BIT(chain_throttle_value, chain_index);
+        return ((chain_throttle_value > chain_index_value)? (1):(0) );
+#else
+        long chain_index_value = 0;
+        SET_BIT(chain_index_value, (chain_index+1));
+        return ((chain_throttle_value & chain_index_value));
+        //return is_immediate_upstream_NF(chain_throttle_value,chain_index);
+#endif //HOP_BY_HOP_BACKPRESSURE
+        //1 => NF component at chain_index is an upstream component w.r.t where the bottleneck is seen in the chain (do not drop/throttle)
+        //0 => NF component at chain_index is an downstream component w.r.t where the bottleneck is seen in the chain (so drop/throttle)
+}
+static inline long is_immediate_upstream_NF(long chain_throttle_value, long chain_index) {
+#ifdef HOP_BY_HOP_BACKPRESSURE
+        long chain_index_value = 0;
+        SET_BIT(chain_index_value, (chain_index+1));
+        return ((chain_throttle_value & chain_index_value));
+#else
+        return is_upstream_NF(chain_throttle_value,chain_index);
+#endif  //HOP_BY_HOP_BACKPRESSURE
+        //1 => NF component at chain_index is an immediate upstream component w.r.t where the bottleneck is seen in the chain (do not drop/throttle)
+        //0 => NF component at chain_index is an downstream component w.r.t where the bottleneck is seen in the chain (so drop/throttle)
+}
+
+/* Mark the NF at chain_index as overflowing; returns 1 if newly marked (caller then throttles/drops its upstream set) */
+static inline int onvm_bkpr_mark_chain_index(volatile uint16_t *marks, unsigned chain_index) {
+        if (TEST_BIT(*marks, chain_index)) return 0;
+        SET_BIT(*marks, chain_index);
+        return 1;
+}
+/* Clear the overflow mark of the NF at chain_index; returns 1 if a mark was cleared (caller then releases its upstream set) */
+static inline int onvm_bkpr_clear_chain_index(volatile uint16_t *marks, unsigned chain_index) {
+        if (!TEST_BIT(*marks, chain_index)) return 0;
+        CLEAR_BIT(*marks, chain_index);
+        return 1;
+}
+
+static inline long get_index_of_highest_set_bit(long x) {
+        long next_set_index = 0;
+        //SET_BIT(chain_index_value, chain_index);
+        //while ((1<<(next_set_index++)) < x);
+        //for(; (x > (1<<next_set_index));next_set_index++)
+        for(; (x >= (1<<next_set_index));next_set_index++);
+        return next_set_index;
+}
+
+#endif  // _ONVM_SCHED_POLICY_H_